@@ -57,11 +57,62 @@
 #include <variant>
 #include <unordered_set>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <glob.h>
+#include <unistd.h>
+#if defined(__linux__)
+	#include <sys/inotify.h>
+#endif
 #include <fcntl.h>
 #include <bit>
 #include <cstddef>
 #include <optional>
-#include <zip.h>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <random>
+#include <atomic>
+#include <list>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+
+// selecting the zlib based zip backend disables the libzip backend
+#ifdef NCR_NUMPY_ZIP_BACKEND_ZLIB
+	#ifndef NCR_NUMPY_DISABLE_ZIP_LIBZIP
+		#define NCR_NUMPY_DISABLE_ZIP_LIBZIP
+	#endif
+#endif
+// zlib is required by the zlib zip backend. Other builds can opt into using
+// zlib by defining NCR_NUMPY_USE_ZLIB (and linking against zlib), which enables
+// estimates of how well arrays compress (see adaptive_compression) and ranged
+// reads of compressed arrays (see npz_reader)
+#if defined(NCR_NUMPY_ZIP_BACKEND_ZLIB) || defined(NCR_NUMPY_USE_ZLIB)
+	#include <zlib.h>
+	#define NCR_NUMPY_HAS_ZLIB
+#endif
+#ifndef NCR_NUMPY_DISABLE_ZIP_LIBZIP
+	#include <zip.h>
+#endif
+// CRC-32s of zip members are computed with carry-less multiplication on x86-64
+// and with the CRC-32 instructions on ARMv8, if available (see
+// zip::crc32_compute). Define NCR_NUMPY_DISABLE_HW_CRC32 to use the software
+// implementation only
+#ifndef NCR_NUMPY_DISABLE_HW_CRC32
+	#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+		#include <immintrin.h>
+		#define NCR_NUMPY_HAS_CRC32_PCLMUL
+	#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+		#include <arm_acle.h>
+		#define NCR_NUMPY_HAS_CRC32_ARMV8
+	#endif
+#endif
 
 /*
  * ncr/bswapdefs.hpp - definitions for bswap16, bswap32, and bswap64
@@ -852,6 +903,33 @@ compute_strides(const std::vector<T> &shape, std::vector<T> &strides, storage_or
 }
 
 
+/*
+ * checked_mul - multiply two values, returns false if the product overflows
+ */
+inline bool
+checked_mul(u64 a, u64 b, u64 &product)
+{
+	return !__builtin_mul_overflow(a, b, &product);
+}
+
+
+/*
+ * checked_product - multiply all values, e.g. the extents of a shape
+ *
+ * Returns false if the product overflows, which shapes parsed from untrusted
+ * file headers easily do.
+ */
+inline bool
+checked_product(const std::vector<u64> &values, u64 &product)
+{
+	product = 1;
+	for (auto v: values)
+		if (!checked_mul(product, v, product))
+			return false;
+	return true;
+}
+
+
 
 } // ncr::
 
@@ -945,6 +1023,53 @@ is_structured_array(const dtype &dt)
 }
 
 
+/*
+ * is_same_dtype - test if two dtypes describe the same data type
+ *
+ * This compares everything that ends up in the serialized description of a
+ * dtype, i.e. name, byte order, type, size, and (recursively) all fields, but
+ * without serializing the dtypes.
+ */
+inline bool
+is_same_dtype(const dtype &a, const dtype &b)
+{
+	if (a.name       != b.name       ||
+	    a.endianness != b.endianness ||
+	    a.fields.size() != b.fields.size())
+		return false;
+
+	if (is_structured_array(a)) {
+		for (size_t i = 0; i < a.fields.size(); ++i)
+			if (!is_same_dtype(a.fields[i], b.fields[i]))
+				return false;
+		return true;
+	}
+	return a.type_code == b.type_code && a.size == b.size && a.shape == b.shape;
+}
+
+
+/*
+ * is_compatible_dtype - test if two dtypes describe the same data up to byte order
+ *
+ * In contrast to is_same_dtype, names and byte order are ignored, i.e. data
+ * of one dtype can be read as the other after swapping bytes if necessary.
+ */
+inline bool
+is_compatible_dtype(const dtype &a, const dtype &b)
+{
+	if (a.fields.size() != b.fields.size())
+		return false;
+
+	if (is_structured_array(a)) {
+		for (size_t i = 0; i < a.fields.size(); ++i)
+			if (!is_compatible_dtype(a.fields[i], b.fields[i]))
+				return false;
+		return true;
+	}
+	return a.type_code == b.type_code && a.size == b.size && a.shape == b.shape;
+}
+
+
 inline
 const dtype*
 find_field(const dtype &dt, const std::string& field_name)
@@ -1020,10 +1145,12 @@ for_each(const std::vector<dtype> &fields, Func &&func)
 //
 // basic dtypes
 //
+inline dtype dtype_int8()   { return {.endianness = byte_order::not_relevant, .type_code = 'i', .size=1, .item_size=1}; }
 inline dtype dtype_int16()  { return {.type_code = 'i', .size=2, .item_size=2}; }
 inline dtype dtype_int32()  { return {.type_code = 'i', .size=4, .item_size=4}; }
 inline dtype dtype_int64()  { return {.type_code = 'i', .size=8, .item_size=8}; }
 
+inline dtype dtype_uint8()  { return {.endianness = byte_order::not_relevant, .type_code = 'u', .size=1, .item_size=1}; }
 inline dtype dtype_uint16() { return {.type_code = 'u', .size=2, .item_size=2}; }
 inline dtype dtype_uint32() { return {.type_code = 'u', .size=4, .item_size=4}; }
 inline dtype dtype_uint64() { return {.type_code = 'u', .size=8, .item_size=8}; }
@@ -1032,6 +1159,9 @@ inline dtype dtype_float16() { return {.type_code = 'f', .size=2, .item_size=2};
 inline dtype dtype_float32() { return {.type_code = 'f', .size=4, .item_size=4}; }
 inline dtype dtype_float64() { return {.type_code = 'f', .size=8, .item_size=8}; }
 
+inline dtype dtype_complex64()  { return {.type_code = 'c', .size=8,  .item_size=8};  }
+inline dtype dtype_complex128() { return {.type_code = 'c', .size=16, .item_size=16}; }
+
 
 //
 // dtype selectors, required for automatic compile time dtype selection in
@@ -1040,10 +1170,12 @@ inline dtype dtype_float64() { return {.type_code = 'f', .size=8, .item_size=8};
 template <typename T>
 struct dtype_selector;
 
+template <> struct dtype_selector<i8>  { static dtype get() { return dtype_int8();  } };
 template <> struct dtype_selector<i16> { static dtype get() { return dtype_int16(); } };
 template <> struct dtype_selector<i32> { static dtype get() { return dtype_int32(); } };
 template <> struct dtype_selector<i64> { static dtype get() { return dtype_int64(); } };
 
+template <> struct dtype_selector<u8>  { static dtype get() { return dtype_uint8();  } };
 template <> struct dtype_selector<u16> { static dtype get() { return dtype_uint16(); } };
 template <> struct dtype_selector<u32> { static dtype get() { return dtype_uint32(); } };
 template <> struct dtype_selector<u64> { static dtype get() { return dtype_uint64(); } };
@@ -1052,6 +1184,19 @@ template <> struct dtype_selector<f16> { static dtype get() { return dtype_float
 template <> struct dtype_selector<f32> { static dtype get() { return dtype_float32(); } };
 template <> struct dtype_selector<f64> { static dtype get() { return dtype_float64(); } };
 
+template <> struct dtype_selector<c64>  { static dtype get() { return dtype_complex64();  } };
+template <> struct dtype_selector<c128> { static dtype get() { return dtype_complex128(); } };
+
+
+/*
+ * HasDtype - element types for which a dtype is known at compile time
+ *
+ * Note that there is no selector for bool, because std::vector<bool> does not
+ * store its elements contiguously. Read boolean arrays into an ndarray.
+ */
+template <typename T>
+concept HasDtype = requires { { dtype_selector<T>::get() } -> std::same_as<dtype>; };
+
 
 //
 // forward declarations (required due to indirect recursion)
@@ -1128,6 +1273,26 @@ serialize_fortran_order(std::ostream &s, storage_order o)
 }
 
 
+/*
+ * serialize_type_description - serialize the header dict of an npy file
+ */
+inline void
+serialize_type_description(std::ostream &s, const dtype &dt, const u64_vector &shape, storage_order o)
+{
+	s << "{";
+	serialize_dtype_descr(s, dt);
+	s << ", ";
+	serialize_fortran_order(s, o);
+	if (shape.size() > 0) {
+		s << ", 'shape': ";
+		serialize_shape(s, shape);
+	}
+	s << ", ";
+	// TODO: optional fields of the array interface
+	s << "}";
+}
+
+
 #ifdef NCR_ENABLE_STREAM_OPERATORS
 /*
  * operator<< - pretty print a dtype
@@ -1441,6 +1606,36 @@ struct ndarray
 	}
 
 
+	/*
+	 * prepare - set type, shape, and storage order, and size the data accordingly
+	 *
+	 * In contrast to assign, the data buffer, shape, and strides keep their
+	 * capacity, i.e. preparing an array for the same (or a smaller) size than
+	 * before does not allocate memory. The contents of the data buffer are
+	 * unspecified afterwards, and the returned span is meant to be filled by
+	 * the caller.
+	 */
+	u8_span
+	prepare(const struct dtype &dt,
+	        const u64_vector &shape,
+	        storage_order o = storage_order::row_major)
+	{
+		_dtype = dt;
+		_shape.assign(shape.begin(), shape.end());
+		_order = o;
+
+		u64 n_items = 1;
+		for (auto s: _shape)
+			n_items *= s;
+		_data.resize(n_items * _dtype.item_size);
+
+		// recompute size and strides
+		_compute_size();
+		_compute_strides();
+		return u8_span(_data);
+	}
+
+
 	/*
 	 * unravel - unravel a given index for this particular array
 	 */
@@ -1726,17 +1921,7 @@ struct ndarray
 	get_type_description() const
 	{
 		std::ostringstream s;
-		s << "{";
-		serialize_dtype_descr(s, dtype());
-		s << ", ";
-		serialize_fortran_order(s, _order);
-		if (_shape.size() > 0) {
-			s << ", 'shape': ";
-			serialize_shape(s, _shape);
-		}
-		s << ", ";
-		// TODO: optional fields of the array interface
-		s << "}";
+		serialize_type_description(s, dtype(), _shape, _order);
 		return s.str();
 	}
 
@@ -1920,6 +2105,127 @@ struct ndarray_t : ndarray
 };
 
 
+/*
+ * typed_ndarray - array with an element type and rank known at compile time
+ *
+ * In contrast to ndarray_t, which is a facade for an ndarray, typed_ndarray
+ * stores its elements as Ts and its shape and strides in std::arrays. Element
+ * access thus does not involve any runtime type or rank checks, and compiles
+ * down to the computation of an offset into the data. Strides are given in
+ * number of elements, not bytes.
+ *
+ * Example:
+ *
+ *     numpy::typed_ndarray<f32, 2> image;
+ *     if (numpy::from_npy("image.npy", image) == numpy::result::ok)
+ *         for (u64 y = 0; y < image.shape()[0]; y++)
+ *             for (u64 x = 0; x < image.shape()[1]; x++)
+ *                 image(y, x) *= 2.0f;
+ */
+template <typename T, size_t Rank>
+requires HasDtype<T>
+struct typed_ndarray
+{
+	using value_type = T;
+	using shape_type = std::array<u64, Rank>;
+
+	static constexpr size_t
+		rank                        {Rank};
+
+	typed_ndarray() {}
+
+	typed_ndarray(const shape_type &shape, storage_order o = storage_order::row_major)
+	{
+		prepare(shape, o);
+	}
+
+
+	/*
+	 * prepare - set shape and storage order, and size the data accordingly
+	 *
+	 * The data keeps its capacity, and its contents are unspecified afterwards
+	 * (see ndarray::prepare).
+	 */
+	std::span<T>
+	prepare(const shape_type &shape, storage_order o = storage_order::row_major)
+	{
+		_shape = shape;
+		_order = o;
+
+		u64 stride = 1;
+		if (_order == storage_order::row_major) {
+			for (size_t k = Rank; k-- > 0; ) {
+				_strides[k] = stride;
+				stride *= _shape[k];
+			}
+		}
+		else {
+			for (size_t k = 0; k < Rank; k++) {
+				_strides[k] = stride;
+				stride *= _shape[k];
+			}
+		}
+		_data.resize(stride);
+		return std::span<T>(_data);
+	}
+
+
+	template <typename... Indexes>
+	requires (sizeof...(Indexes) == Rank)
+	inline T&
+	operator()(Indexes... index)
+	{
+		return _data[offset(index...)];
+	}
+
+
+	template <typename... Indexes>
+	requires (sizeof...(Indexes) == Rank)
+	inline const T&
+	operator()(Indexes... index) const
+	{
+		return _data[offset(index...)];
+	}
+
+
+	/*
+	 * offset - compute the offset of an element, in number of elements
+	 */
+	template <typename... Indexes>
+	requires (sizeof...(Indexes) == Rank)
+	inline u64
+	offset(Indexes... index) const
+	{
+		u64 off = 0;
+		size_t k = 0;
+		((off += static_cast<u64>(index) * _strides[k++]), ...);
+		return off;
+	}
+
+
+	static struct dtype            dtype()         { return dtype_selector<T>::get(); }
+	inline const shape_type&       shape()   const { return _shape;   }
+	inline const shape_type&       strides() const { return _strides; }
+	inline storage_order           order()   const { return _order;   }
+	inline u64                     size()    const { return _data.size(); }
+	inline std::span<T>            data()          { return _data;    }
+	inline std::span<const T>      data()    const { return _data;    }
+
+private:
+	shape_type
+		_shape                      {};
+
+	shape_type
+		_strides                    {};
+
+	storage_order
+		_order                      {storage_order::row_major};
+
+	std::vector<T>
+		_data;
+};
+
+
 /*
  * print_tensor - print an ndarray to an ostream
  *
@@ -3880,13 +4186,35 @@ namespace zip {
 		internal_error,
 	};
 
-	// mode for file opening.
-	// TODO: currently, reading and writing are treated mutually exclusive. not
-	//       clear if this is the best way to treat this. Also, when opening for
-	//       writing, the file will be truncated at least in the libzip backend
+	// mode for file opening. When opening for writing, an existing file will be
+	// replaced (the zlib backend replaces it only when the archive is closed,
+	// and keeps it if the archive is released without closing it). When opening for appending, an existing archive is opened and
+	// its files are retained, and new files can be written to it (the archive
+	// is created if it does not exist). Files can also be read in append mode.
 	enum class filemode : unsigned {
 		read   = 1 << 0,
-		write  = 1 << 1
+		write  = 1 << 1,
+		append = 1 << 2
+	};
+
+	// information about a file within an archive
+	struct file_stat {
+		// uncompressed size in bytes
+		u64  size            {0};
+
+		// size of the (possibly) compressed data within the archive
+		u64  compressed_size {0};
+
+		// CRC-32 of the uncompressed data, as stored in the archive
+		u32  crc32           {0};
+
+		// true if the file is stored compressed
+		bool compressed      {false};
+
+		// positions at which inflating can start without a dictionary, as
+		// pairs of offsets into the uncompressed and the compressed data. Only
+		// available for some files and backends
+		std::vector<std::pair<u64, u64>> sync_points;
 	};
 
 	// a zip backend might require to store state between calls, e.g. when
@@ -3930,6 +4258,46 @@ namespace zip {
 		// backend can make sure that the buffer survives as long as required. For
 		// an example of this behavior, see ncr_zip_impl_libzip.hpp
 		result (*write)(backend_state *, const std::string filename, u8_vector &&buffer, bool compress, u32 compression_level);
+
+		// get information about a file within an archive without reading it.
+		// this is optional, and backends which do not support it leave this
+		// as nullptr. Callers need to check for nullptr before use
+		result (*stat)(backend_state *, const std::string filename, file_stat &st);
+
+		// remove a file from an archive that was opened for writing or
+		// appending. this is optional, and backends which do not support it
+		// leave this as nullptr
+		result (*remove)(backend_state *, const std::string filename);
+
+		// copy a file from one archive to another archive without decompressing
+		// and recompressing it. Both states need to be of the same backend,
+		// `src' needs to be opened for reading and `dst' for writing or
+		// appending. `src' must remain open until `dst' was closed. this is
+		// optional, and backends which do not support it leave this as nullptr
+		result (*copy)(backend_state *dst, backend_state *src, const std::string src_filename, const std::string dst_filename);
+
+		// write a file with the same content as a file that already is in an
+		// archive opened for writing or appending, reusing its compressed data.
+		// this is optional, and backends which do not support it leave this as
+		// nullptr
+		result (*duplicate)(backend_state *, const std::string filename, const std::string new_filename);
+
+		// read size bytes at offset of the data of a file as it is stored in
+		// the archive, i.e. without decompressing it. this is optional, and
+		// backends which do not support it leave this as nullptr
+		result (*read_raw)(backend_state *, const std::string filename, u64 offset, u8 *dest, u64 size);
+
+		// open an archive for reading from a file descriptor of a file of a
+		// given size. The descriptor remains owned by the caller. this is
+		// optional, and backends which do not support it leave this as nullptr
+		result (*open_fd)(backend_state *, int fd, u64 size);
+
+		// read size bytes at offset of the (decompressed) content of a file
+		// into dest, decompressing no more of the file than needed, e.g. to
+		// read only the header of an npy file. If the range ends at the end of
+		// the file, the CRC-32 of the entire file is verified. this is
+		// optional, and backends which do not support it leave this as nullptr
+		result (*read_range)(backend_state *, const std::string filename, u64 offset, u8 *dest, u64 size);
 	};
 
 	// get an interface for the backend
@@ -3941,6 +4309,265 @@ namespace zip {
 
 #endif /* _8d2a79e5218b40e3807880febfa294a0_ */
 
+/*
+ * ncr_zip_crc32 - CRC-32 of zip members
+ *
+ */
+#ifndef _c138e0eab5d54bef9aff9962b845b7c6_
+#define _c138e0eab5d54bef9aff9962b845b7c6_
+
+
+namespace ncr { namespace zip {
+
+
+// the CRC-32 polynomial of zip (and zlib) in bit reflected order
+constexpr u32 crc32_polynomial = 0xedb88320u;
+
+// buffers are split into blocks of at least this size to compute their CRC-32
+// in parallel, see crc32_parallel
+constexpr u64 crc32_min_block_size = u64(4) << 20;
+
+
+/*
+ * crc32_software - CRC-32 of a buffer without hardware acceleration
+ */
+inline u32
+crc32_software(const u8 *data, u64 size, u32 crc = 0)
+{
+#ifdef NCR_NUMPY_HAS_ZLIB
+	// zlib's length arguments are 32bit
+	uLong c = crc;
+	while (size > 0) {
+		uInt n = static_cast<uInt>(std::min<u64>(size, 1u << 30));
+		c = ::crc32(c, data, n);
+		data += n;
+		size -= n;
+	}
+	return static_cast<u32>(c);
+#else
+	static const auto table = []() {
+		std::array<u32, 256> t;
+		for (u32 i = 0; i < 256; i++) {
+			u32 c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? (c >> 1) ^ crc32_polynomial : c >> 1;
+			t[i] = c;
+		}
+		return t;
+	}();
+
+	u32 c = ~crc;
+	for (u64 i = 0; i < size; i++)
+		c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+	return ~c;
+#endif
+}
+
+
+#ifdef NCR_NUMPY_HAS_CRC32_PCLMUL
+/*
+ * crc32_pclmul_fold - fold 16 bytes x by the constants k onto y
+ */
+__attribute__((target("pclmul,sse2")))
+inline __m128i
+crc32_pclmul_fold(__m128i x, __m128i k, __m128i y)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), y);
+}
+
+
+/*
+ * crc32_pclmul - fold a buffer into a CRC-32 register with carry-less multiplication
+ *
+ * Implements the folding and Barrett reduction of "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009). The buffer
+ * needs to hold at least 64 bytes and its size needs to be a multiple of 16.
+ * The register is not inverted, i.e. this takes and returns ~crc.
+ */
+__attribute__((target("pclmul,sse2")))
+inline u32
+crc32_pclmul(const u8 *data, u64 size, u32 reg)
+{
+	// constants of the paper for the bit reflected polynomial
+	alignas(16) static constexpr u64 k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	alignas(16) static constexpr u64 k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	alignas(16) static constexpr u64 k5k0[] = {0x0163cd6124, 0x0000000000};
+	alignas(16) static constexpr u64 poly[] = {0x01db710641, 0x01f7011641};
+
+	auto load = [](const u8 *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+	auto fold = crc32_pclmul_fold;
+
+	// fold four lanes of 16 bytes in parallel
+	__m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(reg)));
+	__m128i x2 = load(data + 16);
+	__m128i x3 = load(data + 32);
+	__m128i x4 = load(data + 48);
+	data += 64;
+	size -= 64;
+
+	__m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+	for (; size >= 64; data += 64, size -= 64) {
+		x1 = fold(x1, k, load(data));
+		x2 = fold(x2, k, load(data + 16));
+		x3 = fold(x3, k, load(data + 32));
+		x4 = fold(x4, k, load(data + 48));
+	}
+
+	// fold the lanes into one, and then the remaining 16 byte blocks
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+	x1 = fold(x1, k, x2);
+	x1 = fold(x1, k, x3);
+	x1 = fold(x1, k, x4);
+	for (; size >= 16; data += 16, size -= 16)
+		x1 = fold(x1, k, load(data));
+
+	// fold 128 to 64 bits
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	k  = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	k  = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return static_cast<u32>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+
+/*
+ * crc32_has_pclmul - test if the CPU supports carry-less multiplication
+ */
+inline bool
+crc32_has_pclmul()
+{
+	static const bool supported = []() {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("pclmul") != 0;
+	}();
+	return supported;
+}
+#endif
+
+
+/*
+ * crc32_compute - CRC-32 of a buffer, continuing from a previous CRC-32
+ *
+ * Uses carry-less multiplication or the ARMv8 CRC-32 instructions if
+ * available, and crc32_software otherwise.
+ */
+inline u32
+crc32_compute(const u8 *data, u64 size, u32 crc = 0)
+{
+#if defined(NCR_NUMPY_HAS_CRC32_PCLMUL)
+	if (size >= 64 && crc32_has_pclmul()) {
+		const u64 n = size & ~u64(15);
+		crc = ~crc32_pclmul(data, n, ~crc);
+		data += n;
+		size -= n;
+	}
+	return crc32_software(data, size, crc);
+#elif defined(NCR_NUMPY_HAS_CRC32_ARMV8)
+	u32 c = ~crc;
+	for (; size >= 8; data += 8, size -= 8) {
+		u64 v;
+		std::memcpy(&v, data, sizeof(v));
+		c = __crc32d(c, v);
+	}
+	for (; size > 0; data++, size--)
+		c = __crc32b(c, *data);
+	return ~c;
+#else
+	return crc32_software(data, size, crc);
+#endif
+}
+
+
+/*
+ * crc32_multiply - multiply two polynomials modulo the CRC-32 polynomial
+ */
+constexpr u32
+crc32_multiply(u32 a, u32 b)
+{
+	u32 p = 0;
+	for (u32 m = u32(1) << 31; m; m >>= 1) {
+		if (a & m)
+			p ^= b;
+		b = (b & 1) ? (b >> 1) ^ crc32_polynomial : b >> 1;
+	}
+	return p;
+}
+
+
+/*
+ * crc32_concat - CRC-32 of the concatenation of two buffers from their CRC-32s
+ *
+ * This is equivalent to zlib's crc32_combine, but does not require zlib.
+ */
+constexpr u32
+crc32_concat(u32 crc1, u32 crc2, u64 size2)
+{
+	// shift crc1 by size2 bytes, i.e. multiply it by x^(8 size2)
+	u32 p  = u32(1) << 31;  // x^0
+	u32 sq = u32(1) << 23;  // x^8
+	for (; size2; size2 >>= 1) {
+		if (size2 & 1)
+			p = crc32_multiply(sq, p);
+		sq = crc32_multiply(sq, sq);
+	}
+	return crc32_multiply(p, crc1) ^ crc2;
+}
+
+
+/*
+ * crc32_parallel - CRC-32 of a buffer, computed in blocks on several threads
+ *
+ * The CRC-32s of the blocks are concatenated with crc32_concat. Buffers
+ * smaller than two blocks are computed on the calling thread. If n_threads is
+ * 0, all hardware threads are used.
+ */
+inline u32
+crc32_parallel(const u8 *data, u64 size, unsigned n_threads = 0)
+{
+	if (n_threads == 0)
+		n_threads = std::max(1u, std::thread::hardware_concurrency());
+	if (n_threads == 1 || size < 2 * crc32_min_block_size)
+		return crc32_compute(data, size);
+
+	const u64 block_size = std::max(crc32_min_block_size, (size + n_threads - 1) / n_threads);
+	const size_t n_blocks = (size + block_size - 1) / block_size;
+	std::vector<u32> crcs(n_blocks);
+
+	std::atomic<size_t> next_block {0};
+	auto worker = [&]() {
+		for (size_t i; (i = next_block.fetch_add(1)) < n_blocks; ) {
+			const u64 offset = i * block_size;
+			crcs[i] = crc32_compute(data + offset, std::min(block_size, size - offset));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < std::min<size_t>(n_threads, n_blocks); t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t: threads)
+		t.join();
+
+	u32 crc = 0;
+	for (size_t i = 0; i < n_blocks; i++)
+		crc = crc32_concat(crc, crcs[i], std::min(block_size, size - i * block_size));
+	return crc;
+}
+
+
+}} // ncr::zip
+
+#endif /* _c138e0eab5d54bef9aff9962b845b7c6_ */
+
 #ifndef _9750a253a01642ea81d4721d4c92ad7c_
 #define _9750a253a01642ea81d4721d4c92ad7c_
 
@@ -4007,16 +4634,32 @@ concept Writable = requires(Range r, Tp value) {
 	{ std::begin(r) != std::end(r) };
 };
 
+// sources from which npy files are read. Readable sources copy the next size
+// bytes into dest and advance, and optionally report errors with fail()
 template <typename T, typename OutputRange>
 concept Readable = requires(T source, OutputRange &&dest, std::size_t size) {
 	{ source.read(dest, size) } -> std::same_as<std::size_t>;
 	{ source.eof() } -> std::same_as<bool>;
-	// TODO: maybe also fail()
 };
 
+// Viewable sources return a view of (at most) the next size bytes and advance,
+// i.e. they can be parsed without copying. The view remains valid at least
+// until the next call to the source
 template <typename T>
 concept Viewable = requires(T source, std::size_t size) {
-	{ source.view(size) } -> std::same_as<std::span<uint8_t>>;
+	{ source.view(size) } -> std::convertible_to<u8_const_span>;
+};
+
+// Viewable sources whose views point into memory that already exists, i.e.
+// views do not copy. buffered_reader is Viewable, but serves views from its
+// buffer, which needs to grow and be filled for views larger than itself
+template <typename T>
+concept ZeroCopyViewable = Viewable<T> && !requires { T::copying_view; };
+
+// Sized sources know how many bytes remain, e.g. to validate the array data
+template <typename T>
+concept SizedSource = requires(const T source) {
+	{ source.remaining() } -> std::same_as<u64>;
 };
 
 
@@ -4118,6 +4761,14 @@ struct npzfile
 		return *where->second.get();
 	}
 
+	const ndarray& operator[](std::string name) const
+	{
+		auto where = arrays.find(name);
+		if (where == arrays.end())
+			throw std::runtime_error(std::string("Key error: No array with name \"") + name + std::string("\""));
+		return *where->second.get();
+	}
+
 	// the names of all arrays in this file
 	std::vector<std::string> names;
 
@@ -4191,6 +4842,22 @@ clear(npzfile &npz)
 	_(error_seek_failed                      , 1ul << 38)                     \
 	_(error_reader_not_open                  , 1ul << 39)                     \
 	_(error_invalid_item_offset              , 1ul << 40)                     \
+	/* */                                                                     \
+	_(error_socket_failed                    , 1ul << 41)                     \
+	_(error_protocol_mismatch                , 1ul << 42)                     \
+	_(error_array_not_found                  , 1ul << 43)                     \
+	_(error_schema_mismatch                  , 1ul << 44)                     \
+	_(error_tar_header_invalid               , 1ul << 45)                     \
+	_(error_end_of_archive                   , 1ul << 46)                     \
+	/* details of a schema mismatch, always set with error_schema_mismatch */ \
+	_(error_schema_dtype_mismatch            , 1ul << 47)                     \
+	_(error_schema_rank_mismatch             , 1ul << 48)                     \
+	_(error_schema_shape_mismatch            , 1ul << 49)                     \
+	_(error_schema_order_mismatch            , 1ul << 50)                     \
+	_(error_schema_size_exceeded             , 1ul << 51)                     \
+	/* detail of a failed read, always set with error_file_read_failed */     \
+	_(error_checksum_mismatch                , 1ul << 52)                     \
+	_(error_invalid_values                   , 1ul << 53)                     \
 
 #define NCR_NUMPY_ERROR_CODE_ENUM_ENTRY(NAME, VALUE) \
 	NAME = VALUE,
@@ -4283,22 +4950,40 @@ struct buffer_reader
 		return read(std::span<T>(dest, size), size);
 	}
 
+	u8_const_span
+	view(std::size_t size)
+	{
+		size = std::min(size, _data.size() - _pos);
+		u8_const_span result(_data.data() + _pos, size);
+		_pos += size;
+		return result;
+	}
+
 	inline bool
 	eof() noexcept {
 		return _pos >= _data.size();
 	}
 
+	inline u64
+	remaining() const noexcept {
+		return _data.size() - _pos;
+	}
+
 	u8_vector   _data;
 	std::size_t _pos;
 };
 
 
 /*
- * ifstream_reader - wrapper for ifstreams to make them a ReadableSource
+ * span_reader - wrapper for (read-only) memory regions to make them a ReadableSource
+ *
+ * In contrast to buffer_reader, span_reader does not own nor copy the memory
+ * it reads from. This is used, for instance, when parsing the header of a
+ * memory mapped file.
  */
-struct ifstream_reader
+struct span_reader
 {
-	ifstream_reader(std::ifstream &stream) : _stream(stream), _eof(false), _fail(false) {}
+	span_reader(u8_const_span data) : _data(data), _pos(0) {}
 
 	template <Writable<u8> D>
 	std::size_t
@@ -4307,8 +4992,331 @@ struct ifstream_reader
 		auto first = std::begin(dest);
 		auto last = std::end(dest);
 		size = std::min(size, static_cast<std::size_t>(std::distance(first, last)));
+		size = (_pos + size > _data.size()) ? _data.size() - _pos : size;
+		std::copy_n(_data.begin() + _pos, size, first);
+		_pos += size;
+		return size;
+	}
 
-		_stream.read(reinterpret_cast<char *>(&(*first)), size);
+	template <typename T>
+	requires std::same_as<T, u8>
+	std::size_t
+	read(T* dest, std::size_t size)
+	{
+		return read(std::span<T>(dest, size), size);
+	}
+
+	u8_const_span
+	view(std::size_t size)
+	{
+		size = std::min(size, _data.size() - _pos);
+		auto result = _data.subspan(_pos, size);
+		_pos += size;
+		return result;
+	}
+
+	inline bool
+	eof() noexcept {
+		return _pos >= _data.size();
+	}
+
+	inline u64
+	remaining() const noexcept {
+		return _data.size() - _pos;
+	}
+
+	u8_const_span _data;
+	std::size_t   _pos;
+};
+
+
+/*
+ * fd_reader - wrapper for file descriptors to make them a ReadableSource
+ *
+ * The reader uses pread and tracks its own position, i.e. the file offset of
+ * the file descriptor is not modified. The file descriptor remains owned by
+ * the caller.
+ */
+struct fd_reader
+{
+	fd_reader(int fd, u64 file_size, u64 pos = 0) : _fd(fd), _size(file_size), _pos(pos), _fail(false) {}
+
+	template <Writable<u8> D>
+	std::size_t
+	read(D &&dest, std::size_t size)
+	{
+		auto first = std::begin(dest);
+		auto last = std::end(dest);
+		size = std::min(size, static_cast<std::size_t>(std::distance(first, last)));
+
+		u8 *ptr = &(*first);
+		std::size_t nread = 0;
+		while (nread < size) {
+			ssize_t n = ::pread(_fd, ptr + nread, size - nread, static_cast<off_t>(_pos));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				_fail = n < 0;
+				break;
+			}
+			nread += static_cast<std::size_t>(n);
+			_pos  += static_cast<u64>(n);
+		}
+		return nread;
+	}
+
+	template <typename T>
+	requires std::same_as<T, u8>
+	std::size_t
+	read(T* dest, std::size_t size)
+	{
+		return read(std::span<T>(dest, size), size);
+	}
+
+	inline bool
+	eof() noexcept {
+		return _pos >= _size;
+	}
+
+	inline bool
+	fail() noexcept {
+		return _fail;
+	}
+
+	inline u64
+	remaining() const noexcept {
+		return _size > _pos ? _size - _pos : 0;
+	}
+
+	int  _fd;
+	u64  _size;
+	u64  _pos;
+	bool _fail;
+};
+
+
+/*
+ * file_reader - fd_reader which opens (and owns) a file
+ */
+struct file_reader : fd_reader
+{
+	file_reader(const std::filesystem::path &filepath) : fd_reader(-1, 0)
+	{
+		struct stat st;
+		if ((_fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+			_fail = true;
+		else if (::fstat(_fd, &st) != 0)
+			_fail = true;
+		else
+			_size = static_cast<u64>(st.st_size);
+	}
+
+	file_reader(const file_reader &) = delete;
+	file_reader& operator=(const file_reader &) = delete;
+
+	~file_reader()
+	{
+		if (_fd >= 0)
+			::close(_fd);
+	}
+
+	inline bool
+	is_open() const noexcept {
+		return _fd >= 0 && !_fail;
+	}
+};
+
+
+/*
+ * pipe_reader - wrapper for non-seekable file descriptors (pipes, sockets) to
+ * make them a ReadableSource
+ *
+ * In contrast to fd_reader, the size is not known in advance and data is read
+ * from the current position of the file descriptor. The file descriptor
+ * remains owned by the caller.
+ */
+struct pipe_reader
+{
+	pipe_reader(int fd) : _fd(fd), _eof(false), _fail(false) {}
+
+	template <Writable<u8> D>
+	std::size_t
+	read(D &&dest, std::size_t size)
+	{
+		auto first = std::begin(dest);
+		auto last = std::end(dest);
+		size = std::min(size, static_cast<std::size_t>(std::distance(first, last)));
+
+		u8 *ptr = &(*first);
+		std::size_t nread = 0;
+		while (nread < size) {
+			ssize_t n = ::read(_fd, ptr + nread, size - nread);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				_fail = n < 0;
+				_eof  = n == 0;
+				break;
+			}
+			nread += static_cast<std::size_t>(n);
+		}
+		return nread;
+	}
+
+	template <typename T>
+	requires std::same_as<T, u8>
+	std::size_t
+	read(T* dest, std::size_t size)
+	{
+		return read(std::span<T>(dest, size), size);
+	}
+
+	inline bool
+	eof() noexcept {
+		return _eof;
+	}
+
+	inline bool
+	fail() noexcept {
+		return _fail;
+	}
+
+	int  _fd;
+	bool _eof;
+	bool _fail;
+};
+
+
+/*
+ * buffered_reader - make a ReadableSource Viewable by reading it in chunks
+ *
+ * This reduces the number of calls to the underlying source when reading many
+ * small pieces, e.g. single items. Note that the buffered_reader reads ahead,
+ * i.e. the underlying source is not positioned after what was read from the
+ * buffered_reader.
+ */
+template <typename Source>
+struct buffered_reader
+{
+	// views are copied into the buffer, see ZeroCopyViewable
+	static constexpr bool copying_view = true;
+
+	buffered_reader(Source &source, std::size_t capacity = 1 << 16) : _source(source), _buffer(capacity), _begin(0), _end(0) {}
+
+	u8_const_span
+	view(std::size_t size)
+	{
+		fill(size);
+		size = std::min(size, _end - _begin);
+		u8_const_span result(_buffer.data() + _begin, size);
+		_begin += size;
+		return result;
+	}
+
+	template <Writable<u8> D>
+	std::size_t
+	read(D &&dest, std::size_t size)
+	{
+		auto first = std::begin(dest);
+		auto last = std::end(dest);
+		size = std::min(size, static_cast<std::size_t>(std::distance(first, last)));
+
+		// reads which exceed the buffer, e.g. the entire array data, bypass it
+		// after what is buffered already was copied
+		if constexpr (std::contiguous_iterator<decltype(first)>) {
+			if (size > _buffer.size()) {
+				std::size_t n = _end - _begin;
+				std::copy(_buffer.begin() + _begin, _buffer.begin() + _end, first);
+				_begin = _end = 0;
+				u8 *ptr = std::to_address(first);
+				while (n < size) {
+					std::size_t k = _source.read(std::span<u8>(ptr + n, size - n), size - n);
+					if (k == 0)
+						break;
+					n += k;
+				}
+				return n;
+			}
+		}
+
+		auto v = view(size);
+		std::copy(v.begin(), v.end(), first);
+		return v.size();
+	}
+
+	template <typename T>
+	requires std::same_as<T, u8>
+	std::size_t
+	read(T* dest, std::size_t size)
+	{
+		return read(std::span<T>(dest, size), size);
+	}
+
+	inline bool
+	eof() noexcept {
+		return _begin == _end && _source.eof();
+	}
+
+	inline bool
+	fail() noexcept {
+		if constexpr (requires { _source.fail(); })
+			return _source.fail();
+		else
+			return false;
+	}
+
+	inline u64
+	remaining() const noexcept
+	requires SizedSource<Source>
+	{
+		return _source.remaining() + (_end - _begin);
+	}
+
+	/*
+	 * fill - make (at least) size bytes available, unless the source ends
+	 */
+	void
+	fill(std::size_t size)
+	{
+		if (_end - _begin >= size)
+			return;
+
+		std::copy(_buffer.begin() + _begin, _buffer.begin() + _end, _buffer.begin());
+		_end -= _begin;
+		_begin = 0;
+		if (_buffer.size() < size)
+			_buffer.resize(size);
+		while (_end < size) {
+			std::size_t n = _source.read(std::span<u8>(_buffer.data() + _end, _buffer.size() - _end), _buffer.size() - _end);
+			if (n == 0)
+				break;
+			_end += n;
+		}
+	}
+
+	Source      &_source;
+	u8_vector    _buffer;
+	std::size_t  _begin;
+	std::size_t  _end;
+};
+
+
+/*
+ * ifstream_reader - wrapper for ifstreams to make them a ReadableSource
+ */
+struct ifstream_reader
+{
+	ifstream_reader(std::ifstream &stream) : _stream(stream), _eof(false), _fail(false) {}
+
+	template <Writable<u8> D>
+	std::size_t
+	read(D &&dest, std::size_t size)
+	{
+		auto first = std::begin(dest);
+		auto last = std::end(dest);
+		size = std::min(size, static_cast<std::size_t>(std::distance(first, last)));
+
+		_stream.read(reinterpret_cast<char *>(&(*first)), size);
 		_fail = _stream.fail();
 		_eof  = _stream.eof();
 		return static_cast<std::size_t>(_stream.gcount());
@@ -4714,6 +5722,25 @@ validate_data_size(const npyfile &npy, const dtype &dt)
 }
 
 
+/*
+ * validate_shape_size - test if the data of an array of given shape fits into the file
+ *
+ * The size of the array data is computed with overflow checks, as the shape of
+ * a crafted header can be arbitrarily large. Unless streaming, the file needs
+ * to contain at least as much data as the shape describes.
+ */
+inline result
+validate_shape_size(const npyfile &npy, const dtype &dt, const u64_vector &shape)
+{
+	u64 n_items, size;
+	if (!checked_product(shape, n_items) || !checked_mul(n_items, dt.item_size, size))
+		return result::error_data_size_mismatch;
+	if (!npy.streaming && npy.data_size < size)
+		return result::error_file_truncated;
+	return result::ok;
+}
+
+
 /*
  * compute_data_size - compute the size of the data in a ReadableSource (if possible)
  */
@@ -4721,14 +5748,10 @@ template <typename Reader>
 inline result
 compute_data_size(Reader &source, npyfile &npy)
 {
-	// TODO: implement for other things or use another approach to externalize
-	//       type detection
-	if constexpr (std::is_same_v<Reader, buffer_reader>) {
-		npy.data_size = source._data.size() - source._pos;
-	}
-	else {
+	if constexpr (SizedSource<Reader>)
+		npy.data_size = source.remaining();
+	else
 		npy.data_size = 0;
-	}
 	return result::ok;
 }
 
@@ -4742,922 +5765,10887 @@ from_stream(std::istream &)
 }
 
 
-template <typename Reader>
-// requires Readable<Reader, OutputRange>
-inline result
-process_file_header(Reader &source, npyfile &npy, dtype &dt, u64_vector &shape, storage_order &order)
+/*
+ * value_rule - checks for the values of an array, or of a field of a
+ * structured array
+ */
+struct value_rule
 {
-	auto res = result::ok;
-
-	// read stuff
-	if ((res |= read_magic_string(source,  npy)    , is_error(res))) return res;
-	if ((res |= read_version(source, npy)          , is_error(res))) return res;
-	if ((res |= read_header_length(source, npy)    , is_error(res))) return res;
-	if ((res |= read_header(source, npy)           , is_error(res))) return res;
-
-	// parse + compute stuff
-	if ((res |= parse_header(npy, dt, order, shape), is_error(res))) return res;
-	if ((res |= compute_item_size(dt)              , is_error(res))) return res;
-	if ((res |= compute_data_size(source, npy)     , is_error(res))) return res;
-	if ((res |= validate_data_size(npy, dt)        , is_error(res))) return res;
-
-	return res;
-}
+	// count NaNs and infinities of floating point and complex values
+	bool
+		nan                         {true},
+		inf                         {true};
+
+	// count values below min and above max. Applies to integer and floating
+	// point values, and the bounds are clamped to the range of the type
+	std::optional<f64>
+		min,
+		max;
+};
 
 
-inline result
-from_buffer(u8_vector &&buffer, npyfile &npy, ndarray &dest)
+/*
+ * value_rules - rules for the values of an array
+ *
+ * Fields of structured arrays are checked with the rule for their name in
+ * fields, where nested fields are named "outer.inner". Fields without a rule
+ * inherit the rule of the enclosing field, and top level fields the rule in
+ * all.
+ */
+struct value_rules
 {
-	auto res = result::ok;
+	value_rule
+		all;
 
-	// setup the npyfile struct as non-streaming
-	npy.streaming = false;
+	std::unordered_map<std::string, value_rule>
+		fields;
 
-	// parts of the array description (will be moved into the array later)
-	dtype         dt;
-	u64_vector    shape;
-	storage_order order;
+	// maximum number of offending items of which the index is reported
+	u64
+		max_indices                 {16};
 
-	// wrap the buffer so that it becomes a ReadableSource
-	auto source = buffer_reader(buffer);
-	if ((res = process_file_header(source, npy, dt, shape, order), is_error(res))) return res;
+	// fail with error_invalid_values if any value offends
+	bool
+		reject                      {false};
 
-	// erase the entire header block. what's left is the raw data of the ndarray
-	buffer.erase(buffer.begin(), buffer.begin() + npy.data_offset);
+	// threads to check an array with, 0 means all hardware threads
+	unsigned
+		n_threads                   {0};
+};
 
-	// build the ndarray from the data that we read by moving into it
-	dest.assign(std::move(dt), std::move(shape), std::move(buffer), order);
 
-	return res;
-}
+/*
+ * value_counts - number of offending values
+ *
+ * A value is counted once, NaN before infinity before the bounds.
+ */
+struct value_counts
+{
+	u64
+		nan                         {0},
+		inf                         {0},
+		below                       {0},
+		above                       {0};
+
+	u64
+	total() const
+	{
+		return nan + inf + below + above;
+	}
+};
+
+
+/*
+ * value_report - outcome of checking the values of an array
+ */
+struct value_report
+{
+	// counts of all checked values
+	value_counts
+		counts;
+
+	// flat indices of the first offending items in ascending order, see
+	// value_rules::max_indices
+	u64_vector
+		first;
+
+	// counts of each checked field of a structured array
+	std::vector<std::pair<std::string, value_counts>>
+		fields;
+
+	bool
+	ok() const
+	{
+		return counts.total() == 0;
+	}
+};
+
+
+// arrays are checked in chunks of about this many bytes, see check_values_chunked
+constexpr u64 value_check_chunk_size = u64(1) << 20;
+
+
+/*
+ * value_checker - check the values of items of a dtype against rules
+ *
+ * The dtype is flattened into the values to check only once, after which
+ * chunks of items can be checked independently, e.g. on several threads or
+ * right after reading them, and their reports merged in order. Values of
+ * contiguous arrays are checked in blocks of a cache line without branches,
+ * which compilers vectorize. Only blocks which contain offending values are
+ * inspected value by value.
+ */
+struct value_checker
+{
+	value_checker(const dtype &dt, const value_rules &rules)
+	: _item_size(dt.item_size), _structured(is_structured_array(dt)), _max_indices(rules.max_indices), _reject(rules.reject)
+	{
+		flatten(dt, "", rules.all, rules);
+	}
+
+
+	u64
+	item_size() const
+	{
+		return _item_size;
+	}
+
+
+	/*
+	 * init - reset a report, and list the fields that are checked
+	 */
+	void
+	init(value_report &report) const
+	{
+		report.counts = {};
+		report.first.clear();
+		report.fields.clear();
+		if (_structured)
+			for (auto &l: _leaves)
+				report.fields.emplace_back(l.name, value_counts{});
+	}
+
+
+	/*
+	 * check - check n_items items at data, the first of which has the index
+	 * first_item, and add the outcome to an initialized report
+	 */
+	void
+	check(const u8 *data, u64 first_item, u64 n_items, value_report &report) const
+	{
+		u64_vector first;
+		for (size_t i = 0; i < _leaves.size(); i++) {
+			value_counts counts;
+			check_leaf(_leaves[i], data, first_item, n_items, counts, first);
+			add(report.counts, counts);
+			if (_structured)
+				add(report.fields[i].second, counts);
+		}
+
+		// offending items of several fields are interleaved, and the first
+		// ones of each field might be after the first ones of another
+		if (_leaves.size() > 1) {
+			std::sort(first.begin(), first.end());
+			first.erase(std::unique(first.begin(), first.end()), first.end());
+		}
+		for (auto i: first) {
+			if (report.first.size() >= _max_indices)
+				break;
+			if (report.first.empty() || report.first.back() < i)
+				report.first.push_back(i);
+		}
+	}
+
+
+	/*
+	 * merge - add the report of a chunk of items after the ones in report
+	 */
+	void
+	merge(value_report &report, const value_report &later) const
+	{
+		add(report.counts, later.counts);
+		for (size_t i = 0; i < report.fields.size() && i < later.fields.size(); i++)
+			add(report.fields[i].second, later.fields[i].second);
+		for (auto i: later.first) {
+			if (report.first.size() >= _max_indices)
+				break;
+			report.first.push_back(i);
+		}
+	}
+
+
+	/*
+	 * finish - get the result of a complete report
+	 */
+	result
+	finish(const value_report &report) const
+	{
+		return (_reject && !report.ok()) ? result::error_invalid_values : result::ok;
+	}
+
+
+private:
+	// a value, or a fixed number of values, within each item
+	struct leaf
+	{
+		// path of the field, empty for arrays which are not structured
+		std::string
+			name;
+
+		u8
+			type_code                   {0};
+
+		// size of a value, which for complex numbers is the size of a part
+		u32
+			size                        {0};
+
+		bool
+			swap                        {false};
+
+		// offset within an item, and number of values of e.g. subarrays
+		u64
+			offset                      {0},
+			count                       {1};
+
+		value_rule
+			rule;
+	};
+
+
+	static void
+	add(value_counts &a, const value_counts &b)
+	{
+		a.nan   += b.nan;
+		a.inf   += b.inf;
+		a.below += b.below;
+		a.above += b.above;
+	}
+
+
+	void
+	flatten(const dtype &dt, const std::string &path, const value_rule &rule, const value_rules &rules)
+	{
+		if (is_structured_array(dt)) {
+			for (auto &field: dt.fields) {
+				std::string name = path.empty() ? field.name : path + "." + field.name;
+				auto it = rules.fields.find(name);
+				flatten(field, name, it != rules.fields.end() ? it->second : rule, rules);
+			}
+			return;
+		}
+
+		leaf l;
+		l.name      = path;
+		l.type_code = dt.type_code;
+		l.size      = dt.size;
+		l.offset    = dt.offset;
+		l.rule      = rule;
+		for (auto s: dt.shape)
+			l.count *= s;
+
+		const bool bounds = rule.min || rule.max;
+		switch (dt.type_code) {
+		case 'i':
+		case 'u':
+			if (!bounds || (l.size != 1 && l.size != 2 && l.size != 4 && l.size != 8))
+				return;
+			break;
+		case 'f':
+			if ((!rule.nan && !rule.inf && !bounds) || (l.size != 2 && l.size != 4 && l.size != 8))
+				return;
+			break;
+		case 'c':
+			// both parts are checked for NaN and infinity, the bounds do not apply
+			if ((!rule.nan && !rule.inf) || (l.size != 8 && l.size != 16))
+				return;
+			l.size  /= 2;
+			l.count *= 2;
+			l.rule.min.reset();
+			l.rule.max.reset();
+			break;
+		default:
+			return;
+		}
+
+		constexpr byte_order native = (std::endian::native == std::endian::little) ? byte_order::little : byte_order::big;
+		l.swap = l.size > 1 && (dt.endianness == byte_order::little || dt.endianness == byte_order::big) && dt.endianness != native;
+		_leaves.push_back(std::move(l));
+	}
+
+
+	void
+	check_leaf(const leaf &l, const u8 *data, u64 first_item, u64 n_items, value_counts &counts, u64_vector &first) const
+	{
+		auto run = [&]<typename E, bool Float>() {
+			if (l.swap)
+				check_values_of<E, Float, true>(l, data, first_item, n_items, counts, first);
+			else
+				check_values_of<E, Float, false>(l, data, first_item, n_items, counts, first);
+		};
+
+		switch (l.type_code) {
+		case 'i':
+			switch (l.size) {
+			case 1: run.template operator()<i8,  false>(); break;
+			case 2: run.template operator()<i16, false>(); break;
+			case 4: run.template operator()<i32, false>(); break;
+			case 8: run.template operator()<i64, false>(); break;
+			}
+			break;
+		case 'u':
+			switch (l.size) {
+			case 1: run.template operator()<u8,  false>(); break;
+			case 2: run.template operator()<u16, false>(); break;
+			case 4: run.template operator()<u32, false>(); break;
+			case 8: run.template operator()<u64, false>(); break;
+			}
+			break;
+		case 'f':
+		case 'c':
+			switch (l.size) {
+			case 2: run.template operator()<f16, true>(); break;
+			case 4: run.template operator()<f32, true>(); break;
+			case 8: run.template operator()<f64, true>(); break;
+			}
+			break;
+		}
+	}
+
+
+	template <typename E>
+	static E
+	clamp_bound(f64 v)
+	{
+		if (v <= static_cast<f64>(std::numeric_limits<E>::lowest()))
+			return std::numeric_limits<E>::lowest();
+		if (v >= static_cast<f64>(std::numeric_limits<E>::max()))
+			return std::numeric_limits<E>::max();
+		return static_cast<E>(v);
+	}
+
+
+	template <typename E, bool Float, bool Swap>
+	void
+	check_values_of(const leaf &l, const u8 *data, u64 first_item, u64 n_items, value_counts &counts, u64_vector &first) const
+	{
+		using U = std::conditional_t<sizeof(E) == 1, u8, std::conditional_t<sizeof(E) == 2, u16, std::conditional_t<sizeof(E) == 4, u32, u64>>>;
+		static_assert(sizeof(U) == sizeof(E));
+
+		// exponent and mantissa of floating point values
+		constexpr U exponent = sizeof(E) == 2 ? U(0x7c00) : sizeof(E) == 4 ? U(0x7f800000) : U(0x7ff0000000000000);
+		constexpr U mantissa = sizeof(E) == 2 ? U(0x03ff) : sizeof(E) == 4 ? U(0x007fffff) : U(0x000fffffffffffff);
+
+		const value_rule &rule = l.rule;
+		E lo, hi;
+		if constexpr (Float) {
+			lo = rule.min ? static_cast<E>(*rule.min) : static_cast<E>(-std::numeric_limits<f32>::infinity());
+			hi = rule.max ? static_cast<E>(*rule.max) : static_cast<E>( std::numeric_limits<f32>::infinity());
+		}
+		else {
+			lo = rule.min ? clamp_bound<E>(std::ceil(*rule.min))  : std::numeric_limits<E>::lowest();
+			hi = rule.max ? clamp_bound<E>(std::floor(*rule.max)) : std::numeric_limits<E>::max();
+		}
+		const U nonfinite = (Float && (rule.nan || rule.inf)) ? U(1) : U(0);
+
+		// each leaf records up to max_indices items after those of the leaves
+		// before it, which are capped once they are merged (see check)
+		const size_t base = first.size();
+
+		auto load = [](const u8 *p) {
+			U bits;
+			std::memcpy(&bits, p, sizeof(U));
+			if constexpr (Swap)
+				bits = ncr::bswap<U>(bits);
+			return bits;
+		};
+
+		// classify a value, and record the item it belongs to
+		auto inspect = [&](U bits, u64 index) {
+			const E x = std::bit_cast<E>(bits);
+			if constexpr (Float) {
+				if ((bits & exponent) == exponent) {
+					if (bits & mantissa) {
+						if (!rule.nan)
+							return;
+						counts.nan++;
+					}
+					else if (rule.inf)
+						counts.inf++;
+					else if (x < lo)
+						counts.below++;
+					else if (x > hi)
+						counts.above++;
+					else
+						return;
+				}
+				else if (x < lo)
+					counts.below++;
+				else if (x > hi)
+					counts.above++;
+				else
+					return;
+			}
+			else {
+				if (x < lo)
+					counts.below++;
+				else if (x > hi)
+					counts.above++;
+				else
+					return;
+			}
+			const u64 item = first_item + index / l.count;
+			if (first.size() - base < _max_indices && (first.size() == base || first.back() != item))
+				first.push_back(item);
+		};
+
+		// values of a plain array are contiguous
+		if (l.offset == 0 && l.count * sizeof(E) == _item_size) {
+			constexpr u64 lanes = 64 / sizeof(E);
+			const u64 n = n_items * l.count;
+			u64 i = 0;
+			for (; i + lanes <= n; i += lanes) {
+				const u8 *block = data + i * sizeof(E);
+				U bad = 0;
+				for (u64 k = 0; k < lanes; k++) {
+					const U bits = load(block + k * sizeof(E));
+					const E x = std::bit_cast<E>(bits);
+					if constexpr (Float)
+						bad |= nonfinite & U((bits & exponent) == exponent);
+					bad |= U(x < lo) | U(x > hi);
+				}
+				if (bad)
+					for (u64 k = 0; k < lanes; k++)
+						inspect(load(block + k * sizeof(E)), i + k);
+			}
+			for (; i < n; i++)
+				inspect(load(data + i * sizeof(E)), i);
+			return;
+		}
+
+		for (u64 i = 0; i < n_items; i++) {
+			const u8 *values = data + i * _item_size + l.offset;
+			for (u64 k = 0; k < l.count; k++)
+				inspect(load(values + k * sizeof(E)), i * l.count + k);
+		}
+	}
+
+
+	std::vector<leaf>
+		_leaves;
+
+	u64
+		_item_size                  {0};
+
+	bool
+		_structured                 {false};
+
+	u64
+		_max_indices                {16};
+
+	bool
+		_reject                     {false};
+};
+
+
+/*
+ * check_values_chunked - check the values of an array in chunks of items on
+ * several threads
+ *
+ * Right before a chunk is checked, prepare(first_item, n_items) is called on
+ * the same thread, e.g. to read or to convert the byte order of the chunk.
+ * Hence, the chunk is checked while it is in cache, instead of in a second
+ * pass over the array. Checking stops at the first error that prepare
+ * returns. With a single thread, chunks are prepared in order, which allows
+ * to read them from sequential sources.
+ */
+template <typename F>
+inline result
+check_values_chunked(const value_checker &checker, const u8 *data, u64 n_items, unsigned n_threads, value_report &report, F &&prepare)
+{
+	checker.init(report);
+	const u64 item_size = checker.item_size();
+	if (n_items == 0 || item_size == 0)
+		return checker.finish(report);
+
+	const u64 chunk_items = std::max<u64>(1, value_check_chunk_size / item_size);
+	const size_t n_chunks = (n_items + chunk_items - 1) / chunk_items;
+	if (n_threads == 0)
+		n_threads = std::max(1u, std::thread::hardware_concurrency());
+	n_threads = static_cast<unsigned>(std::min<size_t>(n_threads, n_chunks));
+
+	std::vector<value_report> parts(n_chunks);
+	std::atomic<size_t> next_chunk {0};
+	std::atomic<result> error {result::ok};
+	auto worker = [&]() {
+		for (size_t i; (i = next_chunk.fetch_add(1)) < n_chunks; ) {
+			if (error.load(std::memory_order_relaxed) != result::ok)
+				return;
+			const u64 first = i * chunk_items;
+			const u64 n = std::min(chunk_items, n_items - first);
+			result res = prepare(first, n);
+			if (res != result::ok) {
+				result expected = result::ok;
+				error.compare_exchange_strong(expected, res);
+				return;
+			}
+			checker.init(parts[i]);
+			checker.check(data + first * item_size, first, n, parts[i]);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < n_threads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t: threads)
+		t.join();
+
+	if (error != result::ok)
+		return error;
+	for (auto &part: parts)
+		checker.merge(report, part);
+	return checker.finish(report);
+}
+
+
+/*
+ * check_values - check the values of an array against rules
+ *
+ * The loaders which accept an array_schema run the checks of
+ * array_schema::values while reading the array data (see
+ * check_values_chunked), which should be preferred over checking arrays after
+ * loading them. Returns error_invalid_values if rules.reject is set and a
+ * value offends.
+ */
+inline result
+check_values(const dtype &dt, u8_const_span data, const value_rules &rules, value_report &report)
+{
+	value_checker checker(dt, rules);
+	const u64 n_items = dt.item_size ? data.size() / dt.item_size : 0;
+	return check_values_chunked(checker, data.data(), n_items, rules.n_threads, report, [](u64, u64) { return result::ok; });
+}
+
+
+template <NDArray NDArrayType>
+inline result
+check_values(const NDArrayType &array, const value_rules &rules, value_report &report)
+{
+	return check_values(array.dtype(), u8_const_span(array.data()), rules, report);
+}
+
+
+template <typename T, size_t Rank>
+inline result
+check_values(const typed_ndarray<T, Rank> &array, const value_rules &rules, value_report &report)
+{
+	auto data = array.data();
+	return check_values(array.dtype(), u8_const_span(reinterpret_cast<const u8*>(data.data()), data.size_bytes()), rules, report);
+}
+
+
+/*
+ * read_checked - read array data from a source and check its values
+ *
+ * Chunks of ZeroCopyViewable sources are copied on several threads, chunks of
+ * other sources are read in order. transform(first_item, n_items) is applied
+ * to each chunk after reading and before checking it, e.g. to convert its byte
+ * order. Returns error_file_truncated if the source ends before the data.
+ */
+template <typename Source, typename F>
+requires Readable<Source, u8_vector&>
+inline result
+read_checked(Source &source, u8 *dest, u64 n_items, const value_checker &checker, const value_rules &rules, value_report &report, F &&transform)
+{
+	const u64 item_size = checker.item_size();
+	if constexpr (ZeroCopyViewable<Source>) {
+		u8_const_span view = source.view(n_items * item_size);
+		if (view.size() != n_items * item_size)
+			return result::error_file_truncated;
+		return check_values_chunked(checker, dest, n_items, rules.n_threads, report, [&](u64 first, u64 n) {
+			std::copy_n(view.data() + first * item_size, n * item_size, dest + first * item_size);
+			transform(first, n);
+			return result::ok;
+		});
+	}
+	else {
+		return check_values_chunked(checker, dest, n_items, 1, report, [&](u64 first, u64 n) {
+			if (source.read(u8_span(dest + first * item_size, n * item_size), n * item_size) != n * item_size)
+				return result::error_file_truncated;
+			transform(first, n);
+			return result::ok;
+		});
+	}
+}
+
+
+/*
+ * dtype_match - how the data type of an array is compared to a schema
+ *
+ * equal requires the same data type including names and byte order (see
+ * is_same_dtype), compatible only the same data up to byte order (see
+ * is_compatible_dtype).
+ */
+enum class dtype_match
+{
+	equal,
+	compatible
+};
+
+
+/*
+ * array_schema - expected data type, shape, and storage order of an array
+ *
+ * All fields are optional. Fields which are not set match any array. Extents
+ * of the shape which are set to array_schema::any match any size along this
+ * dimension, e.g. {array_schema::any, 128} matches all 2D arrays with 128
+ * columns. The loaders which accept a schema validate it right after parsing
+ * the header of a file, i.e. before reading the array data. Values are checked
+ * against value_rules chunk by chunk, right after a chunk was read (see
+ * check_values_chunked).
+ */
+struct array_schema
+{
+	static constexpr u64
+		any                         {~u64(0)};
+
+	std::optional<dtype>
+		dt;
+
+	std::optional<u64_vector>
+		shape;
+
+	std::optional<storage_order>
+		order;
+
+	// number of dimensions, e.g. if the extents do not matter
+	std::optional<u64>
+		rank;
+
+	// maximum size of the array data in bytes
+	std::optional<u64>
+		max_bytes;
+
+	dtype_match
+		match                       {dtype_match::equal};
+
+	// rules for the values of the array, which are checked while the array
+	// data is read. The outcome is written to report, if set
+	const value_rules *
+		values                      {nullptr};
+
+	value_report *
+		report                      {nullptr};
+};
+
+
+/*
+ * validate_schema - test if an array description matches a schema
+ *
+ * A mismatch is reported as error_schema_mismatch together with the code of
+ * what did not match, e.g. error_schema_shape_mismatch.
+ */
+inline result
+validate_schema(const array_schema &schema, const dtype &dt, const u64_vector &shape, storage_order order)
+{
+	if (schema.order && *schema.order != order)
+		return result::error_schema_mismatch | result::error_schema_order_mismatch;
+
+	if (schema.rank && *schema.rank != shape.size())
+		return result::error_schema_mismatch | result::error_schema_rank_mismatch;
+
+	if (schema.shape) {
+		if (schema.shape->size() != shape.size())
+			return result::error_schema_mismatch | result::error_schema_rank_mismatch;
+		for (size_t i = 0; i < shape.size(); ++i)
+			if ((*schema.shape)[i] != array_schema::any && (*schema.shape)[i] != shape[i])
+				return result::error_schema_mismatch | result::error_schema_shape_mismatch;
+	}
+
+	if (schema.dt) {
+		bool match = (schema.match == dtype_match::compatible)
+			? is_compatible_dtype(*schema.dt, dt)
+			: is_same_dtype(*schema.dt, dt);
+		if (!match)
+			return result::error_schema_mismatch | result::error_schema_dtype_mismatch;
+	}
+
+	if (schema.max_bytes) {
+		// test against the limit before multiplying to avoid overflows
+		u64 size = dt.item_size;
+		if (size > *schema.max_bytes)
+			return result::error_schema_mismatch | result::error_schema_size_exceeded;
+		for (auto s: shape) {
+			if (s != 0 && size > *schema.max_bytes / s)
+				return result::error_schema_mismatch | result::error_schema_size_exceeded;
+			size *= s;
+		}
+	}
+
+	return result::ok;
+}
+
+
+/*
+ * npz_schema - expected schema for (some of the) arrays in an npz file
+ *
+ * Each listed array must be present in the file. Arrays which are not listed
+ * are not validated.
+ */
+using npz_schema = std::map<std::string, array_schema>;
+
+
+/*
+ * process_file_header - read and parse the header of an npy file from a ReadableSource
+ *
+ * If a schema is given, it is validated as soon as the header is parsed.
+ */
+template <typename Reader>
+// requires Readable<Reader, OutputRange>
+inline result
+process_file_header(Reader &source, npyfile &npy, dtype &dt, u64_vector &shape, storage_order &order, const array_schema *schema = nullptr)
+{
+	auto res = result::ok;
+
+	// read stuff
+	if ((res |= read_magic_string(source,  npy)    , is_error(res))) return res;
+	if ((res |= read_version(source, npy)          , is_error(res))) return res;
+	if ((res |= read_header_length(source, npy)    , is_error(res))) return res;
+	if ((res |= read_header(source, npy)           , is_error(res))) return res;
+
+	// parse + compute stuff
+	if ((res |= parse_header(npy, dt, order, shape), is_error(res))) return res;
+	if ((res |= compute_item_size(dt)              , is_error(res))) return res;
+	if (schema && (res |= validate_schema(*schema, dt, shape, order), is_error(res))) return res;
+	if ((res |= compute_data_size(source, npy)     , is_error(res))) return res;
+	if ((res |= validate_data_size(npy, dt)        , is_error(res))) return res;
+	if ((res |= validate_shape_size(npy, dt, shape), is_error(res))) return res;
+
+	return res;
+}
+
+
+inline result
+from_buffer(u8_vector &&buffer, npyfile &npy, ndarray &dest, const array_schema *schema = nullptr)
+{
+	auto res = result::ok;
+
+	// setup the npyfile struct as non-streaming
+	npy.streaming = false;
+
+	// parts of the array description (will be moved into the array later)
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+
+	// view the buffer so that it becomes a ReadableSource. Note that a
+	// buffer_reader would copy the buffer
+	auto source = span_reader(buffer);
+	if ((res = process_file_header(source, npy, dt, shape, order, schema), is_error(res))) return res;
+
+	// erase the entire header block. what's left is the raw data of the ndarray
+	buffer.erase(buffer.begin(), buffer.begin() + npy.data_offset);
+
+	// the buffer is already in memory, i.e. nothing to fuse the checks with
+	if (schema && schema->values) {
+		value_report _report;
+		if ((res |= check_values(dt, u8_const_span(buffer), *schema->values, schema->report ? *schema->report : _report), is_error(res)))
+			return res;
+	}
+
+	// build the ndarray from the data that we read by moving into it
+	dest.assign(std::move(dt), std::move(shape), std::move(buffer), order);
+
+	return res;
+}
+
+
+/*
+ * from_source - read an npy file from a ReadableSource into an ndarray
+ *
+ * The header is parsed from the source, after which the array data is copied
+ * (or read) directly into the array. For ZeroCopyViewable sources, e.g.
+ * span_reader, nothing else is copied, and a buffered_reader passes the read
+ * of the array data through to its source. Sources of unknown size, e.g.
+ * pipe_reader, are read up to the end of the array data. The schema is
+ * validated before the array data is read.
+ */
+template <typename Source, NDArray NDArrayType>
+requires Readable<Source, u8_vector&>
+result
+from_source(Source &source, NDArrayType &array, const array_schema &schema, npyfile *npy = nullptr)
+{
+	result res;
+
+	// see from_npy_ifstream
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+	npy_ptr->streaming = !SizedSource<Source>;
+
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+	if ((res = process_file_header(source, *npy_ptr, dt, shape, order, &schema), is_error(res))) return res;
+
+	// shapes of crafted headers can overflow
+	u64 n_items, size;
+	if (!checked_product(shape, n_items) || !checked_mul(n_items, dt.item_size, size))
+		return result::error_data_size_mismatch;
+	if constexpr (SizedSource<Source>) {
+		if (npy_ptr->data_size < size)
+			return result::error_file_truncated;
+	}
+
+	u8_vector data;
+	if (schema.values) {
+		value_report _report;
+		value_checker checker(dt, *schema.values);
+		data.resize(size);
+		if ((res |= read_checked(source, data.data(), n_items, checker, *schema.values, schema.report ? *schema.report : _report, [](u64, u64) {}), is_error(res)))
+			return res;
+	}
+	else if constexpr (ZeroCopyViewable<Source>) {
+		u8_const_span view = source.view(size);
+		if (view.size() != size)
+			return result::error_file_truncated;
+		data.assign(view.begin(), view.end());
+	}
+	else {
+		data.resize(size);
+		if (source.read(data, size) != size)
+			return result::error_file_truncated;
+	}
+	npy_ptr->data_size = size;
+
+	array.assign(std::move(dt), std::move(shape), std::move(data), order);
+	return res;
+}
+
+
+template <typename Source, NDArray NDArrayType>
+requires Readable<Source, u8_vector&>
+result
+from_source(Source &source, NDArrayType &array, npyfile *npy = nullptr)
+{
+	return from_source(source, array, array_schema{}, npy);
+}
+
+
+/*
+ * open_fd - open a file for reading
+ */
+inline result
+open_fd(const std::filesystem::path &filepath, int &fd)
+{
+	if ((fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+		return (errno == ENOENT) ? result::error_file_not_found : result::error_file_open_failed;
+	return result::ok;
+}
+
+
+/*
+ * open_temporary_file - create a new file with a unique name
+ *
+ * Like mkstemp, the trailing XXXXXX of tmpl are replaced by random characters.
+ * In contrast to mkstemp, which always uses mode 0600, the file is created
+ * with mode 0666 minus the umask of the process, i.e. like any other file.
+ * This matters for temporary files which are renamed into place afterwards.
+ * Returns a file descriptor opened for reading and writing, or -1 on error.
+ */
+inline int
+open_temporary_file(std::string &tmpl)
+{
+	constexpr std::string_view placeholder = "XXXXXX";
+	constexpr std::string_view chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	if (!tmpl.ends_with(placeholder)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	thread_local std::mt19937_64 rng(std::random_device{}() ^ (static_cast<u64>(::getpid()) << 32));
+	for (unsigned attempt = 0; attempt < 128; attempt++) {
+		for (size_t i = tmpl.size() - placeholder.size(); i < tmpl.size(); i++)
+			tmpl[i] = chars[rng() % chars.size()];
+		int fd = ::open(tmpl.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+		if (fd >= 0 || errno != EEXIST)
+			return fd;
+	}
+	return -1;
+}
+
+
+/*
+ * read_all - read an entire buffer at an offset from a file descriptor
+ *
+ * Retries on short reads and interrupted system calls. Returns the number of
+ * bytes read, which is less than size only at the end of the file or if an
+ * error occurred.
+ */
+inline size_t
+read_all(int fd, u8 *data, size_t size, u64 offset)
+{
+	size_t nread = 0;
+	while (nread < size) {
+		ssize_t n = ::pread(fd, data + nread, size - nread, static_cast<off_t>(offset + nread));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		nread += static_cast<size_t>(n);
+	}
+	return nread;
+}
+
+
+/*
+ * write_all - write an entire buffer to a file descriptor
+ *
+ * Retries on short writes and interrupted system calls.
+ */
+inline bool
+write_all(int fd, const u8 *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = ::write(fd, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+
+/*
+ * write_all - write several buffers to a file descriptor with vectored writes
+ *
+ * Retries on short writes and interrupted system calls. Note that the iovecs
+ * are modified to track what remains to be written.
+ */
+inline bool
+write_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t n = ::writev(fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		// skip what was written entirely, and advance into the rest
+		size_t nwritten = static_cast<size_t>(n);
+		while (iovcnt > 0 && nwritten >= iov->iov_len) {
+			nwritten -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = static_cast<u8*>(iov->iov_base) + nwritten;
+			iov->iov_len -= nwritten;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * read_fd - read the contents of a file descriptor into a buffer
+ *
+ * Regular files are read entirely with a single allocation, regardless of the
+ * offset of the file descriptor. Everything else, e.g. pipes and sockets, is
+ * read from the current position until the end of the stream.
+ */
+inline result
+read_fd(int fd, u8_vector &buffer)
+{
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+
+	if (S_ISREG(st.st_mode)) {
+		buffer.resize(static_cast<size_t>(st.st_size));
+		if (read_all(fd, buffer.data(), buffer.size(), 0) != buffer.size())
+			return result::error_file_read_failed;
+		return result::ok;
+	}
+
+	constexpr size_t chunk_size = 1 << 16;
+	buffer.clear();
+	for (;;) {
+		size_t size = buffer.size();
+		buffer.resize(size + chunk_size);
+		ssize_t n = ::read(fd, buffer.data() + size, chunk_size);
+		if (n < 0 && errno == EINTR) {
+			buffer.resize(size);
+			continue;
+		}
+		if (n < 0)
+			return result::error_file_read_failed;
+		buffer.resize(size + static_cast<size_t>(n));
+		if (n == 0)
+			return result::ok;
+	}
+}
+
+
+/*
+ * is_zip_file - test if a buffer starts with a zip local file header signature
+ */
+inline bool
+is_zip_file(u8_const_span data)
+{
+	// see is_zip_file(std::istream &) below
+	return data.size() >= 4 &&
+	       data[0] == 0x50 &&
+	       data[1] == 0x4b &&
+	       data[2] == 0x03 &&
+	       data[3] == 0x04;
+}
+
+
+/*
+ * is_zip_file - test if a file descriptor refers to a zip file
+ */
+inline bool
+is_zip_file(int fd)
+{
+	u8 buffer[4];
+	return read_all(fd, buffer, sizeof(buffer), 0) == sizeof(buffer) && is_zip_file(u8_const_span(buffer, sizeof(buffer)));
+}
+
+
+inline bool
+is_zip_file(std::istream &is)
+{
+	// each zip file starts with a local file header signature of 4 bytes and
+	// the value 0x04034b50. For more information see the ZIP file format
+	// specification: https://pkware.cachefly.net/webdocs/APPNOTE/APPNOTE-6.3.9.TXT
+	u8 buffer[4];
+	is.read((char*)buffer, 4);
+	return buffer[0] == 0x50 &&
+	       buffer[1] == 0x4b &&
+	       buffer[2] == 0x03 &&
+	       buffer[3] == 0x04;
+}
+
+
+/*
+ * zip_member_reader - wrapper for a member of a zip archive to make it a ReadableSource
+ *
+ * The member is read with read_raw of the zip backend, i.e. what is read is
+ * the stored data. Hence, this yields the npy file only for members which
+ * are not compressed. Compressed members are read with read_range if
+ * decompress is set, which decompresses the member from its beginning up to
+ * what is read in each call. Hence, read in few large pieces, e.g. through a
+ * buffered_reader.
+ */
+struct zip_member_reader
+{
+	zip_member_reader(zip::backend_interface &backend, zip::backend_state *state, std::string filename, u64 size, bool decompress = false)
+	: _backend(backend), _state(state), _filename(std::move(filename)), _size(size), _pos(0), _decompress(decompress), _fail(false) {}
+
+	template <Writable<u8> D>
+	std::size_t
+	read(D &&dest, std::size_t size)
+	{
+		auto first = std::begin(dest);
+		auto last = std::end(dest);
+		size = std::min(size, static_cast<std::size_t>(std::distance(first, last)));
+		size = static_cast<std::size_t>(std::min<u64>(size, remaining()));
+		if (size == 0)
+			return 0;
+
+		auto read = _decompress ? _backend.read_range : _backend.read_raw;
+		if (read(_state, _filename, _pos, &(*first), size) != zip::result::ok) {
+			_fail = true;
+			return 0;
+		}
+		_pos += size;
+		return size;
+	}
+
+	template <typename T>
+	requires std::same_as<T, u8>
+	std::size_t
+	read(T* dest, std::size_t size)
+	{
+		return read(std::span<T>(dest, size), size);
+	}
+
+	inline bool
+	eof() noexcept {
+		return _pos >= _size;
+	}
+
+	inline bool
+	fail() noexcept {
+		return _fail;
+	}
+
+	inline u64
+	remaining() const noexcept {
+		return _size > _pos ? _size - _pos : 0;
+	}
+
+	zip::backend_interface &_backend;
+	zip::backend_state     *_state;
+	std::string             _filename;
+	u64                     _size;
+	u64                     _pos;
+	bool                    _decompress;
+	bool                    _fail;
+};
+
+
+/*
+ * validate_zip_member - validate the header of a member of a zip archive against a schema
+ *
+ * Only the header is read, which requires that the zip backend implements
+ * stat, and read_raw for stored or read_range for compressed members. Of
+ * compressed members, only a prefix which contains the header is
+ * decompressed. Otherwise, this returns ok and the schema is validated when
+ * the member is parsed.
+ */
+inline result
+validate_zip_member(zip::backend_interface &zip_backend, zip::backend_state *zip_state, const std::string &fname, const array_schema &schema)
+{
+	zip::file_stat st;
+	if (!zip_backend.stat || zip_backend.stat(zip_state, fname, st) != zip::result::ok ||
+	    !(st.compressed ? zip_backend.read_range : zip_backend.read_raw))
+		return result::ok;
+
+	auto member = zip_member_reader(zip_backend, zip_state, fname, st.size, st.compressed);
+	auto source = buffered_reader(member, 4096);
+
+	npyfile       npy;
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+	result res = process_file_header(source, npy, dt, shape, order, &schema);
+	return is_error(res) ? res : result::ok;
+}
+
+
+/*
+ * file_identity - identifies a particular version of a file
+ *
+ * Two identities are equal only if they refer to the same path, the same inode
+ * on the same device, and if size and modification time did not change. That
+ * is, replacing or modifying a file yields a new identity.
+ */
+struct file_identity
+{
+	std::string path;
+	u64         device  {0};
+	u64         inode   {0};
+	i64         mtime   {0};   // nanoseconds
+	u64         size    {0};
+
+	bool operator==(const file_identity &) const = default;
+};
+
+
+struct file_identity_hash
+{
+	size_t
+	operator()(const file_identity &id) const noexcept
+	{
+		// boost::hash_combine style mixing
+		size_t h = std::hash<std::string>{}(id.path);
+		auto mix = [&h](u64 v) { h ^= std::hash<u64>{}(v) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+		mix(id.device);
+		mix(id.inode);
+		mix(static_cast<u64>(id.mtime));
+		mix(id.size);
+		return h;
+	}
+};
+
+
+/*
+ * file_identity_from_stat - fill device, inode, size, and modification time of an identity
+ */
+inline void
+file_identity_from_stat(const struct stat &st, file_identity &id)
+{
+	id.device = static_cast<u64>(st.st_dev);
+	id.inode  = static_cast<u64>(st.st_ino);
+	id.size   = static_cast<u64>(st.st_size);
+	#if defined(__APPLE__)
+		id.mtime = static_cast<i64>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+	#else
+		id.mtime = static_cast<i64>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+	#endif
+}
+
+
+/*
+ * get_file_identity - stat a file and determine its identity
+ */
+inline result
+get_file_identity(const std::filesystem::path &filepath, file_identity &id)
+{
+	struct stat st;
+	if (::stat(filepath.c_str(), &st) != 0)
+		return (errno == ENOENT) ? result::error_file_not_found : result::error_file_open_failed;
+
+	file_identity_from_stat(st, id);
+	id.path = filepath.native();
+	return result::ok;
+}
+
+
+/*
+ * get_file_identity - fstat an opened file and determine its identity
+ *
+ * The path of the identity remains empty.
+ */
+inline result
+get_file_identity(int fd, file_identity &id)
+{
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_open_failed;
+
+	file_identity_from_stat(st, id);
+	id.path.clear();
+	return result::ok;
+}
+
+
+/*
+ * integrity_mode - when to verify the CRC-32 of members of zip archives
+ *
+ * verify checks every member each time it is read. verify_once checks a
+ * member only the first time it is read by this process, unless the archive
+ * was modified or replaced in between (see verified_members). skip does not
+ * check any member. Compressed members are inflated by the zip backend, which
+ * verifies them in all modes.
+ */
+enum class integrity_mode
+{
+	verify,
+	verify_once,
+	skip
+};
+
+
+/*
+ * verified_members - members of zip archives whose CRC-32 was verified
+ *
+ * A member is identified by device, inode, size, and modification time of the
+ * archive, and by its filename, size, and CRC-32. The path of the archive is
+ * not part of the key, i.e. a member that was verified when loading the
+ * archive via one path does not need to be verified when loading it via
+ * another. The registry is shared by all threads of the process.
+ */
+struct verified_members
+{
+	static verified_members&
+	instance()
+	{
+		static verified_members registry;
+		return registry;
+	}
+
+	bool
+	contains(const file_identity &archive, const std::string &filename, const zip::file_stat &st)
+	{
+		std::string k = key(archive, filename, st);
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _keys.contains(k);
+	}
+
+	void
+	insert(const file_identity &archive, const std::string &filename, const zip::file_stat &st)
+	{
+		std::string k = key(archive, filename, st);
+		std::lock_guard<std::mutex> lock(_mutex);
+		_keys.insert(std::move(k));
+	}
+
+	void
+	clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_keys.clear();
+	}
+
+private:
+	static std::string
+	key(const file_identity &archive, const std::string &filename, const zip::file_stat &st)
+	{
+		char buffer[128];
+		std::snprintf(buffer, sizeof(buffer), "%llx-%llx-%llx-%llx-%08x-%llx-",
+			static_cast<unsigned long long>(archive.device),
+			static_cast<unsigned long long>(archive.inode),
+			static_cast<unsigned long long>(archive.size),
+			static_cast<unsigned long long>(archive.mtime),
+			st.crc32,
+			static_cast<unsigned long long>(st.size));
+		return std::string(buffer) + filename;
+	}
+
+	std::mutex
+		_mutex;
+
+	std::unordered_set<std::string>
+		_keys;
+};
+
+
+/*
+ * read_zip_member - read a member of an opened archive and verify its CRC-32
+ *
+ * Members which are stored uncompressed are read with read_raw, and their
+ * CRC-32 is computed with zip::crc32_parallel or not at all, depending on the
+ * integrity mode. verify_once requires the identity of the archive and falls
+ * back to verify without it. All other members, and all members if the zip
+ * backend does not implement stat and read_raw, are read with the backend.
+ */
+inline result
+read_zip_member(zip::backend_interface &zip_backend, zip::backend_state *zip_state, const std::string &fname, integrity_mode integrity, const file_identity *archive, u8_vector &buffer)
+{
+	zip::file_stat st;
+	if (!zip_backend.stat || !zip_backend.read_raw ||
+	    zip_backend.stat(zip_state, fname, st) != zip::result::ok ||
+	    st.compressed || st.compressed_size != st.size)
+		return zip_backend.read(zip_state, fname, buffer) == zip::result::ok ? result::ok : result::error_file_read_failed;
+
+	buffer.resize(st.size);
+	if (st.size > 0 && zip_backend.read_raw(zip_state, fname, 0, buffer.data(), st.size) != zip::result::ok)
+		return result::error_file_read_failed;
+
+	const bool once = integrity == integrity_mode::verify_once && archive;
+	if (integrity == integrity_mode::skip || (once && verified_members::instance().contains(*archive, fname, st)))
+		return result::ok;
+	if (zip::crc32_parallel(buffer.data(), buffer.size()) != st.crc32)
+		return result::error_file_read_failed | result::error_checksum_mismatch;
+	if (once)
+		verified_members::instance().insert(*archive, fname, st);
+	return result::ok;
+}
+
+
+/*
+ * from_zip_member - decompress and parse a compressed member of an opened archive
+ *
+ * Requires that the zip backend implements read_range. The header is parsed
+ * and validated from a prefix of the member, after which the array data is
+ * decompressed directly into the array and the CRC-32 of the member verified.
+ * Values are checked once the array data is in memory, as the array data is
+ * decompressed in one piece.
+ */
+inline result
+from_zip_member(zip::backend_interface &zip_backend, zip::backend_state *zip_state, const std::string &fname, u64 size, npyfile &npy, ndarray &array, const array_schema *schema = nullptr)
+{
+	auto member = zip_member_reader(zip_backend, zip_state, fname, size, true);
+	auto source = buffered_reader(member, 4096);
+
+	array_schema header_schema = schema ? *schema : array_schema{};
+	header_schema.values = nullptr;
+
+	result res;
+	if ((res = from_source(source, array, header_schema, &npy), is_error(res)))
+		return member.fail() ? result::error_file_read_failed : res;
+
+	// the CRC-32 is verified once the member was read up to its end
+	if (source.remaining() > 0) {
+		u8_vector rest(source.remaining());
+		if (source.read(rest, rest.size()) != rest.size())
+			return result::error_file_read_failed;
+	}
+
+	if (schema && schema->values) {
+		value_report _report;
+		if ((res |= check_values(array, *schema->values, schema->report ? *schema->report : _report), is_error(res)))
+			return res;
+	}
+	return res;
+}
+
+
+/*
+ * read_zip_archive - decompress and parse all arrays of an opened archive
+ */
+inline result
+read_zip_archive(zip::backend_interface &zip_backend, zip::backend_state *zip_state, npzfile &npz, const npz_schema *schema = nullptr, integrity_mode integrity = integrity_mode::verify, const file_identity *archive = nullptr)
+{
+	std::vector<std::string> file_list;
+	if (zip_backend.get_file_list(zip_state, file_list) != zip::result::ok)
+		// TODO: better error return value
+		return result::error_file_read_failed;
+
+	// arrays which the schema requires need to be in the central directory
+	if (schema) {
+		for (auto &[name, _]: *schema) {
+			auto it = std::find_if(file_list.begin(), file_list.end(), [&](const std::string &fname) {
+				return fname.substr(0, fname.find_last_of(".")) == name;
+			});
+			if (it == file_list.end())
+				return result::error_array_not_found;
+		}
+	}
+
+	// for each archive file, decompress and parse the numpy array. warnings
+	// of all arrays are collected in res
+	result res = result::ok;
+	for (auto &fname: file_list) {
+		// remove ".npy" from array name
+		std::string array_name = fname.substr(0, fname.find_last_of("."));
+
+		const array_schema *member_schema = nullptr;
+		if (schema) {
+			auto it = schema->find(array_name);
+			if (it != schema->end())
+				member_schema = &it->second;
+		}
+
+		// get a npy file and array
+		auto npy = std::make_unique<npyfile>();
+		auto array = std::make_unique<ndarray>();
+
+		zip::file_stat st;
+		if (zip_backend.stat && zip_backend.read_range &&
+		    zip_backend.stat(zip_state, fname, st) == zip::result::ok && st.compressed) {
+			if ((res |= from_zip_member(zip_backend, zip_state, fname, st.size, *npy, *array, member_schema), is_error(res)))
+				return res;
+		}
+		else {
+			if (member_schema && (res |= validate_zip_member(zip_backend, zip_state, fname, *member_schema), is_error(res)))
+				return res;
+
+			u8_vector buffer;
+			if ((res |= read_zip_member(zip_backend, zip_state, fname, integrity, archive, buffer), is_error(res)))
+				return res;
+			if ((res |= from_buffer(std::move(buffer), *npy, *array, member_schema), is_error(res)))
+				return res;
+		}
+
+		// store the information in an npz_file
+		npz.names.push_back(array_name);
+		npz.npys.insert(std::make_pair(array_name, std::move(npy)));
+		npz.arrays.insert(std::make_pair(array_name, std::move(array)));
+	}
+	return res;
+}
+
+
+inline result
+from_zip_archive(std::filesystem::path filepath, npzfile &npz, const npz_schema *schema = nullptr, integrity_mode integrity = integrity_mode::verify)
+{
+	// get a zip backend
+	zip::backend_state *zip_state      = nullptr;
+	zip::backend_interface zip_backend = zip::get_backend_interface();
+
+	// the identity needs to be that of the file which is read. Thus, it can
+	// only be determined if the backend reads from the opened file. Without
+	// an identity, verify_once verifies every member
+	file_identity id;
+	bool has_id = false;
+
+	zip_backend.make(&zip_state);
+	if (zip_backend.open_fd) {
+		result res;
+		int fd;
+		if ((res = open_fd(filepath, fd)) != result::ok) {
+			zip_backend.release(&zip_state);
+			return res;
+		}
+		if ((res = get_file_identity(fd, id)) != result::ok) {
+			::close(fd);
+			zip_backend.release(&zip_state);
+			return res;
+		}
+		has_id = integrity == integrity_mode::verify_once;
+		const bool opened = zip_backend.open_fd(zip_state, fd, id.size) == zip::result::ok;
+		::close(fd);
+		if (!opened) {
+			zip_backend.release(&zip_state);
+			return result::error_file_open_failed;
+		}
+	}
+	else if (zip_backend.open(zip_state, filepath, zip::filemode::read) != zip::result::ok) {
+		zip_backend.release(&zip_state);
+		return result::error_file_open_failed;
+	}
+
+	result res = read_zip_archive(zip_backend, zip_state, npz, schema, integrity, has_id ? &id : nullptr);
+
+	// close the zip backend and release it again
+	zip_backend.close(zip_state);
+	zip_backend.release(&zip_state);
+	return res;
+}
+
+
+/*
+ * from_zip_archive - read an archive of a given size from an opened file descriptor
+ *
+ * The file descriptor remains owned by the caller. Returns error_unavailable
+ * if the zip backend cannot open archives from file descriptors.
+ */
+inline result
+from_zip_archive(int fd, u64 size, npzfile &npz, const npz_schema *schema = nullptr, integrity_mode integrity = integrity_mode::verify)
+{
+	zip::backend_state *zip_state      = nullptr;
+	zip::backend_interface zip_backend = zip::get_backend_interface();
+	if (!zip_backend.open_fd)
+		return result::error_unavailable;
+
+	file_identity id;
+	const bool has_id = integrity == integrity_mode::verify_once && get_file_identity(fd, id) == result::ok;
+
+	zip_backend.make(&zip_state);
+	if (zip_backend.open_fd(zip_state, fd, size) != zip::result::ok) {
+		zip_backend.release(&zip_state);
+		return result::error_file_open_failed;
+	}
+
+	result res = read_zip_archive(zip_backend, zip_state, npz, schema, integrity, has_id ? &id : nullptr);
+
+	zip_backend.close(zip_state);
+	zip_backend.release(&zip_state);
+	return res;
+}
+
+inline result
+open_fstream(std::filesystem::path filepath, std::ifstream &fstream)
+{
+	namespace fs = std::filesystem;
+
+	// test if the file exists
+	if (!fs::exists(filepath))
+		return result::error_file_not_found;
+
+	// attempt to read
+	fstream.open(filepath, std::ios::binary);
+	if (!fstream)
+		return result::error_file_open_failed;
+
+	return result::ok;
+}
+
+
+/*
+ * from_npz_fd - read an already opened npz file
+ *
+ * The file descriptor remains owned by the caller. Arrays which the schema
+ * requires are looked up in the central directory before any array is read,
+ * and each array is validated right after parsing its header. For arrays which
+ * are stored uncompressed, this happens before the array data is read. The
+ * CRC-32 of arrays is verified according to the integrity mode, see
+ * integrity_mode and read_zip_member.
+ */
+inline result
+from_npz_fd(int fd, npzfile &npz, const npz_schema &schema, integrity_mode integrity = integrity_mode::verify)
+{
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+	if (!is_zip_file(fd))
+		return result::error_wrong_filetype;
+
+	// let the zip backend handle this file from now on
+	return from_zip_archive(fd, static_cast<u64>(st.st_size), npz, &schema, integrity);
+}
+
+
+inline result
+from_npz_fd(int fd, npzfile &npz, integrity_mode integrity = integrity_mode::verify)
+{
+	return from_npz_fd(fd, npz, npz_schema{}, integrity);
+}
+
+
+/*
+ * from_npz - read an npz file, see from_npz_fd for the validation of the
+ * schema and the integrity mode
+ */
+inline result
+from_npz(std::filesystem::path filepath, npzfile &npz, const npz_schema &schema, integrity_mode integrity = integrity_mode::verify)
+{
+	result res;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok)
+		return res;
+
+	// backends which cannot read from a file descriptor open the file
+	// themselves
+	if (!zip::get_backend_interface().open_fd) {
+		bool test = is_zip_file(fd);
+		::close(fd);
+		if (!test)
+			return result::error_wrong_filetype;
+		return from_zip_archive(filepath, npz, &schema, integrity);
+	}
+
+	res = from_npz_fd(fd, npz, schema, integrity);
+	::close(fd);
+	return res;
+}
+
+
+inline result
+from_npz(std::filesystem::path filepath, npzfile &npz, integrity_mode integrity = integrity_mode::verify)
+{
+	return from_npz(std::move(filepath), npz, npz_schema{}, integrity);
+}
+
+
+/*
+ * open_npy - attempt to open an npy file.
+ *
+ * This function opens a file and examines the first few bytes to test if it is
+ * a zip file (e.g. used in .npz). If that's the case, it returns an error,
+ * because handling .npz files is different regarding how data is read and where
+ * it will be written to. If the file is not a zip file, this function resets
+ * the read cursor to before the first byte, and returns OK. If it later turns
+ * out that this is, in fact, not a .npy file, other functions will return
+ * errors because parsing the .npy header will (most likely) fail.
+ */
+inline result
+open_npy(std::filesystem::path filepath, std::ifstream &file)
+{
+	result res;
+	if ((res = open_fstream(filepath, file), is_error(res)))
+		return res;
+
+	// test if this is a PKzip file, and if yes then we exit early. for loading
+	// npz files, use from_npz
+	if (is_zip_file(file))
+		return result::error_wrong_filetype;
+
+	file.seekg(0);
+	return res;
+}
+
+
+#ifndef NCR_HAS_GET_FILE_SIZE
+#define NCR_HAS_GET_FILE_SIZE
+inline u64
+get_file_size(std::ifstream &is)
+{
+	auto ip = is.tellg();
+	is.seekg(0, std::ios::end);
+	auto res = is.tellg();
+	is.seekg(ip);
+	return static_cast<u64>(res);
+}
+#endif
+
+
+/*
+ * from_npy_ifstream - read an already opened ifstream into an ndarray
+ */
+template <NDArray NDArrayType, bool unsafe_read = true>
+result
+from_npy_ifstream(std::ifstream &file, NDArrayType &array, npyfile *npy = nullptr)
+{
+	result res = result::ok;
+
+	// read the file into a vector. the c++ iostream interface is horrible to
+	// work with and considered bad design by many developers. We'll load the
+	// file into a vector (which is not the fastest), but then working with it
+	// is reasonably simple
+	auto filesize = get_file_size(file);
+	u8_vector buf(filesize);
+	if constexpr (unsafe_read)
+		file.read(reinterpret_cast<char*>(buf.data()), filesize);
+	else
+		buf.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	// if the caller didnt pass in a preallocated object, we'll use a local one.
+	// this way avoids allocating an object, as _tmp is already present on the
+	// stack. it also doesn't tamper with the npy pointer
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+
+	// Note the change in argument order!
+	res = from_buffer(std::move(buf), *npy_ptr, array);
+
+	// done
+	return res;
+}
+
+
+/*
+ * from_npy_fd - read an already opened npy file into an ndarray
+ *
+ * The file descriptor remains owned by the caller. Regular files are read
+ * entirely, regardless of the offset of the file descriptor. The header is
+ * read and validated against the schema first, and the array data afterwards
+ * directly into the array.
+ */
+template <NDArray NDArrayType>
+result
+from_npy_fd(int fd, NDArrayType &array, const array_schema &schema, npyfile *npy = nullptr)
+{
+	result res;
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+
+	// pipes and sockets are read up to the end of the array, and directly
+	// into the array. Hence, several arrays can be sent over the same pipe
+	if (!S_ISREG(st.st_mode)) {
+		auto source = pipe_reader(fd);
+		return from_source(source, array, schema, npy);
+	}
+
+	// the first read covers the headers of all but unusual files, and entire
+	// small files
+	const u64 file_size = static_cast<u64>(st.st_size);
+	u8_vector header(std::min<u64>(file_size, 4096));
+	if (read_all(fd, header.data(), header.size(), 0) != header.size())
+		return result::error_file_read_failed;
+
+	// see open_npy
+	if (is_zip_file(u8_const_span(header)))
+		return result::error_wrong_filetype;
+
+	// see from_npy_ifstream
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+	npy_ptr->streaming = false;
+
+	auto prefix = span_reader(header);
+	if ((res = read_magic_string(prefix, *npy_ptr))  != result::ok) return res;
+	if ((res = read_version(prefix, *npy_ptr))       != result::ok) return res;
+	if ((res = read_header_length(prefix, *npy_ptr)) != result::ok) return res;
+	if (npy_ptr->data_offset > file_size)
+		return result::error_header_truncated;
+
+	const u64 prefix_size = header.size();
+	if (npy_ptr->data_offset > prefix_size) {
+		header.resize(npy_ptr->data_offset);
+		if (read_all(fd, header.data() + prefix_size, header.size() - prefix_size, prefix_size) != header.size() - prefix_size)
+			return result::error_file_read_failed;
+	}
+
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+	auto source = span_reader(header);
+	source._pos = npy_ptr->data_offset - npy_ptr->header_size;
+	npy_ptr->data_size = file_size - npy_ptr->data_offset;
+	if ((res |= read_header(source, *npy_ptr)                , is_error(res))) return res;
+	if ((res |= parse_header(*npy_ptr, dt, order, shape)     , is_error(res))) return res;
+	if ((res |= compute_item_size(dt)                        , is_error(res))) return res;
+	if ((res |= validate_schema(schema, dt, shape, order)    , is_error(res))) return res;
+	if ((res |= validate_data_size(*npy_ptr, dt)             , is_error(res))) return res;
+	if ((res |= validate_shape_size(*npy_ptr, dt, shape)     , is_error(res))) return res;
+
+	// copy what was read already, and read the rest directly into the data
+	u8_vector data(file_size - npy_ptr->data_offset);
+	const u64 n = std::min<u64>(data.size(), header.size() - npy_ptr->data_offset);
+	std::copy_n(header.begin() + static_cast<std::ptrdiff_t>(npy_ptr->data_offset), n, data.begin());
+	if (schema.values) {
+		// each chunk is read and checked on the same thread
+		value_report _report;
+		value_checker checker(dt, *schema.values);
+		const u64 item_size = dt.item_size;
+		const u64 n_items = item_size ? data.size() / item_size : 0;
+		res |= check_values_chunked(checker, data.data(), n_items, schema.values->n_threads, schema.report ? *schema.report : _report, [&](u64 first, u64 count) {
+			const u64 begin = std::max(n, first * item_size);
+			const u64 end   = (first + count) * item_size;
+			if (begin < end && read_all(fd, data.data() + begin, end - begin, npy_ptr->data_offset + begin) != end - begin)
+				return result::error_file_read_failed;
+			return result::ok;
+		});
+		if (is_error(res))
+			return res;
+	}
+	else if (read_all(fd, data.data() + n, data.size() - n, npy_ptr->data_offset + n) != data.size() - n)
+		return result::error_file_read_failed;
+
+	array.assign(std::move(dt), std::move(shape), std::move(data), order);
+	return res;
+}
+
+
+template <NDArray NDArrayType>
+result
+from_npy_fd(int fd, NDArrayType &array, npyfile *npy = nullptr)
+{
+	return from_npy_fd(fd, array, array_schema{}, npy);
+}
+
+
+/*
+ * from_nyp - read a file into a container
+ *
+ * When reading a file into an ndarray, we read the file in one go into a buffer
+ * and then process it. unsafe_read only applies to from_npy_ifstream, and is
+ * kept for compatibility.
+ */
+template <NDArray NDArrayType, bool unsafe_read = true>
+result
+from_npy(std::filesystem::path filepath, NDArrayType &array, npyfile *npy = nullptr)
+{
+	// try to open the file
+	result res = result::ok;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok) return res;
+
+	res = from_npy_fd(fd, array, npy);
+	::close(fd);
+	return res;
+}
+
+
+/*
+ * from_npy - read a file into a container if it matches a schema
+ *
+ * The schema is validated before the array data is read, see from_npy_fd.
+ */
+template <NDArray NDArrayType>
+result
+from_npy(std::filesystem::path filepath, NDArrayType &array, const array_schema &schema, npyfile *npy = nullptr)
+{
+	result res;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok) return res;
+
+	res = from_npy_fd(fd, array, schema, npy);
+	::close(fd);
+	return res;
+}
+
+
+/*
+ * bswap_value - reverse the byte order of a value of a typed_ndarray
+ *
+ * Complex values are swapped per part, all other values via the unsigned
+ * integer of the same size.
+ */
+template <typename T>
+inline T
+bswap_value(T v)
+{
+	if constexpr (std::is_same_v<T, c64> || std::is_same_v<T, c128>)
+		return T(bswap_value(v.real()), bswap_value(v.imag()));
+	else {
+		using U = std::conditional_t<sizeof(T) == 2, u16, std::conditional_t<sizeof(T) == 4, u32, u64>>;
+		static_assert(sizeof(U) == sizeof(T));
+		return std::bit_cast<T>(ncr::bswap<U>(std::bit_cast<U>(v)));
+	}
+}
+
+
+/*
+ * check_typed_array - test if an array description matches a typed_ndarray
+ *
+ * The data type needs to match T, and the number of dimensions Rank. Data in
+ * the opposite byte order is accepted, in which case swap is set.
+ */
+template <typename T, size_t Rank>
+result
+check_typed_array(const dtype &dt, const u64_vector &shape, bool &swap)
+{
+	const dtype expected = dtype_selector<T>::get();
+	if (is_structured_array(dt) || !dt.shape.empty() ||
+	    dt.type_code != expected.type_code || dt.size != expected.size)
+		return result::error_schema_mismatch | result::error_schema_dtype_mismatch;
+	if (shape.size() != Rank)
+		return result::error_schema_mismatch | result::error_schema_rank_mismatch;
+
+	constexpr byte_order native = (std::endian::native == std::endian::little) ? byte_order::little : byte_order::big;
+	switch (dt.endianness) {
+	case byte_order::little:
+	case byte_order::big:
+		swap = sizeof(T) > 1 && dt.endianness != native;
+		break;
+	case byte_order::not_relevant:
+		swap = false;
+		break;
+	default:
+		return result::error_schema_mismatch | result::error_schema_dtype_mismatch;
+	}
+	return result::ok;
+}
+
+
+/*
+ * from_source - read an npy file from a ReadableSource into a typed_ndarray
+ *
+ * Type, rank, and the optional schema, e.g. to restrict the extents of the
+ * array, are checked right after parsing the header, i.e. before any of the
+ * array data is read. The array data is read directly into the array, and
+ * converted to native byte order if necessary.
+ */
+template <typename T, size_t Rank, typename Source>
+requires Readable<Source, u8_vector&>
+result
+from_source(Source &source, typed_ndarray<T, Rank> &array, const array_schema &schema, npyfile *npy = nullptr)
+{
+	result res;
+
+	// see from_npy_ifstream
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+	npy_ptr->streaming = !SizedSource<Source>;
+
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+	bool          swap;
+	if ((res = process_file_header(source, *npy_ptr, dt, shape, order, &schema), is_error(res))) return res;
+	if ((res |= check_typed_array<T, Rank>(dt, shape, swap), is_error(res)))                    return res;
+
+	typename typed_ndarray<T, Rank>::shape_type extents;
+	std::copy(shape.begin(), shape.end(), extents.begin());
+	// shapes of crafted headers can overflow
+	u64 n_items, size;
+	if (!checked_product(shape, n_items) || !checked_mul(n_items, sizeof(T), size))
+		return result::error_data_size_mismatch;
+	if constexpr (SizedSource<Source>) {
+		if (npy_ptr->data_size < size)
+			return result::error_file_truncated;
+	}
+
+	std::span<T> data = array.prepare(extents, order);
+	u8_span bytes(reinterpret_cast<u8*>(data.data()), data.size_bytes());
+	auto swap_values = [&](u64 first, u64 n) {
+		if constexpr (sizeof(T) > 1) {
+			if (swap)
+				for (auto &v: data.subspan(first, n))
+					v = bswap_value(v);
+		}
+	};
+
+	// values are checked once they are in native byte order, and right after
+	// their chunk was read and converted
+	if (schema.values) {
+		value_report _report;
+		dtype checked = dt;
+		checked.endianness = byte_order::not_relevant;
+		value_checker checker(checked, *schema.values);
+		if ((res |= read_checked(source, bytes.data(), data.size(), checker, *schema.values, schema.report ? *schema.report : _report, swap_values), is_error(res)))
+			return res;
+		npy_ptr->data_size = size;
+		return res;
+	}
+
+	if constexpr (ZeroCopyViewable<Source>) {
+		u8_const_span view = source.view(size);
+		if (view.size() != size)
+			return result::error_file_truncated;
+		std::copy(view.begin(), view.end(), bytes.begin());
+	}
+	else {
+		if (source.read(bytes, size) != size)
+			return result::error_file_truncated;
+	}
+	npy_ptr->data_size = size;
+	swap_values(0, data.size());
+	return res;
+}
+
+
+template <typename T, size_t Rank, typename Source>
+requires Readable<Source, u8_vector&>
+result
+from_source(Source &source, typed_ndarray<T, Rank> &array, npyfile *npy = nullptr)
+{
+	return from_source(source, array, array_schema{}, npy);
+}
+
+
+/*
+ * from_npy_fd - read an already opened npy file into a typed_ndarray
+ *
+ * See from_source. The header of regular files is read through a small buffer,
+ * and the array data directly into the array. The file descriptor remains
+ * owned by the caller.
+ */
+template <typename T, size_t Rank>
+result
+from_npy_fd(int fd, typed_ndarray<T, Rank> &array, const array_schema &schema, npyfile *npy = nullptr)
+{
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+
+	if (!S_ISREG(st.st_mode)) {
+		auto source = pipe_reader(fd);
+		return from_source(source, array, schema, npy);
+	}
+
+	auto file = fd_reader(fd, static_cast<u64>(st.st_size));
+	auto source = buffered_reader(file, 4096);
+	result res = from_source(source, array, schema, npy);
+
+	// see open_npy
+	if (res == result::error_magic_string_invalid && is_zip_file(fd))
+		return result::error_wrong_filetype;
+	return res;
+}
+
+
+template <typename T, size_t Rank>
+result
+from_npy_fd(int fd, typed_ndarray<T, Rank> &array, npyfile *npy = nullptr)
+{
+	return from_npy_fd(fd, array, array_schema{}, npy);
+}
+
+
+/*
+ * from_npy - read an npy file into a typed_ndarray
+ */
+template <typename T, size_t Rank>
+result
+from_npy(std::filesystem::path filepath, typed_ndarray<T, Rank> &array, const array_schema &schema, npyfile *npy = nullptr)
+{
+	result res;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok) return res;
+
+	res = from_npy_fd(fd, array, schema, npy);
+	::close(fd);
+	return res;
+}
+
+
+template <typename T, size_t Rank>
+result
+from_npy(std::filesystem::path filepath, typed_ndarray<T, Rank> &array, npyfile *npy = nullptr)
+{
+	return from_npy(std::move(filepath), array, array_schema{}, npy);
+}
+
+
+
+
+/*
+ * npy_loader - load many npy files in a row without allocating memory
+ *
+ * The loader keeps its buffers as well as the header and the parsed array
+ * description of the last file that it loaded. Files with the same header as
+ * their predecessor, e.g. arrays of the same shape and type, are thus neither
+ * parsed again, and loading them into the same ndarray reuses the memory of
+ * the array (see ndarray::prepare). In this steady state, loading a file does
+ * not allocate memory. The array data is read directly into the array. An
+ * optional schema is validated whenever a header is parsed, i.e. before the
+ * array data is read.
+ *
+ * Example:
+ *
+ *     numpy::npy_loader loader;
+ *     numpy::ndarray array;
+ *     for (auto &filepath: filepaths) {
+ *         if (loader.load(filepath, array) != numpy::result::ok)
+ *             break;
+ *         process(array);
+ *     }
+ */
+struct npy_loader
+{
+	npy_loader() = default;
+	npy_loader(array_schema schema) : _schema(std::move(schema)) {}
+
+
+	/*
+	 * load - load an npy file into an ndarray
+	 */
+	result
+	load(const std::filesystem::path &filepath, ndarray &array)
+	{
+		result res;
+		int fd;
+		if ((res = open_fd(filepath, fd)) != result::ok)
+			return res;
+		res = load_fd(fd, array);
+		::close(fd);
+		return res;
+	}
+
+
+	/*
+	 * load_fd - load an already opened npy file into an ndarray
+	 *
+	 * The file descriptor remains owned by the caller, and needs to refer to
+	 * a regular file, see from_npy_fd otherwise.
+	 */
+	result
+	load_fd(int fd, ndarray &array)
+	{
+		result res;
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+			return result::error_file_read_failed;
+		if (!S_ISREG(st.st_mode))
+			return result::error_unsupported_file_format;
+		const u64 file_size = static_cast<u64>(st.st_size);
+
+		// the first read covers the headers of all but unusual files, and
+		// entire small files
+		_buffer.resize(std::min<u64>(file_size, prefix_size));
+		if (read_all(fd, _buffer.data(), _buffer.size(), 0) != _buffer.size())
+			return result::error_file_read_failed;
+		if (is_zip_file(u8_const_span(_buffer)))
+			return result::error_wrong_filetype;
+
+		clear(_npy);
+		_npy.file_size = file_size;
+		auto prefix = span_reader(_buffer);
+		if ((res = read_magic_string(prefix, _npy))  != result::ok) return res;
+		if ((res = read_version(prefix, _npy))       != result::ok) return res;
+		if ((res = read_header_length(prefix, _npy)) != result::ok) return res;
+		if (_npy.data_offset > file_size)
+			return result::error_header_truncated;
+
+		const u64 header_offset = _npy.data_offset - _npy.header_size;
+		if (_npy.data_offset > _buffer.size()) {
+			const u64 n = _buffer.size();
+			_buffer.resize(_npy.data_offset);
+			if (read_all(fd, _buffer.data() + n, _buffer.size() - n, n) != _buffer.size() - n)
+				return result::error_file_read_failed;
+		}
+
+		// parse the header only if it changed. Warnings of the parser are
+		// kept and returned also for files with the same header
+		auto header = u8_const_span(_buffer).subspan(header_offset, _npy.header_size);
+		if (!_valid || !std::equal(header.begin(), header.end(), _header.begin(), _header.end())) {
+			_valid = false;
+			_dt = dtype{};
+			_shape.clear();
+			_parse_result = result::ok;
+
+			auto source = span_reader(_buffer);
+			source._pos = header_offset;
+			if ((_parse_result |= read_header(source, _npy)             , is_error(_parse_result))) return _parse_result;
+			if ((_parse_result |= parse_header(_npy, _dt, _order, _shape), is_error(_parse_result))) return _parse_result;
+			if ((_parse_result |= compute_item_size(_dt)                , is_error(_parse_result))) return _parse_result;
+			if ((_parse_result |= validate_schema(_schema, _dt, _shape, _order), is_error(_parse_result))) return _parse_result;
+			_header.assign(header.begin(), header.end());
+			_valid = true;
+		}
+
+		u64 n_items, size;
+		_npy.data_size = file_size - _npy.data_offset;
+		if (!checked_product(_shape, n_items) || !checked_mul(n_items, _dt.item_size, size) || _npy.data_size != size)
+			return result::error_data_size_mismatch;
+
+		// copy what was read already, and read the rest directly into the array
+		u8_span data = array.prepare(_dt, _shape, _order);
+		const u64 n = std::min<u64>(size, _buffer.size() - _npy.data_offset);
+		std::copy_n(_buffer.begin() + static_cast<std::ptrdiff_t>(_npy.data_offset), n, data.begin());
+		if (read_all(fd, data.data() + n, size - n, _npy.data_offset + n) != size - n)
+			return result::error_file_read_failed;
+		return _parse_result;
+	}
+
+
+	/*
+	 * npy - file information of the last file that was loaded
+	 *
+	 * Note that the header is only available if it had to be parsed.
+	 */
+	const npyfile &
+	npy() const
+	{
+		return _npy;
+	}
+
+
+	// size of the first read of each file
+	static constexpr u64
+		prefix_size                 {4096};
+
+private:
+	array_schema
+		_schema;
+
+	npyfile
+		_npy;
+
+	u8_vector
+		_buffer;
+
+	// header and array description of the last file
+	bool
+		_valid                      {false};
+
+	result
+		_parse_result               {result::ok};
+
+	u8_vector
+		_header;
+
+	dtype
+		_dt;
+
+	u64_vector
+		_shape;
+
+	storage_order
+		_order                      {storage_order::row_major};
+};
+
+
+/*
+ * from_npy_callback_source - read an npy file from a ReadableSource item by item
+ *
+ * Items of Viewable sources are passed to typed callbacks without copying them
+ * into a buffer first.
+ */
+template <typename T, typename F, typename G, typename Source>
+requires Readable<Source, u8_vector&>
+result
+from_npy_callback_source(Source &source, G array_properties_callback, F data_callback, npyfile *npy = nullptr)
+{
+	result res = result::ok;
+
+	// see comment in from_npy for NDArrayType
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+	npy_ptr->streaming = !SizedSource<Source>;
+
+	// process the file header and extract properties of the array
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+	if ((res = process_file_header(source, *npy_ptr, dt, shape, order), is_error(res))) return res;
+	if constexpr (ArrayPropertiesCallback<G>) {
+		bool cb_result = array_properties_callback(dt, shape, order);
+		if (!cb_result)
+			return res;
+	}
+
+	// at this point we know the item size, and can read items from the file
+	// until we hit eof
+	u8_vector buffer;
+	for (u64 i = 0;; ++i) {
+		u8_const_span item;
+		if constexpr (Viewable<Source> && !GenericReaderCallback<F>)
+			item = source.view(dt.item_size);
+		else {
+			// generic callbacks take ownership of the buffer
+			buffer.assign(dt.item_size, 0);
+			item = u8_const_span(buffer.data(), source.read(buffer, dt.item_size));
+		}
+		size_t bytes_read = item.size();
+		if (bytes_read != dt.item_size) {
+			// EOF -> nothing more to read, w'ere in a good state
+			if (bytes_read == 0 && source.eof())
+				break;
+			else {
+				// there was some failure while reading. this might also be set
+				// when trying to read more bytes than available
+				// TODO: determine when this might happen
+				bool failed = false;
+				if constexpr (requires { source.fail(); })
+					failed = source.fail();
+				if (failed)
+					res = result::error_file_read_failed;
+
+				// the file is truncated, there were not enough bytes for
+				// another item.
+				else
+					res = result::error_file_truncated;
+
+				break;
+			}
+		}
+
+		// select the right callback variant. if the callback returns false, the
+		// user wants an early exit
+		if constexpr (GenericReaderCallback<F>) {
+			if (!data_callback(dt, shape, order, i, std::move(buffer)))
+				break;
+		}
+		else if constexpr (TypedReaderCallbackFlat<T, F>) {
+			// when the callback returns false, the user wants an early exit
+			T value;
+			std::memcpy(&value, item.data(), sizeof(T));
+			if (!data_callback(i, value))
+				break;
+		}
+		else if constexpr (TypedReaderCallbackMulti<T, F>) {
+			// when the callback returns false, the user wants an early exit
+			u64_vector multi_index = unravel_index(i, shape, order);
+			T value;
+			std::memcpy(&value, item.data(), sizeof(T));
+			if (!data_callback(multi_index, value))
+				break;
+		}
+		else {
+			static_assert(GenericReaderCallback<F> || TypedReaderCallback<T, F>,
+						  "The provided function does not satisfy any of the required concepts.");
+		}
+	}
+	return res;
+}
+
+
+template <typename T, typename F, typename G>
+result
+from_npy_callback_fd(int fd, G array_properties_callback, F data_callback, npyfile *npy = nullptr)
+{
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+
+	// see open_npy
+	if (is_zip_file(fd))
+		return result::error_wrong_filetype;
+
+	// read the file in chunks instead of item by item
+	auto file = fd_reader(fd, static_cast<u64>(st.st_size));
+	auto source = buffered_reader(file);
+	return from_npy_callback_source<T, F, G>(source, std::forward<G>(array_properties_callback), std::forward<F>(data_callback), npy);
+}
+
+
+template <typename T, typename F, typename G>
+result
+from_npy_callback(std::filesystem::path filepath, G array_properties_callback, F data_callback, npyfile *npy = nullptr)
+{
+	// try to open the file
+	result res = result::ok;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok) return res;
+
+	res = from_npy_callback_fd<T, F, G>(fd, std::forward<G>(array_properties_callback), std::forward<F>(data_callback), npy);
+	::close(fd);
+	return res;
+}
+
+template <typename F> requires GenericReaderCallback<F>
+result
+from_npy(std::filesystem::path filepath, F callback, npyfile *npy = nullptr)
+{
+	return from_npy_callback<void>(
+		std::move(filepath),
+		nullptr,
+		std::forward<F>(callback),
+		npy);
+}
+
+
+template <typename T, typename F> requires TypedReaderCallback<T, F>
+result
+from_npy(std::filesystem::path filepath, F callback, npyfile *npy = nullptr)
+{
+	return from_npy_callback<T, F>(
+		std::move(filepath),
+		nullptr,
+		std::forward<F>(callback),
+		npy);
+}
+
+
+template <typename T, typename G, typename F>
+requires ArrayPropertiesCallback<G> && TypedReaderCallback<T, F>
+result
+from_npy(std::filesystem::path filepath, G array_properties_callback, F data_callback, npyfile *npy = nullptr)
+{
+	return from_npy_callback<T, F, G>(
+		std::move(filepath),
+		std::forward<G>(array_properties_callback),
+		std::forward<F>(data_callback),
+		npy);
+}
+
+
+
+
+//
+// helpers to extract the type from the variant. If you're sure about the file
+// type (npz / npy), it's recommended to directly use the from_* functions
+//
+inline result  get_result(variant_result   &res) { return std::get<result>(std::forward<variant_result>(res));  }
+inline result  get_result(variant_result  &&res) { return std::get<result>(std::forward<variant_result>(res));  }
+inline ndarray get_ndarray(variant_result  &res) { return std::get<ndarray>(std::forward<variant_result>(res)); }
+inline ndarray get_ndarray(variant_result &&res) { return std::get<ndarray>(std::forward<variant_result>(res)); }
+inline npzfile get_npzfile(variant_result  &res) { return std::get<npzfile>(std::forward<variant_result>(res)); }
+inline npzfile get_npzfile(variant_result &&res) { return std::get<npzfile>(std::forward<variant_result>(res)); }
+
+
+/*
+ * load_fd - high level API which tries to load whatever file descriptor is given
+ *
+ * The file is stat'ed once, and the bytes that were read to determine the file
+ * type are not read again: npy files are read into a buffer of the size of the
+ * file that starts with these bytes, and npz files are passed to the zip
+ * backend together with their size. The file descriptor remains owned by the
+ * caller.
+ */
+inline variant_result
+load_fd(int fd)
+{
+	result res;
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+
+	u8_vector buffer;
+	if (S_ISREG(st.st_mode)) {
+		const size_t size = static_cast<size_t>(st.st_size);
+		std::array<u8, 4> magic;
+		const size_t n = std::min(magic.size(), size);
+		if (read_all(fd, magic.data(), n, 0) != n)
+			return result::error_file_read_failed;
+
+		// return the full npz if this is an archive, so that users can work
+		// with the result similar to what they would get from numpy.load
+		if (is_zip_file(u8_const_span(magic.data(), n))) {
+			npzfile npz;
+			if ((res = from_zip_archive(fd, static_cast<u64>(size), npz), is_error(res)))
+				return res;
+			return npz;
+		}
+
+		buffer.resize(size);
+		std::copy_n(magic.begin(), n, buffer.begin());
+		if (read_all(fd, buffer.data() + n, size - n, n) != size - n)
+			return result::error_file_read_failed;
+	}
+	else {
+		// archives cannot be read from pipes or sockets
+		if ((res = read_fd(fd, buffer)) != result::ok)
+			return res;
+		if (is_zip_file(u8_const_span(buffer)))
+			return result::error_unavailable;
+	}
+
+	// users are usually only interested in the array when loading from .npy
+	ndarray arr;
+	npyfile npy;
+	if ((res = from_buffer(std::move(buffer), npy, arr), is_error(res))) {
+		// in case the magic string is invalid, then this is not a numpy file
+		if (res == result::error_magic_string_invalid)
+			return result::error_unsupported_file_format;
+		else
+			// something else happened
+			return res;
+	}
+	return arr;
+}
+
+
+/*
+ * load - high level API which tries to load whatever file is given
+ *
+ * In case the file cannot be loaded, i.e. it's not an npz or npy file, the
+ * variant will hold a corresponding error code. The file is opened exactly
+ * once, see load_fd.
+ *
+ * TODO: memory-mapped variant, which then moves the file descriptor *into* the
+ *       array (this way the array will be backed by the memory mapped data,
+ *       similar to numpy.memmap)
+ */
+inline variant_result
+load(std::filesystem::path filepath)
+{
+	// open the file
+	result res;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok)
+		return res;
+
+	// zip backends which cannot read from a file descriptor open the file
+	// themselves
+	if (!zip::get_backend_interface().open_fd && is_zip_file(fd)) {
+		::close(fd);
+		npzfile npz;
+		if ((res = from_zip_archive(filepath, npz), is_error(res)))
+			return res;
+		return npz;
+	}
+
+	variant_result v = load_fd(fd);
+	::close(fd);
+	return v;
+}
+
+
+/*
+ * to_npy_header - construct the header of an npy file
+ *
+ * The header is padded such that the array data, which follows the header,
+ * starts at a multiple of 64 bytes.
+ */
+inline result
+to_npy_header(const dtype &dt, const u64_vector &shape, storage_order order, u8_vector &buffer)
+{
+	// initialize default header structure
+	buffer = {
+		// magic string
+		0x93, 'N', 'U', 'M', 'P', 'Y',
+		// version (2.0)
+		0x02, 0x00,
+		// space for header size (version 2.0 -> 4 bytes)
+		0x00, 0x00, 0x00, 0x00
+	};
+
+	// write the header string
+	std::ostringstream s;
+	serialize_type_description(s, dt, shape, order);
+	std::string typedescr = s.str();
+	std::copy(typedescr.begin(), typedescr.end(), std::back_inserter(buffer));
+
+	// the entire header must be divisible by 64 -> find next bigger. Common
+	// formula is simply (((N + divisor - 1) / divisor) * divisor), where
+	// divisor = 64.  However, we need to adapt for +1 for the trailing \n that
+	// terminates the header
+	size_t bufsize = buffer.size();
+	size_t total_header_length = ((bufsize + 64) / 64) * 64;
+
+	// fill white whitespace (0x20) and trailing \n
+	buffer.resize(total_header_length);
+	std::fill(buffer.begin() + bufsize, buffer.end() - 1, 0x20);
+	buffer[buffer.size() - 1] = '\n';
+
+	// write the header length (in little endian). Note that the eader length
+	// itself is the length without magic string, size, and version bytes and
+	// not the total header length!
+	size_t header_length = total_header_length
+		- ncr::numpy::npyfile::magic_byte_count
+		- ncr::numpy::npyfile::version_byte_count
+		- 4; // four bytes for the header size (version 2.0 file)
+
+	// do we need to byteswap the header length?
+	u8 *buf_hlen = buffer.data() + ncr::numpy::npyfile::magic_byte_count + ncr::numpy::npyfile::version_byte_count;
+	if constexpr (std::endian::native == std::endian::big) {
+		u32 swapped_length = ncr::bswap<u32>(header_length);
+		std::memcpy(buf_hlen, &swapped_length, sizeof(u32));
+	}
+	else
+		std::memcpy(buf_hlen, &header_length, sizeof(u32));
+
+	return result::ok;
+}
+
+
+/*
+ * to_npy_buffer - construct a npy file compatible buffer from ndarray
+ */
+inline result
+to_npy_buffer(const ndarray &arr, u8_vector &buffer)
+{
+	result res;
+	if ((res = to_npy_header(arr.dtype(), arr.shape(), arr.order(), buffer)) != result::ok)
+		return res;
+
+	// copy the rest of the array
+	const u8_vector &payload = arr.data();
+	buffer.insert(buffer.end(), payload.begin(), payload.end());
+
+	return result::ok;
+}
+
+
+/*
+ * save_fd - write an ndarray as npy file to an opened file descriptor
+ *
+ * The header and the array data are written at the current position of the
+ * file descriptor, which can thus also be a pipe or a socket. The array data is
+ * not copied into an intermediate buffer. The file descriptor remains owned by
+ * the caller.
+ */
+inline result
+save_fd(int fd, const ndarray &arr)
+{
+	result res;
+	u8_vector header;
+	if ((res = to_npy_header(arr.dtype(), arr.shape(), arr.order(), header)) != result::ok)
+		return res;
+
+	const u8_vector &payload = arr.data();
+	struct iovec iov[2] = {
+		{header.data(), header.size()},
+		{const_cast<u8*>(payload.data()), payload.size()}
+	};
+	if (!write_all(fd, iov, 2))
+		return result::error_file_write_failed;
+	return result::ok;
+}
+
+
+inline result
+save(std::filesystem::path filepath, const ndarray &arr, bool overwrite=false)
+{
+	// O_EXCL makes the test if the file exists part of opening it
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	if (!overwrite)
+		flags |= O_EXCL;
+
+	int fd;
+	if ((fd = ::open(filepath.c_str(), flags, 0666)) < 0)
+		return (errno == EEXIST) ? result::error_file_exists : result::error_file_open_failed;
+
+	result res = save_fd(fd, arr);
+	if (::close(fd) != 0 && res == result::ok)
+		res = result::error_file_close;
+	return res;
+}
+
+
+/*
+ * npy_writer - write many arrays of the same type and shape as npy files
+ *
+ * The writer is bound to a dtype, shape, and storage order, and constructs the
+ * npy header only once. Afterwards, each write checks that the array matches
+ * and passes the header and the array data to a single vectored write. With
+ * save_in_place, existing files of the right size are overwritten without
+ * truncating them first, which avoids that the file system releases and
+ * reallocates their blocks, e.g. for checkpoints that are written periodically.
+ *
+ * Example:
+ *
+ *     numpy::npy_writer writer;
+ *     if (writer.bind(weights) != numpy::result::ok)
+ *         return;
+ *     for (size_t step = 0; step < n_steps; step++) {
+ *         train(weights);
+ *         writer.save_in_place("weights.npy", weights);
+ *     }
+ */
+struct npy_writer
+{
+	/*
+	 * bind - bind the writer to a data type, shape, and storage order
+	 */
+	result
+	bind(const dtype &dt, const u64_vector &shape, storage_order order = storage_order::row_major)
+	{
+		result res;
+		_bound = false;
+		if ((res = to_npy_header(dt, shape, order, _header)) != result::ok)
+			return res;
+
+		_dt = dt;
+		_shape = shape;
+		_order = order;
+		_data_size = dt.item_size;
+		for (auto s: shape)
+			_data_size *= s;
+		_bound = true;
+		return result::ok;
+	}
+
+
+	/*
+	 * bind - bind the writer to the data type, shape, and storage order of an array
+	 */
+	result
+	bind(const ndarray &arr)
+	{
+		return bind(arr.dtype(), arr.shape(), arr.order());
+	}
+
+
+	/*
+	 * write_fd - write an array as npy file to an opened file descriptor
+	 *
+	 * Like save_fd, the array is written at the current position of the file
+	 * descriptor, which remains owned by the caller.
+	 */
+	result
+	write_fd(int fd, const ndarray &arr) const
+	{
+		result res;
+		if ((res = check(arr)) != result::ok)
+			return res;
+		return write_fd(fd, u8_const_span(arr.data()));
+	}
+
+
+	/*
+	 * write_fd - write array data, which is not wrapped in an ndarray, as npy file
+	 *
+	 * The data needs to be laid out according to the dtype, shape, and storage
+	 * order that the writer is bound to.
+	 */
+	result
+	write_fd(int fd, u8_const_span data) const
+	{
+		if (!_bound)
+			return result::error_unavailable;
+		if (data.size() != _data_size)
+			return result::error_data_size_mismatch;
+
+		struct iovec iov[2] = {
+			{const_cast<u8*>(_header.data()), _header.size()},
+			{const_cast<u8*>(data.data()),    data.size()}
+		};
+		if (!write_all(fd, iov, 2))
+			return result::error_file_write_failed;
+		return result::ok;
+	}
+
+
+	/*
+	 * save - write an array as npy file, see save()
+	 */
+	result
+	save(std::filesystem::path filepath, const ndarray &arr, bool overwrite=false) const
+	{
+		result res;
+		if ((res = check(arr)) != result::ok)
+			return res;
+
+		int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+		if (!overwrite)
+			flags |= O_EXCL;
+
+		int fd;
+		if ((fd = ::open(filepath.c_str(), flags, 0666)) < 0)
+			return (errno == EEXIST) ? result::error_file_exists : result::error_file_open_failed;
+
+		res = write_fd(fd, u8_const_span(arr.data()));
+		if (::close(fd) != 0 && res == result::ok)
+			res = result::error_file_close;
+		return res;
+	}
+
+
+	/*
+	 * save_in_place - overwrite a file with an array without truncating it
+	 *
+	 * The file is created if it does not exist. Files of a different size than
+	 * the npy file are resized, so that stale data never remains at the end.
+	 */
+	result
+	save_in_place(std::filesystem::path filepath, const ndarray &arr) const
+	{
+		result res;
+		if ((res = check(arr)) != result::ok)
+			return res;
+
+		int fd;
+		if ((fd = ::open(filepath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666)) < 0)
+			return result::error_file_open_failed;
+
+		struct stat st;
+		const u64 file_size = _header.size() + _data_size;
+		if (::fstat(fd, &st) != 0 ||
+		    (static_cast<u64>(st.st_size) != file_size && ::ftruncate(fd, static_cast<off_t>(file_size)) != 0))
+			res = result::error_file_write_failed;
+		else
+			res = write_fd(fd, u8_const_span(arr.data()));
+
+		if (::close(fd) != 0 && res == result::ok)
+			res = result::error_file_close;
+		return res;
+	}
+
+
+	/*
+	 * check - test if an array matches what the writer is bound to
+	 */
+	result
+	check(const ndarray &arr) const
+	{
+		if (!_bound)
+			return result::error_unavailable;
+		if (arr.order() != _order)
+			return result::error_schema_mismatch | result::error_schema_order_mismatch;
+		if (arr.shape() != _shape)
+			return result::error_schema_mismatch | result::error_schema_shape_mismatch;
+		if (!is_same_dtype(arr.dtype(), _dt))
+			return result::error_schema_mismatch | result::error_schema_dtype_mismatch;
+		return result::ok;
+	}
+
+
+	/*
+	 * header - the precomputed npy header
+	 */
+	const u8_vector &
+	header() const
+	{
+		return _header;
+	}
+
+private:
+	bool
+		_bound                      {false};
+
+	u8_vector
+		_header;
+
+	dtype
+		_dt;
+
+	u64_vector
+		_shape;
+
+	storage_order
+		_order                      {storage_order::row_major};
+
+	u64
+		_data_size                  {0};
+};
+
+
+/*
+ * savez_arg - helper object to capture arguments to savez* and save_npz
+ */
+struct savez_arg
+{
+	std::string name;
+	ndarray&    array;
+
+	// per array overrides of whether to compress the array, and of the
+	// compression level. Arrays with an explicit compress are not subject to
+	// adaptive compression
+	std::optional<bool> compress          {};
+	std::optional<u32>  compression_level {};
+};
+
+
+/*
+ * adaptive_compression - store arrays which do not compress well uncompressed
+ *
+ * Before compressing an array, a sample of n_blocks evenly spaced blocks of
+ * its payload (of sample_size bytes in total) is compressed. If the sample
+ * does not shrink to at most max_ratio of its size, the array is stored
+ * uncompressed. This requires zlib.
+ */
+struct adaptive_compression
+{
+	bool
+		enabled                     {false};
+
+	double
+		max_ratio                   {0.9};
+
+	u64
+		sample_size                 {256 << 10},
+		n_blocks                    {8};
+};
+
+
+/*
+ * estimate_compression_ratio - estimate how well a payload compresses
+ *
+ * Returns the ratio of compressed to uncompressed size of a sample of the
+ * payload, or 0 if the estimate is not available.
+ */
+inline double
+estimate_compression_ratio(const u8 *data, u64 size, u32 compression_level, const adaptive_compression &opts)
+{
+#ifdef NCR_NUMPY_HAS_ZLIB
+	if (size == 0 || opts.n_blocks == 0)
+		return 0.0;
+
+	const u64 sample_size = std::min(size, opts.sample_size);
+	const u64 n_blocks    = std::min(opts.n_blocks, std::max<u64>(1, sample_size));
+	const u64 block_size  = sample_size / n_blocks;
+	const u64 stride      = n_blocks > 1 ? (size - block_size) / (n_blocks - 1) : 0;
+
+	// 0 is the default compression level, see zip::backend_interface::write
+	const int level = compression_level == 0 ? Z_DEFAULT_COMPRESSION : static_cast<int>(std::min(compression_level, 9u));
+	z_stream zs {};
+	if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0.0;
+
+	u8_vector out(deflateBound(&zs, static_cast<uLong>(block_size)));
+	u64 total_in = 0, total_out = 0;
+	for (u64 i = 0; i < n_blocks; i++) {
+		deflateReset(&zs);
+		zs.next_in   = const_cast<u8*>(data + i * stride);
+		zs.avail_in  = static_cast<uInt>(block_size);
+		zs.next_out  = out.data();
+		zs.avail_out = static_cast<uInt>(out.size());
+		if (::deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+			deflateEnd(&zs);
+			return 0.0;
+		}
+		total_in  += block_size;
+		total_out += zs.total_out;
+	}
+	deflateEnd(&zs);
+	return total_in ? static_cast<double>(total_out) / static_cast<double>(total_in) : 0.0;
+#else
+	(void)data; (void)size; (void)compression_level; (void)opts;
+	return 0.0;
+#endif
+}
+
+
+/*
+ * select_compression - decide how to write an array to an npz file
+ *
+ * buffer is the npy representation of arg.array.
+ */
+inline void
+select_compression(const savez_arg &arg, const u8_vector &buffer, bool compress, u32 compression_level, const adaptive_compression &adaptive, bool &member_compress, u32 &member_level)
+{
+	member_compress = arg.compress.value_or(compress);
+	member_level    = arg.compression_level.value_or(compression_level);
+	if (!member_compress || !adaptive.enabled || arg.compress.has_value())
+		return;
+
+	const u64 payload_size = arg.array.data().size();
+	const u8 *payload      = buffer.data() + (buffer.size() - payload_size);
+	const double ratio     = estimate_compression_ratio(payload, payload_size, member_level, adaptive);
+	if (ratio > adaptive.max_ratio)
+		member_compress = false;
+}
+
+
+/*
+ * xxhash64 - 64bit xxHash (XXH64) of a buffer
+ */
+inline u64
+xxhash64(const u8 *data, size_t size, u64 seed = 0)
+{
+	constexpr u64 p1 = 11400714785074694791ull;
+	constexpr u64 p2 = 14029467366897019727ull;
+	constexpr u64 p3 =  1609587929392839161ull;
+	constexpr u64 p4 =  9650029242287828579ull;
+	constexpr u64 p5 =  2870177450012600261ull;
+
+	// input is read as little endian
+	auto le = [](auto v) {
+		if constexpr (std::endian::native == std::endian::big)
+			return ncr::bswap<decltype(v)>(v);
+		else
+			return v;
+	};
+	auto read64 = [&](const u8 *p) { u64 v; std::memcpy(&v, p, sizeof(v)); return le(v); };
+	auto read32 = [&](const u8 *p) { u32 v; std::memcpy(&v, p, sizeof(v)); return le(v); };
+	auto round  = [](u64 acc, u64 input) { return std::rotl(acc + input * p2, 31) * p1; };
+	auto merge  = [&](u64 acc, u64 v) { return (acc ^ round(0, v)) * p1 + p4; };
+
+	const u8 *p   = data;
+	const u8 *end = data + size;
+	u64 h;
+	if (size >= 32) {
+		u64 v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+		for (; p + 32 <= end; p += 32) {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+		h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+	}
+	else
+		h = seed + p5;
+
+	h += size;
+	for (; p + 8 <= end; p += 8)
+		h = std::rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
+	if (p + 4 <= end) {
+		h = std::rotl(h ^ (static_cast<u64>(read32(p)) * p1), 23) * p2 + p3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		h = std::rotl(h ^ (static_cast<u64>(*p) * p5), 11) * p1;
+
+	h ^= h >> 33;
+	h *= p2;
+	h ^= h >> 29;
+	h *= p3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+// payloads are hashed in chunks of this size, which can be hashed concurrently
+constexpr size_t content_hash_chunk_size = 1 << 20;
+
+
+/*
+ * content_hashes - hash the npy representation of several arrays
+ *
+ * The hash of an array covers its npy header and its payload. The payloads
+ * are split into chunks of content_hash_chunk_size bytes, which are hashed by
+ * n_threads threads concurrently (or the number of hardware threads if
+ * n_threads is 0). The hashes do not depend on the number of threads.
+ */
+inline result
+content_hashes(const std::vector<savez_arg> &args, u64_vector &hashes, unsigned n_threads=0)
+{
+	// chunk hashes of all arrays, prefixed by the hash of the header and the
+	// size of the payload
+	std::vector<u64_vector> parts(args.size());
+	std::vector<std::pair<size_t, size_t>> jobs;
+	for (size_t i = 0; i < args.size(); i++) {
+		result res;
+		u8_vector header;
+		if ((res = to_npy_header(args[i].array.dtype(), args[i].array.shape(), args[i].array.order(), header)) != result::ok)
+			return res;
+
+		const u64 size = args[i].array.data().size();
+		const size_t n_chunks = (size + content_hash_chunk_size - 1) / content_hash_chunk_size;
+		parts[i].resize(2 + n_chunks);
+		parts[i][0] = xxhash64(header.data(), header.size());
+		parts[i][1] = size;
+		for (size_t j = 0; j < n_chunks; j++)
+			jobs.emplace_back(i, j);
+	}
+
+	if (n_threads == 0)
+		n_threads = std::max(1u, std::thread::hardware_concurrency());
+	n_threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(n_threads, jobs.size())));
+
+	std::atomic<size_t> next_job {0};
+	auto worker = [&]() {
+		for (size_t k; (k = next_job.fetch_add(1)) < jobs.size(); ) {
+			auto [i, j] = jobs[k];
+			const u8_vector &data = args[i].array.data();
+			const size_t offset = j * content_hash_chunk_size;
+			parts[i][2 + j] = xxhash64(data.data() + offset, std::min(content_hash_chunk_size, data.size() - offset));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < n_threads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t: threads)
+		t.join();
+
+	hashes.resize(args.size());
+	for (size_t i = 0; i < args.size(); i++) {
+		if constexpr (std::endian::native == std::endian::big)
+			for (auto &part: parts[i])
+				part = ncr::bswap<u64>(part);
+		hashes[i] = xxhash64(reinterpret_cast<const u8*>(parts[i].data()), parts[i].size() * sizeof(u64));
+	}
+	return result::ok;
+}
+
+
+/*
+ * equal_npy_content - test if two arrays have the same npy representation
+ */
+inline bool
+equal_npy_content(const ndarray &a, const ndarray &b)
+{
+	if (&a == &b)
+		return true;
+	u8_vector header_a, header_b;
+	if (to_npy_header(a.dtype(), a.shape(), a.order(), header_a) != result::ok ||
+	    to_npy_header(b.dtype(), b.shape(), b.order(), header_b) != result::ok)
+		return false;
+	return header_a == header_b && a.data() == b.data();
+}
+
+
+/*
+ * save_npz - save arrays to an npz file
+ *
+ * With deduplicate, arrays with identical content (e.g. tied weights or
+ * aliases) are serialized and compressed only once, and duplicates copy the
+ * compressed data. This saves the time to compress duplicates, but not space:
+ * each array is still a regular file with its own copy of the data within the
+ * archive, because zip readers (including numpy) expect this. Deduplication
+ * requires a zip backend that supports zip::backend_interface::duplicate,
+ * which currently is the zlib backend. Other backends fail with
+ * error_unavailable before anything is written.
+ */
+inline result
+to_zip_archive(std::filesystem::path filepath, std::vector<savez_arg> args, bool compress, bool overwrite=false, u32 compression_level=0, bool deduplicate=false, adaptive_compression adaptive={})
+{
+	namespace fs = std::filesystem;
+
+	// detect if there are any name clashes
+	std::unordered_set<std::string> _set;
+	for (auto &arg: args) {
+		if (_set.contains(arg.name))
+			return result::error_duplicate_array_name;
+		_set.insert(arg.name);
+	}
+
+	// test if the file exists
+	if (fs::exists(filepath) && !overwrite)
+		return result::error_file_exists;
+
+	zip::backend_state *zip_state        = nullptr;
+	zip::backend_interface zip_interface = zip::get_backend_interface();
+
+	// hash collisions are ruled out by comparing the arrays
+	u64_vector hashes;
+	std::unordered_map<u64, size_t> first_of_hash;
+	if (deduplicate && zip_interface.duplicate == nullptr)
+		return result::error_unavailable;
+	if (deduplicate && content_hashes(args, hashes) != result::ok)
+		deduplicate = false;
+
+	zip_interface.make(&zip_state);
+	if (zip_interface.open(zip_state, filepath, zip::filemode::write) != zip::result::ok) {
+		zip_interface.release(&zip_state);
+		return result::error_file_open_failed;
+	}
+
+	// write all arrays. append .npy to each argument name
+	for (size_t i = 0; i < args.size(); i++) {
+		auto &arg = args[i];
+		std::string name = arg.name + ".npy";
+
+		if (deduplicate) {
+			auto [it, inserted] = first_of_hash.try_emplace(hashes[i], i);
+			if (!inserted && equal_npy_content(args[it->second].array, arg.array)) {
+				if (zip_interface.duplicate(zip_state, args[it->second].name + ".npy", name) != zip::result::ok) {
+					zip_interface.release(&zip_state);
+					return result::error_file_write_failed;
+				}
+				continue;
+			}
+		}
+
+		bool member_compress;
+		u32 member_level;
+		u8_vector buffer;
+		to_npy_buffer(arg.array, buffer);
+		select_compression(arg, buffer, compress, compression_level, adaptive, member_compress, member_level);
+		if (zip_interface.write(zip_state, name, std::move(buffer), member_compress, member_level) != zip::result::ok) {
+			zip_interface.release(&zip_state);
+			return result::error_file_write_failed;
+		}
+	}
+
+	if (zip_interface.close(zip_state) != zip::result::ok) {
+		zip_interface.release(&zip_state);
+		return result::error_file_close;
+	}
+
+	zip_interface.release(&zip_state);
+	return result::ok;
+}
+
+
+/*
+ * savez - save name/array pairs to an uncompressed npz file
+ */
+inline result
+savez(std::filesystem::path filepath, std::vector<savez_arg> args, bool overwrite=false, bool deduplicate=false)
+{
+	return to_zip_archive(filepath, std::forward<decltype(args)>(args), false, overwrite, 0, deduplicate);
+}
+
+
+/*
+ * savez_compressed - save to compressed npz file
+ *
+ * With adaptive compression, arrays which barely compress (e.g. noise) are
+ * stored uncompressed, see adaptive_compression.
+ */
+inline result
+savez_compressed(std::filesystem::path filepath, std::vector<savez_arg> args, bool overwrite=false, u32 compression_level = 0, bool deduplicate=false, adaptive_compression adaptive={})
+{
+	return to_zip_archive(filepath, std::forward<decltype(args)>(args), true, overwrite, compression_level, deduplicate, adaptive);
+}
+
+
+/*
+ * name_conflict - policy for array names that already exist in an archive
+ */
+enum class name_conflict : u8
+{
+	// fail with error_duplicate_array_name before modifying the archive
+	error,
+
+	// replace the existing array with the new one
+	replace,
+
+	// keep the existing array and do not write the new one
+	skip
+};
+
+
+// defined in numpy_merge below
+inline result compact_npz(const std::filesystem::path &filepath);
+
+
+/*
+ * append_to_zip_archive - add arrays to an existing npz file
+ *
+ * The archive is created if it does not exist. Whether existing files of the
+ * archive are rewritten depends on the zip backend. The zlib backend only
+ * rewrites the central directory of the archive, whereas libzip copies the
+ * entire archive.
+ *
+ * Appending in place leaves the previous central directory, and the data of
+ * replaced arrays, in the archive as unreferenced bytes. Archives thus grow
+ * with every append. Once the (estimated) unreferenced bytes exceed
+ * compact_threshold of the size of the archive, the archive is rewritten with
+ * compact_npz. A threshold of 1 or more disables compaction.
+ */
+inline result
+append_to_zip_archive(std::filesystem::path filepath, std::vector<savez_arg> args, bool compress, name_conflict policy = name_conflict::error, u32 compression_level=0, f64 compact_threshold = 0.5)
+{
+	// detect if there are any name clashes within the arguments
+	std::unordered_set<std::string> _set;
+	for (auto &arg: args) {
+		if (_set.contains(arg.name))
+			return result::error_duplicate_array_name;
+		_set.insert(arg.name);
+	}
+
+	zip::backend_state *zip_state        = nullptr;
+	zip::backend_interface zip_interface = zip::get_backend_interface();
+
+	zip_interface.make(&zip_state);
+	if (zip_interface.open(zip_state, filepath, zip::filemode::append) != zip::result::ok) {
+		zip_interface.release(&zip_state);
+		return result::error_file_open_failed;
+	}
+
+	std::vector<std::string> file_list;
+	if (zip_interface.get_file_list(zip_state, file_list) != zip::result::ok) {
+		zip_interface.close(zip_state);
+		zip_interface.release(&zip_state);
+		return result::error_file_read_failed;
+	}
+	std::unordered_set<std::string> existing(file_list.begin(), file_list.end());
+
+	// check for conflicts before anything is written
+	for (auto &arg: args) {
+		if (!existing.contains(arg.name + ".npy"))
+			continue;
+		if (policy == name_conflict::error || (policy == name_conflict::replace && zip_interface.remove == nullptr)) {
+			zip_interface.close(zip_state);
+			zip_interface.release(&zip_state);
+			return policy == name_conflict::error ? result::error_duplicate_array_name : result::error_unavailable;
+		}
+	}
+
+	for (auto &arg: args) {
+		std::string name = arg.name + ".npy";
+		if (existing.contains(name)) {
+			if (policy == name_conflict::skip)
+				continue;
+			if (zip_interface.remove(zip_state, name) != zip::result::ok) {
+				zip_interface.release(&zip_state);
+				return result::error_file_write_failed;
+			}
+		}
+
+		bool member_compress;
+		u32 member_level;
+		u8_vector buffer;
+		to_npy_buffer(arg.array, buffer);
+		select_compression(arg, buffer, compress, compression_level, {}, member_compress, member_level);
+		if (zip_interface.write(zip_state, name, std::move(buffer), member_compress, member_level) != zip::result::ok) {
+			zip_interface.release(&zip_state);
+			return result::error_file_write_failed;
+		}
+	}
+
+	// bytes that are referenced by the new central directory. the sizes of
+	// headers and extra fields are estimated generously, which errs on the
+	// side of not compacting
+	u64 referenced = 0;
+	bool estimated = compact_threshold < 1.0 && zip_interface.stat != nullptr;
+	if (estimated) {
+		file_list.clear();
+		estimated = zip_interface.get_file_list(zip_state, file_list) == zip::result::ok;
+		for (size_t i = 0; estimated && i < file_list.size(); i++) {
+			zip::file_stat st;
+			estimated = zip_interface.stat(zip_state, file_list[i], st) == zip::result::ok;
+			referenced += st.compressed_size + 2 * file_list[i].size() + 160;
+		}
+		referenced += 128;
+	}
+
+	if (zip_interface.close(zip_state) != zip::result::ok) {
+		zip_interface.release(&zip_state);
+		return result::error_file_close;
+	}
+	zip_interface.release(&zip_state);
+
+	std::error_code ec;
+	u64 size = estimated ? std::filesystem::file_size(filepath, ec) : 0;
+	if (estimated && !ec && size > referenced && static_cast<f64>(size - referenced) > compact_threshold * static_cast<f64>(size))
+		return compact_npz(filepath);
+	return result::ok;
+}
+
+
+/*
+ * savez_append - add name/array pairs to an uncompressed npz file
+ *
+ * See append_to_zip_archive for compact_threshold.
+ */
+inline result
+savez_append(std::filesystem::path filepath, std::vector<savez_arg> args, name_conflict policy = name_conflict::error, f64 compact_threshold = 0.5)
+{
+	return append_to_zip_archive(filepath, std::move(args), false, policy, 0, compact_threshold);
+}
+
+
+/*
+ * savez_compressed_append - add name/array pairs to a compressed npz file
+ *
+ * See append_to_zip_archive for compact_threshold.
+ */
+inline result
+savez_compressed_append(std::filesystem::path filepath, std::vector<savez_arg> args, name_conflict policy = name_conflict::error, u32 compression_level = 0, f64 compact_threshold = 0.5)
+{
+	return append_to_zip_archive(filepath, std::move(args), true, policy, compression_level, compact_threshold);
+}
+
+
+/*
+ * savez - save unamed arrays to an uncompressed npz file
+ *
+ * Note that the arrays will receive a name of the format arr_i, where i is the
+ * position in the args vector
+ */
+inline result
+savez(std::filesystem::path filepath, std::vector<std::reference_wrapper<ndarray>> args, bool overwrite=false)
+{
+	std::vector<savez_arg> _args;
+	size_t i = 0;
+	for (auto &arg: args)
+		_args.push_back({std::string("arr_") + std::to_string(i++), arg});
+	return to_zip_archive(filepath, std::move(_args), false, overwrite);
+}
+
+
+/*
+ * savez_compressed - save unamed arrays to a compressed npz file
+ *
+ * Note that the arrays will receive a name of the format arr_i, where i is the
+ * position in the args vector
+ */
+inline result
+savez_compressed(std::filesystem::path filepath, std::vector<std::reference_wrapper<ndarray>> args, bool overwrite=false, u32 compression_level=0)
+{
+	std::vector<savez_arg> _args;
+	size_t i = 0;
+	for (auto &arg: args)
+		_args.push_back({std::string("arr_") + std::to_string(i++), arg});
+	return to_zip_archive(filepath, std::move(_args), true, overwrite, compression_level);
+}
+
+
+
+
+
+}} // ncr::numpy
+
+
+#endif /* _9750a253a01642ea81d4721d4c92ad7c_ */
+
+/*
+ * ncr/numpy_mmap.hpp - memory mapped numpy arrays
+ *
+ */
+#ifndef _4f0c2d7e9a3b4c55b1e86d2a7f93c0e1_
+#define _4f0c2d7e9a3b4c55b1e86d2a7f93c0e1_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * mapped_region - read-only memory mapping of a file
+ *
+ * The mapping is released when the region is destroyed. Regions are usually
+ * held via a shared_ptr, so that all arrays which point into the same mapping
+ * keep it alive.
+ */
+struct mapped_region
+{
+	mapped_region() {}
+	mapped_region(const mapped_region &) = delete;
+	mapped_region& operator=(const mapped_region &) = delete;
+
+	~mapped_region()
+	{
+		if (ptr != nullptr)
+			munmap(ptr, size);
+	}
+
+	// base pointer of the mapping
+	void*
+		ptr                         {nullptr};
+
+	// size of the mapping in bytes
+	u64
+		size                        {0};
+
+	u8_const_span span() const { return u8_const_span(static_cast<const u8*>(ptr), size); }
+};
+
+
+/*
+ * mmap_reader - span_reader which keeps a mapped region alive
+ */
+struct mmap_reader : span_reader
+{
+	mmap_reader(std::shared_ptr<const mapped_region> region) : span_reader(region->span()), _region(std::move(region)) {}
+
+	std::shared_ptr<const mapped_region> _region;
+};
+
+
+/*
+ * map_fd - map a file descriptor read-only into memory
+ *
+ * Note that the file descriptor can be closed after this call, the mapping
+ * stays valid until the region is destroyed.
+ */
+inline result
+map_fd(int fd, std::shared_ptr<const mapped_region> &region)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+	if (st.st_size <= 0)
+		return result::error_file_truncated;
+
+	void *ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED)
+		return result::error_mmap_failed;
+
+	auto r  = std::make_shared<mapped_region>();
+	r->ptr  = ptr;
+	r->size = static_cast<u64>(st.st_size);
+	region  = std::move(r);
+	return result::ok;
+}
+
+
+/*
+ * mmap_ndarray - read-only ndarray that is backed by a memory mapped file
+ *
+ * This is the counterpart to numpy.memmap in read-only mode. The array does not
+ * own its data, but holds a reference to the mapped region in which the data
+ * resides. Copies of an mmap_ndarray share the same mapping, and the mapping
+ * is released once the last array that uses it is destroyed.
+ *
+ * The interface follows ndarray, but only provides read access.
+ */
+struct mmap_ndarray
+{
+	mmap_ndarray() {}
+
+
+	/*
+	 * assign - let the array point to data within a mapped region
+	 */
+	result
+	assign(std::shared_ptr<const mapped_region> region,
+	       u64 data_offset,
+	       struct dtype &&dt,
+	       u64_vector &&shape,
+	       storage_order o = storage_order::row_major)
+	{
+		if (!region || data_offset > region->size)
+			return result::error_invalid_item_offset;
+
+		_dtype  = std::move(dt);
+		_shape  = std::move(shape);
+		_order  = o;
+		_region = std::move(region);
+		_data   = _region->span().subspan(data_offset);
+
+		// see ndarray::_compute_size for the handling of empty shapes
+		bool valid = true;
+		if (_shape.size() > 0)
+			valid = checked_product(_shape, _size);
+		else {
+			_size = _dtype.item_size > 0 ? _data.size() / _dtype.item_size : 0;
+			if (_size > 0)
+				_shape.push_back(_size);
+		}
+
+		// accessing beyond the mapping would be fatal, so we need to
+		// guarantee that all elements are within the mapped region, also if
+		// the shape of a crafted header overflows
+		u64 size;
+		if (!valid || !checked_mul(_size, _dtype.item_size, size) || size > _data.size()) {
+			clear();
+			return result::error_data_size_mismatch;
+		}
+		_data = _data.subspan(0, size);
+
+		compute_strides(_shape, _strides, _order);
+		return result::ok;
+	}
+
+
+	/*
+	 * clear - release the mapping and reset the array
+	 */
+	void
+	clear()
+	{
+		_dtype  = {};
+		_shape.clear();
+		_strides.clear();
+		_size   = 0;
+		_order  = storage_order::row_major;
+		_data   = {};
+		_region.reset();
+	}
+
+
+	/*
+	 * get - get the u8 span in the data buffer for an element
+	 */
+	template <typename ...Indexes>
+	u8_const_span
+	get(Indexes... index) const
+	{
+		assert(_shape.size() == sizeof...(Indexes));
+
+		if (sizeof...(Indexes) > 0) {
+			{
+				size_t i = 0;
+				bool valid_index = ((index >= 0 && (size_t)index < _shape[i++]) && ...);
+				if (!valid_index)
+					throw std::out_of_range("Index out of bounds\n");
+			}
+
+			size_t i = 0;
+			size_t offset = 0;
+			((offset += index * _strides[i], i++), ...);
+			return _data.subspan(_dtype.item_size * offset, _dtype.item_size);
+		}
+		else
+			return u8_const_span();
+	}
+
+
+	/*
+	 * get - get the u8 span in the data buffer for an element
+	 */
+	u8_const_span
+	get(const u64_vector &indexes) const
+	{
+		if (indexes.size() != _shape.size())
+			throw std::out_of_range("Number of indexes does not match number of dimensions\n");
+
+		size_t offset = 0;
+		for (size_t i = 0; i < indexes.size(); i++) {
+			if (indexes[i] >= _shape[i])
+				throw std::out_of_range("Index out of bounds\n");
+			offset += indexes[i] * _strides[i];
+		}
+		return _data.subspan(_dtype.item_size * offset, _dtype.item_size);
+	}
+
+
+	/*
+	 * value - get a copy of the value at a given index
+	 */
+	template <typename T, typename... Indexes>
+	inline T
+	value(Indexes... index) const
+	{
+		if (_dtype.item_size < sizeof(T)) {
+			std::ostringstream s;
+			s << "Template argument type size (" << sizeof(T) << " bytes) exceeds location size (" << _dtype.item_size << " bytes)";
+			throw std::out_of_range(s.str());
+		}
+		T value;
+		std::memcpy(&value, this->get(index...).data(), sizeof(T));
+		return value;
+	}
+
+
+	template <typename T>
+	inline T
+	value(const u64_vector &indexes) const
+	{
+		if (_dtype.item_size < sizeof(T)) {
+			std::ostringstream s;
+			s << "Template argument type size (" << sizeof(T) << " bytes) exceeds location size (" << _dtype.item_size << " bytes)";
+			throw std::out_of_range(s.str());
+		}
+		T value;
+		std::memcpy(&value, this->get(indexes).data(), sizeof(T));
+		return value;
+	}
+
+
+	//
+	// property getters
+	//
+	const struct dtype&  dtype()    const { return _dtype; }
+	storage_order        order()    const { return _order; }
+	const u64_vector&    shape()    const { return _shape; }
+	u8_const_span        data()     const { return _data;  }
+	size_t               size()     const { return _size;  }
+	size_t               bytesize() const { return _data.size(); }
+	bool                 empty()    const { return _region == nullptr; }
+
+	// the region into which this array points
+	const std::shared_ptr<const mapped_region>& region() const { return _region; }
+
+private:
+	struct dtype
+		_dtype;
+
+	u64_vector
+		_shape;
+
+	// number of elements in the array
+	size_t
+		_size  = 0;
+
+	storage_order
+		_order = storage_order::row_major;
+
+	// strides in number of elements (see ndarray::_strides)
+	u64_vector
+		_strides;
+
+	// the memory mapping which contains the array data
+	std::shared_ptr<const mapped_region>
+		_region;
+
+	// data of the array within the mapped region
+	u8_const_span
+		_data;
+};
+
+
+/*
+ * to_ndarray - copy the data of an mmap_ndarray into a (regular) ndarray
+ */
+inline void
+to_ndarray(const mmap_ndarray &src, ndarray &dest)
+{
+	struct dtype dt = src.dtype();
+	u64_vector shape = src.shape();
+	u8_vector buffer(src.data().begin(), src.data().end());
+	dest.assign(std::move(dt), std::move(shape), std::move(buffer), src.order());
+}
+
+
+/*
+ * from_mapped_region - parse the npy header within a mapped region
+ */
+inline result
+from_mapped_region(std::shared_ptr<const mapped_region> region, mmap_ndarray &array, npyfile *npy = nullptr)
+{
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+	npy_ptr->streaming = false;
+	npy_ptr->file_size = region->size;
+
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+
+	result res;
+	auto source = span_reader(region->span());
+	if ((res = process_file_header(source, *npy_ptr, dt, shape, order), is_error(res)))
+		return res;
+
+	result tmp;
+	if ((tmp = array.assign(std::move(region), npy_ptr->data_offset, std::move(dt), std::move(shape), order)) != result::ok)
+		return tmp;
+	return res;
+}
+
+
+/*
+ * from_npy_mmap_fd - memory map an already opened npy file
+ *
+ * The file descriptor remains owned by the caller and can be closed after this
+ * call returns.
+ */
+inline result
+from_npy_mmap_fd(int fd, mmap_ndarray &array, npyfile *npy = nullptr)
+{
+	result res;
+	std::shared_ptr<const mapped_region> region;
+	if ((res = map_fd(fd, region)) != result::ok)
+		return res;
+	return from_mapped_region(std::move(region), array, npy);
+}
+
+
+/*
+ * from_npy_mmap - memory map an npy file
+ *
+ * Only the header of the file is parsed. The array data is paged in by the
+ * operating system when it is accessed.
+ */
+inline result
+from_npy_mmap(std::filesystem::path filepath, mmap_ndarray &array, npyfile *npy = nullptr)
+{
+	result res;
+	int fd;
+	if ((res = open_fd(filepath, fd)) != result::ok)
+		return res;
+
+	res = from_npy_mmap_fd(fd, array, npy);
+	::close(fd);
+	return res;
+}
+
+
+}} // ncr::numpy
+
+#endif /* _4f0c2d7e9a3b4c55b1e86d2a7f93c0e1_ */
+
+/*
+ * ncr/numpy_server.hpp - share memory mapped arrays via unix domain sockets
+ *
+ * The array_server keeps a registry of npy files and npz members. Clients
+ * request arrays by name. The server replies with the already parsed header
+ * and passes a file descriptor to the array data along (via SCM_RIGHTS), which
+ * the client then maps read-only into its own address space. That is, clients
+ * neither parse npy headers nor read any array data themselves.
+ *
+ * The protocol is a simple length-prefixed message protocol, in which all
+ * values are transmitted in host byte order (client and server always run on
+ * the same machine). A request consists of
+ *
+ *     u32 magic, u32 name length, name
+ *
+ * and a response of
+ *
+ *     u32 magic, u64 result, [u64 data offset, u8 order, shape, dtype]
+ *
+ * where the bracketed part is only present if the result is ok.
+ */
+#ifndef _b2e61f0a7c5d4e18a9f3c47d80e5b6a2_
+#define _b2e61f0a7c5d4e18a9f3c47d80e5b6a2_
+
+
+namespace ncr { namespace numpy {
+
+
+// magic value that prefixes each request and response ("NCR1")
+constexpr u32 array_server_protocol_magic = 0x3152434e;
+
+// upper bound for the size of a single message. anything larger is considered
+// a protocol violation
+constexpr u32 array_server_max_message_size = 1 << 20;
+
+// time in milliseconds that a client may take to complete a request or to
+// accept a response. slower clients are disconnected, so that a stalled client
+// cannot hold up any other client
+constexpr int array_server_client_timeout_ms = 5000;
+
+
+/*
+ * wire_buffer - helper to (de)serialize messages of the array server protocol
+ */
+struct wire_buffer
+{
+	u8_vector
+		data;
+
+	size_t
+		pos                         {0};
+
+	template <typename T>
+	requires std::is_arithmetic_v<T>
+	void
+	put(T value)
+	{
+		const u8 *ptr = reinterpret_cast<const u8*>(&value);
+		data.insert(data.end(), ptr, ptr + sizeof(T));
+	}
+
+	void
+	put(const std::string &str)
+	{
+		put<u32>(static_cast<u32>(str.size()));
+		data.insert(data.end(), str.begin(), str.end());
+	}
+
+	template <typename T>
+	requires std::is_arithmetic_v<T>
+	bool
+	get(T &value)
+	{
+		if (pos + sizeof(T) > data.size())
+			return false;
+		std::memcpy(&value, data.data() + pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	bool
+	get(std::string &str)
+	{
+		u32 len;
+		if (!get(len) || pos + len > data.size())
+			return false;
+		str.assign(data.begin() + pos, data.begin() + pos + len);
+		pos += len;
+		return true;
+	}
+};
+
+
+/*
+ * serialize_dtype_binary - write a (possibly nested) dtype to a wire_buffer
+ */
+inline void
+serialize_dtype_binary(wire_buffer &buf, const dtype &dt)
+{
+	buf.put(dt.name);
+	buf.put<u8>(static_cast<u8>(to_char(dt.endianness)));
+	buf.put<u8>(dt.type_code);
+	buf.put<u32>(dt.size);
+	buf.put<u64>(dt.item_size);
+	buf.put<u64>(dt.offset);
+	buf.put<u32>(static_cast<u32>(dt.shape.size()));
+	for (auto s: dt.shape)
+		buf.put<u64>(s);
+	buf.put<u32>(static_cast<u32>(dt.fields.size()));
+	for (auto &field: dt.fields)
+		serialize_dtype_binary(buf, field);
+}
+
+
+/*
+ * deserialize_dtype_binary - read a (possibly nested) dtype from a wire_buffer
+ */
+inline bool
+deserialize_dtype_binary(wire_buffer &buf, dtype &dt, unsigned depth = 0)
+{
+	// structured arrays are rarely nested deeper than a handful of levels. the
+	// limit avoids unbounded recursion on malformed input
+	if (depth > 64)
+		return false;
+
+	u8 endianness;
+	u32 n;
+	if (!buf.get(dt.name)       ||
+	    !buf.get(endianness)    ||
+	    !buf.get(dt.type_code)  ||
+	    !buf.get(dt.size)       ||
+	    !buf.get(dt.item_size)  ||
+	    !buf.get(dt.offset)     ||
+	    !buf.get(n))
+		return false;
+	dt.endianness = to_byte_order(endianness);
+
+	if (n > (buf.data.size() - buf.pos) / sizeof(u64))
+		return false;
+	dt.shape.resize(n);
+	for (auto &s: dt.shape)
+		if (!buf.get(s))
+			return false;
+
+	if (!buf.get(n))
+		return false;
+	for (u32 i = 0; i < n; i++) {
+		dtype field;
+		if (!deserialize_dtype_binary(buf, field, depth + 1))
+			return false;
+		add_field(dt, std::move(field));
+	}
+	return true;
+}
+
+
+/*
+ * frame_message - prefix a message with its length
+ */
+inline u8_vector
+frame_message(const wire_buffer &msg)
+{
+	wire_buffer buf;
+	buf.put<u32>(static_cast<u32>(msg.data.size()));
+	buf.data.insert(buf.data.end(), msg.data.begin(), msg.data.end());
+	return std::move(buf.data);
+}
+
+
+/*
+ * send_some - send (part of) a buffer, optionally passing along a file descriptor
+ *
+ * Returns the number of bytes sent, or -1 with errno set. The file descriptor
+ * is attached to the first byte that is sent, i.e. pass it only along with the
+ * beginning of a message.
+ */
+inline ssize_t
+send_some(int sock, const u8 *data, size_t size, int pass_fd = -1)
+{
+	int flags = 0;
+	#ifdef MSG_NOSIGNAL
+		flags |= MSG_NOSIGNAL;
+	#endif
+
+	ssize_t n;
+	if (pass_fd < 0) {
+		do {
+			n = send(sock, data, size, flags);
+		} while (n < 0 && errno == EINTR);
+		return n;
+	}
+
+	struct iovec iov;
+	iov.iov_base = const_cast<u8*>(data);
+	iov.iov_len  = size;
+
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	struct msghdr mh = {};
+	mh.msg_iov        = &iov;
+	mh.msg_iovlen     = 1;
+	mh.msg_control    = control;
+	mh.msg_controllen = sizeof(control);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+	std::memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+
+	do {
+		n = sendmsg(sock, &mh, flags);
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+
+/*
+ * send_message - send a length-prefixed message, optionally passing along a file descriptor
+ */
+inline result
+send_message(int sock, const wire_buffer &msg, int pass_fd = -1)
+{
+	u8_vector buf = frame_message(msg);
+	size_t sent = 0;
+	while (sent < buf.size()) {
+		ssize_t n = send_some(sock, buf.data() + sent, buf.size() - sent, sent == 0 ? pass_fd : -1);
+		if (n <= 0)
+			return result::error_socket_failed;
+		sent += static_cast<size_t>(n);
+	}
+	return result::ok;
+}
+
+
+/*
+ * recv_message - receive a length-prefixed message and an optional file descriptor
+ *
+ * If a file descriptor was passed along with the message, it will be stored
+ * in received_fd and the caller takes ownership of it. Otherwise, received_fd
+ * is set to -1. If the peer closed the connection, error_file_truncated is
+ * returned.
+ */
+inline result
+recv_message(int sock, wire_buffer &msg, int *received_fd = nullptr)
+{
+	if (received_fd)
+		*received_fd = -1;
+
+	u8 prefix[sizeof(u32)];
+	size_t received = 0;
+	{
+		struct iovec iov;
+		iov.iov_base = prefix;
+		iov.iov_len  = sizeof(prefix);
+
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+		struct msghdr mh = {};
+		mh.msg_iov        = &iov;
+		mh.msg_iovlen     = 1;
+		mh.msg_control    = control;
+		mh.msg_controllen = sizeof(control);
+
+		int flags = 0;
+		#ifdef MSG_CMSG_CLOEXEC
+			flags |= MSG_CMSG_CLOEXEC;
+		#endif
+
+		ssize_t n;
+		do {
+			n = recvmsg(sock, &mh, flags);
+		} while (n < 0 && errno == EINTR);
+		if (n == 0)
+			return result::error_file_truncated;
+		if (n < 0)
+			return result::error_socket_failed;
+		received = static_cast<size_t>(n);
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg != nullptr; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			int fd;
+			std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+			if (received_fd && *received_fd < 0)
+				*received_fd = fd;
+			else
+				::close(fd);
+		}
+	}
+
+	auto recv_all = [sock](u8 *dest, size_t size, size_t done) {
+		while (done < size) {
+			ssize_t n = recv(sock, dest + done, size - done, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			done += static_cast<size_t>(n);
+		}
+		return true;
+	};
+
+	u32 length;
+	result res = result::ok;
+	if (!recv_all(prefix, sizeof(prefix), received))
+		res = result::error_socket_failed;
+	else {
+		std::memcpy(&length, prefix, sizeof(u32));
+		if (length > array_server_max_message_size)
+			res = result::error_protocol_mismatch;
+		else {
+			msg.data.resize(length);
+			msg.pos = 0;
+			if (!recv_all(msg.data.data(), length, 0))
+				res = result::error_socket_failed;
+		}
+	}
+
+	if (res != result::ok && received_fd && *received_fd >= 0) {
+		::close(*received_fd);
+		*received_fd = -1;
+	}
+	return res;
+}
+
+
+/*
+ * create_anonymous_file - create an empty, unnamed file
+ *
+ * Returns a file descriptor, or -1 on error. On linux, this uses a memfd which
+ * can be sealed. On other systems, this falls back to an unlinked temporary
+ * file.
+ */
+inline int
+create_anonymous_file()
+{
+	#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+		return memfd_create("ncr_numpy", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	#else
+		char tmpl[] = "/tmp/ncr_numpy_XXXXXX";
+		int fd = mkstemp(tmpl);
+		if (fd >= 0) {
+			unlink(tmpl);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+		return fd;
+	#endif
+}
+
+
+/*
+ * seal_anonymous_file - prevent any further modification of an anonymous file
+ */
+inline void
+seal_anonymous_file([[maybe_unused]] int fd)
+{
+	#if defined(F_ADD_SEALS)
+		// clients must never see the data change underneath their mappings
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	#endif
+}
+
+
+/*
+ * make_anonymous_file - store a buffer in an anonymous, read-only file
+ *
+ * Returns a file descriptor, or -1 on error.
+ */
+inline int
+make_anonymous_file(u8_const_span buffer)
+{
+	int fd = create_anonymous_file();
+	if (fd < 0)
+		return -1;
+
+	if (!write_all(fd, buffer.data(), buffer.size())) {
+		::close(fd);
+		return -1;
+	}
+	seal_anonymous_file(fd);
+	return fd;
+}
+
+
+/*
+ * make_anonymous_file - copy the first size bytes of a file into an anonymous, read-only file
+ *
+ * Returns a file descriptor, or -1 on error, including when the source file
+ * turns out to be shorter than size.
+ */
+inline int
+make_anonymous_file(int src_fd, u64 size)
+{
+	int fd = create_anonymous_file();
+	if (fd < 0)
+		return -1;
+
+	constexpr u64 chunk_size = 1 << 20;
+	u8_vector buffer(std::min(size, chunk_size));
+	u64 copied = 0;
+	while (copied < size) {
+		u64 n = std::min(size - copied, chunk_size);
+		if (read_all(src_fd, buffer.data(), n, copied) != n || !write_all(fd, buffer.data(), n)) {
+			::close(fd);
+			return -1;
+		}
+		copied += n;
+	}
+	seal_anonymous_file(fd);
+	return fd;
+}
+
+
+/*
+ * array_server - serve npy files and npz members to other processes
+ *
+ * Typical usage:
+ *
+ *     numpy::array_server server;
+ *     server.add_npy("weights", "weights.npy");
+ *     server.add_npz("tables.npz", "tables/");
+ *     server.listen("/run/myapp/arrays.sock");
+ *     server.serve();  // blocks until stop() is called
+ *
+ * The registry can be modified while the server is running. npz members are
+ * decompressed once when they are added to the registry. Client connections
+ * are non-blocking and handled independently of each other. A client that
+ * leaves a request or response incomplete for longer than
+ * array_server_client_timeout_ms is disconnected.
+ */
+struct array_server
+{
+	array_server() {}
+	array_server(const array_server &) = delete;
+	array_server& operator=(const array_server &) = delete;
+
+	~array_server()
+	{
+		if (_listen_fd >= 0) {
+			::close(_listen_fd);
+			unlink(_socket_path.c_str());
+		}
+		for (int fd: _wakeup)
+			if (fd >= 0)
+				::close(fd);
+		for (auto &[name, e]: _registry)
+			::close(e.fd);
+	}
+
+
+	/*
+	 * add_npy - register an npy file under a given name
+	 *
+	 * By default, the file is copied into a sealed anonymous file (a memfd on
+	 * linux) when it is added, and clients map this copy. Clients thus see a
+	 * consistent snapshot, regardless of what happens to the file later on.
+	 * With snapshot set to false, clients map the file itself, which avoids the
+	 * copy. However, a client that accesses its mapping after the file was
+	 * truncated will receive SIGBUS, and modifications of the file become
+	 * visible to clients. Only disable snapshots for files that are never
+	 * modified in place while they are being served.
+	 */
+	result
+	add_npy(const std::string &name, std::filesystem::path filepath, bool snapshot = true)
+	{
+		result res;
+		int fd;
+		if ((res = open_fd(filepath, fd)) != result::ok)
+			return res;
+
+		if (snapshot) {
+			struct stat st;
+			int copy_fd = -1;
+			if (fstat(fd, &st) == 0)
+				copy_fd = make_anonymous_file(fd, static_cast<u64>(st.st_size));
+			::close(fd);
+			if (copy_fd < 0)
+				return result::error_file_read_failed;
+			fd = copy_fd;
+		}
+
+		if ((res = _add(name, fd), is_error(res)))
+			::close(fd);
+		return res;
+	}
+
+
+	/*
+	 * add_npz - register all arrays of an npz file
+	 *
+	 * Each array is registered under its name within the archive, prefixed
+	 * by prefix. Either all arrays are registered, or none: if one of them
+	 * fails, the arrays that were already registered are removed again.
+	 */
+	result
+	add_npz(std::filesystem::path filepath, const std::string &prefix = "")
+	{
+		zip::backend_state *zip_state      = nullptr;
+		zip::backend_interface zip_backend = zip::get_backend_interface();
+		if (zip_backend.open_fd == nullptr)
+			return result::error_unavailable;
+
+		result res;
+		int fd;
+		struct stat st;
+		if ((res = open_fd(filepath, fd)) != result::ok)
+			return res;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			return result::error_file_read_failed;
+		}
+
+		zip_backend.make(&zip_state);
+		const bool opened = zip_backend.open_fd(zip_state, fd, static_cast<u64>(st.st_size)) == zip::result::ok;
+		::close(fd);
+		if (!opened) {
+			zip_backend.release(&zip_state);
+			return result::error_file_open_failed;
+		}
+
+		std::vector<std::string> added;
+		std::vector<std::string> file_list;
+		if (zip_backend.get_file_list(zip_state, file_list) != zip::result::ok)
+			res = result::error_file_read_failed;
+
+		for (auto &fname: file_list) {
+			u8_vector buffer;
+			if (zip_backend.read(zip_state, fname, buffer) != zip::result::ok) {
+				res = result::error_file_read_failed;
+				break;
+			}
+
+			int fd = make_anonymous_file(buffer);
+			if (fd < 0) {
+				res = result::error_file_write_failed;
+				break;
+			}
+
+			std::string array_name = prefix + fname.substr(0, fname.find_last_of("."));
+			if ((res = _add(array_name, fd), is_error(res))) {
+				::close(fd);
+				break;
+			}
+			added.push_back(std::move(array_name));
+		}
+
+		zip_backend.close(zip_state);
+		zip_backend.release(&zip_state);
+
+		if (is_error(res))
+			for (auto &name: added)
+				remove(name);
+		return res;
+	}
+
+
+	/*
+	 * remove - remove an array from the registry
+	 *
+	 * Clients which already received the array keep their mapping.
+	 */
+	result
+	remove(const std::string &name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _registry.find(name);
+		if (it == _registry.end())
+			return result::error_array_not_found;
+		::close(it->second.fd);
+		_registry.erase(it);
+		return result::ok;
+	}
+
+
+	/*
+	 * listen - bind the server to a unix domain socket
+	 *
+	 * A stale socket file at socket_path will be replaced.
+	 */
+	result
+	listen(std::filesystem::path socket_path)
+	{
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (socket_path.native().size() >= sizeof(addr.sun_path))
+			return result::error_socket_failed;
+		std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.native().size());
+
+		if (pipe(_wakeup) != 0)
+			return result::error_socket_failed;
+		fcntl(_wakeup[0], F_SETFD, FD_CLOEXEC);
+		fcntl(_wakeup[1], F_SETFD, FD_CLOEXEC);
+
+		_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (_listen_fd < 0)
+			return result::error_socket_failed;
+		fcntl(_listen_fd, F_SETFD, FD_CLOEXEC);
+
+		std::error_code ec;
+		if (std::filesystem::is_socket(socket_path, ec))
+			unlink(socket_path.c_str());
+
+		if (bind(_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+		    ::listen(_listen_fd, SOMAXCONN) != 0)
+		{
+			::close(_listen_fd);
+			_listen_fd = -1;
+			return result::error_socket_failed;
+		}
+		_socket_path = socket_path;
+		return result::ok;
+	}
+
+
+	/*
+	 * serve - handle client requests until stop() is called
+	 */
+	result
+	serve()
+	{
+		if (_listen_fd < 0)
+			return result::error_socket_failed;
+
+		std::vector<connection> clients;
+		std::vector<struct pollfd> fds;
+		while (true) {
+			// clients with a pending response wait for their socket to become
+			// writable, and are not read from until the response was sent
+			auto now = clock::now();
+			int timeout = -1;
+			fds.assign({
+				{_wakeup[0], POLLIN, 0},
+				{_listen_fd, POLLIN, 0},
+			});
+			for (auto &c: clients) {
+				fds.push_back({c.fd, static_cast<short>(c.outbox.empty() ? POLLIN : POLLOUT), 0});
+				if (c.busy()) {
+					auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(c.deadline - now).count();
+					int t = static_cast<int>(std::clamp<decltype(ms)>(ms, 0, array_server_client_timeout_ms));
+					timeout = timeout < 0 ? t : std::min(timeout, t);
+				}
+			}
+
+			if (poll(fds.data(), fds.size(), timeout) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+
+			if (fds[0].revents & POLLIN) {
+				u8 tmp;
+				while (read(_wakeup[0], &tmp, 1) < 0 && errno == EINTR) {}
+				break;
+			}
+
+			now = clock::now();
+			for (size_t i = 0; i < clients.size(); i++) {
+				auto &c = clients[i];
+				short revents = fds[i + 2].revents;
+				bool keep = true;
+				if (revents & (POLLERR | POLLNVAL))
+					keep = false;
+				else if (revents & POLLOUT)
+					keep = _send(c, now);
+				else if (revents & (POLLIN | POLLHUP))
+					keep = _receive(c, now);
+				if (keep && c.busy() && now >= c.deadline)
+					keep = false;
+				if (!keep)
+					_disconnect(c);
+			}
+			std::erase_if(clients, [](const connection &c){ return c.fd < 0; });
+
+			if (fds[1].revents & POLLIN) {
+				int client = accept(_listen_fd, nullptr, nullptr);
+				if (client >= 0) {
+					fcntl(client, F_SETFD, FD_CLOEXEC);
+					fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+					clients.push_back({.fd = client});
+				}
+			}
+		}
+
+		for (auto &c: clients)
+			_disconnect(c);
+		return result::ok;
+	}
+
+
+	/*
+	 * stop - stop serving. Can be called from any thread or a signal handler
+	 */
+	void
+	stop()
+	{
+		if (_wakeup[1] >= 0) {
+			u8 tmp = 0;
+			while (write(_wakeup[1], &tmp, 1) < 0 && errno == EINTR) {}
+		}
+	}
+
+
+private:
+	// registry entry. the header is parsed exactly once when the array is
+	// added to the registry
+	struct entry {
+		int           fd;
+		u64           data_offset;
+		dtype         dt;
+		u64_vector    shape;
+		storage_order order;
+	};
+
+	std::mutex
+		_mutex;
+
+	std::map<std::string, entry>
+		_registry;
+
+	int
+		_listen_fd                  {-1};
+
+	// self-pipe to wake up the poll loop in serve()
+	int
+		_wakeup[2]                  {-1, -1};
+
+	std::filesystem::path
+		_socket_path;
+
+	using clock = std::chrono::steady_clock;
+
+	// state of a client connection. requests are collected in the inbox until
+	// they are complete, and responses are sent from the outbox whenever the
+	// socket becomes writable. The file descriptor which is passed along with
+	// a response is a duplicate, so that removing an array from the registry
+	// does not affect pending responses
+	struct connection {
+		int                fd       {-1};
+		u8_vector          inbox    {};
+		u8_vector          outbox   {};
+		size_t             sent     {0};
+		int                pass_fd  {-1};
+		clock::time_point  deadline {};
+
+		bool busy() const { return !inbox.empty() || !outbox.empty(); }
+	};
+
+
+	void
+	_disconnect(connection &c)
+	{
+		if (c.pass_fd >= 0)
+			::close(c.pass_fd);
+		::close(c.fd);
+		c.pass_fd = -1;
+		c.fd = -1;
+	}
+
+
+	// read whatever is available from a client. returns false if the client
+	// is to be disconnected
+	bool
+	_receive(connection &c, clock::time_point now)
+	{
+		u8 buffer[4096];
+		ssize_t n;
+		do {
+			n = recv(c.fd, buffer, sizeof(buffer), 0);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		if (n == 0)
+			return false;
+
+		if (c.inbox.empty())
+			c.deadline = now + std::chrono::milliseconds(array_server_client_timeout_ms);
+		c.inbox.insert(c.inbox.end(), buffer, buffer + n);
+		return _process(c, now);
+	}
+
+
+	// handle complete requests in the inbox, one at a time. the next request
+	// is only handled once the response to the previous one was sent
+	bool
+	_process(connection &c, clock::time_point now)
+	{
+		while (c.outbox.empty() && c.inbox.size() >= sizeof(u32)) {
+			u32 length;
+			std::memcpy(&length, c.inbox.data(), sizeof(u32));
+			if (length > array_server_max_message_size)
+				return false;
+			if (c.inbox.size() < sizeof(u32) + length)
+				return true;
+
+			wire_buffer request, response;
+			request.data.assign(c.inbox.begin() + sizeof(u32), c.inbox.begin() + sizeof(u32) + length);
+			c.inbox.erase(c.inbox.begin(), c.inbox.begin() + sizeof(u32) + length);
+			if (_handle_request(request, response, c.pass_fd) != result::ok)
+				return false;
+
+			c.outbox   = frame_message(response);
+			c.sent     = 0;
+			c.deadline = now + std::chrono::milliseconds(array_server_client_timeout_ms);
+			if (!_send(c, now))
+				return false;
+		}
+		return true;
+	}
+
+
+	// send as much of the pending response as the socket accepts. returns
+	// false if the client is to be disconnected
+	bool
+	_send(connection &c, clock::time_point now)
+	{
+		while (c.sent < c.outbox.size()) {
+			ssize_t n = send_some(c.fd, c.outbox.data() + c.sent, c.outbox.size() - c.sent,
+					c.sent == 0 ? c.pass_fd : -1);
+			if (n < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			if (n == 0)
+				return false;
+			c.sent += static_cast<size_t>(n);
+		}
+
+		c.outbox.clear();
+		c.sent = 0;
+		if (c.pass_fd >= 0) {
+			::close(c.pass_fd);
+			c.pass_fd = -1;
+		}
+		if (!c.inbox.empty())
+			c.deadline = now + std::chrono::milliseconds(array_server_client_timeout_ms);
+		return _process(c, now);
+	}
+
+
+	result
+	_add(const std::string &name, int fd)
+	{
+		result res;
+		npyfile npy;
+		mmap_ndarray array;
+		if ((res = from_npy_mmap_fd(fd, array, &npy), is_error(res)))
+			return res;
+
+		entry e {
+			.fd          = fd,
+			.data_offset = npy.data_offset,
+			.dt          = array.dtype(),
+			.shape       = array.shape(),
+			.order       = array.order(),
+		};
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_registry.contains(name))
+			return result::error_duplicate_array_name;
+		_registry.emplace(name, std::move(e));
+		return res;
+	}
+
+
+	result
+	_handle_request(wire_buffer &request, wire_buffer &response, int &pass_fd)
+	{
+		u32 magic;
+		std::string name;
+		if (!request.get(magic) || magic != array_server_protocol_magic || !request.get(name))
+			return result::error_protocol_mismatch;
+
+		response.put<u32>(array_server_protocol_magic);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _registry.find(name);
+		if (it == _registry.end()) {
+			response.put<u64>(static_cast<u64>(result::error_array_not_found));
+			return result::ok;
+		}
+
+		auto &e = it->second;
+		if ((pass_fd = fcntl(e.fd, F_DUPFD_CLOEXEC, 0)) < 0)
+			return result::error_socket_failed;
+		response.put<u64>(static_cast<u64>(result::ok));
+		response.put<u64>(e.data_offset);
+		response.put<u8>(e.order == storage_order::col_major ? 1 : 0);
+		response.put<u32>(static_cast<u32>(e.shape.size()));
+		for (auto s: e.shape)
+			response.put<u64>(s);
+		serialize_dtype_binary(response, e.dt);
+		return result::ok;
+	}
+};
+
+
+/*
+ * array_client - request arrays from an array_server
+ */
+struct array_client
+{
+	array_client() {}
+	array_client(const array_client &) = delete;
+	array_client& operator=(const array_client &) = delete;
+	~array_client() { close(); }
+
+
+	/*
+	 * connect - connect to the server listening on socket_path
+	 */
+	result
+	connect(std::filesystem::path socket_path)
+	{
+		close();
+
+		struct sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if (socket_path.native().size() >= sizeof(addr.sun_path))
+			return result::error_socket_failed;
+		std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.native().size());
+
+		_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (_sock < 0)
+			return result::error_socket_failed;
+		fcntl(_sock, F_SETFD, FD_CLOEXEC);
+
+		if (::connect(_sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+			close();
+			return result::error_socket_failed;
+		}
+		return result::ok;
+	}
+
+
+	/*
+	 * close - close the connection to the server
+	 *
+	 * Arrays that were received earlier remain valid.
+	 */
+	void
+	close()
+	{
+		if (_sock >= 0) {
+			::close(_sock);
+			_sock = -1;
+		}
+	}
+
+
+	/*
+	 * get - request an array by name and map it read-only
+	 */
+	result
+	get(const std::string &name, mmap_ndarray &array)
+	{
+		if (_sock < 0)
+			return result::error_socket_failed;
+
+		result res;
+		wire_buffer request;
+		request.put<u32>(array_server_protocol_magic);
+		request.put(name);
+		if ((res = send_message(_sock, request)) != result::ok)
+			return res;
+
+		int fd;
+		wire_buffer response;
+		if ((res = recv_message(_sock, response, &fd)) != result::ok)
+			return res;
+
+		// the file descriptor is only required until the data is mapped
+		std::unique_ptr<int, void(*)(int*)> fd_guard(&fd, [](int *p){ if (*p >= 0) ::close(*p); });
+
+		u32 magic;
+		u64 status;
+		if (!response.get(magic) || magic != array_server_protocol_magic || !response.get(status))
+			return result::error_protocol_mismatch;
+		if (static_cast<result>(status) != result::ok)
+			return static_cast<result>(status);
+
+		u64 data_offset;
+		u8 order;
+		u32 ndim;
+		if (!response.get(data_offset) || !response.get(order) || !response.get(ndim))
+			return result::error_protocol_mismatch;
+		if (ndim > (response.data.size() - response.pos) / sizeof(u64))
+			return result::error_protocol_mismatch;
+		u64_vector shape(ndim);
+		for (auto &s: shape)
+			if (!response.get(s))
+				return result::error_protocol_mismatch;
+		dtype dt;
+		if (!deserialize_dtype_binary(response, dt) || fd < 0)
+			return result::error_protocol_mismatch;
+
+		std::shared_ptr<const mapped_region> region;
+		if ((res = map_fd(fd, region)) != result::ok)
+			return res;
+		return array.assign(std::move(region), data_offset, std::move(dt), std::move(shape),
+			order ? storage_order::col_major : storage_order::row_major);
+	}
+
+
+private:
+	int
+		_sock                       {-1};
+};
+
+
+}} // ncr::numpy
+
+#endif /* _b2e61f0a7c5d4e18a9f3c47d80e5b6a2_ */
+
+/*
+ * ncr/numpy_cache.hpp - in-process cache for loaded arrays
+ *
+ */
+#ifndef _6a1d93c4e2f74b0d8c5e17b9a04f3d68_
+#define _6a1d93c4e2f74b0d8c5e17b9a04f3d68_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * array_cache - LRU cache for arrays loaded from npy and npz files
+ *
+ * The cache is opt-in, i.e. only loads that go through an array_cache instance
+ * are cached. Entries are keyed by file_identity, which means that files that
+ * change on disk will be loaded again. Each file is opened exactly once, and
+ * both its identity and its contents are taken from the same file descriptor.
+ * Thus, replacing a file while it is being loaded never caches the contents of
+ * the new file under the identity of the old one. The cache returns shared, read-only
+ * arrays. Once the memory used by the cached arrays exceeds the configured
+ * budget, the least recently used entries are evicted. Arrays that are still
+ * in use elsewhere stay alive after eviction, the cache just drops its
+ * reference to them.
+ *
+ * Concurrent loads of the same file are collapsed into a single load, i.e.
+ * other threads that request the same file while it is loading will wait for
+ * and share the result of the first load.
+ *
+ * Example:
+ *
+ *     numpy::array_cache cache(512 << 20);
+ *     std::shared_ptr<const numpy::ndarray> arr;
+ *     if (cache.from_npy("table.npy", arr) == numpy::result::ok)
+ *         ...
+ */
+struct array_cache
+{
+	using ndarray_ptr = std::shared_ptr<const ndarray>;
+	using npzfile_ptr = std::shared_ptr<const npzfile>;
+
+	array_cache(u64 memory_budget = u64(1) << 30) : _budget(memory_budget) {}
+	array_cache(const array_cache &) = delete;
+	array_cache& operator=(const array_cache &) = delete;
+
+
+	/*
+	 * from_npy - load an npy file, or get it from the cache
+	 */
+	result
+	from_npy(const std::filesystem::path &filepath, ndarray_ptr &array)
+	{
+		value_type value;
+		result res = _get(filepath, false, value);
+		if (!is_error(res))
+			array = std::get<ndarray_ptr>(value);
+		return res;
+	}
+
+
+	/*
+	 * from_npz - load an npz file, or get it from the cache
+	 */
+	result
+	from_npz(const std::filesystem::path &filepath, npzfile_ptr &npz)
+	{
+		value_type value;
+		result res = _get(filepath, true, value);
+		if (!is_error(res))
+			npz = std::get<npzfile_ptr>(value);
+		return res;
+	}
+
+
+	/*
+	 * set_memory_budget - change the memory budget, evicting entries if necessary
+	 */
+	void
+	set_memory_budget(u64 budget)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_budget = budget;
+		_evict();
+	}
+
+
+	/*
+	 * clear - drop all cached entries
+	 */
+	void
+	clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_lru.clear();
+		_entries.clear();
+		_paths.clear();
+		_usage = 0;
+	}
+
+
+	u64    memory_budget() { std::lock_guard<std::mutex> lock(_mutex); return _budget; }
+	u64    memory_usage()  { std::lock_guard<std::mutex> lock(_mutex); return _usage; }
+	size_t size()          { std::lock_guard<std::mutex> lock(_mutex); return _entries.size(); }
+	u64    hits()          { std::lock_guard<std::mutex> lock(_mutex); return _hits; }
+	u64    misses()        { std::lock_guard<std::mutex> lock(_mutex); return _misses; }
+
+
+private:
+	using value_type = std::variant<ndarray_ptr, npzfile_ptr>;
+	using lru_list   = std::list<file_identity>;
+
+	struct entry {
+		value_type         value;
+		u64                bytes;
+		lru_list::iterator lru_pos;
+	};
+
+	// state of a load that is currently in progress
+	using inflight_value = std::pair<result, value_type>;
+
+	std::mutex
+		_mutex;
+
+	u64
+		_budget,
+		_usage                      {0},
+		_hits                       {0},
+		_misses                     {0};
+
+	// most recently used entries are at the front
+	lru_list
+		_lru;
+
+	std::unordered_map<file_identity, entry, file_identity_hash>
+		_entries;
+
+	// most recent identity for each path. used to drop outdated versions of
+	// a file as soon as a newer version is loaded
+	std::unordered_map<std::string, file_identity>
+		_paths;
+
+	std::unordered_map<file_identity, std::shared_future<inflight_value>, file_identity_hash>
+		_inflight;
+
+
+	static u64
+	_bytesize(const value_type &value)
+	{
+		if (auto *arr = std::get_if<ndarray_ptr>(&value))
+			return (*arr)->bytesize();
+
+		u64 bytes = 0;
+		for (auto &[name, arr]: std::get<npzfile_ptr>(value)->arrays)
+			bytes += arr->bytesize();
+		return bytes;
+	}
+
+
+	static inflight_value
+	_load(int fd, bool is_npz)
+	{
+		result res;
+		if (is_npz) {
+			auto npz = std::make_shared<npzfile>();
+			res = numpy::from_npz_fd(fd, *npz);
+			return {res, npzfile_ptr(std::move(npz))};
+		}
+		auto arr = std::make_shared<ndarray>();
+		res = numpy::from_npy_fd(fd, *arr);
+		return {res, ndarray_ptr(std::move(arr))};
+	}
+
+
+	void
+	_erase(const file_identity &id)
+	{
+		auto it = _entries.find(id);
+		if (it == _entries.end())
+			return;
+		_usage -= it->second.bytes;
+		_lru.erase(it->second.lru_pos);
+		_entries.erase(it);
+	}
+
+
+	void
+	_evict()
+	{
+		while (_usage > _budget && !_lru.empty()) {
+			file_identity id = _lru.back();
+			auto p = _paths.find(id.path);
+			if (p != _paths.end() && p->second == id)
+				_paths.erase(p);
+			_erase(id);
+		}
+	}
+
+
+	result
+	_get(const std::filesystem::path &filepath, bool is_npz, value_type &value)
+	{
+		// the identity and the contents must come from the same file, see
+		// the documentation of array_cache
+		result res;
+		int fd;
+		if ((res = open_fd(filepath, fd)) != result::ok)
+			return res;
+		std::unique_ptr<int, void(*)(int*)> fd_guard(&fd, [](int *p){ ::close(*p); });
+
+		file_identity id;
+		if ((res = get_file_identity(fd, id)) != result::ok)
+			return res;
+		id.path = filepath.native();
+
+		std::shared_future<inflight_value> future;
+		std::promise<inflight_value> promise;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			// cache hit
+			auto it = _entries.find(id);
+			if (it != _entries.end() && (std::holds_alternative<npzfile_ptr>(it->second.value) == is_npz)) {
+				_lru.splice(_lru.begin(), _lru, it->second.lru_pos);
+				value = it->second.value;
+				++_hits;
+				return result::ok;
+			}
+			++_misses;
+
+			// someone else is already loading this file
+			auto inf = _inflight.find(id);
+			if (inf != _inflight.end())
+				future = inf->second;
+			else
+				_inflight.emplace(id, promise.get_future().share());
+		}
+
+		if (future.valid()) {
+			auto [r, v] = future.get();
+			if (is_error(r) || std::holds_alternative<npzfile_ptr>(v) != is_npz)
+				return is_error(r) ? r : result::error_wrong_filetype;
+			value = v;
+			return r;
+		}
+
+		inflight_value loaded;
+		try {
+			loaded = _load(fd, is_npz);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_inflight.erase(id);
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_inflight.erase(id);
+
+			if (!is_error(loaded.first)) {
+				// drop any outdated version of the same file
+				auto p = _paths.find(id.path);
+				if (p != _paths.end() && !(p->second == id))
+					_erase(p->second);
+
+				u64 bytes = _bytesize(loaded.second);
+				if (bytes <= _budget && !_entries.contains(id)) {
+					_lru.push_front(id);
+					_entries.emplace(id, entry{loaded.second, bytes, _lru.begin()});
+					_paths[id.path] = id;
+					_usage += bytes;
+					_evict();
+				}
+			}
+		}
+		promise.set_value(loaded);
+
+		value = std::move(loaded.second);
+		return loaded.first;
+	}
+};
+
+
+}} // ncr::numpy
+
+#endif /* _6a1d93c4e2f74b0d8c5e17b9a04f3d68_ */
+
+/*
+ * ncr/numpy_npz_cache.hpp - persistent cache of decompressed npz members
+ *
+ */
+#ifndef _c83e5a0f1b7d4296a4e0d95c2f6b18a7_
+#define _c83e5a0f1b7d4296a4e0d95c2f6b18a7_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * mmap_npzfile - container for memory mapped members of an npz file
+ */
+struct mmap_npzfile
+{
+	const mmap_ndarray& operator[](std::string name) const
+	{
+		auto where = arrays.find(name);
+		if (where == arrays.end())
+			throw std::runtime_error(std::string("Key error: No array with name \"") + name + std::string("\""));
+		return where->second;
+	}
+
+	// the names of all arrays in this file
+	std::vector<std::string> names;
+
+	// the arrays
+	std::map<std::string, mmap_ndarray> arrays;
+};
+
+
+/*
+ * npz_disk_cache - directory of decompressed npz members
+ *
+ * Decompressing the members of a compressed npz file can take considerably
+ * longer than reading them. The disk cache stores each decompressed member as
+ * an npy file within a cache directory. The header of each npy file is padded
+ * such that the array data starts at a page boundary. Later loads map these
+ * files into memory instead of decompressing the archive again.
+ *
+ * Cache files are named after the identity of the archive (see file_identity)
+ * and the CRC-32 and size of the member. Thus, modified archives are never
+ * served from stale cache files. Cache files are written to a temporary file
+ * first and then renamed into place. This makes it safe for several processes
+ * to share the same cache directory.
+ *
+ * Once the cache directory exceeds max_size, the least recently used files are
+ * removed. Members larger than max_size are not cached at all, but are
+ * decompressed into anonymous memory instead.
+ *
+ * Example:
+ *
+ *     numpy::npz_disk_cache cache("/var/cache/myapp/npz", 8ul << 30);
+ *     numpy::mmap_npzfile npz;
+ *     if (numpy::from_npz("weights.npz", npz, cache) == numpy::result::ok)
+ *         auto &w = npz["layer0"];
+ */
+struct npz_disk_cache
+{
+	npz_disk_cache(std::filesystem::path directory, u64 max_size = u64(4) << 30)
+	: _directory(std::move(directory)), _max_size(max_size) {}
+
+
+	const std::filesystem::path& directory() const { return _directory; }
+	u64                          max_size()  const { return _max_size; }
+
+
+	/*
+	 * load - map all members of an npz file, populating the cache if necessary
+	 */
+	result
+	load(const std::filesystem::path &filepath, mmap_npzfile &npz)
+	{
+		namespace fs = std::filesystem;
+
+		zip::backend_state *zip_state      = nullptr;
+		zip::backend_interface zip_backend = zip::get_backend_interface();
+		if (zip_backend.stat == nullptr || zip_backend.open_fd == nullptr)
+			return result::error_unavailable;
+
+		// the identity is taken from the same file that the archive is read
+		// from, so that a file replaced in between cannot be cached under
+		// the identity of another
+		result res;
+		int fd;
+		file_identity id;
+		if ((res = open_fd(filepath, fd)) != result::ok)
+			return res;
+		if ((res = get_file_identity(fd, id)) != result::ok) {
+			::close(fd);
+			return res;
+		}
+		std::error_code ec;
+		fs::path canonical = fs::weakly_canonical(filepath, ec);
+		id.path = ec ? filepath.native() : canonical.native();
+
+		fs::create_directories(_directory, ec);
+		if (ec) {
+			::close(fd);
+			return result::error_file_open_failed;
+		}
+
+		zip_backend.make(&zip_state);
+		const bool opened = zip_backend.open_fd(zip_state, fd, id.size) == zip::result::ok;
+		::close(fd);
+		if (!opened) {
+			zip_backend.release(&zip_state);
+			return result::error_file_open_failed;
+		}
+
+		std::vector<std::string> file_list;
+		if (zip_backend.get_file_list(zip_state, file_list) != zip::result::ok)
+			res = result::error_file_read_failed;
+
+		bool populated = false;
+		char archive_key[17];
+		std::snprintf(archive_key, sizeof(archive_key), "%016llx", static_cast<unsigned long long>(_hash(id)));
+
+		for (auto &fname: file_list) {
+			zip::file_stat st;
+			if (zip_backend.stat(zip_state, fname, st) != zip::result::ok) {
+				res = result::error_file_read_failed;
+				break;
+			}
+
+			char member_key[64];
+			std::snprintf(member_key, sizeof(member_key), "-%08x-%llx.npy", st.crc32, static_cast<unsigned long long>(st.size));
+			fs::path cache_file = _directory / (std::string(archive_key) + member_key);
+
+			std::string array_name = fname.substr(0, fname.find_last_of("."));
+			mmap_ndarray array;
+
+			// cache hit. the file might get removed by another process in
+			// between, in which case this is treated as a miss
+			if (_map_cached(cache_file, array) == result::ok) {
+				npz.names.push_back(array_name);
+				npz.arrays.insert_or_assign(array_name, std::move(array));
+				continue;
+			}
+
+			u8_vector buffer;
+			if (zip_backend.read(zip_state, fname, buffer) != zip::result::ok) {
+				res = result::error_file_read_failed;
+				break;
+			}
+
+			if ((res = _populate(cache_file, std::move(buffer), array), is_error(res)))
+				break;
+			populated = true;
+
+			npz.names.push_back(array_name);
+			npz.arrays.insert_or_assign(array_name, std::move(array));
+		}
+
+		zip_backend.close(zip_state);
+		zip_backend.release(&zip_state);
+
+		if (populated)
+			trim();
+		return res;
+	}
+
+
+	/*
+	 * trim - remove least recently used cache files until max_size is met
+	 *
+	 * Temporary files which are older than a few minutes are left-overs of
+	 * processes that died while populating the cache and are removed as well.
+	 */
+	void
+	trim()
+	{
+		namespace fs = std::filesystem;
+
+		struct file_info {
+			fs::path path;
+			i64      mtime;
+			u64      size;
+		};
+		std::vector<file_info> files;
+		u64 total = 0;
+
+		const i64 now = static_cast<i64>(::time(nullptr)) * 1000000000;
+		std::error_code ec;
+		for (auto &entry: fs::directory_iterator(_directory, ec)) {
+			file_identity id;
+			if (!entry.is_regular_file(ec) || get_file_identity(entry.path(), id) != result::ok)
+				continue;
+
+			const std::string name = entry.path().filename().native();
+			if (name.starts_with(".tmp-")) {
+				if (now - id.mtime > stale_tmp_seconds * 1000000000)
+					::unlink(entry.path().c_str());
+				continue;
+			}
+			if (!name.ends_with(".npy"))
+				continue;
+
+			files.push_back({entry.path(), id.mtime, id.size});
+			total += id.size;
+		}
+
+		if (total <= _max_size)
+			return;
+
+		std::sort(files.begin(), files.end(), [](const file_info &a, const file_info &b){ return a.mtime < b.mtime; });
+		for (auto &f: files) {
+			if (total <= _max_size)
+				break;
+			// mapped files stay valid after unlinking them
+			if (::unlink(f.path.c_str()) == 0)
+				total -= f.size;
+		}
+	}
+
+
+	/*
+	 * clear - remove all files from the cache directory
+	 */
+	void
+	clear()
+	{
+		namespace fs = std::filesystem;
+		std::error_code ec;
+		for (auto &entry: fs::directory_iterator(_directory, ec)) {
+			const std::string name = entry.path().filename().native();
+			if (name.starts_with(".tmp-") || name.ends_with(".npy"))
+				::unlink(entry.path().c_str());
+		}
+	}
+
+
+	// seconds after which temporary files are considered abandoned
+	static constexpr i64
+		stale_tmp_seconds           {600};
+
+
+private:
+	std::filesystem::path
+		_directory;
+
+	u64
+		_max_size;
+
+
+	// FNV-1a, which is stable across processes and builds unlike std::hash
+	static u64
+	_hash(const file_identity &id)
+	{
+		u64 h = 0xcbf29ce484222325ull;
+		auto mix = [&h](const void *data, size_t size) {
+			const u8 *p = static_cast<const u8*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				h ^= p[i];
+				h *= 0x100000001b3ull;
+			}
+		};
+		mix(id.path.data(), id.path.size());
+		mix(&id.device, sizeof(id.device));
+		mix(&id.inode,  sizeof(id.inode));
+		mix(&id.mtime,  sizeof(id.mtime));
+		mix(&id.size,   sizeof(id.size));
+		return h;
+	}
+
+
+	static result
+	_map_cached(const std::filesystem::path &cache_file, mmap_ndarray &array)
+	{
+		int fd = ::open(cache_file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return result::error_file_not_found;
+
+		result res = from_npy_mmap_fd(fd, array);
+		if (!is_error(res))
+			// mark as recently used
+			::futimens(fd, nullptr);
+		::close(fd);
+
+		// corrupt cache files are removed and populated again
+		if (is_error(res))
+			::unlink(cache_file.c_str());
+		return res;
+	}
+
+
+	/*
+	 * _populate - write a decompressed member to the cache and map it
+	 */
+	result
+	_populate(const std::filesystem::path &cache_file, u8_vector &&buffer, mmap_ndarray &array)
+	{
+		result res;
+		npyfile npy;
+		dtype dt;
+		u64_vector shape;
+		storage_order order;
+		auto source = span_reader(buffer);
+		if ((res = process_file_header(source, npy, dt, shape, order), is_error(res)))
+			return res;
+
+		// build a new (version 2.0) header which is padded to the page size
+		const u64 page_size = static_cast<u64>(::sysconf(_SC_PAGESIZE));
+		std::string dict(npy.header.begin(), npy.header.end());
+		while (!dict.empty() && (dict.back() == ' ' || dict.back() == '\n'))
+			dict.pop_back();
+
+		u8_vector header = {0x93, 'N', 'U', 'M', 'P', 'Y', 0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+		header.insert(header.end(), dict.begin(), dict.end());
+		const u64 total_header_length = ((header.size() + page_size) / page_size) * page_size;
+		const size_t dict_end = header.size();
+		header.resize(total_header_length);
+		std::fill(header.begin() + dict_end, header.end() - 1, 0x20);
+		header.back() = '\n';
+
+		u32 header_length = static_cast<u32>(total_header_length - npyfile::magic_byte_count - npyfile::version_byte_count - 4);
+		if constexpr (std::endian::native == std::endian::big)
+			header_length = ncr::bswap<u32>(header_length);
+		std::memcpy(header.data() + npyfile::magic_byte_count + npyfile::version_byte_count, &header_length, sizeof(u32));
+
+		const u8 *payload = buffer.data() + npy.data_offset;
+		const u64 payload_size = buffer.size() - npy.data_offset;
+
+		// too large for the cache -> keep it in anonymous memory only
+		if (header.size() + payload_size > _max_size) {
+			u8_vector file = std::move(header);
+			file.insert(file.end(), payload, payload + payload_size);
+			int fd = make_anonymous_file(file);
+			if (fd < 0)
+				return result::error_file_write_failed;
+			res = from_npy_mmap_fd(fd, array);
+			::close(fd);
+			return res;
+		}
+
+		std::string tmpl = (_directory / ".tmp-XXXXXX").native();
+		int fd = open_temporary_file(tmpl);
+		if (fd < 0)
+			return result::error_file_open_failed;
+
+		if (!write_all(fd, header.data(), header.size()) || !write_all(fd, payload, payload_size)) {
+			::close(fd);
+			::unlink(tmpl.c_str());
+			return result::error_file_write_failed;
+		}
+
+		// publish atomically. concurrent writers of the same member produce
+		// identical files, so it does not matter who wins the race
+		if (::rename(tmpl.c_str(), cache_file.c_str()) != 0) {
+			::close(fd);
+			::unlink(tmpl.c_str());
+			return result::error_file_write_failed;
+		}
+
+		res = from_npy_mmap_fd(fd, array);
+		::close(fd);
+		return res;
+	}
+};
+
+
+/*
+ * from_npz - load an npz file via a persistent cache of decompressed members
+ */
+inline result
+from_npz(std::filesystem::path filepath, mmap_npzfile &npz, npz_disk_cache &cache)
+{
+	return cache.load(filepath, npz);
+}
+
+
+}} // ncr::numpy
+
+#endif /* _c83e5a0f1b7d4296a4e0d95c2f6b18a7_ */
+
+/*
+ * ncr/numpy_watch.hpp - reload arrays when files change on disk
+ *
+ */
+#ifndef _e5f70b2c94a8413d86c1d3a5b07e9f24_
+#define _e5f70b2c94a8413d86c1d3a5b07e9f24_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * file_watcher - call a function whenever a file was changed
+ *
+ * On Linux, the watcher uses inotify on the directory of the file, which also
+ * catches files that are replaced by renaming another file over them (which is
+ * the recommended way to update files that are read by other processes). On
+ * other systems, or if inotify is not available, the file identity (see
+ * file_identity) is polled periodically instead.
+ *
+ * The callback is invoked from a background thread.
+ */
+struct file_watcher
+{
+	file_watcher() {}
+	file_watcher(const file_watcher &) = delete;
+	file_watcher& operator=(const file_watcher &) = delete;
+
+	~file_watcher() { stop(); }
+
+
+	/*
+	 * start - start watching a file in a background thread
+	 */
+	result
+	start(std::filesystem::path filepath, std::function<void()> on_change, int poll_interval_ms = 1000)
+	{
+		if (_thread.joinable())
+			return result::error_unavailable;
+
+		_filepath = std::move(filepath);
+		_on_change = std::move(on_change);
+		_poll_interval_ms = poll_interval_ms;
+
+		if (::pipe(_wakeup) != 0)
+			return result::error_file_open_failed;
+
+		#if defined(__linux__)
+			_inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (_inotify_fd >= 0) {
+				auto dir = _filepath.parent_path();
+				if (dir.empty())
+					dir = ".";
+				if (::inotify_add_watch(_inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+					::close(_inotify_fd);
+					_inotify_fd = -1;
+				}
+			}
+		#endif
+
+		get_file_identity(_filepath, _identity);
+		_thread = std::thread([this]{ _run(); });
+		return result::ok;
+	}
+
+
+	/*
+	 * stop - stop watching and join the background thread
+	 */
+	void
+	stop()
+	{
+		if (_thread.joinable()) {
+			char c = 0;
+			while (::write(_wakeup[1], &c, 1) < 0 && errno == EINTR)
+				;
+			_thread.join();
+		}
+		for (int &fd: _wakeup) {
+			if (fd >= 0)
+				::close(fd);
+			fd = -1;
+		}
+		if (_inotify_fd >= 0)
+			::close(_inotify_fd);
+		_inotify_fd = -1;
+	}
+
+
+private:
+	std::filesystem::path
+		_filepath;
+
+	std::function<void()>
+		_on_change;
+
+	int
+		_poll_interval_ms           {1000},
+		_inotify_fd                 {-1},
+		_wakeup[2]                  {-1, -1};
+
+	file_identity
+		_identity;
+
+	std::thread
+		_thread;
+
+
+	bool
+	_changed_inotify()
+	{
+		#if defined(__linux__)
+			// inotify events are of variable length
+			alignas(struct inotify_event) char buffer[4096];
+			const std::string filename = _filepath.filename().native();
+			bool changed = false;
+			for (;;) {
+				ssize_t n = ::read(_inotify_fd, buffer, sizeof(buffer));
+				if (n <= 0)
+					break;
+				for (char *p = buffer; p < buffer + n; ) {
+					auto *ev = reinterpret_cast<struct inotify_event*>(p);
+					if (ev->len > 0 && filename == ev->name)
+						changed = true;
+					p += sizeof(struct inotify_event) + ev->len;
+				}
+			}
+			return changed;
+		#else
+			return false;
+		#endif
+	}
+
+
+	bool
+	_changed_identity()
+	{
+		file_identity id;
+		if (get_file_identity(_filepath, id) != result::ok || id == _identity)
+			return false;
+		_identity = std::move(id);
+		return true;
+	}
+
+
+	void
+	_run()
+	{
+		struct pollfd fds[2] = {
+			{_wakeup[0],  POLLIN, 0},
+			{_inotify_fd, POLLIN, 0},
+		};
+		const nfds_t nfds = _inotify_fd >= 0 ? 2 : 1;
+		const int timeout = _inotify_fd >= 0 ? -1 : _poll_interval_ms;
+
+		for (;;) {
+			int n = ::poll(fds, nfds, timeout);
+			if (n < 0 && errno != EINTR)
+				return;
+			if (fds[0].revents & POLLIN)
+				return;
+
+			bool changed = (_inotify_fd >= 0)
+				? ((fds[1].revents & POLLIN) && _changed_inotify())
+				: _changed_identity();
+			if (changed && _on_change)
+				_on_change();
+		}
+	}
+};
+
+
+/*
+ * watched_traits - how to load and validate a watched file of type T
+ */
+template <typename T>
+struct watched_traits;
+
+template <>
+struct watched_traits<ndarray>
+{
+	using schema_type = array_schema;
+
+	static result
+	load(const std::filesystem::path &filepath, const schema_type &schema, ndarray &array)
+	{
+		result res = numpy::from_npy(filepath, array, schema);
+		return is_error(res) ? res : result::ok;
+	}
+};
+
+template <>
+struct watched_traits<npzfile>
+{
+	using schema_type = npz_schema;
+
+	static result
+	load(const std::filesystem::path &filepath, const schema_type &schema, npzfile &npz)
+	{
+		return numpy::from_npz(filepath, npz, schema);
+	}
+};
+
+
+/*
+ * watched - a file on disk which is reloaded whenever it changes
+ *
+ * After start() loaded the file for the first time, a background thread
+ * watches for changes. New versions of the file are loaded in the background
+ * and validated against a schema. Only if loading and validation succeed, the
+ * new version is published. Otherwise the previous version is kept, and the
+ * error is available via last_result().
+ *
+ * Readers get a snapshot of the current version via snapshot(). Snapshots are
+ * immutable and remain valid as long as the reader holds on to them, even if
+ * a newer version was published in the meantime. Old versions are released
+ * once the last snapshot to them is gone.
+ *
+ * Example:
+ *
+ *     numpy::array_schema schema{numpy::dtype_float32(), u64_vector{numpy::array_schema::any, 64}};
+ *     numpy::watched_array table("/srv/tables/embeddings.npy", schema);
+ *     if (table.start() != numpy::result::ok)
+ *         ...
+ *     // in any thread
+ *     auto snap = table.snapshot();
+ *     float v = snap->value<float>(row, 3);
+ */
+template <typename T>
+struct watched
+{
+	using value_type  = T;
+	using schema_type = typename watched_traits<T>::schema_type;
+	using pointer     = std::shared_ptr<const T>;
+
+	watched(std::filesystem::path filepath, schema_type schema = {})
+	: _filepath(std::move(filepath)), _schema(std::move(schema)) {}
+
+	watched(const watched &) = delete;
+	watched& operator=(const watched &) = delete;
+
+	~watched() { stop(); }
+
+
+	/*
+	 * start - load the file and start watching it
+	 *
+	 * Returns the result of the initial load. If this fails, the file is not
+	 * watched.
+	 */
+	result
+	start(int poll_interval_ms = 1000)
+	{
+		result res = reload();
+		if (is_error(res))
+			return res;
+		return _watcher.start(_filepath, [this]{ reload(); }, poll_interval_ms);
+	}
+
+
+	/*
+	 * stop - stop watching the file. The current snapshot remains available
+	 */
+	void
+	stop()
+	{
+		_watcher.stop();
+	}
+
+
+	/*
+	 * reload - load, validate, and publish the file now
+	 */
+	result
+	reload()
+	{
+		std::lock_guard<std::mutex> lock(_reload_mutex);
+		auto value = std::make_shared<T>();
+		result res = watched_traits<T>::load(_filepath, _schema, *value);
+		_last_result.store(res, std::memory_order_relaxed);
+		if (is_error(res))
+			return res;
+
+		_publish(pointer(std::move(value)));
+		_version.fetch_add(1, std::memory_order_release);
+		return res;
+	}
+
+
+	/*
+	 * snapshot - get the current version of the file
+	 *
+	 * Returns nullptr if the file was never loaded successfully.
+	 */
+	pointer
+	snapshot() const
+	{
+		#if defined(__cpp_lib_atomic_shared_ptr)
+			return _current.load(std::memory_order_acquire);
+		#else
+			return std::atomic_load_explicit(&_current, std::memory_order_acquire);
+		#endif
+	}
+
+
+	// number of versions that were published so far
+	u64    version()     const { return _version.load(std::memory_order_acquire); }
+
+	// result of the most recent (re)load attempt
+	result last_result() const { return _last_result.load(std::memory_order_relaxed); }
+
+	const std::filesystem::path& filepath() const { return _filepath; }
+
+
+private:
+	std::filesystem::path
+		_filepath;
+
+	schema_type
+		_schema;
+
+	#if defined(__cpp_lib_atomic_shared_ptr)
+		std::atomic<pointer>
+			_current;
+	#else
+		pointer
+			_current;
+	#endif
+
+	std::atomic<u64>
+		_version                    {0};
+
+	std::atomic<result>
+		_last_result                {result::ok};
+
+	// serializes reloads from the watcher thread and explicit calls
+	std::mutex
+		_reload_mutex;
+
+	file_watcher
+		_watcher;
+
+
+	void
+	_publish(pointer value)
+	{
+		#if defined(__cpp_lib_atomic_shared_ptr)
+			_current.store(std::move(value), std::memory_order_release);
+		#else
+			std::atomic_store_explicit(&_current, std::move(value), std::memory_order_release);
+		#endif
+	}
+};
+
+
+using watched_array = watched<ndarray>;
+using watched_npz   = watched<npzfile>;
+
+
+}} // ncr::numpy
+
+#endif /* _e5f70b2c94a8413d86c1d3a5b07e9f24_ */
+
+/*
+ * ncr/numpy_sharded.hpp - arrays split into several npy files
+ *
+ */
+#ifndef _0b9d4e7a36f1428c95a2d8c1e47b6f03_
+#define _0b9d4e7a36f1428c95a2d8c1e47b6f03_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * sharded_array - virtual concatenation of npy files along the first axis
+ *
+ * Large arrays are often split into several shard files, e.g. part-00000.npy,
+ * part-00001.npy, ..., which share the data type and all but the first
+ * dimension. A sharded_array memory maps all shards and presents them as one
+ * array whose first dimension is the sum of the first dimensions of all
+ * shards. Accesses are routed to the shard that contains the row by means of
+ * a prefix sum over the shard sizes. No concatenated copy is built.
+ *
+ * Only C (row-major) ordered shards can be concatenated this way.
+ *
+ * Example:
+ *
+ *     numpy::sharded_array arr;
+ *     if (numpy::open_sharded("data/part-*.npy", arr) != numpy::result::ok)
+ *         ...
+ *     for (u8_const_span row: arr)
+ *         ...
+ */
+struct sharded_array
+{
+	sharded_array() {}
+
+
+	/*
+	 * assign - set the shards of this array
+	 *
+	 * All shards must have the same data type, at least one dimension, and
+	 * the same extents in all but the first dimension.
+	 */
+	result
+	assign(std::vector<mmap_ndarray> &&shards)
+	{
+		clear();
+		if (shards.empty())
+			return result::error_file_not_found;
+
+		const mmap_ndarray &first = shards.front();
+		std::ostringstream first_dtype;
+		serialize_dtype(first_dtype, first.dtype());
+
+		for (auto &shard: shards) {
+			if (shard.order() != storage_order::row_major)
+				return result::error_schema_mismatch | result::error_schema_order_mismatch;
+			if (shard.shape().empty() || shard.shape().size() != first.shape().size())
+				return result::error_schema_mismatch | result::error_schema_rank_mismatch;
+
+			std::ostringstream s;
+			serialize_dtype(s, shard.dtype());
+			if (s.str() != first_dtype.str())
+				return result::error_schema_mismatch | result::error_schema_dtype_mismatch;
+
+			if (!std::equal(shard.shape().begin() + 1, shard.shape().end(), first.shape().begin() + 1))
+				return result::error_schema_mismatch | result::error_schema_shape_mismatch;
+		}
+
+		// prefix sum over the first dimension. _offsets[i] is the first row
+		// of shard i, and _offsets.back() the total number of rows
+		_offsets.reserve(shards.size() + 1);
+		_offsets.push_back(0);
+		for (auto &shard: shards)
+			_offsets.push_back(_offsets.back() + shard.shape()[0]);
+
+		_shape = first.shape();
+		_shape[0] = _offsets.back();
+		_row_size = 1;
+		for (size_t i = 1; i < _shape.size(); i++)
+			_row_size *= _shape[i];
+		_dtype = first.dtype();
+		_shards = std::move(shards);
+		return result::ok;
+	}
+
+
+	/*
+	 * clear - release all shards
+	 */
+	void
+	clear()
+	{
+		_shards.clear();
+		_offsets.clear();
+		_shape.clear();
+		_dtype = {};
+		_row_size = 0;
+	}
+
+
+	/*
+	 * locate - find the shard and the row within the shard for a given row
+	 */
+	void
+	locate(u64 row, size_t &shard, u64 &local_row) const
+	{
+		if (row >= rows())
+			throw std::out_of_range("Index out of bounds\n");
+		auto it = std::upper_bound(_offsets.begin(), _offsets.end(), row);
+		shard = static_cast<size_t>(std::distance(_offsets.begin(), it)) - 1;
+		local_row = row - _offsets[shard];
+	}
+
+
+	/*
+	 * row - get the u8 span in the data buffer of a row
+	 */
+	u8_const_span
+	row(u64 index) const
+	{
+		size_t shard;
+		u64 local_row;
+		locate(index, shard, local_row);
+		return _shards[shard].data().subspan(local_row * row_bytesize(), row_bytesize());
+	}
+
+
+	/*
+	 * get - get the u8 span in the data buffer for an element
+	 */
+	template <typename ...Indexes>
+	u8_const_span
+	get(Indexes... index) const
+	{
+		return get(u64_vector{static_cast<u64>(index)...});
+	}
+
+
+	/*
+	 * get - get the u8 span in the data buffer for an element
+	 */
+	u8_const_span
+	get(const u64_vector &indexes) const
+	{
+		if (indexes.empty() || indexes.size() != _shape.size())
+			throw std::out_of_range("Number of indexes does not match number of dimensions\n");
+
+		size_t shard;
+		u64_vector local = indexes;
+		locate(indexes[0], shard, local[0]);
+		return _shards[shard].get(local);
+	}
+
+
+	/*
+	 * value - get a copy of the value at a given index
+	 */
+	template <typename T, typename... Indexes>
+	inline T
+	value(Indexes... index) const
+	{
+		if (_dtype.item_size < sizeof(T)) {
+			std::ostringstream s;
+			s << "Template argument type size (" << sizeof(T) << " bytes) exceeds location size (" << _dtype.item_size << " bytes)";
+			throw std::out_of_range(s.str());
+		}
+		T value;
+		std::memcpy(&value, this->get(index...).data(), sizeof(T));
+		return value;
+	}
+
+
+	/*
+	 * read_rows - copy count rows starting at first into a buffer
+	 *
+	 * The buffer needs to hold at least count * row_bytesize() bytes.
+	 */
+	result
+	read_rows(u64 first, u64 count, u8 *dest) const
+	{
+		if (first + count > rows() || first + count < first)
+			return result::error_invalid_item_offset;
+
+		// copy contiguous runs shard by shard
+		for_each_run(first, count, [&dest](u8_const_span run) {
+			std::memcpy(dest, run.data(), run.size());
+			dest += run.size();
+			return true;
+		});
+		return result::ok;
+	}
+
+
+	/*
+	 * slice - copy count rows starting at first into an ndarray
+	 */
+	result
+	slice(u64 first, u64 count, ndarray &dest) const
+	{
+		if (first + count > rows() || first + count < first)
+			return result::error_invalid_item_offset;
+
+		u8_vector buffer(count * row_bytesize());
+		result res;
+		if ((res = read_rows(first, count, buffer.data())) != result::ok)
+			return res;
+
+		u64_vector shape = _shape;
+		shape[0] = count;
+		struct dtype dt = _dtype;
+		dest.assign(std::move(dt), std::move(shape), std::move(buffer), storage_order::row_major);
+		return result::ok;
+	}
+
+
+	/*
+	 * for_each_run - call f for each contiguous run of rows within a range
+	 *
+	 * A range of rows spans one or more shards. f receives the data of each
+	 * part of the range that lies within a single shard, in order. If f
+	 * returns false, iteration stops.
+	 */
+	template <typename F>
+	void
+	for_each_run(u64 first, u64 count, F &&f) const
+	{
+		if (count == 0)
+			return;
+
+		size_t shard;
+		u64 local_row;
+		locate(first, shard, local_row);
+		while (count > 0 && shard < _shards.size()) {
+			u64 n = std::min(count, _shards[shard].shape()[0] - local_row);
+			if (n > 0 && !f(_shards[shard].data().subspan(local_row * row_bytesize(), n * row_bytesize())))
+				return;
+			count -= n;
+			local_row = 0;
+			++shard;
+		}
+	}
+
+
+	/*
+	 * row_iterator - iterate over the rows of all shards
+	 */
+	struct row_iterator
+	{
+		using iterator_category = std::forward_iterator_tag;
+		using value_type        = u8_const_span;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = void;
+		using reference         = u8_const_span;
+
+		const sharded_array *array {nullptr};
+		size_t shard               {0};
+		u64 local_row              {0};
+
+		u8_const_span
+		operator*() const
+		{
+			return array->_shards[shard].data().subspan(local_row * array->row_bytesize(), array->row_bytesize());
+		}
+
+		row_iterator&
+		operator++()
+		{
+			if (++local_row >= array->_shards[shard].shape()[0]) {
+				local_row = 0;
+				++shard;
+				// skip empty shards
+				while (shard < array->_shards.size() && array->_shards[shard].shape()[0] == 0)
+					++shard;
+			}
+			return *this;
+		}
+
+		row_iterator
+		operator++(int)
+		{
+			row_iterator tmp = *this;
+			++(*this);
+			return tmp;
+		}
+
+		bool
+		operator==(const row_iterator &other) const
+		{
+			return shard == other.shard && local_row == other.local_row;
+		}
+	};
+
+	row_iterator
+	begin() const
+	{
+		row_iterator it{this, 0, 0};
+		while (it.shard < _shards.size() && _shards[it.shard].shape()[0] == 0)
+			++it.shard;
+		return it;
+	}
+
+	row_iterator end() const { return row_iterator{this, _shards.size(), 0}; }
+
+
+	//
+	// property getters
+	//
+	const struct dtype&  dtype()        const { return _dtype; }
+	storage_order        order()        const { return storage_order::row_major; }
+	const u64_vector&    shape()        const { return _shape; }
+	u64                  rows()         const { return _offsets.empty() ? 0 : _offsets.back(); }
+	size_t               size()         const { return rows() * _row_size; }
+	size_t               bytesize()     const { return size() * _dtype.item_size; }
+	size_t               row_bytesize() const { return _row_size * _dtype.item_size; }
+	bool                 empty()        const { return _shards.empty(); }
+
+	// access to the individual shards and the first row of each shard
+	size_t               shard_count()  const { return _shards.size(); }
+	const mmap_ndarray&  shard(size_t i) const { return _shards[i]; }
+	const u64_vector&    offsets()      const { return _offsets; }
+
+private:
+	struct dtype
+		_dtype;
+
+	// logical shape of the concatenated array
+	u64_vector
+		_shape;
+
+	// number of elements per row
+	u64
+		_row_size                   {0};
+
+	std::vector<mmap_ndarray>
+		_shards;
+
+	// prefix sum of the shard sizes along the first dimension
+	u64_vector
+		_offsets;
+};
+
+
+/*
+ * open_sharded - open a list of npy files as one sharded array
+ *
+ * The files are concatenated in the order in which they are given.
+ */
+inline result
+open_sharded(const std::vector<std::filesystem::path> &filepaths, sharded_array &array)
+{
+	std::vector<mmap_ndarray> shards(filepaths.size());
+	for (size_t i = 0; i < filepaths.size(); i++) {
+		result res = from_npy_mmap(filepaths[i], shards[i]);
+		if (is_error(res))
+			return res;
+	}
+	return array.assign(std::move(shards));
+}
+
+
+/*
+ * sharded_filename - get the file name of a shard for a given path prefix
+ *
+ * Shards are named <prefix>-00000.npy, <prefix>-00001.npy, and so on.
+ */
+inline std::filesystem::path
+sharded_filename(const std::filesystem::path &prefix, size_t index)
+{
+	char suffix[32];
+	std::snprintf(suffix, sizeof(suffix), "-%05zu.npy", index);
+	return std::filesystem::path(prefix.native() + suffix);
+}
+
+
+/*
+ * sharded_manifest_filename - get the file name of the manifest of shards
+ *
+ * The manifest is an npy file with a u64 array of length N+1 for N shards.
+ * Entry i is the first row of shard i, and entry N the total number of rows.
+ */
+inline std::filesystem::path
+sharded_manifest_filename(const std::filesystem::path &prefix)
+{
+	return std::filesystem::path(prefix.native() + ".manifest.npy");
+}
+
+
+/*
+ * open_sharded_manifest - open exactly the shards that are listed in a manifest
+ *
+ * prefix is the prefix that was passed to write_shards or save_sharded. The
+ * number of rows of each shard is checked against the manifest.
+ */
+inline result
+open_sharded_manifest(const std::filesystem::path &prefix, sharded_array &array)
+{
+	result res;
+	ndarray manifest;
+	if ((res = from_npy(sharded_manifest_filename(prefix), manifest), is_error(res)))
+		return res;
+
+	if (manifest.dtype().type_code != 'u' || manifest.dtype().size != sizeof(u64) ||
+	    manifest.shape().size() != 1 || manifest.shape()[0] == 0)
+		return result::error_wrong_filetype;
+
+	const size_t n_shards = manifest.shape()[0] - 1;
+	u64_vector offsets(n_shards + 1);
+	std::memcpy(offsets.data(), manifest.data().data(), offsets.size() * sizeof(u64));
+	constexpr byte_order native = (std::endian::native == std::endian::little) ? byte_order::little : byte_order::big;
+	if (manifest.dtype().endianness == byte_order::little || manifest.dtype().endianness == byte_order::big)
+		if (manifest.dtype().endianness != native)
+			for (auto &o: offsets)
+				o = bswap<u64>(o);
+
+	std::vector<mmap_ndarray> shards(n_shards);
+	for (size_t i = 0; i < n_shards; i++) {
+		if ((res = from_npy_mmap(sharded_filename(prefix, i), shards[i]), is_error(res)))
+			return res;
+		if (shards[i].shape().empty() || offsets[i + 1] < offsets[i] ||
+		    shards[i].shape()[0] != offsets[i + 1] - offsets[i])
+			return result::error_data_size_mismatch;
+	}
+	return array.assign(std::move(shards));
+}
+
+
+/*
+ * open_sharded - open shards by glob pattern or by the prefix they were written with
+ *
+ * If pattern contains no wildcards and a manifest exists for it (see
+ * sharded_manifest_filename), pattern is taken as the prefix that was passed to
+ * write_shards or save_sharded, and exactly the shards listed in the manifest
+ * are opened. This is the safe way to open shards written by this library, as
+ * it never picks up unrelated files that happen to match a pattern. Otherwise,
+ * all files matching the glob pattern are concatenated in lexicographic order
+ * of their names.
+ *
+ * Note that a braced list of file names is ambiguous between the two overloads
+ * of open_sharded. Pass an std::vector explicitly in this case.
+ */
+inline result
+open_sharded(const std::string &pattern, sharded_array &array)
+{
+	if (pattern.find_first_of("*?[") == std::string::npos) {
+		std::error_code ec;
+		if (std::filesystem::exists(sharded_manifest_filename(pattern), ec))
+			return open_sharded_manifest(pattern, array);
+	}
+
+	glob_t g {};
+	std::vector<std::filesystem::path> filepaths;
+	int rc = ::glob(pattern.c_str(), 0, nullptr, &g);
+	if (rc == 0)
+		filepaths.assign(g.gl_pathv, g.gl_pathv + g.gl_pathc);
+	::globfree(&g);
+
+	if (rc == GLOB_NOMATCH)
+		return result::error_file_not_found;
+	if (rc != 0)
+		return result::error_file_open_failed;
+	return open_sharded(filepaths, array);
+}
+
+
+/*
+ * remove_shards - remove shard files of a prefix, starting at a given index
+ *
+ * Only files named exactly like the shards of prefix (see sharded_filename)
+ * are removed.
+ */
+inline void
+remove_shards(const std::filesystem::path &prefix, size_t first_index = 0)
+{
+	namespace fs = std::filesystem;
+	const fs::path dir    = prefix.has_parent_path() ? prefix.parent_path() : fs::path(".");
+	const std::string stem = prefix.filename().native() + "-";
+	const std::string ext  = ".npy";
+
+	std::error_code ec;
+	std::vector<fs::path> stale;
+	for (auto it = fs::directory_iterator(dir, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+		const std::string name = it->path().filename().native();
+		if (name.size() <= stem.size() + ext.size() || !name.starts_with(stem) || !name.ends_with(ext))
+			continue;
+
+		const std::string digits = name.substr(stem.size(), name.size() - stem.size() - ext.size());
+		if (digits.size() < 5 || !std::all_of(digits.begin(), digits.end(), [](char c){ return c >= '0' && c <= '9'; }))
+			continue;
+		if (std::stoull(digits) >= first_index && sharded_filename(prefix, std::stoull(digits)).filename() == it->path().filename())
+			stale.push_back(it->path());
+	}
+	for (auto &p: stale)
+		fs::remove(p, ec);
+}
+
+
+template <typename F>
+concept ShardSource = requires(F f, u64 first_row, u64 count, u8_vector &scratch) {
+	{ f(first_row, count, scratch) } -> std::same_as<std::optional<u8_const_span>>;
+};
+
+template <typename F>
+concept ShardProducer = requires(F f, u64 first_row, u64 count, u8 *dest) {
+	{ f(first_row, count, dest) } -> std::same_as<bool>;
+};
+
+
+/*
+ * write_shards - write an array to shard files in parallel
+ *
+ * shape is the shape of the entire array, which will be split into shards of
+ * rows_per_shard rows along the first dimension. For each shard, the source
+ * returns the payload of rows [first_row, first_row + count). It can either
+ * return a span into existing data, or fill the scratch buffer (which is
+ * local to each thread) and return a span to it. Returning std::nullopt
+ * aborts writing.
+ *
+ * The shards are written by n_threads threads concurrently (or the number of
+ * hardware threads if n_threads is 0). The source is called concurrently from
+ * these threads. Each shard is written as header followed directly by the
+ * payload. Finally, a manifest of the row offsets of all shards is written
+ * (see sharded_manifest_filename).
+ *
+ * With overwrite, the manifest of an earlier export is removed before any
+ * shard is written, and shards of an earlier export that are beyond the new
+ * number of shards are removed once the new manifest was written. If writing
+ * fails, all shards that were written so far are removed again (with
+ * overwrite, all shards of prefix) and no manifest is written.
+ */
+template <ShardSource F>
+inline result
+write_shards(const std::filesystem::path &prefix, const dtype &dt, const u64_vector &shape, u64 rows_per_shard, F &&source, bool overwrite=false, unsigned n_threads=0)
+{
+	if (shape.empty() || rows_per_shard == 0)
+		return result::error_shape_invalid_value;
+
+	const u64 rows = shape[0];
+	u64 row_size = dt.item_size;
+	for (size_t i = 1; i < shape.size(); i++)
+		row_size *= shape[i];
+
+	// always write at least one (empty) shard to retain the dtype and shape
+	const size_t n_shards = std::max<u64>(1, (rows + rows_per_shard - 1) / rows_per_shard);
+
+	if (!overwrite) {
+		if (std::filesystem::exists(sharded_manifest_filename(prefix)))
+			return result::error_file_exists;
+		for (size_t i = 0; i < n_shards; i++)
+			if (std::filesystem::exists(sharded_filename(prefix, i)))
+				return result::error_file_exists;
+	}
+	else {
+		// a manifest must never describe a partially written set of shards
+		std::error_code ec;
+		std::filesystem::remove(sharded_manifest_filename(prefix), ec);
+		if (ec)
+			return result::error_file_write_failed;
+	}
+
+	if (n_threads == 0)
+		n_threads = std::max(1u, std::thread::hardware_concurrency());
+	n_threads = static_cast<unsigned>(std::min<size_t>(n_threads, n_shards));
+
+	std::atomic<size_t> next_shard {0};
+	std::atomic<result> error {result::ok};
+
+	// shards which were opened for writing, and which need to be removed if
+	// writing fails. each entry is only touched by the thread that writes
+	// the shard
+	std::vector<u8> opened(n_shards, 0);
+
+	auto worker = [&]() {
+		u8_vector scratch;
+		u8_vector header;
+		for (size_t i; (i = next_shard.fetch_add(1)) < n_shards; ) {
+			if (error.load(std::memory_order_relaxed) != result::ok)
+				return;
+
+			const u64 first = i * rows_per_shard;
+			const u64 count = std::min(rows_per_shard, rows - std::min(rows, first));
+
+			result res = result::ok;
+			std::optional<u8_const_span> payload = source(first, count, scratch);
+			if (!payload || payload->size() != count * row_size)
+				res = result::error_data_size_mismatch;
+
+			u64_vector shard_shape = shape;
+			shard_shape[0] = count;
+			if (res == result::ok)
+				res = to_npy_header(dt, shard_shape, storage_order::row_major, header);
+
+			if (res == result::ok) {
+				const auto filepath = sharded_filename(prefix, i);
+				int fd = ::open(filepath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (overwrite ? O_TRUNC : O_EXCL), 0666);
+				if (fd < 0)
+					res = (errno == EEXIST) ? result::error_file_exists : result::error_file_open_failed;
+				else {
+					opened[i] = 1;
+					if (!write_all(fd, header.data(), header.size()) || !write_all(fd, payload->data(), payload->size()))
+						res = result::error_file_write_failed;
+					if (::close(fd) != 0 && res == result::ok)
+						res = result::error_file_close;
+				}
+			}
+
+			if (res != result::ok) {
+				result expected = result::ok;
+				error.compare_exchange_strong(expected, res);
+				return;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < n_threads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t: threads)
+		t.join();
+
+	// when overwriting, the shards of an earlier export are already
+	// unusable at this point, because their manifest was removed
+	auto remove_opened = [&]() {
+		std::error_code ec;
+		if (overwrite)
+			remove_shards(prefix);
+		else for (size_t i = 0; i < n_shards; i++)
+			if (opened[i])
+				std::filesystem::remove(sharded_filename(prefix, i), ec);
+	};
+
+	if (error.load() != result::ok) {
+		remove_opened();
+		return error.load();
+	}
+
+	// manifest with the first row of each shard
+	u8_vector offsets((n_shards + 1) * sizeof(u64));
+	for (size_t i = 0; i <= n_shards; i++) {
+		u64 offset = std::min(rows, static_cast<u64>(i) * rows_per_shard);
+		std::memcpy(offsets.data() + i * sizeof(u64), &offset, sizeof(u64));
+	}
+	ndarray manifest(dtype_uint64(), u64_vector{n_shards + 1}, std::move(offsets));
+	result res;
+	if ((res = save(sharded_manifest_filename(prefix), manifest, overwrite)) != result::ok) {
+		std::error_code ec;
+		std::filesystem::remove(sharded_manifest_filename(prefix), ec);
+		remove_opened();
+		return res;
+	}
+
+	// shards of an earlier, larger export
+	if (overwrite)
+		remove_shards(prefix, n_shards);
+	return result::ok;
+}
+
+
+/*
+ * save_sharded - save an array to several npy files
+ *
+ * The array is split along the first dimension into shards of rows_per_shard
+ * rows, which are written in parallel directly from the array's data. Only C
+ * (row-major) ordered arrays can be split this way. See write_shards for
+ * details.
+ *
+ * Example:
+ *
+ *     numpy::save_sharded("export/part", arr, 1 << 20);
+ *     // ...
+ *     numpy::open_sharded("export/part", sharded);
+ */
+inline result
+save_sharded(const std::filesystem::path &prefix, const ndarray &arr, u64 rows_per_shard, bool overwrite=false, unsigned n_threads=0)
+{
+	if (arr.order() != storage_order::row_major && arr.shape().size() > 1)
+		return result::error_unavailable;
+
+	u64 row_bytesize = arr.dtype().item_size;
+	for (size_t i = 1; i < arr.shape().size(); i++)
+		row_bytesize *= arr.shape()[i];
+
+	u8_const_span data(arr.data());
+	auto source = [&](u64 first, u64 count, u8_vector &) -> std::optional<u8_const_span> {
+		return data.subspan(first * row_bytesize, count * row_bytesize);
+	};
+	return write_shards(prefix, arr.dtype(), arr.shape(), rows_per_shard, source, overwrite, n_threads);
+}
+
+
+/*
+ * save_sharded - save data from a producer to several npy files
+ *
+ * This is useful for data that does not fit into memory at once. shape is the
+ * shape of the entire array. The producer fills count rows starting at
+ * first_row into the destination buffer, which can hold exactly count rows of
+ * data, and returns false on failure. Note that the producer is called
+ * concurrently from several threads.
+ */
+template <ShardProducer F>
+inline result
+save_sharded(const std::filesystem::path &prefix, const dtype &dt, const u64_vector &shape, u64 rows_per_shard, F &&producer, bool overwrite=false, unsigned n_threads=0)
+{
+	u64 row_bytesize = dt.item_size;
+	for (size_t i = 1; i < shape.size(); i++)
+		row_bytesize *= shape[i];
+
+	auto source = [&](u64 first, u64 count, u8_vector &scratch) -> std::optional<u8_const_span> {
+		scratch.resize(count * row_bytesize);
+		if (!producer(first, count, scratch.data()))
+			return std::nullopt;
+		return u8_const_span(scratch);
+	};
+	return write_shards(prefix, dt, shape, rows_per_shard, source, overwrite, n_threads);
+}
+
+
+}} // ncr::numpy
+
+#endif /* _0b9d4e7a36f1428c95a2d8c1e47b6f03_ */
+
+/*
+ * ncr/numpy_take.hpp - gather rows from arrays on disk
+ *
+ */
+#ifndef _7d2c61a9f8e04b3fa1c5e96b20d84a17_
+#define _7d2c61a9f8e04b3fa1c5e96b20d84a17_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * take_options - options for gather reads
+ */
+struct take_options
+{
+	// rows which are at most gap_threshold bytes apart on disk are read with a
+	// single read, and the bytes in between are discarded. 0 merges only
+	// adjacent rows
+	u64
+		gap_threshold               {64 << 10};
+
+	// upper limit for the size of a single merged read
+	u64
+		max_read_size               {8 << 20};
+
+	// number of threads which issue reads. 0 selects the number of hardware
+	// threads
+	unsigned
+		n_threads                   {0};
+};
+
+
+/*
+ * gather_rows - read rows of a C ordered array from a file
+ *
+ * The payload of the array starts at data_offset within the file, and has
+ * rows rows of row_bytesize bytes each. The rows given by indices are copied
+ * to dest, in the order of indices, i.e. row indices[i] is copied to dest + i *
+ * row_bytesize. dest needs to hold indices.size() * row_bytesize bytes.
+ *
+ * Indices may be unsorted and contain duplicates. They are sorted and
+ * deduplicated internally, nearby rows are merged into larger reads (see
+ * take_options), and the reads are issued in parallel using pread.
+ */
+inline result
+gather_rows(int fd, u64 data_offset, u64 row_bytesize, u64 rows, std::span<const u64> indices, u8 *dest, const take_options &opts = {})
+{
+	if (indices.empty() || row_bytesize == 0)
+		return result::ok;
+
+	// positions into indices, sorted by row
+	std::vector<u64> order(indices.size());
+	for (u64 i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&indices](u64 a, u64 b){ return indices[a] < indices[b]; });
+	if (indices[order.back()] >= rows)
+		return result::error_invalid_item_offset;
+
+	// coalesce rows into runs. each run covers the rows [first_row, last_row]
+	// on disk, and the entries [begin, end) of order
+	struct run {
+		u64 first_row, last_row;
+		u64 begin, end;
+	};
+	std::vector<run> runs;
+	for (u64 k = 0; k < order.size(); k++) {
+		const u64 row = indices[order[k]];
+		if (!runs.empty()) {
+			run &r = runs.back();
+			if (row == r.last_row) {
+				r.end = k + 1;
+				continue;
+			}
+			const u64 gap = (row - r.last_row - 1) * row_bytesize;
+			const u64 len = (row - r.first_row + 1) * row_bytesize;
+			if (gap <= opts.gap_threshold && len <= opts.max_read_size) {
+				r.last_row = row;
+				r.end = k + 1;
+				continue;
+			}
+		}
+		runs.push_back({row, row, k, k + 1});
+	}
+
+	unsigned n_threads = opts.n_threads ? opts.n_threads : std::max(1u, std::thread::hardware_concurrency());
+	n_threads = static_cast<unsigned>(std::min<size_t>(n_threads, runs.size()));
+
+	std::atomic<size_t> next_run {0};
+	std::atomic<result> error {result::ok};
+
+	auto worker = [&]() {
+		u8_vector scratch;
+		for (size_t i; (i = next_run.fetch_add(1)) < runs.size(); ) {
+			if (error.load(std::memory_order_relaxed) != result::ok)
+				return;
+
+			const run &r = runs[i];
+			const u64 length = (r.last_row - r.first_row + 1) * row_bytesize;
+
+			// single rows are read directly into their destination
+			u8 *buffer;
+			if (r.first_row == r.last_row)
+				buffer = dest + order[r.begin] * row_bytesize;
+			else {
+				scratch.resize(length);
+				buffer = scratch.data();
+			}
+
+			fd_reader reader(fd, data_offset + rows * row_bytesize, data_offset + r.first_row * row_bytesize);
+			if (reader.read(buffer, length) != length) {
+				result expected = result::ok;
+				error.compare_exchange_strong(expected, reader.fail() ? result::error_file_read_failed : result::error_file_truncated);
+				return;
+			}
+
+			// scatter back to the positions in the caller's order
+			for (u64 k = r.begin; k < r.end; k++) {
+				u8 *target = dest + order[k] * row_bytesize;
+				const u8 *src = buffer + (indices[order[k]] - r.first_row) * row_bytesize;
+				if (target != src)
+					std::memcpy(target, src, row_bytesize);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < n_threads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t: threads)
+		t.join();
+
+	return error.load();
+}
+
+
+/*
+ * take_fd - gather rows of an npy file along the first axis
+ *
+ * The result is an array with the same data type as the file, and shape
+ * (indices.size(), ...). Only C (row-major) ordered arrays are supported,
+ * except for one-dimensional arrays. The file descriptor remains owned by
+ * the caller.
+ */
+inline result
+take_fd(int fd, const u64_vector &indices, ndarray &dest, const take_options &opts = {}, npyfile *npy = nullptr)
+{
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+		return result::error_file_read_failed;
+
+	npyfile _tmp;
+	npyfile *npy_ptr = npy ? npy : &_tmp;
+	npy_ptr->file_size = static_cast<u64>(st.st_size);
+
+	dtype         dt;
+	u64_vector    shape;
+	storage_order order;
+	result res;
+	fd_reader reader(fd, static_cast<u64>(st.st_size));
+	if ((res = process_file_header(reader, *npy_ptr, dt, shape, order), is_error(res)))
+		return res;
+
+	if (shape.empty())
+		return result::error_shape_invalid_value;
+	if (order != storage_order::row_major && shape.size() > 1)
+		return result::error_unavailable;
+
+	// shapes of crafted headers can overflow
+	u64 row_bytesize = dt.item_size, size;
+	for (size_t i = 1; i < shape.size(); i++)
+		if (!checked_mul(row_bytesize, shape[i], row_bytesize))
+			return result::error_data_size_mismatch;
+	if (!checked_mul(shape[0], row_bytesize, size) || size > npy_ptr->data_size)
+		return result::error_data_size_mismatch;
+
+	u8_vector buffer(indices.size() * row_bytesize);
+	result tmp;
+	if ((tmp = gather_rows(fd, npy_ptr->data_offset, row_bytesize, shape[0], indices, buffer.data(), opts)) != result::ok)
+		return tmp;
+
+	shape[0] = indices.size();
+	dest.assign(std::move(dt), std::move(shape), std::move(buffer), order);
+	return res;
+}
+
+
+/*
+ * take - gather rows of an npy file along the first axis
+ *
+ * This reads only the requested rows, which makes random access to arrays
+ * that are larger than the available memory feasible. See gather_rows and
+ * take_fd for details.
+ *
+ * Example:
+ *
+ *     numpy::ndarray batch;
+ *     numpy::take("features.npy", {52311, 17, 90210, 17}, batch);
+ */
+inline result
+take(const std::filesystem::path &filepath, const u64_vector &indices, ndarray &dest, const take_options &opts = {}, npyfile *npy = nullptr)
+{
+	int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return (errno == ENOENT) ? result::error_file_not_found : result::error_file_open_failed;
+
+	result res = take_fd(fd, indices, dest, opts, npy);
+	::close(fd);
+	return res;
+}
+
+
+/*
+ * take - gather rows of a sharded array along the first axis
+ */
+inline result
+take(const sharded_array &array, const u64_vector &indices, ndarray &dest)
+{
+	if (array.empty())
+		return result::error_unavailable;
+
+	const u64 row_bytesize = array.row_bytesize();
+	u8_vector buffer(indices.size() * row_bytesize);
+	for (size_t i = 0; i < indices.size(); i++) {
+		if (indices[i] >= array.rows())
+			return result::error_invalid_item_offset;
+		std::memcpy(buffer.data() + i * row_bytesize, array.row(indices[i]).data(), row_bytesize);
+	}
+
+	u64_vector shape = array.shape();
+	shape[0] = indices.size();
+	struct dtype dt = array.dtype();
+	dest.assign(std::move(dt), std::move(shape), std::move(buffer), storage_order::row_major);
+	return result::ok;
+}
+
+
+}} // ncr::numpy
+
+#endif /* _7d2c61a9f8e04b3fa1c5e96b20d84a17_ */
+
+/*
+ * ncr/numpy_batches.hpp - shuffled minibatches with background prefetching
+ *
+ */
+#ifndef _31f8c0a5d6e24b7c9e0a4f12b8d3c6e9_
+#define _31f8c0a5d6e24b7c9e0a4f12b8d3c6e9_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * batch_loader_options - configuration of a batch_loader
+ */
+struct batch_loader_options
+{
+	// number of rows per batch
+	u64
+		batch_size                  {32};
+
+	// shuffle rows at the beginning of each epoch. The permutation depends
+	// only on seed and the epoch number, i.e. it is reproducible
+	bool
+		shuffle                     {true};
+
+	u64
+		seed                        {0};
+
+	// skip the last batch of an epoch if it has less than batch_size rows
+	bool
+		drop_last                   {false};
+
+	// number of batch buffers. 2 means double buffering, 3 triple buffering
+	unsigned
+		n_buffers                   {2};
+
+	// number of background threads which fill batch buffers. At most
+	// n_buffers threads can make progress at any time
+	unsigned
+		n_threads                   {1};
+
+	// alignment of the batch buffers in bytes
+	size_t
+		alignment                   {64};
+
+	// options for reading rows from npy files. see take_options
+	take_options
+		read_options                {.n_threads = 1};
+};
+
+
+/*
+ * batch_view - a batch of rows as returned from batch_loader::next
+ *
+ * The data is owned by the batch_loader and remains valid until the next call
+ * to next() or start_epoch().
+ */
+struct batch_view
+{
+	// index of the batch within the current epoch
+	u64
+		index                       {0};
+
+	// number of rows in this batch
+	u64
+		rows                        {0};
+
+	// row indices of the source array that make up this batch
+	std::span<const u64>
+		indices;
+
+	// rows * row_bytesize bytes of data, C ordered
+	u8_const_span
+		data;
+};
+
+
+/*
+ * batch_loader - iterate minibatches of rows of an npy file or sharded array
+ *
+ * Batches consist of batch_size rows along the first axis of the source. The
+ * rows of each epoch are shuffled with a seeded permutation. Background
+ * threads fill the next batches into a ring of aligned buffers while the
+ * caller works on the current batch.
+ *
+ * Example:
+ *
+ *     numpy::batch_loader loader;
+ *     loader.open("features.npy", {.batch_size = 256, .seed = 42});
+ *     for (u64 epoch = 0; epoch < 10; epoch++) {
+ *         loader.start_epoch(epoch);
+ *         numpy::batch_view batch;
+ *         while (loader.next(batch))
+ *             train(batch.data, batch.rows);
+ *         if (is_error(loader.last_result()))
+ *             ...
+ *     }
+ */
+struct batch_loader
+{
+	batch_loader() {}
+	batch_loader(const batch_loader &) = delete;
+	batch_loader& operator=(const batch_loader &) = delete;
+
+	~batch_loader() { close(); }
+
+
+	/*
+	 * open - iterate batches of a C ordered npy file
+	 */
+	result
+	open(const std::filesystem::path &filepath, const batch_loader_options &opts = {})
+	{
+		close();
+
+		int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return (errno == ENOENT) ? result::error_file_not_found : result::error_file_open_failed;
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			return result::error_file_read_failed;
+		}
+
+		npyfile npy;
+		storage_order order;
+		result res;
+		fd_reader reader(fd, static_cast<u64>(st.st_size));
+		if ((res = process_file_header(reader, npy, _dtype, _shape, order), is_error(res))) {
+			::close(fd);
+			return res;
+		}
+		if (_shape.empty() || (order != storage_order::row_major && _shape.size() > 1)) {
+			::close(fd);
+			return result::error_unavailable;
+		}
+
+		_fd = fd;
+		_data_offset = npy.data_offset;
+		if ((res = _setup(opts)) != result::ok) {
+			close();
+			return res;
+		}
+		if (_shape[0] * _row_bytesize > npy.data_size) {
+			close();
+			return result::error_data_size_mismatch;
+		}
+		return res;
+	}
+
+
+	/*
+	 * open - iterate batches of a sharded array
+	 */
+	result
+	open(sharded_array &&array, const batch_loader_options &opts = {})
+	{
+		close();
+		if (array.empty())
+			return result::error_unavailable;
+
+		_dtype = array.dtype();
+		_shape = array.shape();
+		_sharded = std::move(array);
+		result res;
+		if ((res = _setup(opts)) != result::ok)
+			close();
+		return res;
+	}
+
+
+	/*
+	 * close - stop prefetching and release the source and all buffers
+	 */
+	void
+	close()
+	{
+		_stop_threads();
+		if (_fd >= 0)
+			::close(_fd);
+		_fd = -1;
+		_sharded.clear();
+		_buffers.clear();
+		_permutation.clear();
+		_n_batches = 0;
+		_current = 0;
+	}
+
+
+	/*
+	 * start_epoch - start iterating the batches of an epoch
+	 *
+	 * Prefetching of the first batches starts immediately.
+	 */
+	result
+	start_epoch(u64 epoch)
+	{
+		_stop_threads();
+		if (_buffers.empty())
+			return result::error_reader_not_open;
+
+		const u64 rows = _shape[0];
+		_permutation.resize(rows);
+		for (u64 i = 0; i < rows; i++)
+			_permutation[i] = i;
+		if (_opts.shuffle) {
+			std::mt19937_64 rng(_opts.seed ^ (0x9e3779b97f4a7c15ull * (epoch + 1)));
+			std::shuffle(_permutation.begin(), _permutation.end(), rng);
+		}
+
+		_epoch     = epoch;
+		_n_batches = _opts.drop_last ? rows / _opts.batch_size : (rows + _opts.batch_size - 1) / _opts.batch_size;
+		_current   = 0;
+		_holding   = false;
+		_error     = result::ok;
+		_stop      = false;
+		_next_batch.store(0);
+		for (size_t i = 0; i < _buffers.size(); i++) {
+			_slot_batch[i] = i;
+			_slot_ready[i] = false;
+		}
+
+		for (unsigned t = 0; t < _opts.n_threads; t++)
+			_threads.emplace_back([this]{ _prefetch(); });
+		return result::ok;
+	}
+
+
+	/*
+	 * next - get the next batch of the current epoch
+	 *
+	 * Returns false at the end of the epoch or if an error occurred, which
+	 * can be queried with last_result(). The previous batch is released.
+	 */
+	bool
+	next(batch_view &batch)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		// release the batch that the caller held so far
+		if (_holding) {
+			const size_t slot = _current % _buffers.size();
+			_slot_ready[slot] = false;
+			_slot_batch[slot] = _current + _buffers.size();
+			_holding = false;
+			++_current;
+			_cv.notify_all();
+		}
+
+		if (_current >= _n_batches)
+			return false;
+
+		const size_t slot = _current % _buffers.size();
+		_cv.wait(lock, [&]{ return _error != result::ok || _slot_ready[slot]; });
+		if (_error != result::ok)
+			return false;
+
+		const u64 first = _current * _opts.batch_size;
+		batch.index   = _current;
+		batch.rows    = std::min(_opts.batch_size, _shape[0] - first);
+		batch.indices = std::span<const u64>(_permutation).subspan(first, batch.rows);
+		batch.data    = u8_const_span(_buffers[slot].get(), batch.rows * _row_bytesize);
+		_holding = true;
+		return true;
+	}
+
+
+	// data type and shape of the source. Batches have shape (rows, shape[1:])
+	const struct dtype& dtype()          const { return _dtype; }
+	const u64_vector&   shape()          const { return _shape; }
+	u64                 row_bytesize()   const { return _row_bytesize; }
+	u64                 batch_count()    const { return _n_batches; }
+	u64                 epoch()          const { return _epoch; }
+
+	result
+	last_result()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _error;
+	}
+
+
+private:
+	struct aligned_delete {
+		std::align_val_t alignment;
+		void operator()(u8 *ptr) const { ::operator delete[](ptr, alignment); }
+	};
+	using buffer_ptr = std::unique_ptr<u8[], aligned_delete>;
+
+	batch_loader_options
+		_opts;
+
+	// source: either an npy file or a sharded array
+	int
+		_fd                         {-1};
+
+	u64
+		_data_offset                {0};
+
+	sharded_array
+		_sharded;
+
+	struct dtype
+		_dtype;
+
+	u64_vector
+		_shape;
+
+	u64
+		_row_bytesize               {0},
+		_epoch                      {0},
+		_n_batches                  {0},
+		_current                    {0};
+
+	// the caller currently holds batch _current
+	bool
+		_holding                    {false},
+		_stop                       {false};
+
+	u64_vector
+		_permutation;
+
+	// ring of batch buffers. slot i holds (or will hold) batch _slot_batch[i]
+	std::vector<buffer_ptr>
+		_buffers;
+
+	u64_vector
+		_slot_batch;
+
+	std::vector<bool>
+		_slot_ready;
+
+	result
+		_error                      {result::ok};
+
+	std::atomic<u64>
+		_next_batch                 {0};
+
+	std::mutex
+		_mutex;
+
+	std::condition_variable
+		_cv;
+
+	std::vector<std::thread>
+		_threads;
+
+
+	result
+	_setup(const batch_loader_options &opts)
+	{
+		if (opts.batch_size == 0 || opts.n_buffers == 0 || opts.n_threads == 0 || !std::has_single_bit(opts.alignment))
+			return result::error_unavailable;
+
+		_opts = opts;
+		_row_bytesize = _dtype.item_size;
+		for (size_t i = 1; i < _shape.size(); i++)
+			_row_bytesize *= _shape[i];
+
+		const std::align_val_t alignment {std::max(opts.alignment, alignof(std::max_align_t))};
+		const size_t bytes = std::max<u64>(1, _opts.batch_size * _row_bytesize);
+		_buffers.clear();
+		for (unsigned i = 0; i < opts.n_buffers; i++)
+			_buffers.emplace_back(static_cast<u8*>(::operator new[](bytes, alignment)), aligned_delete{alignment});
+		_slot_batch.assign(opts.n_buffers, 0);
+		_slot_ready.assign(opts.n_buffers, false);
+		return result::ok;
+	}
+
+
+	void
+	_stop_threads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+			_cv.notify_all();
+		}
+		for (auto &t: _threads)
+			t.join();
+		_threads.clear();
+	}
+
+
+	result
+	_fill(u64 batch, u8 *dest)
+	{
+		const u64 first = batch * _opts.batch_size;
+		const u64 rows = std::min(_opts.batch_size, _shape[0] - first);
+		std::span<const u64> indices = std::span<const u64>(_permutation).subspan(first, rows);
+
+		if (_fd >= 0)
+			return gather_rows(_fd, _data_offset, _row_bytesize, _shape[0], indices, dest, _opts.read_options);
+
+		for (u64 i = 0; i < rows; i++)
+			std::memcpy(dest + i * _row_bytesize, _sharded.row(indices[i]).data(), _row_bytesize);
+		return result::ok;
+	}
+
+
+	void
+	_prefetch()
+	{
+		for (;;) {
+			const u64 batch = _next_batch.fetch_add(1);
+			if (batch >= _n_batches)
+				return;
+
+			// wait until the consumer released the previous batch in this slot
+			const size_t slot = batch % _buffers.size();
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cv.wait(lock, [&]{ return _stop || _error != result::ok || _slot_batch[slot] == batch; });
+				if (_stop || _error != result::ok)
+					return;
+			}
+
+			result res = _fill(batch, _buffers[slot].get());
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (res != result::ok)
+				_error = res;
+			else
+				_slot_ready[slot] = true;
+			_cv.notify_all();
+			if (res != result::ok)
+				return;
+		}
+	}
+};
+
+
+}} // ncr::numpy
+
+#endif /* _31f8c0a5d6e24b7c9e0a4f12b8d3c6e9_ */
+
+/*
+ * ncr/numpy_tar.hpp - read npy files from tar archives
+ *
+ */
+#ifndef _a4e9d2b71c0f4e36b8d5f0c3a92e7b18_
+#define _a4e9d2b71c0f4e36b8d5f0c3a92e7b18_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * tar_member - a regular file within a tar archive
+ */
+struct tar_member
+{
+	// full name of the member, including its path within the archive
+	std::string
+		name;
+
+	// offset of the (first) header block of the member
+	u64
+		header_offset               {0};
+
+	// offset and size of the member's data
+	u64
+		data_offset                 {0},
+		size                        {0};
+};
+
+
+/*
+ * tar_block_size - tar archives consist of blocks of 512 bytes
+ */
+constexpr u64 tar_block_size = 512;
+
+// GNU long names and pax extended headers are read into memory as a whole, and
+// are rejected if they are larger than this
+constexpr u64 tar_max_extended_header_size = 1 << 20;
+
+
+/*
+ * parse_tar_number - parse a numeric field of a tar header
+ *
+ * Numbers are stored as octal ASCII, or in base-256 if the high bit of the
+ * first byte is set (GNU extension for large files).
+ */
+inline bool
+parse_tar_number(const u8 *field, size_t length, u64 &value)
+{
+	value = 0;
+	if (field[0] & 0x80) {
+		for (size_t i = 0; i < length; i++) {
+			u8 byte = (i == 0) ? (field[i] & 0x7f) : field[i];
+			if (value >> 56)
+				return false;
+			value = (value << 8) | byte;
+		}
+		return true;
+	}
+
+	size_t i = 0;
+	while (i < length && field[i] == ' ')
+		i++;
+	for (; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+		value = (value << 3) | static_cast<u64>(field[i] - '0');
+	return i == length || field[i] == ' ' || field[i] == '\0';
+}
+
+
+/*
+ * tar_header - relevant information of a single tar header block
+ */
+struct tar_header
+{
+	std::string
+		name;
+
+	u64
+		size                        {0};
+
+	char
+		type                        {'0'};
+};
+
+
+/*
+ * parse_tar_header - parse a ustar (or pre-POSIX) header block
+ *
+ * Returns error_end_of_archive for the zero block that terminates an archive.
+ */
+inline result
+parse_tar_header(const u8 *block, tar_header &header)
+{
+	if (std::all_of(block, block + tar_block_size, [](u8 b){ return b == 0; }))
+		return result::error_end_of_archive;
+
+	// the checksum is computed with the checksum field set to spaces
+	u64 checksum;
+	if (!parse_tar_number(block + 148, 8, checksum))
+		return result::error_tar_header_invalid;
+	u64 sum = 8 * ' ';
+	for (size_t i = 0; i < tar_block_size; i++)
+		if (i < 148 || i >= 156)
+			sum += block[i];
+	if (sum != checksum)
+		return result::error_tar_header_invalid;
+
+	if (!parse_tar_number(block + 124, 12, header.size))
+		return result::error_tar_header_invalid;
+
+	auto field = [block](size_t offset, size_t length) {
+		const char *p = reinterpret_cast<const char*>(block + offset);
+		return std::string(p, strnlen(p, length));
+	};
+
+	header.type = static_cast<char>(block[156]);
+	header.name = field(0, 100);
+	if (std::memcmp(block + 257, "ustar", 5) == 0) {
+		std::string prefix = field(345, 155);
+		if (!prefix.empty())
+			header.name = prefix + "/" + header.name;
+	}
+	return result::ok;
+}
+
+
+/*
+ * parse_pax_path - get the path record of a pax extended header, if any
+ */
+inline bool
+parse_pax_path(u8_const_span data, std::string &path)
+{
+	// records have the format "<length> <key>=<value>\n"
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t length = 0, i = pos;
+		while (i < data.size() && data[i] >= '0' && data[i] <= '9' && length <= data.size())
+			length = length * 10 + (data[i++] - '0');
+		if (length == 0 || length > data.size() - pos || i >= data.size() || data[i] != ' ')
+			return false;
+		// the length includes itself, the space, and the newline
+		if (length < i + 2 - pos)
+			return false;
+
+		std::string_view record(reinterpret_cast<const char*>(data.data()) + i + 1, length - (i + 1 - pos) - 1);
+		if (record.starts_with("path=")) {
+			path = std::string(record.substr(5));
+			return true;
+		}
+		pos += length;
+	}
+	return false;
+}
+
+
+/*
+ * tar_padded_size - size of data rounded up to full blocks
+ *
+ * Returns false if the rounded size does not fit into 64 bits, which base-256
+ * sizes of crafted headers can provoke.
+ */
+inline bool
+tar_padded_size(u64 size, u64 &padded)
+{
+	if (size > std::numeric_limits<u64>::max() - (tar_block_size - 1))
+		return false;
+	padded = (size + tar_block_size - 1) / tar_block_size * tar_block_size;
+	return true;
+}
+
+
+/*
+ * tar_reader - random and sequential access to npy files in a tar archive
+ *
+ * Large datasets are often stored as tar archives of many npy files, e.g. in
+ * the WebDataset layout with members sample0001.input.npy,
+ * sample0001.label.npy, and so on. The tar_reader memory maps the archive and
+ * parses the headers of all members. npy members are parsed in place, i.e.
+ * they can be accessed as mmap_ndarray without copying them.
+ *
+ * Members can be read sequentially with next(). For random access, find()
+ * builds an index of members lazily, i.e. only as far as the archive needs to
+ * be scanned to find a member.
+ *
+ * Example:
+ *
+ *     numpy::tar_reader tar;
+ *     tar.open("shard-000042.tar");
+ *     numpy::tar_member member;
+ *     numpy::mmap_ndarray array;
+ *     while (tar.next(member)) {
+ *         if (member.name.ends_with(".npy") && tar.load(member, array) == numpy::result::ok)
+ *             ...
+ *     }
+ */
+struct tar_reader
+{
+	tar_reader() {}
+
+
+	/*
+	 * open - memory map a tar archive
+	 */
+	result
+	open(const std::filesystem::path &filepath)
+	{
+		int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return (errno == ENOENT) ? result::error_file_not_found : result::error_file_open_failed;
+		result res = open_fd(fd);
+		::close(fd);
+		return res;
+	}
+
+
+	/*
+	 * open_fd - memory map an opened tar archive
+	 *
+	 * The file descriptor remains owned by the caller and can be closed
+	 * after this call returns.
+	 */
+	result
+	open_fd(int fd)
+	{
+		close();
+		return map_fd(fd, _region);
+	}
+
+
+	/*
+	 * close - release the archive
+	 */
+	void
+	close()
+	{
+		_region.reset();
+		_members.clear();
+		_names.clear();
+		_scan_offset = 0;
+		_complete    = false;
+		_cursor      = 0;
+		_error       = result::ok;
+	}
+
+
+	/*
+	 * next - get the next regular file of the archive
+	 *
+	 * Returns false at the end of the archive, or if the archive is invalid.
+	 * Use last_result() to distinguish the two cases.
+	 */
+	bool
+	next(tar_member &member)
+	{
+		if (_cursor >= _members.size() && !_scan_one())
+			return false;
+		member = _members[_cursor++];
+		return true;
+	}
+
+
+	/*
+	 * rewind - restart sequential reading at the first member
+	 */
+	void rewind() { _cursor = 0; }
+
+
+	/*
+	 * find - find a member by name
+	 */
+	result
+	find(const std::string &name, tar_member &member)
+	{
+		auto it = _names.find(name);
+		while (it == _names.end()) {
+			if (!_scan_one())
+				return is_error(_error) ? _error : result::error_array_not_found;
+			if (_members.back().name == name)
+				it = _names.find(name);
+		}
+		member = _members[it->second];
+		return result::ok;
+	}
+
+
+	/*
+	 * members - get all members of the archive
+	 *
+	 * This scans the entire archive if it was not scanned already.
+	 */
+	const std::vector<tar_member>&
+	members()
+	{
+		while (_scan_one())
+			;
+		return _members;
+	}
+
+
+	/*
+	 * data - get the bytes of a member
+	 */
+	u8_const_span
+	data(const tar_member &member) const
+	{
+		return _region->span().subspan(member.data_offset, member.size);
+	}
+
+
+	/*
+	 * load - parse a npy member in place
+	 *
+	 * The array refers to the mapping of the archive, which stays alive as
+	 * long as the array does.
+	 */
+	result
+	load(const tar_member &member, mmap_ndarray &array, npyfile *npy = nullptr) const
+	{
+		if (!_region)
+			return result::error_reader_not_open;
+
+		npyfile _tmp;
+		npyfile *npy_ptr = npy ? npy : &_tmp;
+		npy_ptr->streaming = false;
+		npy_ptr->file_size = member.size;
+
+		dtype         dt;
+		u64_vector    shape;
+		storage_order order;
+		result res;
+		auto source = span_reader(data(member));
+		if ((res = process_file_header(source, *npy_ptr, dt, shape, order), is_error(res)))
+			return res;
+
+		result tmp;
+		if ((tmp = array.assign(_region, member.data_offset + npy_ptr->data_offset, std::move(dt), std::move(shape), order)) != result::ok)
+			return tmp;
+
+		// the mapping extends beyond the member, so check the size here
+		if (array.bytesize() > npy_ptr->data_size) {
+			array.clear();
+			return result::error_data_size_mismatch;
+		}
+		return res;
+	}
+
+
+	/*
+	 * load - copy a npy member into an ndarray
+	 */
+	result
+	load(const tar_member &member, ndarray &array, npyfile *npy = nullptr) const
+	{
+		if (!_region)
+			return result::error_reader_not_open;
+
+		npyfile _tmp;
+		auto bytes = data(member);
+		return from_buffer(u8_vector(bytes.begin(), bytes.end()), npy ? *npy : _tmp, array);
+	}
+
+
+	// result of scanning the archive. Either ok, or the error which stopped
+	// scanning
+	result last_result() const { return _error; }
+
+
+private:
+	std::shared_ptr<const mapped_region>
+		_region;
+
+	// members in the order of the archive, as far as scanned so far
+	std::vector<tar_member>
+		_members;
+
+	std::unordered_map<std::string, size_t>
+		_names;
+
+	// offset of the next header block that was not yet scanned
+	u64
+		_scan_offset                {0};
+
+	bool
+		_complete                   {false};
+
+	size_t
+		_cursor                     {0};
+
+	result
+		_error                      {result::ok};
+
+
+	/*
+	 * _scan_one - scan the archive until the next regular file
+	 */
+	bool
+	_scan_one()
+	{
+		if (_complete || !_region)
+			return false;
+
+		const u8_const_span archive = _region->span();
+		std::string long_name;
+		for (;;) {
+			// archives should end with zero blocks, but not all writers
+			// emit them. partial blocks are an error though
+			if (_scan_offset + tar_block_size > archive.size()) {
+				if (_scan_offset != archive.size())
+					_error = result::error_file_truncated;
+				break;
+			}
+
+			const u64 header_offset = _scan_offset;
+			tar_header header;
+			result res = parse_tar_header(archive.data() + header_offset, header);
+			if (res == result::error_end_of_archive)
+				break;
+			if (res != result::ok) {
+				_error = res;
+				break;
+			}
+
+			const u64 data_offset = header_offset + tar_block_size;
+			if (header.size > archive.size() - data_offset) {
+				_error = result::error_file_truncated;
+				break;
+			}
+			// header.size is bounded by the archive, and so is its padding
+			u64 padded_size;
+			tar_padded_size(header.size, padded_size);
+			_scan_offset = data_offset + padded_size;
+
+			const u8_const_span content = archive.subspan(data_offset, header.size);
+			switch (header.type) {
+			// GNU long name and pax extended header for the next member
+			case 'L':
+				long_name.assign(reinterpret_cast<const char*>(content.data()), strnlen(reinterpret_cast<const char*>(content.data()), content.size()));
+				break;
+			case 'x':
+				parse_pax_path(content, long_name);
+				break;
+
+			// regular files
+			case '0':
+			case '\0':
+			case '7': {
+				tar_member member;
+				member.name          = long_name.empty() ? std::move(header.name) : std::move(long_name);
+				member.header_offset = header_offset;
+				member.data_offset   = data_offset;
+				member.size          = header.size;
+				// the first occurrence of a name wins
+				_names.emplace(member.name, _members.size());
+				_members.push_back(std::move(member));
+				return true;
+			}
+
+			// directories, links, global pax headers, etc.
+			default:
+				long_name.clear();
+				break;
+			}
+		}
+		_complete = true;
+		return false;
+	}
+};
+
+
+/*
+ * read_tar_stream - read npy members of a tar archive from a stream
+ *
+ * This reads a tar archive sequentially from a file descriptor, e.g. a pipe
+ * or socket, which cannot be memory mapped. Each member whose name ends in
+ * ".npy" is loaded and passed to the callback, which returns false to stop
+ * reading. Other members are skipped.
+ *
+ * Example:
+ *
+ *     numpy::read_tar_stream(STDIN_FILENO, [](const std::string &name, numpy::ndarray &&arr) {
+ *         ...
+ *         return true;
+ *     });
+ */
+template <typename F>
+requires requires(F f, const std::string &name, ndarray &&array) {
+	{ f(name, std::move(array)) } -> std::same_as<bool>;
+}
+inline result
+read_tar_stream(int fd, F &&callback)
+{
+	// read exactly size bytes, or fail
+	auto read_exact = [fd](u8 *dest, u64 size) -> result {
+		while (size > 0) {
+			ssize_t n = ::read(fd, dest, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0)
+				return result::error_file_read_failed;
+			if (n == 0)
+				return result::error_file_truncated;
+			dest += n;
+			size -= static_cast<u64>(n);
+		}
+		return result::ok;
+	};
+
+	std::array<u8, tar_block_size> block;
+	std::string long_name;
+	u8_vector content;
+	for (;;) {
+		result res;
+		if ((res = read_exact(block.data(), block.size())) != result::ok)
+			return res;
+
+		tar_header header;
+		res = parse_tar_header(block.data(), header);
+		if (res == result::error_end_of_archive)
+			return result::ok;
+		if (res != result::ok)
+			return res;
+
+		const bool is_file = header.type == '0' || header.type == '\0' || header.type == '7';
+		const std::string name = long_name.empty() ? header.name : long_name;
+		const bool wanted = header.type == 'L' || header.type == 'x' || (is_file && name.ends_with(".npy"));
+
+		u64 padded_size;
+		if (!tar_padded_size(header.size, padded_size))
+			return result::error_tar_header_invalid;
+		if ((header.type == 'L' || header.type == 'x') && header.size > tar_max_extended_header_size)
+			return result::error_tar_header_invalid;
+
+		// read (or skip) the content including its padding. wanted content
+		// grows with the data that actually arrives, so that the size of a
+		// crafted header does not allocate memory up front
+		constexpr u64 chunk_size = 64 << 10;
+		content.clear();
+		if (!wanted)
+			content.resize(chunk_size);
+		for (u64 remaining = padded_size; remaining > 0; ) {
+			u64 n = std::min<u64>(remaining, wanted ? std::max<u64>(content.size(), chunk_size) : chunk_size);
+			u8 *dest = content.data();
+			if (wanted) {
+				content.resize(content.size() + n);
+				dest = content.data() + content.size() - n;
+			}
+			if ((res = read_exact(dest, n)) != result::ok)
+				return res;
+			remaining -= n;
+		}
+
+		if (header.type == 'L') {
+			long_name.assign(reinterpret_cast<const char*>(content.data()), strnlen(reinterpret_cast<const char*>(content.data()), header.size));
+			continue;
+		}
+		if (header.type == 'x') {
+			parse_pax_path(u8_const_span(content.data(), header.size), long_name);
+			continue;
+		}
+		long_name.clear();
+
+		if (is_file && wanted) {
+			content.resize(header.size);
+			npyfile npy;
+			ndarray array;
+			if ((res = from_buffer(std::move(content), npy, array), is_error(res)))
+				return res;
+			content = u8_vector();
+			if (!callback(name, std::move(array)))
+				return result::ok;
+		}
+	}
+}
+
+
+}} // ncr::numpy
+
+#endif /* _a4e9d2b71c0f4e36b8d5f0c3a92e7b18_ */
+
+/*
+ * ncr/numpy_npz_merge.hpp - merge and repack npz files without recompression
+ *
+ */
+#ifndef _d81f4a6c2e0b4b97a3c5e8f10b72d9a4_
+#define _d81f4a6c2e0b4b97a3c5e8f10b72d9a4_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * npz_member_copy - a file to copy from one of several archives
+ */
+struct npz_member_copy
+{
+	// index of the archive that contains the file
+	size_t
+		source                      {0};
+
+	// name of the file within the source and the destination archive
+	std::string
+		src_name,
+		dst_name;
+};
+
+
+template <typename F>
+concept NpzCopyPlan = requires(F f, const std::vector<std::vector<std::string>> &file_lists, std::vector<npz_member_copy> &members) {
+	{ f(file_lists, members) } -> std::same_as<result>;
+};
+
+template <typename F>
+concept NpzRenameCallback = requires(F f, size_t source, const std::string &name) {
+	{ f(source, name) } -> std::convertible_to<std::string>;
+};
+
+template <typename F>
+concept NpzFilterCallback = requires(F f, const std::string &name) {
+	{ f(name) } -> std::convertible_to<bool>;
+};
+
+
+/*
+ * copy_npz_members - copy files from several archives into a new archive
+ *
+ * All source archives are opened first, and plan receives the list of files
+ * of each of them. It then decides which files to copy under which name. The
+ * files are copied without decompressing them if the zip backend supports
+ * this. Otherwise, they are read and written again.
+ */
+template <NpzCopyPlan Plan>
+inline result
+copy_npz_members(std::filesystem::path filepath, const std::vector<std::filesystem::path> &sources, Plan &&plan, bool overwrite=false)
+{
+	namespace fs = std::filesystem;
+
+	// never overwrite one of the sources
+	std::error_code ec;
+	for (auto &source: sources)
+		if (fs::equivalent(filepath, source, ec))
+			return result::error_file_exists;
+	if (fs::exists(filepath) && !overwrite)
+		return result::error_file_exists;
+
+	zip::backend_interface zip_interface = zip::get_backend_interface();
+	std::vector<zip::backend_state*> states(sources.size(), nullptr);
+	zip::backend_state *zip_state = nullptr;
+
+	// the sources need to remain open until the destination was closed, see
+	// zip::backend_interface::copy
+	auto release_all = [&](result res) {
+		if (zip_state)
+			zip_interface.release(&zip_state);
+		for (auto &state: states) {
+			if (!state)
+				continue;
+			zip_interface.close(state);
+			zip_interface.release(&state);
+		}
+		return res;
+	};
+
+	std::vector<std::vector<std::string>> file_lists(sources.size());
+	for (size_t i = 0; i < sources.size(); i++) {
+		zip_interface.make(&states[i]);
+		if (zip_interface.open(states[i], sources[i], zip::filemode::read) != zip::result::ok) {
+			zip_interface.release(&states[i]);
+			return release_all(result::error_file_open_failed);
+		}
+		if (zip_interface.get_file_list(states[i], file_lists[i]) != zip::result::ok)
+			return release_all(result::error_file_read_failed);
+	}
+
+	result res;
+	std::vector<npz_member_copy> members;
+	if ((res = plan(file_lists, members)) != result::ok)
+		return release_all(res);
+
+	zip_interface.make(&zip_state);
+	if (zip_interface.open(zip_state, filepath, zip::filemode::write) != zip::result::ok)
+		return release_all(result::error_file_open_failed);
+
+	for (auto &m: members) {
+		if (m.source >= states.size())
+			return release_all(result::error_file_read_failed);
+
+		if (zip_interface.copy) {
+			if (zip_interface.copy(zip_state, states[m.source], m.src_name, m.dst_name) != zip::result::ok)
+				return release_all(result::error_file_write_failed);
+			continue;
+		}
+
+		// fallback: keep the previous compression of the file, if known
+		zip::file_stat st;
+		bool compress = true;
+		if (zip_interface.stat && zip_interface.stat(states[m.source], m.src_name, st) == zip::result::ok)
+			compress = st.compressed;
+
+		u8_vector buffer;
+		if (zip_interface.read(states[m.source], m.src_name, buffer) != zip::result::ok)
+			return release_all(result::error_file_read_failed);
+		if (zip_interface.write(zip_state, m.dst_name, std::move(buffer), compress, 0) != zip::result::ok)
+			return release_all(result::error_file_write_failed);
+	}
+
+	if (zip_interface.close(zip_state) != zip::result::ok)
+		return release_all(result::error_file_close);
+
+	return release_all(result::ok);
+}
+
+
+/*
+ * merge_npz - merge several npz files into a new npz file
+ *
+ * The arrays of all inputs are copied without recompressing them. rename
+ * receives the index of an input and the name of one of its arrays, and
+ * returns the name of the array in the merged file, or an empty string to
+ * drop the array. Names which occur more than once are resolved by policy,
+ * where replace means that arrays of later inputs take precedence.
+ */
+template <NpzRenameCallback Rename>
+inline result
+merge_npz(std::filesystem::path filepath, const std::vector<std::filesystem::path> &inputs, Rename &&rename, name_conflict policy = name_conflict::error, bool overwrite=false)
+{
+	auto plan = [&](const std::vector<std::vector<std::string>> &file_lists, std::vector<npz_member_copy> &members) {
+		std::unordered_map<std::string, size_t> index;
+		for (size_t i = 0; i < file_lists.size(); i++) {
+			for (auto &fname: file_lists[i]) {
+				// arrays are stored as name.npy
+				bool is_npy = fname.ends_with(".npy");
+				std::string name = rename(i, is_npy ? fname.substr(0, fname.size() - 4) : fname);
+				if (name.empty())
+					continue;
+				if (is_npy)
+					name += ".npy";
+
+				auto it = index.find(name);
+				if (it == index.end()) {
+					index[name] = members.size();
+					members.push_back({i, fname, name});
+				}
+				else if (policy == name_conflict::error)
+					return result::error_duplicate_array_name;
+				else if (policy == name_conflict::replace)
+					members[it->second] = {i, fname, name};
+			}
+		}
+		return result::ok;
+	};
+	return copy_npz_members(filepath, inputs, plan, overwrite);
+}
+
+
+/*
+ * merge_npz - merge several npz files into a new npz file
+ */
+inline result
+merge_npz(std::filesystem::path filepath, const std::vector<std::filesystem::path> &inputs, name_conflict policy = name_conflict::error, bool overwrite=false)
+{
+	return merge_npz(filepath, inputs, [](size_t, const std::string &name) { return name; }, policy, overwrite);
+}
+
+
+/*
+ * repack_npz - copy the arrays of an npz file for which filter returns true
+ *
+ * The arrays are copied without recompressing them.
+ */
+template <NpzFilterCallback Filter>
+inline result
+repack_npz(std::filesystem::path input, std::filesystem::path filepath, Filter &&filter, bool overwrite=false)
+{
+	return merge_npz(filepath, {input}, [&](size_t, const std::string &name) {
+		return filter(name) ? name : std::string{};
+	}, name_conflict::error, overwrite);
+}
+
+
+/*
+ * repack_npz - copy all arrays of an npz file
+ *
+ * This removes unreferenced data from archives which had arrays replaced or
+ * removed in place (see savez_append).
+ */
+inline result
+repack_npz(std::filesystem::path input, std::filesystem::path filepath, bool overwrite=false)
+{
+	return repack_npz(input, filepath, [](const std::string &) { return true; }, overwrite);
+}
+
+
+/*
+ * compact_npz - remove unreferenced data from an npz file in place
+ *
+ * The archive is repacked into a temporary file next to it, which then
+ * replaces the archive. The permissions of the archive are retained. See
+ * append_to_zip_archive, which calls this automatically.
+ */
+inline result
+compact_npz(const std::filesystem::path &filepath)
+{
+	struct stat st;
+	if (::stat(filepath.c_str(), &st) != 0)
+		return result::error_file_not_found;
+
+	std::string tmp = filepath.native() + ".compact-XXXXXX";
+	int fd = open_temporary_file(tmp);
+	if (fd < 0)
+		return result::error_file_open_failed;
+	::close(fd);
+
+	result res = repack_npz(filepath, tmp, true);
+	if (res == result::ok && ::chmod(tmp.c_str(), st.st_mode & 07777) != 0)
+		res = result::error_file_write_failed;
+	if (res == result::ok && ::rename(tmp.c_str(), filepath.c_str()) != 0)
+		res = result::error_file_write_failed;
+	if (res != result::ok)
+		::unlink(tmp.c_str());
+	return res;
+}
+
+
+}} // ncr::numpy
+
+#endif /* _d81f4a6c2e0b4b97a3c5e8f10b72d9a4_ */
+
+
+/*
+ * ncr/numpy_checkpoint.hpp - incremental checkpoints of npz files
+ *
+ */
+#ifndef _3f7b0e9d5c2a4e18b6d4a1c9e08f2b75_
+#define _3f7b0e9d5c2a4e18b6d4a1c9e08f2b75_
+
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * checkpoint_manifest_filename - get the filename of the manifest of a checkpoint
+ *
+ * The manifest is a text file with one line per array, which contains the
+ * content hash (in hex) and the name of the array, separated by a space.
+ */
+inline std::filesystem::path
+checkpoint_manifest_filename(const std::filesystem::path &filepath)
+{
+	return std::filesystem::path(filepath.native() + ".manifest");
+}
+
+
+/*
+ * read_checkpoint_manifest - read the manifest of a checkpoint
+ */
+inline result
+read_checkpoint_manifest(const std::filesystem::path &filepath, std::unordered_map<std::string, u64> &hashes)
+{
+	std::ifstream f(checkpoint_manifest_filename(filepath));
+	if (!f)
+		return result::error_file_not_found;
+
+	std::string line;
+	while (std::getline(f, line)) {
+		if (line.size() < 18 || line[16] != ' ')
+			return result::error_file_read_failed;
+		u64 hash = 0;
+		for (size_t i = 0; i < 16; i++) {
+			const char c = line[i];
+			if (c >= '0' && c <= '9')      hash = (hash << 4) | static_cast<u64>(c - '0');
+			else if (c >= 'a' && c <= 'f') hash = (hash << 4) | static_cast<u64>(c - 'a' + 10);
+			else return result::error_file_read_failed;
+		}
+		hashes[line.substr(17)] = hash;
+	}
+	return result::ok;
+}
+
+
+/*
+ * write_checkpoint_manifest - write the manifest of a checkpoint
+ */
+inline result
+write_checkpoint_manifest(const std::filesystem::path &filepath, const std::vector<savez_arg> &args, const u64_vector &hashes)
+{
+	std::string content;
+	char hex[20];
+	for (size_t i = 0; i < args.size(); i++) {
+		// such names cannot be represented, and the array is rewritten next time
+		if (args[i].name.find('\n') != std::string::npos)
+			continue;
+		std::snprintf(hex, sizeof(hex), "%016llx ", static_cast<unsigned long long>(hashes[i]));
+		content += hex;
+		content += args[i].name;
+		content += '\n';
+	}
+
+	const auto manifest = checkpoint_manifest_filename(filepath);
+	std::string tmp = manifest.native() + ".tmp-XXXXXX";
+	int fd = open_temporary_file(tmp);
+	if (fd < 0)
+		return result::error_file_open_failed;
+	bool ok = write_all(fd, reinterpret_cast<const u8*>(content.data()), content.size());
+	ok = (::close(fd) == 0) && ok;
+	if (!ok || ::rename(tmp.c_str(), manifest.c_str()) != 0) {
+		::unlink(tmp.c_str());
+		return result::error_file_write_failed;
+	}
+	return result::ok;
+}
+
+
+/*
+ * checkpoint_options - options for save_checkpoint
+ */
+struct checkpoint_options
+{
+	// compression of arrays which are written
+	bool
+		compress                    {true};
+
+	u32
+		compression_level           {0};
+
+	adaptive_compression
+		adaptive                    {};
+
+	// number of threads to hash arrays, 0 means hardware concurrency
+	unsigned
+		n_threads                   {0};
+};
+
+
+/*
+ * checkpoint_stats - what save_checkpoint did
+ */
+struct checkpoint_stats
+{
+	// arrays copied from the previous checkpoint
+	size_t
+		n_copied                    {0};
+
+	// arrays (re)compressed and written
+	size_t
+		n_written                   {0};
+};
+
+
+/*
+ * save_checkpoint - save name/array pairs to an npz file incrementally
+ *
+ * The content hash of each array is compared to the manifest of a previous
+ * checkpoint. Unchanged arrays are copied from the previous checkpoint
+ * without recompressing them (keeping their previous compression), and only
+ * changed arrays are written. If there is no previous checkpoint or manifest,
+ * all arrays are written.
+ *
+ * The checkpoint is written to a temporary file which then replaces filepath,
+ * which can thus be the same as previous. The manifest is written last, so
+ * that a checkpoint is never paired with a stale manifest.
+ */
+inline result
+save_checkpoint(std::filesystem::path filepath, std::filesystem::path previous, std::vector<savez_arg> args, checkpoint_options opts = {}, checkpoint_stats *stats = nullptr)
+{
+	// detect if there are any name clashes
+	std::unordered_set<std::string> _set;
+	for (auto &arg: args) {
+		if (_set.contains(arg.name))
+			return result::error_duplicate_array_name;
+		_set.insert(arg.name);
+	}
+
+	result res;
+	u64_vector hashes;
+	if ((res = content_hashes(args, hashes, opts.n_threads)) != result::ok)
+		return res;
+
+	zip::backend_interface zip_interface = zip::get_backend_interface();
+	zip::backend_state *prev_state = nullptr;
+	zip::backend_state *zip_state  = nullptr;
+
+	// a previous checkpoint that cannot be read is ignored
+	std::unordered_map<std::string, u64> previous_hashes;
+	std::unordered_set<std::string> previous_files;
+	if (!previous.empty() && read_checkpoint_manifest(previous, previous_hashes) == result::ok) {
+		std::vector<std::string> file_list;
+		zip_interface.make(&prev_state);
+		if (zip_interface.open(prev_state, previous, zip::filemode::read) != zip::result::ok) {
+			zip_interface.release(&prev_state);
+		}
+		else if (zip_interface.get_file_list(prev_state, file_list) != zip::result::ok) {
+			zip_interface.close(prev_state);
+			zip_interface.release(&prev_state);
+		}
+		previous_files.insert(file_list.begin(), file_list.end());
+	}
+
+	std::string tmp = filepath.native() + ".tmp-XXXXXX";
+	int fd = open_temporary_file(tmp);
+	if (fd < 0 || ::close(fd) != 0) {
+		if (prev_state) {
+			zip_interface.close(prev_state);
+			zip_interface.release(&prev_state);
+		}
+		return result::error_file_open_failed;
+	}
+
+	// the previous checkpoint needs to remain open until the new one was
+	// closed, see zip::backend_interface::copy
+	auto release_all = [&](result res) {
+		if (zip_state)
+			zip_interface.release(&zip_state);
+		if (prev_state) {
+			zip_interface.close(prev_state);
+			zip_interface.release(&prev_state);
+		}
+		if (res != result::ok)
+			::unlink(tmp.c_str());
+		return res;
+	};
+
+	zip_interface.make(&zip_state);
+	if (zip_interface.open(zip_state, tmp, zip::filemode::write) != zip::result::ok)
+		return release_all(result::error_file_open_failed);
+
+	checkpoint_stats _stats;
+	for (size_t i = 0; i < args.size(); i++) {
+		std::string name = args[i].name + ".npy";
+
+		auto it = previous_hashes.find(args[i].name);
+		if (prev_state && it != previous_hashes.end() && it->second == hashes[i] && previous_files.contains(name)) {
+			zip::result zres;
+			if (zip_interface.copy)
+				zres = zip_interface.copy(zip_state, prev_state, name, name);
+			else {
+				u8_vector buffer;
+				zip::file_stat st;
+				bool compress = opts.compress;
+				if (zip_interface.stat && zip_interface.stat(prev_state, name, st) == zip::result::ok)
+					compress = st.compressed;
+				if ((zres = zip_interface.read(prev_state, name, buffer)) == zip::result::ok)
+					zres = zip_interface.write(zip_state, name, std::move(buffer), compress, opts.compression_level);
+			}
+			if (zres != zip::result::ok)
+				return release_all(result::error_file_write_failed);
+			_stats.n_copied++;
+			continue;
+		}
+
+		bool member_compress;
+		u32 member_level;
+		u8_vector buffer;
+		if ((res = to_npy_buffer(args[i].array, buffer)) != result::ok)
+			return release_all(res);
+		select_compression(args[i], buffer, opts.compress, opts.compression_level, opts.adaptive, member_compress, member_level);
+		if (zip_interface.write(zip_state, name, std::move(buffer), member_compress, member_level) != zip::result::ok)
+			return release_all(result::error_file_write_failed);
+		_stats.n_written++;
+	}
+
+	if (zip_interface.close(zip_state) != zip::result::ok)
+		return release_all(result::error_file_close);
+	release_all(result::ok);
+
+	// remove the manifest of the checkpoint that is replaced before replacing it
+	const auto manifest = checkpoint_manifest_filename(filepath);
+	if (::unlink(manifest.c_str()) != 0 && errno != ENOENT) {
+		::unlink(tmp.c_str());
+		return result::error_file_write_failed;
+	}
+	if (::rename(tmp.c_str(), filepath.c_str()) != 0) {
+		::unlink(tmp.c_str());
+		return result::error_file_write_failed;
+	}
+	if ((res = write_checkpoint_manifest(filepath, args, hashes)) != result::ok)
+		return res;
+
+	if (stats)
+		*stats = _stats;
+	return result::ok;
+}
+
+
+}} // ncr::numpy
+
+#endif /* _3f7b0e9d5c2a4e18b6d4a1c9e08f2b75_ */
+
+
+/*
+ * ncr/numpy_npz_reader.hpp - ranged reads from arrays in npz files
+ *
+ */
+#ifndef _e61a9c3f0d2b4a7885f4c2d9b07e3a16_
+#define _e61a9c3f0d2b4a7885f4c2d9b07e3a16_
+
+#ifdef NCR_NUMPY_HAS_ZLIB
+
+namespace ncr { namespace numpy {
+
+
+/*
+ * inflate_window_size - size of the deflate dictionary
+ */
+constexpr u64 inflate_window_size = 32768;
+
+
+/*
+ * inflate_point - a position at which inflating a deflate stream can start
+ *
+ * This is the approach of zran.c from the zlib examples. Deflate blocks do not
+ * necessarily end on a byte boundary, and data within a block can refer back
+ * to up to 32K of preceeding data. A point thus records the bits of the
+ * previous byte that belong to the next block, and the last 32K of data before
+ * the point. Points at which the dictionary was reset (e.g. full flushes) have
+ * an empty window.
+ */
+struct inflate_point
+{
+	// offset into the uncompressed data
+	u64
+		out                         {0};
+
+	// offset into the compressed data of the first complete byte
+	u64
+		in                          {0};
+
+	// number of bits of the byte before in that belong to the next block
+	u8
+		bits                        {0};
+
+	// the (up to) 32K of uncompressed data that preceed out
+	u8_vector
+		window;
+};
+
+
+/*
+ * inflate_index - points at which a deflate stream can be entered
+ */
+struct inflate_index
+{
+	// size and crc of the uncompressed data
+	u64
+		size                        {0};
+
+	u32
+		crc32                       {0};
+
+	// points, sorted by their offset into the uncompressed data
+	std::vector<inflate_point>
+		points;
+};
+
+
+/*
+ * RawDataReader - reads size bytes at offset of compressed data into dest
+ */
+template <typename F>
+concept RawDataReader = requires(F f, u64 offset, u8 *dest, u64 size) {
+	{ f(offset, dest, size) } -> std::same_as<bool>;
+};
+
+
+/*
+ * build_inflate_index - inflate a raw deflate stream and record entry points
+ *
+ * A point is recorded at the beginning of the stream, and at the first block
+ * boundary after each span bytes of uncompressed data. The size and crc
+ * of the uncompressed data are computed alongside, so that the caller can
+ * validate the stream.
+ */
+template <RawDataReader F>
+inline result
+build_inflate_index(F &&read, u64 compressed_size, u64 span, inflate_index &index)
+{
+	index = {};
+
+	z_stream zs {};
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+		return result::error_file_read_failed;
+
+	constexpr u64 chunk_size = 1 << 16;
+	u8_vector input(chunk_size);
+	u8_vector window(inflate_window_size, 0);
+
+	// a raw deflate stream can be entered at its beginning
+	index.points.emplace_back();
+
+	u64 in_pos = 0, total_in = 0, total_out = 0, last = 0;
+	u32 crc = 0;
+	int ret = Z_OK;
+	do {
+		// the end of the stream might still be in the bit buffer of inflate
+		// when all input was consumed
+		if (zs.avail_in == 0 && in_pos < compressed_size) {
+			const u64 n = std::min(chunk_size, compressed_size - in_pos);
+			if (!read(in_pos, input.data(), n)) {
+				inflateEnd(&zs);
+				return result::error_file_read_failed;
+			}
+			in_pos += n;
+			zs.next_in  = input.data();
+			zs.avail_in = static_cast<uInt>(n);
+		}
+
+		do {
+			// the window is used as a circular buffer
+			if (zs.avail_out == 0) {
+				zs.next_out  = window.data();
+				zs.avail_out = static_cast<uInt>(inflate_window_size);
+			}
+
+			u8 *out = zs.next_out;
+			total_in  += zs.avail_in;
+			total_out += zs.avail_out;
+			ret = ::inflate(&zs, Z_BLOCK);
+			total_in  -= zs.avail_in;
+			total_out -= zs.avail_out;
+			crc = zip::crc32_compute(out, static_cast<u64>(zs.next_out - out), crc);
+
+			if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || (ret == Z_BUF_ERROR && zs.next_out == out)) {
+				inflateEnd(&zs);
+				return result::error_file_read_failed;
+			}
+			if (ret == Z_STREAM_END)
+				break;
+
+			// at the end of a block which is not the last block
+			if ((zs.data_type & 128) && !(zs.data_type & 64) && total_out - last >= span) {
+				inflate_point point;
+				point.out  = total_out;
+				point.in   = total_in;
+				point.bits = static_cast<u8>(zs.data_type & 7);
+
+				// unroll the circular buffer, and keep only what was written
+				const u64 left = zs.avail_out;
+				const u64 n = std::min(total_out, inflate_window_size);
+				u8_vector unrolled(window.begin() + static_cast<std::ptrdiff_t>(inflate_window_size - left), window.end());
+				unrolled.insert(unrolled.end(), window.begin(), window.begin() + static_cast<std::ptrdiff_t>(inflate_window_size - left));
+				point.window.assign(unrolled.end() - static_cast<std::ptrdiff_t>(n), unrolled.end());
+
+				index.points.push_back(std::move(point));
+				last = total_out;
+			}
+		} while (zs.avail_in != 0);
+	} while (ret != Z_STREAM_END);
+	inflateEnd(&zs);
+
+	index.size  = total_out;
+	index.crc32 = crc;
+	return result::ok;
+}
+
+
+/*
+ * inflate_range - inflate size bytes at offset of a raw deflate stream
+ *
+ * Inflating starts at the last point of the index before offset, and the data
+ * between the point and offset is discarded. Thus, at most span bytes (see
+ * build_inflate_index) are inflated needlessly.
+ */
+template <RawDataReader F>
+inline result
+inflate_range(F &&read, u64 compressed_size, const inflate_index &index, u64 offset, u8 *dest, u64 size)
+{
+	if (offset > index.size || size > index.size - offset)
+		return result::error_invalid_item_offset;
+	if (size == 0)
+		return result::ok;
+
+	auto it = std::upper_bound(index.points.begin(), index.points.end(), offset,
+		[](u64 off, const inflate_point &p) { return off < p.out; });
+	if (it == index.points.begin())
+		return result::error_file_read_failed;
+	const inflate_point &point = *std::prev(it);
+	if (point.in > compressed_size || (point.bits && point.in == 0))
+		return result::error_file_read_failed;
+
+	z_stream zs {};
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+		return result::error_file_read_failed;
+
+	if (point.bits) {
+		u8 byte;
+		if (!read(point.in - 1, &byte, 1)) {
+			inflateEnd(&zs);
+			return result::error_file_read_failed;
+		}
+		inflatePrime(&zs, point.bits, byte >> (8 - point.bits));
+	}
+	if (!point.window.empty())
+		inflateSetDictionary(&zs, point.window.data(), static_cast<uInt>(point.window.size()));
+
+	constexpr u64 chunk_size = 1 << 16;
+	u8_vector input(chunk_size);
+	u8_vector discard(inflate_window_size);
+
+	u64 in_pos = point.in;
+	u64 skip = offset - point.out;
+	while (size > 0) {
+		if (zs.avail_out == 0) {
+			if (skip > 0) {
+				zs.next_out  = discard.data();
+				zs.avail_out = static_cast<uInt>(std::min(skip, inflate_window_size));
+			}
+			else {
+				zs.next_out  = dest;
+				zs.avail_out = static_cast<uInt>(std::min<u64>(size, 1u << 30));
+			}
+		}
+		// the end of the stream might still be in the bit buffer of inflate
+		// when all input was consumed
+		if (zs.avail_in == 0 && in_pos < compressed_size) {
+			const u64 n = std::min(chunk_size, compressed_size - in_pos);
+			if (!read(in_pos, input.data(), n)) {
+				inflateEnd(&zs);
+				return result::error_file_read_failed;
+			}
+			in_pos += n;
+			zs.next_in  = input.data();
+			zs.avail_in = static_cast<uInt>(n);
+		}
+
+		u8 *out = zs.next_out;
+		int ret = ::inflate(&zs, Z_NO_FLUSH);
+		const u64 produced = static_cast<u64>(zs.next_out - out);
+		if (skip > 0)
+			skip -= produced;
+		else {
+			dest += produced;
+			size -= produced;
+		}
+
+		if ((ret == Z_STREAM_END && size > 0) || (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) || (ret == Z_BUF_ERROR && produced == 0)) {
+			inflateEnd(&zs);
+			return result::error_file_read_failed;
+		}
+	}
+	inflateEnd(&zs);
+	return result::ok;
+}
+
+
+/*
+ * inflate_index_filename - get the filename of the sidecar of an npz file that
+ * stores the inflate indexes of its members
+ */
+inline std::filesystem::path
+inflate_index_filename(const std::filesystem::path &filepath)
+{
+	return std::filesystem::path(filepath.native() + ".zidx");
+}
+
+
+/*
+ * the sidecar contains a magic string, the size and modification time of the
+ * npz file that it belongs to, and the index of each member. All integers are
+ * stored in little endian.
+ */
+constexpr std::array<u8, 8> inflate_index_magic = {'N', 'C', 'R', 'Z', 'I', 'D', 'X', '1'};
+
+
+template <typename T>
+inline void
+inflate_index_put(u8_vector &out, T value)
+{
+	if constexpr (std::endian::native == std::endian::big)
+		value = ncr::bswap<T>(value);
+	const u8 *p = reinterpret_cast<const u8*>(&value);
+	out.insert(out.end(), p, p + sizeof(T));
+}
+
+
+template <typename T>
+inline bool
+inflate_index_get(u8_const_span &in, T &value)
+{
+	if (in.size() < sizeof(T))
+		return false;
+	std::memcpy(&value, in.data(), sizeof(T));
+	if constexpr (std::endian::native == std::endian::big)
+		value = ncr::bswap<T>(value);
+	in = in.subspan(sizeof(T));
+	return true;
+}
+
+
+/*
+ * inflate_index_stamp - get size and modification time of a file
+ */
+inline bool
+inflate_index_stamp(const std::filesystem::path &filepath, u64 &size, u64 &mtime)
+{
+	struct stat st;
+	if (::stat(filepath.c_str(), &st) != 0)
+		return false;
+	size  = static_cast<u64>(st.st_size);
+	mtime = static_cast<u64>(st.st_mtim.tv_sec) * 1000000000ull + static_cast<u64>(st.st_mtim.tv_nsec);
+	return true;
+}
+
+
+/*
+ * read_inflate_indexes - read the inflate indexes of the members of an npz file
+ *
+ * Returns error_file_not_found if there is no sidecar, or if it belongs to
+ * another version of the npz file.
+ */
+inline result
+read_inflate_indexes(const std::filesystem::path &filepath, std::unordered_map<std::string, inflate_index> &indexes)
+{
+	u64 size, mtime;
+	if (!inflate_index_stamp(filepath, size, mtime))
+		return result::error_file_not_found;
+
+	std::ifstream f(inflate_index_filename(filepath), std::ios::binary);
+	if (!f)
+		return result::error_file_not_found;
+	u8_vector buffer((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+	u8_const_span in(buffer);
+	if (in.size() < inflate_index_magic.size() || !std::equal(inflate_index_magic.begin(), inflate_index_magic.end(), in.begin()))
+		return result::error_file_read_failed;
+	in = in.subspan(inflate_index_magic.size());
+
+	u64 stamp_size, stamp_mtime, n_members;
+	if (!inflate_index_get(in, stamp_size) || !inflate_index_get(in, stamp_mtime) || !inflate_index_get(in, n_members))
+		return result::error_file_read_failed;
+	if (stamp_size != size || stamp_mtime != mtime)
+		return result::error_file_not_found;
+
+	std::unordered_map<std::string, inflate_index> result_indexes;
+	for (u64 i = 0; i < n_members; i++) {
+		u64 name_size, n_points;
+		inflate_index index;
+		if (!inflate_index_get(in, name_size) || in.size() < name_size)
+			return result::error_file_read_failed;
+		std::string name(reinterpret_cast<const char*>(in.data()), name_size);
+		in = in.subspan(name_size);
+		if (!inflate_index_get(in, index.size) || !inflate_index_get(in, index.crc32) || !inflate_index_get(in, n_points))
+			return result::error_file_read_failed;
+		for (u64 j = 0; j < n_points; j++) {
+			inflate_point point;
+			u64 window_size;
+			if (!inflate_index_get(in, point.out) || !inflate_index_get(in, point.in) || !inflate_index_get(in, point.bits) || !inflate_index_get(in, window_size))
+				return result::error_file_read_failed;
+			if (window_size > inflate_window_size || in.size() < window_size)
+				return result::error_file_read_failed;
+			point.window.assign(in.begin(), in.begin() + static_cast<std::ptrdiff_t>(window_size));
+			in = in.subspan(window_size);
+			index.points.push_back(std::move(point));
+		}
+		result_indexes.emplace(std::move(name), std::move(index));
+	}
+	indexes = std::move(result_indexes);
+	return result::ok;
+}
+
+
+/*
+ * write_inflate_indexes - write the inflate indexes of the members of an npz file
+ */
+inline result
+write_inflate_indexes(const std::filesystem::path &filepath, const std::unordered_map<std::string, inflate_index> &indexes)
+{
+	u64 size, mtime;
+	if (!inflate_index_stamp(filepath, size, mtime))
+		return result::error_file_not_found;
+
+	u8_vector out(inflate_index_magic.begin(), inflate_index_magic.end());
+	inflate_index_put<u64>(out, size);
+	inflate_index_put<u64>(out, mtime);
+	inflate_index_put<u64>(out, indexes.size());
+	for (auto &[name, index]: indexes) {
+		inflate_index_put<u64>(out, name.size());
+		out.insert(out.end(), name.begin(), name.end());
+		inflate_index_put<u64>(out, index.size);
+		inflate_index_put<u32>(out, index.crc32);
+		inflate_index_put<u64>(out, index.points.size());
+		for (auto &point: index.points) {
+			inflate_index_put<u64>(out, point.out);
+			inflate_index_put<u64>(out, point.in);
+			inflate_index_put<u8>(out, point.bits);
+			inflate_index_put<u64>(out, point.window.size());
+			out.insert(out.end(), point.window.begin(), point.window.end());
+		}
+	}
+
+	const auto sidecar = inflate_index_filename(filepath);
+	std::string tmp = sidecar.native() + ".tmp-XXXXXX";
+	int fd = open_temporary_file(tmp);
+	if (fd < 0)
+		return result::error_file_open_failed;
+	bool ok = write_all(fd, out.data(), out.size());
+	ok = (::close(fd) == 0) && ok;
+	if (!ok || ::rename(tmp.c_str(), sidecar.c_str()) != 0) {
+		::unlink(tmp.c_str());
+		return result::error_file_write_failed;
+	}
+	return result::ok;
+}
+
+
+/*
+ * npz_reader_options - options for npz_reader
+ */
+struct npz_reader_options
+{
+	// minimal distance of two inflate points in the uncompressed data. Smaller
+	// values make ranged reads faster, at the cost of 32K per point
+	u64
+		span                        {8 << 20};
+
+	// read inflate indexes from, and write new ones to, a sidecar file next
+	// to the npz file (see inflate_index_filename). Off by default, as the
+	// reader would otherwise create files next to the npz files it reads
+	bool
+		persist_index               {false};
+
+	// verification of stored arrays the first time they are accessed, which
+	// requires to read them entirely. Compressed arrays are verified when
+	// their inflate index is built by inflating them
+	integrity_mode
+		integrity                   {integrity_mode::skip};
+};
+
+
+/*
+ * npz_reader - read parts of arrays in an npz file without inflating them
+ *
+ * Arrays in npz files are usually compressed, and loading a few rows of an
+ * array with from_npz requires to inflate the entire npz file. npz_reader
+ * instead keeps the archive open and parses only the header of an array when
+ * it is accessed. Ranged reads of a compressed array start from the closest
+ * point of an inflate index of the array (see build_inflate_index). The index
+ * is built during the first ranged read of the array, unless the archive
+ * already provides such points (e.g. the block index written by the zlib zip
+ * backend) or, if npz_reader_options::persist_index is set, a sidecar file
+ * with the index exists.
+ *
+ * Ranged reads require a zip backend that implements read_raw and stat. The
+ * reader is not thread safe.
+ *
+ * Example:
+ *
+ *     numpy::npz_reader reader;
+ *     numpy::ndarray rows;
+ *     if (reader.open("data.npz") == numpy::result::ok)
+ *         reader.slice("images", 1000, 32, rows);
+ */
+struct npz_reader
+{
+	npz_reader() = default;
+	npz_reader(const npz_reader &) = delete;
+	npz_reader& operator=(const npz_reader &) = delete;
+	~npz_reader() { close(); }
+
+
+	/*
+	 * open - open an npz file
+	 */
+	result
+	open(std::filesystem::path filepath, npz_reader_options opts = {})
+	{
+		close();
+		_interface = zip::get_backend_interface();
+		if (!_interface.read_raw || !_interface.stat)
+			return result::error_unavailable;
+
+		_interface.make(&_state);
+		if (_interface.open(_state, filepath, zip::filemode::read) != zip::result::ok) {
+			_interface.release(&_state);
+			return result::error_file_open_failed;
+		}
+
+		std::vector<std::string> file_list;
+		if (_interface.get_file_list(_state, file_list) != zip::result::ok) {
+			close();
+			return result::error_file_read_failed;
+		}
+
+		_filepath = filepath;
+		_opts = opts;
+		if (_opts.integrity == integrity_mode::verify_once && get_file_identity(_filepath, _identity) != result::ok)
+			_opts.integrity = integrity_mode::verify;
+		for (auto &fname: file_list) {
+			member m;
+			m.filename = fname;
+			if (_interface.stat(_state, fname, m.stat) != zip::result::ok) {
+				close();
+				return result::error_file_read_failed;
+			}
+			// remove ".npy" from array name
+			std::string name = fname.substr(0, fname.find_last_of("."));
+			_names.push_back(name);
+			_members.emplace(std::move(name), std::move(m));
+		}
+
+		if (_opts.persist_index)
+			read_inflate_indexes(_filepath, _indexes);
+		return result::ok;
+	}
+
+
+	/*
+	 * close - close the npz file
+	 */
+	void
+	close()
+	{
+		if (_state) {
+			_interface.close(_state);
+			_interface.release(&_state);
+		}
+		_names.clear();
+		_members.clear();
+		_indexes.clear();
+		_filepath.clear();
+	}
+
+
+	/*
+	 * names - names of the arrays in the npz file
+	 */
+	const std::vector<std::string> &
+	names() const
+	{
+		return _names;
+	}
+
+
+	/*
+	 * header - get data type, shape, and storage order of an array
+	 */
+	result
+	header(const std::string &name, dtype &dt, u64_vector &shape, storage_order &order)
+	{
+		result res;
+		member *m;
+		if ((res = get_member(name, m)) != result::ok)
+			return res;
+		dt    = m->dt;
+		shape = m->shape;
+		order = m->order;
+		return result::ok;
+	}
+
+
+	/*
+	 * read - copy size bytes at offset of the data of an array into dest
+	 */
+	result
+	read(const std::string &name, u64 offset, u8 *dest, u64 size)
+	{
+		result res;
+		member *m;
+		if ((res = get_member(name, m)) != result::ok)
+			return res;
+		if (offset > m->data_size || size > m->data_size - offset)
+			return result::error_invalid_item_offset;
+		return read_member(*m, m->data_offset + offset, dest, size);
+	}
+
+
+	/*
+	 * read_rows - copy count rows starting at first into a buffer
+	 *
+	 * Rows are along the first dimension of arrays in row major order. The
+	 * buffer needs to hold at least count * row_bytesize bytes.
+	 */
+	result
+	read_rows(const std::string &name, u64 first, u64 count, u8 *dest)
+	{
+		result res;
+		member *m;
+		if ((res = get_member(name, m)) != result::ok)
+			return res;
+		if (m->shape.empty())
+			return result::error_schema_mismatch | result::error_schema_rank_mismatch;
+		if (m->order != storage_order::row_major && m->shape.size() > 1)
+			return result::error_schema_mismatch | result::error_schema_order_mismatch;
+		if (first + count > m->shape[0] || first + count < first)
+			return result::error_invalid_item_offset;
+		return read_member(*m, m->data_offset + first * m->row_bytesize, dest, count * m->row_bytesize);
+	}
+
+
+	/*
+	 * slice - copy count rows starting at first into an ndarray
+	 */
+	result
+	slice(const std::string &name, u64 first, u64 count, ndarray &dest)
+	{
+		result res;
+		member *m;
+		if ((res = get_member(name, m)) != result::ok)
+			return res;
+
+		u8_vector buffer(count * m->row_bytesize);
+		if ((res = read_rows(name, first, count, buffer.data())) != result::ok)
+			return res;
+
+		u64_vector shape = m->shape;
+		shape[0] = count;
+		dtype dt = m->dt;
+		dest.assign(std::move(dt), std::move(shape), std::move(buffer), m->order);
+		return result::ok;
+	}
+
+
+private:
+	struct member
+	{
+		std::string
+			filename;
+
+		zip::file_stat
+			stat;
+
+		bool
+			has_header                  {false};
+
+		dtype
+			dt;
+
+		u64_vector
+			shape;
+
+		storage_order
+			order                       {storage_order::row_major};
+
+		// offset and size of the array data within the npy file
+		u64
+			data_offset                 {0},
+			data_size                   {0},
+			row_bytesize                {0};
+	};
+
+
+	/*
+	 * get_member - find an array, and parse its header if not done yet
+	 */
+	result
+	get_member(const std::string &name, member *&m)
+	{
+		if (!_state)
+			return result::error_reader_not_open;
+		auto it = _members.find(name);
+		if (it == _members.end())
+			return result::error_array_not_found;
+		m = &it->second;
+		if (m->has_header)
+			return result::ok;
+
+		result res;
+		if ((res = verify_member(*m)) != result::ok)
+			return res;
+
+		// read the fixed size part of the header first, and the remainder
+		// once its length is known
+		npyfile npy;
+		u8_vector buffer(std::min<u64>(m->stat.size, 4096));
+		if ((res = read_member(*m, 0, buffer.data(), buffer.size())) != result::ok)
+			return res;
+		{
+			auto source = span_reader(buffer);
+			if ((res = read_magic_string(source, npy)) != result::ok) return res;
+			if ((res = read_version(source, npy))      != result::ok) return res;
+			if ((res = read_header_length(source, npy)) != result::ok) return res;
+		}
+		if (npy.data_offset > m->stat.size)
+			return result::error_header_truncated;
+		if (npy.data_offset > buffer.size()) {
+			buffer.resize(npy.data_offset);
+			if ((res = read_member(*m, 0, buffer.data(), buffer.size())) != result::ok)
+				return res;
+		}
+
+		auto source = span_reader(buffer);
+		source._pos = npy.data_offset - npy.header_size;
+		if ((res = read_header(source, npy))                        != result::ok) return res;
+		if ((res = parse_header(npy, m->dt, m->order, m->shape), is_error(res))) return res;
+		if ((res = compute_item_size(m->dt))                        != result::ok) return res;
+
+		// shapes of crafted headers can overflow
+		u64 n_items, size;
+		m->data_offset = npy.data_offset;
+		m->data_size   = m->stat.size - npy.data_offset;
+		if (!checked_product(m->shape, n_items) || !checked_mul(n_items, m->dt.item_size, size) || m->data_size != size)
+			return result::error_data_size_mismatch;
+
+		m->row_bytesize = m->dt.item_size;
+		for (size_t i = 1; i < m->shape.size(); i++)
+			m->row_bytesize *= m->shape[i];
+		m->has_header = true;
+		return result::ok;
+	}
+
+
+	/*
+	 * verify_member - check the CRC-32 of a stored member, depending on the
+	 * integrity mode
+	 *
+	 * The member is read in chunks, the CRC-32 of which is computed in
+	 * parallel.
+	 */
+	result
+	verify_member(const member &m)
+	{
+		if (_opts.integrity == integrity_mode::skip || m.stat.compressed)
+			return result::ok;
+
+		const bool once = _opts.integrity == integrity_mode::verify_once;
+		if (once && verified_members::instance().contains(_identity, m.filename, m.stat))
+			return result::ok;
+
+		constexpr u64 chunk_size = 64 << 20;
+		u8_vector chunk(std::min(m.stat.size, chunk_size));
+		u32 crc = 0;
+		for (u64 offset = 0; offset < m.stat.size; offset += chunk.size()) {
+			const u64 size = std::min<u64>(chunk.size(), m.stat.size - offset);
+			if (_interface.read_raw(_state, m.filename, offset, chunk.data(), size) != zip::result::ok)
+				return result::error_file_read_failed;
+			crc = zip::crc32_concat(crc, zip::crc32_parallel(chunk.data(), size), size);
+		}
+		if (crc != m.stat.crc32)
+			return result::error_file_read_failed | result::error_checksum_mismatch;
+		if (once)
+			verified_members::instance().insert(_identity, m.filename, m.stat);
+		return result::ok;
+	}
+
+
+	/*
+	 * read_member - copy size bytes at offset of an npy file into dest
+	 */
+	result
+	read_member(member &m, u64 offset, u8 *dest, u64 size)
+	{
+		auto read_raw = [&](u64 raw_offset, u8 *raw_dest, u64 raw_size) {
+			return _interface.read_raw(_state, m.filename, raw_offset, raw_dest, raw_size) == zip::result::ok;
+		};
+
+		if (!m.stat.compressed) {
+			if (size > 0 && !read_raw(offset, dest, size))
+				return result::error_file_read_failed;
+			return result::ok;
+		}
+
+		result res;
+		const inflate_index *index;
+		if ((res = get_index(m, index)) != result::ok)
+			return res;
+		return inflate_range(read_raw, m.stat.compressed_size, *index, offset, dest, size);
+	}
+
+
+	/*
+	 * get_index - get the inflate index of a compressed member, build it if
+	 * necessary
+	 */
+	result
+	get_index(member &m, const inflate_index *&index)
+	{
+		auto it = _indexes.find(m.filename);
+		if (it != _indexes.end() && it->second.size == m.stat.size && it->second.crc32 == m.stat.crc32) {
+			index = &it->second;
+			return result::ok;
+		}
+
+		// points provided by the archive have an empty window
+		inflate_index idx;
+		if (!m.stat.sync_points.empty()) {
+			idx.size  = m.stat.size;
+			idx.crc32 = m.stat.crc32;
+			for (auto &[out, in]: m.stat.sync_points) {
+				inflate_point point;
+				point.out = out;
+				point.in  = in;
+				idx.points.push_back(std::move(point));
+			}
+			index = &(_indexes[m.filename] = std::move(idx));
+			return result::ok;
+		}
+
+		auto read_raw = [&](u64 raw_offset, u8 *raw_dest, u64 raw_size) {
+			return _interface.read_raw(_state, m.filename, raw_offset, raw_dest, raw_size) == zip::result::ok;
+		};
+		result res;
+		if ((res = build_inflate_index(read_raw, m.stat.compressed_size, _opts.span, idx)) != result::ok)
+			return res;
+		if (idx.size != m.stat.size || idx.crc32 != m.stat.crc32)
+			return result::error_file_read_failed;
+		index = &(_indexes[m.filename] = std::move(idx));
+
+		// failing to write the sidecar only means that the index needs to be
+		// built again next time
+		if (_opts.persist_index)
+			write_inflate_indexes(_filepath, _indexes);
+		return result::ok;
+	}
+
+
+	zip::backend_interface
+		_interface                  {};
+
+	zip::backend_state *
+		_state                      {nullptr};
+
+	std::filesystem::path
+		_filepath;
+
+	npz_reader_options
+		_opts;
+
+	// identity of the archive for integrity_mode::verify_once
+	file_identity
+		_identity;
+
+	std::vector<std::string>
+		_names;
+
+	std::unordered_map<std::string, member>
+		_members;
+
+	// inflate indexes by filename within the archive
+	std::unordered_map<std::string, inflate_index>
+		_indexes;
+};
+
+
+}} // ncr::numpy
+
+#endif /* NCR_NUMPY_HAS_ZLIB */
+
+#endif /* _e61a9c3f0d2b4a7885f4c2d9b07e3a16_ */
+
+
+/*
+ * the zip implementation can be actively turned off by setting the compiler
+ * flag NCR_NUMPY_DISABLE_ZIP_LIBZIP. This allows to develop custom other zip
+ * backends and disbale the libzip implementation that ships with ncr_numpy.
+ */
+#ifndef NCR_NUMPY_DISABLE_ZIP_LIBZIP
+/*
+ * zip_libzip.hpp - ncr zip backend based on libzip
+ *
+ */
+
+#ifndef _ff3beaed1e3b48528794e7d803a82757_
+#define _ff3beaed1e3b48528794e7d803a82757_
+
+// TODO: get rid of iostream
+
+
+
+namespace ncr { namespace zip {
+
+
+/*
+ * backend_state - libzip state
+ */
+struct backend_state
+{
+	// zip archive
+	zip_t *zip {nullptr};
+
+	// store all write buffers within the backend to make sure that the buffers
+	// live long enough. zip_file_add does not directly read from the buffer,
+	// and therefore a buffer might be invalid once writing actually happens
+	std::vector<u8_vector> write_buffers;
+};
+
+
+/*
+ * libzip_close - close a libzip backend sate
+ */
+inline result
+libzip_close(backend_state *state)
+{
+	if (!state)
+		return result::error_invalid_argument;
+	if (state->zip != nullptr) {
+		zip_close(state->zip);
+		state->zip = nullptr;
+	}
+	return result::ok;
+}
+
+
+/*
+ * libzip_get_file_list - get the list of files contained in an archive
+ */
+inline result
+libzip_get_file_list(backend_state *state, std::vector<std::string> &list)
+{
+	if (!state)
+		return result::error_invalid_state;
+	if (!state->zip)
+		return result::error_archive_not_open;
+
+	zip_int64_t num_entries = zip_get_num_entries(state->zip, 0);
+	for (zip_int64_t i = 0; i < num_entries; i++) {
+		const char *fname = zip_get_name(state->zip, i, 0);
+		if (fname == nullptr) {
+			zip_error_t *error = zip_get_error(state->zip);
+			// translate the error code
+			switch (error->zip_err) {
+				case ZIP_ER_MEMORY:  return result::error_memory;
+				case ZIP_ER_DELETED: return result::error_file_deleted;
+				case ZIP_ER_INVAL:   return result::error_invalid_file_index;
+				default:             return result::internal_error;
+			}
+		}
+		list.push_back(fname);
+	}
+	return result::ok;
+}
 
 
-inline bool
-is_zip_file(std::istream &is)
+/*
+ * libzip_make - make a (libzip) backend state
+ */
+inline result
+libzip_make(backend_state **state)
 {
-	// each zip file starts with a local file header signature of 4 bytes and
-	// the value 0x04034b50. For more information see the ZIP file format
-	// specification: https://pkware.cachefly.net/webdocs/APPNOTE/APPNOTE-6.3.9.TXT
-	u8 buffer[4];
-	is.read((char*)buffer, 4);
-	return buffer[0] == 0x50 &&
-	       buffer[1] == 0x4b &&
-	       buffer[2] == 0x03 &&
-	       buffer[3] == 0x04;
+	if (state == nullptr)
+		return result::error_invalid_argument;
+
+	result res = result::ok;
+	if (*state != nullptr)
+		res = result::warning_backend_ptr_not_null;
+
+	*state = new backend_state{};
+	return res;
 }
 
 
+/*
+ * libzip_open - open a file from an archive
+ */
 inline result
-from_zip_archive(std::filesystem::path filepath, npzfile &npz)
+libzip_open(backend_state *state, const std::filesystem::path filepath, filemode mode)
 {
-	// get a zip backend
-	zip::backend_state *zip_state      = nullptr;
-	zip::backend_interface zip_backend = zip::get_backend_interface();
+	if (!state)
+		return result::error_invalid_argument;
 
-	zip_backend.make(&zip_state);
-	if (zip_backend.open(zip_state, filepath, zip::filemode::read) != zip::result::ok) {
-		zip_backend.release(&zip_state);
-		return result::error_file_open_failed;
+	// when opening for writing, the file will be truncated if it already
+	// exists. Whether or not this is desired is checked on the callsite (see
+	// savez and savez_compressed's overwrite argument).
+	//
+	// Note that libzip writes changes to a temporary file during zip_close, and
+	// then replaces the archive. Thus, appending to an archive copies all
+	// existing files (albeit without recompressing them).
+	int flags;
+	switch (mode) {
+		case filemode::read:   flags = ZIP_RDONLY; break;
+		case filemode::append: flags = ZIP_CREATE; break;
+		default:               flags = ZIP_CREATE | ZIP_TRUNCATE; break;
 	}
 
-	std::vector<std::string> file_list;
-	if (zip_backend.get_file_list(zip_state, file_list) != zip::result::ok) {
-		zip_backend.close(zip_state);
-		zip_backend.release(&zip_state);
-		// TODO: better error return value
-		return result::error_file_read_failed;
+	int err = 0;
+	if ((state->zip = zip_open(filepath.c_str(), flags, &err)) == nullptr) {
+		zip_error_t error;
+		zip_error_init_with_code(&error, err);
+
+		// TODO: set a local error string that is part of the zip interface
+		std::cerr << "cannot open zip archive " << filepath << ": " << zip_error_strerror(&error) << "\n";
+		return result::error_invalid_filepath;
 	}
 
-	// for each archive file, decompress and parse the numpy array
-	for (auto &fname: file_list) {
-		u8_vector buffer;
-		if (zip_backend.read(zip_state, fname, buffer) != zip::result::ok) {
-			zip_backend.close(zip_state);
-			zip_backend.release(&zip_state);
-			return result::error_file_read_failed;
+	return result::ok;
+}
+
+
+/*
+ * libzip_open_fd - open an archive for reading from a file descriptor
+ */
+inline result
+libzip_open_fd(backend_state *state, int fd, u64)
+{
+	if (!state)
+		return result::error_invalid_argument;
+
+	// zip_fdopen takes ownership of the descriptor if it succeeds. Note that
+	// libzip determines the size of the file itself
+	int dup_fd;
+	if ((dup_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0)
+		return result::error_invalid_argument;
+
+	int err = 0;
+	if ((state->zip = zip_fdopen(dup_fd, 0, &err)) == nullptr) {
+		::close(dup_fd);
+		zip_error_t error;
+		zip_error_init_with_code(&error, err);
+
+		// TODO: set a local error string that is part of the zip interface
+		std::cerr << "cannot open zip archive from file descriptor " << fd << ": " << zip_error_strerror(&error) << "\n";
+		return result::error_invalid_filepath;
+	}
+	return result::ok;
+}
+
+
+/*
+ * libzip_read - unzip a given filename (of an archive) into an u8 buffer
+ */
+inline result
+libzip_read(backend_state *bptr, const std::string filename, u8_vector &buffer)
+{
+	if (!bptr)
+		return result::error_invalid_state;
+	if (!bptr->zip)
+		return result::error_archive_not_open;
+
+	// get the file index
+	zip_int64_t fid;
+	if ((fid = zip_name_locate(bptr->zip, filename.c_str(), 0)) < 0) {
+		zip_error_t *error = zip_get_error(bptr->zip);
+		// translate the error code
+		switch (error->zip_err) {
+			case ZIP_ER_MEMORY:  return result::error_memory;
+			case ZIP_ER_INVAL:   return result::error_invalid_file_index;
+			case ZIP_ER_NOENT:   return result::error_file_not_found;
+			default:             return result::internal_error;
 		}
+	}
 
-		// remove ".npy" from array name
-		std::string array_name = fname.substr(0, fname.find_last_of("."));
+	// open the file pointer
+	zip_file_t *fp = zip_fopen_index(bptr->zip, fid, 0);
+	if (fp == nullptr) {
+		zip_error_t *error = zip_get_error(bptr->zip);
+		switch (error->zip_err) {
+			case ZIP_ER_MEMORY: return result::error_memory;
+			case ZIP_ER_READ:   return result::error_read;
+			case ZIP_ER_WRITE:  return result::error_write;
+			// TODO: translate more errors
+			default:            return result::internal_error;
+		}
+	}
 
-		// get a npy file and array
-		npyfile *npy = new npyfile{};
-		ndarray *array = new ndarray{};
-		result res;
-		if ((res = from_buffer(std::move(buffer), *npy, *array)) != result::ok) {
-			zip_backend.close(zip_state);
-			zip_backend.release(&zip_state);
-			return res;
+	// get stats to know how many bytes to read
+	zip_stat_t stat;
+	if (zip_stat_index(bptr->zip, fid, 0, &stat) < 0) {
+		zip_error_t *error = zip_get_error(bptr->zip);
+		// translate the error code
+		switch (error->zip_err) {
+			case ZIP_ER_INVAL:   return result::error_invalid_file_index;
+			default:             return result::internal_error;
 		}
+	}
 
-		// store the information in an npz_file
-		npz.names.push_back(array_name);
-		npz.npys.insert(std::make_pair(array_name, std::make_unique<npyfile>(*npy)));
-		npz.arrays.insert(std::make_pair(array_name, std::make_unique<ndarray>(*array)));
+	// finally, read the file into the buffer
+	buffer.resize(stat.size);
+	zip_int64_t nread = zip_fread(fp, buffer.data(), stat.size);
+	if (nread < 0) {
+		// TODO: better error reporting
+		return result::internal_error;
+	}
+	else if (nread == 0) {
+		return result::error_end_of_file;
 	}
 
-	// close the zip backend and release it again
-	zip_backend.close(zip_state);
-	zip_backend.release(&zip_state);
+	int err_code;
+	if ((err_code = zip_fclose(fp)) != 0) {
+		return result::error_file_close;
+	}
+
+	return result::ok;
+}
+
+
+/*
+ * libzip_release - release the libzip backend state
+ */
+inline result
+libzip_release(backend_state **bptr)
+{
+	if (bptr == nullptr || *bptr == nullptr)
+		return result::error_invalid_argument;
+	(*bptr)->write_buffers.clear();
+	delete *bptr;
+	*bptr = nullptr;
+	return result::ok;
+}
+
+
+/*
+ * libzip_write - write a buffer to a previously open zip archive
+ */
+inline result
+libzip_write(backend_state *bptr, const std::string name, u8_vector &&buffer, bool compress, u32 compression_level = 0)
+{
+	if (!bptr)
+		return result::error_invalid_state;
+	if (!bptr->zip)
+		return result::error_archive_not_open;
+
+	// move the buffer into the local list of write buffers. this will retain
+	// the livetime of the buffer as long as required (cleared only during
+	// release and after zip_close was called, or on error)
+	bptr->write_buffers.push_back(std::move(buffer));
+	void *data_ptr = bptr->write_buffers.back().data();
+	zip_uint64_t size = bptr->write_buffers.back().size();
+
+	// create a source from the buffer
+	zip_source_t *source = zip_source_buffer(bptr->zip, data_ptr, size, 0);
+	if (!source) {
+		return result::error_write;
+	}
+
+	zip_int64_t fid;
+	if ((fid = zip_file_add(bptr->zip, name.c_str(), source, ZIP_FL_ENC_UTF_8)) < 0) {
+		zip_source_free(source);
+		return result::error_write;
+	}
+
+	if (compress) {
+		// Note: ZIP_CM_DEFLATE accepts compression levels 1 to 9, with 0
+		// indicating "default". the values origin from zlib. python's zlib
+		// backend until python 3.7 used zlib's "default" value, meaning that
+		// for instance numpy arrays were compressed most likely with the
+		// default value
+		if (zip_set_file_compression(bptr->zip, fid, ZIP_CM_DEFLATE, compression_level) < 0) {
+			return result::error_compression_failed;
+		}
+	}
+	else {
+		// libzip deflates new files by default
+		if (zip_set_file_compression(bptr->zip, fid, ZIP_CM_STORE, 0) < 0) {
+			return result::error_compression_failed;
+		}
+	}
+
+	return result::ok;
+}
+
+
+/*
+ * libzip_stat - get size and crc of a file within an archive
+ */
+inline result
+libzip_stat(backend_state *bptr, const std::string filename, file_stat &st)
+{
+	if (!bptr)
+		return result::error_invalid_state;
+	if (!bptr->zip)
+		return result::error_archive_not_open;
+
+	zip_int64_t fid;
+	if ((fid = zip_name_locate(bptr->zip, filename.c_str(), 0)) < 0)
+		return result::error_file_not_found;
+
+	zip_stat_t stat;
+	zip_stat_init(&stat);
+	if (zip_stat_index(bptr->zip, fid, 0, &stat) < 0)
+		return result::error_invalid_file_index;
+
+	// the crc is mandatory, everything else can be derived
+	if (!(stat.valid & ZIP_STAT_CRC) || !(stat.valid & ZIP_STAT_SIZE))
+		return result::internal_error;
+
+	st.size            = stat.size;
+	st.compressed_size = (stat.valid & ZIP_STAT_COMP_SIZE) ? stat.comp_size : stat.size;
+	st.crc32           = stat.crc;
+	st.compressed      = (stat.valid & ZIP_STAT_COMP_METHOD) && stat.comp_method != ZIP_CM_STORE;
+	return result::ok;
+}
+
+
+/*
+ * libzip_remove - remove a file from an archive
+ */
+inline result
+libzip_remove(backend_state *bptr, const std::string filename)
+{
+	if (!bptr)
+		return result::error_invalid_state;
+	if (!bptr->zip)
+		return result::error_archive_not_open;
+
+	zip_int64_t fid;
+	if ((fid = zip_name_locate(bptr->zip, filename.c_str(), 0)) < 0)
+		return result::error_file_not_found;
+	if (zip_delete(bptr->zip, fid) < 0)
+		return result::error_write;
 	return result::ok;
 }
 
+
+/*
+ * libzip_copy - copy a file from one archive to another
+ */
 inline result
-open_fstream(std::filesystem::path filepath, std::ifstream &fstream)
+libzip_copy(backend_state *dst, backend_state *src, const std::string src_filename, const std::string dst_filename)
 {
-	namespace fs = std::filesystem;
+	if (!dst || !src)
+		return result::error_invalid_state;
+	if (!dst->zip || !src->zip)
+		return result::error_archive_not_open;
 
-	// test if the file exists
-	if (!fs::exists(filepath))
+	zip_int64_t sid;
+	if ((sid = zip_name_locate(src->zip, src_filename.c_str(), 0)) < 0)
 		return result::error_file_not_found;
 
-	// attempt to read
-	fstream.open(filepath, std::ios::binary);
-	if (!fstream)
-		return result::error_file_open_failed;
+	zip_stat_t stat;
+	zip_stat_init(&stat);
+	if (zip_stat_index(src->zip, sid, 0, &stat) < 0)
+		return result::error_invalid_file_index;
+
+	// libzip copies the compressed data of an entire file of another archive
+	// verbatim, as long as the compression method of the file is not changed.
+	// The data is read from src during zip_close of dst
+	zip_source_t *source = zip_source_zip(dst->zip, src->zip, static_cast<zip_uint64_t>(sid), 0, 0, -1);
+	if (!source)
+		return result::error_read;
+
+	zip_int64_t fid;
+	if ((fid = zip_file_add(dst->zip, dst_filename.c_str(), source, ZIP_FL_ENC_UTF_8)) < 0) {
+		zip_source_free(source);
+		return result::error_write;
+	}
+
+	if ((stat.valid & ZIP_STAT_COMP_METHOD) && zip_set_file_compression(dst->zip, fid, stat.comp_method, 0) < 0)
+		return result::error_write;
 
 	return result::ok;
 }
 
 
+/*
+ * libzip_read_raw - read a range of the stored data of a file
+ */
 inline result
-from_npz(std::filesystem::path filepath, npzfile &npz)
+libzip_read_raw(backend_state *bptr, const std::string filename, u64 offset, u8 *dest, u64 size)
 {
-	// open the file for file type test
-	result res;
-	std::ifstream f;
-	if ((res = open_fstream(filepath, f), is_error(res)))
-		return res;
+	if (!bptr)
+		return result::error_invalid_state;
+	if (!bptr->zip)
+		return result::error_archive_not_open;
 
-	// test if this is a PKzip file, also close it again
-	bool test = is_zip_file(f);
-	f.close();
-	if (!test)
-		return result::error_wrong_filetype;
+	zip_int64_t fid;
+	if ((fid = zip_name_locate(bptr->zip, filename.c_str(), 0)) < 0)
+		return result::error_file_not_found;
 
-	// let the zip backend handle this file from now on
-	return from_zip_archive(filepath, npz);
+	// files opened with ZIP_FL_COMPRESSED are not decompressed, and can
+	// therefore be seeked
+	zip_file_t *fp = zip_fopen_index(bptr->zip, fid, ZIP_FL_COMPRESSED);
+	if (fp == nullptr)
+		return result::error_read;
+	if (offset > 0 && zip_fseek(fp, static_cast<zip_int64_t>(offset), SEEK_SET) < 0) {
+		zip_fclose(fp);
+		return result::error_read;
+	}
+	while (size > 0) {
+		zip_int64_t nread = zip_fread(fp, dest, size);
+		if (nread <= 0) {
+			zip_fclose(fp);
+			return result::error_read;
+		}
+		dest += nread;
+		size -= static_cast<u64>(nread);
+	}
+	if (zip_fclose(fp) != 0)
+		return result::error_file_close;
+	return result::ok;
 }
 
 
 /*
- * open_npy - attempt to open an npy file.
+ * libzip_read_range - read and decompress a range of a file
  *
- * This function opens a file and examines the first few bytes to test if it is
- * a zip file (e.g. used in .npz). If that's the case, it returns an error,
- * because handling .npz files is different regarding how data is read and where
- * it will be written to. If the file is not a zip file, this function resets
- * the read cursor to before the first byte, and returns OK. If it later turns
- * out that this is, in fact, not a .npy file, other functions will return
- * errors because parsing the .npy header will (most likely) fail.
+ * libzip cannot seek within compressed files, so what is before the range is
+ * decompressed and discarded. libzip verifies the crc once a file was read up
+ * to its end.
  */
 inline result
-open_npy(std::filesystem::path filepath, std::ifstream &file)
+libzip_read_range(backend_state *bptr, const std::string filename, u64 offset, u8 *dest, u64 size)
 {
-	result res;
-	if ((res = open_fstream(filepath, file), is_error(res)))
-		return res;
+	if (!bptr)
+		return result::error_invalid_state;
+	if (!bptr->zip)
+		return result::error_archive_not_open;
 
-	// test if this is a PKzip file, and if yes then we exit early. for loading
-	// npz files, use from_npz
-	if (is_zip_file(file))
-		return result::error_wrong_filetype;
+	zip_int64_t fid;
+	if ((fid = zip_name_locate(bptr->zip, filename.c_str(), 0)) < 0)
+		return result::error_file_not_found;
 
-	file.seekg(0);
-	return res;
+	zip_stat_t stat;
+	zip_stat_init(&stat);
+	if (zip_stat_index(bptr->zip, fid, 0, &stat) < 0 || !(stat.valid & ZIP_STAT_SIZE))
+		return result::error_invalid_file_index;
+	if (offset > stat.size || size > stat.size - offset)
+		return result::error_invalid_argument;
+
+	zip_file_t *fp = zip_fopen_index(bptr->zip, fid, 0);
+	if (fp == nullptr)
+		return result::error_read;
+
+	auto read = [fp](u8 *p, u64 n) {
+		while (n > 0) {
+			zip_int64_t nread = zip_fread(fp, p, n);
+			if (nread <= 0)
+				return false;
+			p += nread;
+			n -= static_cast<u64>(nread);
+		}
+		return true;
+	};
+
+	u8_vector skipped(std::min<u64>(offset, 1 << 16));
+	bool ok = true;
+	for (u64 pos = 0; ok && pos < offset; ) {
+		const u64 n = std::min<u64>(skipped.size(), offset - pos);
+		ok   = read(skipped.data(), n);
+		pos += n;
+	}
+	ok = ok && read(dest, size);
+
+	// reading past the end makes libzip check the crc
+	u8 extra;
+	if (ok && offset + size == stat.size)
+		ok = zip_fread(fp, &extra, 1) == 0;
+
+	if (zip_fclose(fp) != 0 || !ok)
+		return result::error_read;
+	return result::ok;
 }
 
 
-#ifndef NCR_HAS_GET_FILE_SIZE
-#define NCR_HAS_GET_FILE_SIZE
-inline u64
-get_file_size(std::ifstream &is)
+/*
+ * get_backend_interface - get the (libzip) backend interface
+ */
+inline backend_interface&
+get_backend_interface()
 {
-	auto ip = is.tellg();
-	is.seekg(0, std::ios::end);
-	auto res = is.tellg();
-	is.seekg(ip);
-	return static_cast<u64>(res);
+	static backend_interface interface = {
+		libzip_make,
+		libzip_release,
+		libzip_open,
+		libzip_close,
+		libzip_get_file_list,
+		libzip_read,
+		libzip_write,
+		libzip_stat,
+		libzip_remove,
+		libzip_copy,
+		// libzip compresses files during zip_close, so the compressed data
+		// of a file cannot be reused while writing an archive
+		nullptr,
+		libzip_read_raw,
+		libzip_open_fd,
+		libzip_read_range
+	};
+	return interface;
 }
+
+
+}} // ncr::zip
+
+#endif /* _ff3beaed1e3b48528794e7d803a82757_ */
+
 #endif
 
 
 /*
- * from_npy_ifstream - read an already opened ifstream into an ndarray
+ * the zlib backend is selected by setting the compiler flag
+ * NCR_NUMPY_ZIP_BACKEND_ZLIB, which also disables the libzip backend. In
+ * contrast to libzip, this backend reads and writes the zip format itself and
+ * uses zlib only for (de)compression. This allows to append to archives by
+ * rewriting only the central directory. Note that the previous central
+ * directory and the data of removed files remain in the archive as
+ * unreferenced bytes, see append_to_zip_archive and compact_npz.
  */
-template <NDArray NDArrayType, bool unsafe_read = true>
-result
-from_npy_ifstream(std::ifstream &file, NDArrayType &array, npyfile *npy = nullptr)
+#ifdef NCR_NUMPY_ZIP_BACKEND_ZLIB
+/*
+ * zip_zlib.hpp - ncr zip backend based on zlib
+ *
+ */
+
+#ifndef _5c2e8b1f7a9d4603b4e1d7f0a6c38e52_
+#define _5c2e8b1f7a9d4603b4e1d7f0a6c38e52_
+
+
+namespace ncr { namespace zip {
+
+
+/*
+ * zlib_entry - a file within the archive, as listed in the central directory
+ */
+struct zlib_entry
 {
-	result res = result::ok;
+	std::string
+		name;
 
-	// read the file into a vector. the c++ iostream interface is horrible to
-	// work with and considered bad design by many developers. We'll load the
-	// file into a vector (which is not the fastest), but then working with it
-	// is reasonably simple
-	auto filesize = get_file_size(file);
-	u8_vector buf(filesize);
-	if constexpr (unsafe_read)
-		file.read(reinterpret_cast<char*>(buf.data()), filesize);
-	else
-		buf.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	u64
+		local_header_offset         {0},
+		compressed_size             {0},
+		size                        {0};
 
-	// if the caller didnt pass in a preallocated object, we'll use a local one.
-	// this way avoids allocating an object, as _tmp is already present on the
-	// stack. it also doesn't tamper with the npy pointer
-	npyfile _tmp;
-	npyfile *npy_ptr = npy ? npy : &_tmp;
+	u32
+		crc32                       {0},
+		external_attributes         {0};
 
-	// Note the change in argument order!
-	res = from_buffer(std::move(buf), *npy_ptr, array);
+	u16
+		version_made_by             {0},
+		flags                       {0},
+		method                      {0},
+		mod_time                    {0},
+		mod_date                    {0};
 
-	// done
-	return res;
-}
+	// content of the block index extra field, see zlib_deflate_blocks
+	u8_vector
+		block_index;
+};
 
 
 /*
- * from_nyp - read a file into a container
- *
- * When reading a file into an ndarray, we read the file in one go into a buffer
- * and then process it.
+ * backend_state - zlib backend state
  */
-template <NDArray NDArrayType, bool unsafe_read = true>
-result
-from_npy(std::filesystem::path filepath, NDArrayType &array, npyfile *npy = nullptr)
+struct backend_state
 {
-	// try to open the file
-	result res = result::ok;
-	std::ifstream file;
-	if ((res = open_npy(filepath, file), is_error(res))) return res;
+	int
+		fd                          {-1};
 
-	return from_npy_ifstream(file, array, npy);
-}
+	filemode
+		mode                        {filemode::read};
 
+	// all files of the archive in the order of the central directory
+	std::vector<zlib_entry>
+		entries;
 
+	std::unordered_map<std::string, size_t>
+		index;
 
+	// offset at which the next local file header will be written. When
+	// appending, new files are written after the end of the existing archive,
+	// which remains intact until the new central directory is written
+	u64
+		write_offset                {0},
+		original_size               {0};
 
-template <typename T, typename F, typename G>
-result
-from_npy_callback(std::filesystem::path filepath, G array_properties_callback, F data_callback, npyfile *npy = nullptr)
-{
-	// try to open the file
-	result res = result::ok;
-	std::ifstream file;
-	if ((res = open_npy(filepath, file), is_error(res))) return res;
+	// the central directory needs to be (re)written on close
+	bool
+		modified                    {false};
 
-	// see comment in from_npy for NDArrayType
-	npyfile _tmp;
-	npyfile *npy_ptr = npy ? npy : &_tmp;
+	// archives opened for writing are written to a temporary file next to
+	// the archive, which replaces it on close. An existing archive thus
+	// remains intact if writing fails or the state is released without
+	// closing it
+	std::string
+		temporary_path,
+		target_path;
 
-	// process the file header and extract properties of the array
-	dtype         dt;
-	u64_vector    shape;
-	storage_order order;
-	auto source = ifstream_reader(file);
-	if ((res = process_file_header(source, *npy_ptr, dt, shape, order), is_error(res))) return res;
-	if constexpr (ArrayPropertiesCallback<G>) {
-		bool cb_result = array_properties_callback(dt, shape, order);
-		if (!cb_result)
-			return res;
-	}
+	// number of threads to deflate and inflate blocks with, 0 uses all
+	// hardware threads
+	unsigned
+		n_threads                   {0};
+};
 
-	// at this point we know the item size, and can read items from the file
-	// until we hit eof
-	for (u64 i = 0;; ++i) {
-		u8_vector buffer(dt.item_size, 0);
-		size_t bytes_read = source.read(buffer, dt.item_size);
-		if (bytes_read != dt.item_size) {
-			// EOF -> nothing more to read, w'ere in a good state
-			if (bytes_read == 0 && source.eof())
-				break;
-			else {
-				// there was some failure while reading. this might also be set
-				// when trying to read more bytes than available
-				// TODO: determine when this might happen
-				if (source.fail())
-					res = result::error_file_read_failed;
 
-				// the file is truncated, there were not enough bytes for
-				// another item.
-				else
-					res = result::error_file_truncated;
+// zip format constants, see APPNOTE.TXT
+constexpr u32 zlib_local_header_signature       = 0x04034b50;
+constexpr u32 zlib_central_header_signature     = 0x02014b50;
+constexpr u32 zlib_eocd_signature               = 0x06054b50;
+constexpr u32 zlib_zip64_eocd_signature         = 0x06064b50;
+constexpr u32 zlib_zip64_locator_signature      = 0x07064b50;
+constexpr u16 zlib_zip64_extra_id               = 0x0001;
+constexpr u16 zlib_flag_utf8                    = 1 << 11;
+constexpr u16 zlib_method_store                 = 0;
+constexpr u16 zlib_method_deflate               = 8;
+constexpr u32 zlib_max32                        = 0xffffffff;
+constexpr u16 zlib_max16                        = 0xffff;
+
+// files larger than one block are deflated as independent blocks, which are
+// listed in an extra field of the central directory. Other zip readers ignore
+// this field. The number of blocks is limited such that the field fits into
+// the 64k of extra data of an entry
+constexpr u16 zlib_block_index_extra_id         = 0x636e;
+constexpr u64 zlib_min_block_size               = 4 << 20;
+constexpr u64 zlib_max_blocks                   = 16000;
 
-				break;
-			}
-		}
 
-		// select the right callback variant. if the callback returns false, the
-		// user wants an early exit
-		if constexpr (GenericReaderCallback<F>) {
-			if (!data_callback(dt, shape, order, i, std::move(buffer)))
-				break;
-		}
-		else if constexpr (TypedReaderCallbackFlat<T, F>) {
-			// when the callback returns false, the user wants an early exit
-			T value;
-			std::memcpy(&value, buffer.data(), sizeof(T));
-			if (!data_callback(i, value))
-				break;
-		}
-		else if constexpr (TypedReaderCallbackMulti<T, F>) {
-			// when the callback returns false, the user wants an early exit
-			u64_vector multi_index = unravel_index(i, shape, order);
-			T value;
-			std::memcpy(&value, buffer.data(), sizeof(T));
-			if (!data_callback(multi_index, value))
-				break;
-		}
-		else {
-			static_assert(GenericReaderCallback<F> || TypedReaderCallback<T, F>,
-						  "The provided function does not satisfy any of the required concepts.");
-		}
-	}
-	return res;
+/*
+ * little endian helpers to read and write the fields of zip records
+ */
+template <typename T>
+inline T
+zlib_get(const u8 *p)
+{
+	T value = 0;
+	for (size_t i = 0; i < sizeof(T); i++)
+		value |= static_cast<T>(p[i]) << (8 * i);
+	return value;
 }
 
-template <typename F> requires GenericReaderCallback<F>
-result
-from_npy(std::filesystem::path filepath, F callback, npyfile *npy = nullptr)
+template <typename T>
+inline void
+zlib_put(u8_vector &buffer, T value)
 {
-	return from_npy_callback<void>(
-		std::move(filepath),
-		nullptr,
-		std::forward<F>(callback),
-		npy);
+	for (size_t i = 0; i < sizeof(T); i++)
+		buffer.push_back(static_cast<u8>(value >> (8 * i)));
 }
 
 
-template <typename T, typename F> requires TypedReaderCallback<T, F>
-result
-from_npy(std::filesystem::path filepath, F callback, npyfile *npy = nullptr)
+inline bool
+zlib_pread(int fd, u8 *dest, u64 size, u64 offset)
 {
-	return from_npy_callback<T, F>(
-		std::move(filepath),
-		nullptr,
-		std::forward<F>(callback),
-		npy);
+	while (size > 0) {
+		ssize_t n = ::pread(fd, dest, size, static_cast<off_t>(offset));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		dest   += n;
+		size   -= static_cast<u64>(n);
+		offset += static_cast<u64>(n);
+	}
+	return true;
 }
 
 
-template <typename T, typename G, typename F>
-requires ArrayPropertiesCallback<G> && TypedReaderCallback<T, F>
-result
-from_npy(std::filesystem::path filepath, G array_properties_callback, F data_callback, npyfile *npy = nullptr)
-{
-	return from_npy_callback<T, F, G>(
-		std::move(filepath),
-		std::forward<G>(array_properties_callback),
-		std::forward<F>(data_callback),
-		npy);
+inline bool
+zlib_pwrite(int fd, const u8 *src, u64 size, u64 offset)
+{
+	while (size > 0) {
+		ssize_t n = ::pwrite(fd, src, size, static_cast<off_t>(offset));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		src    += n;
+		size   -= static_cast<u64>(n);
+		offset += static_cast<u64>(n);
+	}
+	return true;
 }
 
 
+/*
+ * zlib_deflate - raw deflate a buffer
+ */
+inline result
+zlib_deflate(const u8 *data, u64 size, int level, u8_vector &out)
+{
+	z_stream zs {};
+	if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return result::error_compression_failed;
+
+	out.resize(deflateBound(&zs, static_cast<uLong>(size)));
+	zs.next_out = out.data();
+	u64 remaining_out = out.size();
+	int ret = Z_OK;
+	while (ret != Z_STREAM_END) {
+		uInt in_chunk  = static_cast<uInt>(std::min<u64>(size, 1u << 30));
+		uInt out_chunk = static_cast<uInt>(std::min<u64>(remaining_out, 1u << 30));
+		zs.next_in   = const_cast<u8*>(data);
+		zs.avail_in  = in_chunk;
+		zs.avail_out = out_chunk;
+		ret = ::deflate(&zs, in_chunk == size ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR || (ret == Z_BUF_ERROR && zs.avail_out > 0)) {
+			deflateEnd(&zs);
+			return result::error_compression_failed;
+		}
+		data          += in_chunk - zs.avail_in;
+		size          -= in_chunk - zs.avail_in;
+		remaining_out -= out_chunk - zs.avail_out;
+	}
+	out.resize(out.size() - remaining_out);
+	deflateEnd(&zs);
+	return result::ok;
+}
 
 
-//
-// helpers to extract the type from the variant. If you're sure about the file
-// type (npz / npy), it's recommended to directly use the from_* functions
-//
-inline result  get_result(variant_result   &res) { return std::get<result>(std::forward<variant_result>(res));  }
-inline result  get_result(variant_result  &&res) { return std::get<result>(std::forward<variant_result>(res));  }
-inline ndarray get_ndarray(variant_result  &res) { return std::get<ndarray>(std::forward<variant_result>(res)); }
-inline ndarray get_ndarray(variant_result &&res) { return std::get<ndarray>(std::forward<variant_result>(res)); }
-inline npzfile get_npzfile(variant_result  &res) { return std::get<npzfile>(std::forward<variant_result>(res)); }
-inline npzfile get_npzfile(variant_result &&res) { return std::get<npzfile>(std::forward<variant_result>(res)); }
+/*
+ * zlib_block_size - get the size of the blocks to deflate a file of given size
+ */
+inline u64
+zlib_block_size(u64 size)
+{
+	constexpr u64 mib = 1 << 20;
+	u64 block_size = std::max(zlib_min_block_size, (size + zlib_max_blocks - 1) / zlib_max_blocks);
+	return (block_size + mib - 1) / mib * mib;
+}
 
 
 /*
- * load - high level API which tries to load whatever file is given
- *
- * In case the file cannot be loaded, i.e. it's not an npz or npy file, the
- * variant will hold a corresponding error code
+ * zlib_run_parallel - call fn(i) for i in [0, n) on n_threads threads
  *
- * TODO: memory-mapped variant, which then moves the file descriptor *into* the
- *       array (this way the array will be backed by the memory mapped data,
- *       similar to numpy.memmap)
+ * 0 threads use all hardware threads.
  */
-inline variant_result
-load(std::filesystem::path filepath)
+template <typename F>
+inline void
+zlib_run_parallel(size_t n, unsigned n_threads, F &&fn)
 {
-	// open the file
-	result res;
-	std::ifstream file;
-	if ((res = open_fstream(filepath, file)) != result::ok) {
-		return res;
-	}
-
-	// return the full npz if this is an archive, so that users can work with
-	// the result similar to what they would get from numpy.load
-	if (is_zip_file(file)) {
-		file.close();
-		npzfile npz;
-		if ((res = from_npz(filepath, npz)) != result::ok)
-			return res;
-		return npz;
-	}
+	if (n_threads == 0)
+		n_threads = std::max(1u, std::thread::hardware_concurrency());
+	n_threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(n_threads, n)));
+
+	std::atomic<size_t> next {0};
+	auto worker = [&]() {
+		for (size_t i; (i = next.fetch_add(1)) < n; )
+			fn(i);
+	};
 
-	// users are usually only interested in the array when loading from .npy
-	// TODO: from_npy opens the file, again. instead of closing it and opening
-	// it immediately again, maybe use from_stream to read the file from an
-	// ifstream or pass the ifstream f forward.
-	ndarray arr;
-	file.seekg(0);
-	if ((res = from_npy_ifstream(file, arr, nullptr), is_error(res))) {
-		// in case the magic string is invalid, then this is not a numpy file
-		if (res == result::error_magic_string_invalid)
-			return result::error_unsupported_file_format;
-		else
-			// something else happened
-			return res;
-	}
-	return arr;
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < n_threads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t: threads)
+		t.join();
 }
 
 
 /*
- * to_npy_buffer - construct a npy file compatible buffer from ndarray
+ * zlib_deflate_blocks - raw deflate a buffer as independent blocks in parallel
+ *
+ * Each block but the last ends with a full flush, which resets the dictionary
+ * and aligns the output to a byte boundary. Hence, the concatenated blocks form
+ * a single deflate stream that every zip reader can inflate, and each block can
+ * also be inflated on its own. The block index consists of the block size
+ * (u64) followed by the compressed size of each block (u32). The crc of the
+ * data is computed alongside. 0 threads use all hardware threads.
  */
 inline result
-to_npy_buffer(const ndarray &arr, u8_vector &buffer)
+zlib_deflate_blocks(const u8 *data, u64 size, int level, u8_vector &out, u8_vector &block_index, u32 &crc, unsigned n_threads = 0)
 {
-	// initialize default header structure
-	buffer = {
-		// magic string
-		0x93, 'N', 'U', 'M', 'P', 'Y',
-		// version (2.0)
-		0x02, 0x00,
-		// space for header size (version 2.0 -> 4 bytes)
-		0x00, 0x00, 0x00, 0x00
-	};
+	const u64 block_size = zlib_block_size(size);
+	const size_t n_blocks = (size + block_size - 1) / block_size;
 
-	// write the header string
-	std::string typedescr = arr.get_type_description();
-	std::copy(typedescr.begin(), typedescr.end(), std::back_inserter(buffer));
+	std::vector<u8_vector> blocks(n_blocks);
+	std::vector<u32> crcs(n_blocks);
+	std::atomic<bool> failed {false};
 
-	// the entire header must be divisible by 64 -> find next bigger. Common
-	// formula is simply (((N + divisor - 1) / divisor) * divisor), where
-	// divisor = 64.  However, we need to adapt for +1 for the trailing \n that
-	// terminates the header
-	size_t bufsize = buffer.size();
-	size_t total_header_length = ((bufsize + 64) / 64) * 64;
+	zlib_run_parallel(n_blocks, n_threads, [&](size_t i) {
+		const u64 offset = i * block_size;
+		const u64 length = std::min(block_size, size - offset);
+		const bool last  = i + 1 == n_blocks;
 
-	// fill white whitespace (0x20) and trailing \n
-	buffer.resize(total_header_length);
-	std::fill(buffer.begin() + bufsize, buffer.end() - 1, 0x20);
-	buffer[buffer.size() - 1] = '\n';
+		z_stream zs {};
+		if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			failed = true;
+			return;
+		}
+		// the full flush adds an empty stored block
+		blocks[i].resize(deflateBound(&zs, static_cast<uLong>(length)) + 16);
+		zs.next_in   = const_cast<u8*>(data + offset);
+		zs.avail_in  = static_cast<uInt>(length);
+		zs.next_out  = blocks[i].data();
+		zs.avail_out = static_cast<uInt>(blocks[i].size());
+		int ret = ::deflate(&zs, last ? Z_FINISH : Z_FULL_FLUSH);
+		if ((last && ret != Z_STREAM_END) || (!last && (ret != Z_OK || zs.avail_in != 0 || zs.avail_out == 0)))
+			failed = true;
+		blocks[i].resize(zs.total_out);
+		deflateEnd(&zs);
+		crcs[i] = crc32_compute(data + offset, length);
+	});
+	if (failed)
+		return result::error_compression_failed;
+
+	u64 total = 0;
+	for (auto &block: blocks)
+		total += block.size();
+	out.clear();
+	out.reserve(total);
+	block_index.clear();
+	zlib_put<u64>(block_index, block_size);
+	crc = 0;
+	for (size_t i = 0; i < n_blocks; i++) {
+		out.insert(out.end(), blocks[i].begin(), blocks[i].end());
+		zlib_put<u32>(block_index, static_cast<u32>(blocks[i].size()));
+		const u64 length = std::min(block_size, size - i * block_size);
+		crc = crc32_concat(crc, crcs[i], length);
+		u8_vector().swap(blocks[i]);
+	}
+	return result::ok;
+}
 
-	// write the header length (in little endian). Note that the eader length
-	// itself is the length without magic string, size, and version bytes and
-	// not the total header length!
-	size_t header_length = total_header_length
-		- ncr::numpy::npyfile::magic_byte_count
-		- ncr::numpy::npyfile::version_byte_count
-		- 4; // four bytes for the header size (version 2.0 file)
 
-	// do we need to byteswap the header length?
-	u8 *buf_hlen = buffer.data() + ncr::numpy::npyfile::magic_byte_count + ncr::numpy::npyfile::version_byte_count;
-	if constexpr (std::endian::native == std::endian::big) {
-		u32 swapped_length = ncr::bswap<u32>(header_length);
-		std::memcpy(buf_hlen, &swapped_length, sizeof(u32));
-	}
-	else
-		std::memcpy(buf_hlen, &header_length, sizeof(u32));
+/*
+ * zlib_inflate_blocks - inflate a range of a file that was deflated as
+ * independent blocks
+ *
+ * Only the blocks which overlap [offset, offset + size) are read, and they are
+ * read and inflated in parallel into their place in dest. The part of a block before
+ * offset is inflated into a scratch buffer. If verify is set, the range needs
+ * to end at the end of the file, and all blocks are inflated to compute the
+ * crc of the entire file. Fails if the block index does not match the entry,
+ * in which case the file needs to be inflated serially.
+ */
+inline result
+zlib_inflate_blocks(backend_state *state, const zlib_entry &e, u64 data_offset, u64 offset, u8 *dest, u64 size, bool verify, u32 &crc)
+{
+	const u8_vector &index = e.block_index;
+	if (index.size() < 8 || (index.size() - 8) % 4 != 0)
+		return result::error_read;
+
+	const u64 block_size = zlib_get<u64>(index.data());
+	const size_t n_blocks = (index.size() - 8) / 4;
+	if (block_size == 0 || n_blocks != (e.size + block_size - 1) / block_size)
+		return result::error_read;
+
+	std::vector<u64> offsets(n_blocks + 1, 0);
+	for (size_t i = 0; i < n_blocks; i++)
+		offsets[i + 1] = offsets[i] + zlib_get<u32>(index.data() + 8 + 4 * i);
+	if (offsets.back() != e.compressed_size)
+		return result::error_read;
+
+	// blocks [first, last) are inflated, and up to the end of the range
+	const u64 end = offset + size;
+	const size_t first = verify ? 0 : static_cast<size_t>(offset / block_size);
+	const size_t last  = verify ? n_blocks : static_cast<size_t>((end + block_size - 1) / block_size);
+	crc = 0;
+	if (first >= last)
+		return result::ok;
 
-	// copy the rest of the array
-	const u8_vector payload = arr.data();
-	buffer.insert(buffer.end(), payload.begin(), payload.end());
+	std::vector<u32> crcs(n_blocks);
+	std::atomic<bool> failed {false};
+	zlib_run_parallel(last - first, state->n_threads, [&](size_t k) {
+		const size_t i  = first + k;
+		const u64 lo    = i * block_size;
+		const u64 hi    = std::min(lo + block_size, e.size);
+		const u64 stop  = std::min(hi, end);
+		const u64 begin = std::clamp(offset, lo, stop);
+
+		// each block is read by the thread that inflates it, i.e. only the
+		// compressed data of the blocks in flight is in memory
+		u8_vector compressed(offsets[i + 1] - offsets[i]);
+		z_stream zs {};
+		if (!zlib_pread(state->fd, compressed.data(), compressed.size(), data_offset + offsets[i]) ||
+		    inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+			failed = true;
+			return;
+		}
+		zs.next_in  = compressed.data();
+		zs.avail_in = static_cast<uInt>(compressed.size());
 
+		int ret = Z_OK;
+		auto inflate_into = [&](u8 *out, u64 length) {
+			if (length == 0)
+				return true;
+			zs.next_out  = out;
+			zs.avail_out = static_cast<uInt>(length);
+			ret = ::inflate(&zs, Z_SYNC_FLUSH);
+			return (ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR) && zs.avail_out == 0;
+		};
+
+		u8_vector skipped(begin - lo);
+		if (!inflate_into(skipped.data(), skipped.size()) || !inflate_into(dest + (begin - offset), stop - begin) ||
+		    (i + 1 == n_blocks && stop == hi && ret != Z_STREAM_END))
+			failed = true;
+		inflateEnd(&zs);
+		if (verify && !failed)
+			crcs[i] = crc32_compute(dest + (begin - offset), stop - begin, crc32_compute(skipped.data(), skipped.size()));
+	});
+	if (failed)
+		return result::error_read;
+
+	if (verify)
+		for (size_t i = 0; i < n_blocks; i++)
+			crc = crc32_concat(crc, crcs[i], std::min(block_size, e.size - i * block_size));
 	return result::ok;
 }
 
 
+/*
+ * zlib_inflate_serial - inflate a range of a file serially
+ *
+ * The compressed data is read in chunks, and inflated up to the end of the
+ * range. What is before offset is inflated into a scratch buffer. If verify is
+ * set, the range needs to end at the end of the file, which is checked to end
+ * there, and the crc of the entire file is computed.
+ */
 inline result
-save(std::filesystem::path filepath, const ndarray &arr, bool overwrite=false)
+zlib_inflate_serial(backend_state *state, const zlib_entry &e, u64 data_offset, u64 offset, u8 *dest, u64 size, bool verify, u32 &crc)
 {
-	namespace fs = std::filesystem;
+	constexpr u64 chunk_size = 1 << 20;
 
-	// test if the file exists
-	if (fs::exists(filepath) && !overwrite)
-		return result::error_file_exists;
+	z_stream zs {};
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+		return result::error_memory;
 
-	std::ofstream fstream;
-	fstream.open(filepath, std::ios::binary | std::ios::out);
-	if (!fstream)
-		return result::error_file_open_failed;
+	u8_vector in(std::min(chunk_size, e.compressed_size));
+	u8_vector skipped(std::min(chunk_size, offset));
+	u8 extra;
+	u64 in_pos = 0, out_pos = 0;
+	const u64 end = offset + size;
 
-	// turn the array into a numpy buffer
-	result res;
-	u8_vector buffer;
-	if ((res = to_npy_buffer(arr, buffer)) != result::ok)
-		return res;
+	crc = 0;
+	int ret = Z_OK;
+	result res = result::ok;
+	while (out_pos < end || (verify && ret != Z_STREAM_END)) {
+		if (ret == Z_STREAM_END) {
+			res = result::error_read;
+			break;
+		}
+		if (zs.avail_in == 0 && in_pos < e.compressed_size) {
+			const u64 n = std::min<u64>(in.size(), e.compressed_size - in_pos);
+			if (!zlib_pread(state->fd, in.data(), n, data_offset + in_pos)) {
+				res = result::error_read;
+				break;
+			}
+			in_pos     += n;
+			zs.next_in  = in.data();
+			zs.avail_in = static_cast<uInt>(n);
+		}
 
-	// write to file
-	fstream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
-	// size_t is most likely 64bit, but just to make sure cast it again. tellp()
-	// can easily be more than 32bit...
-	if (fstream.bad() || static_cast<u64>(fstream.tellp()) != static_cast<u64>(buffer.size()))
-		return result::error_file_write_failed;
+		// after the range, the stream needs to end without further output
+		u8 *out;
+		u64 length;
+		if (out_pos < offset) {
+			out    = skipped.data();
+			length = std::min<u64>(skipped.size(), offset - out_pos);
+		}
+		else if (out_pos < end) {
+			out    = dest + (out_pos - offset);
+			length = std::min<u64>(end - out_pos, 1u << 30);
+		}
+		else {
+			out    = &extra;
+			length = 1;
+		}
+		zs.next_out  = out;
+		zs.avail_out = static_cast<uInt>(length);
+		ret = ::inflate(&zs, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			res = result::error_read;
+			break;
+		}
+		const u64 produced = length - zs.avail_out;
+		if (out_pos < offset && verify)
+			crc = crc32_compute(out, produced, crc);
+		out_pos += produced;
+		if (out_pos > end) {
+			res = result::error_read;
+			break;
+		}
+	}
+	inflateEnd(&zs);
 
-	return result::ok;
+	if (res == result::ok && verify)
+		crc = crc32_concat(crc, crc32_parallel(dest, size, state->n_threads), size);
+	return res;
 }
 
 
 /*
- * savez_arg - helper object to capture arguments to savez* and save_npz
+ * zlib_dos_datetime - current local time in MS-DOS format
  */
-struct savez_arg
+inline void
+zlib_dos_datetime(u16 &time, u16 &date)
 {
-	std::string name;
-	ndarray&    array;
-};
+	std::time_t now = std::time(nullptr);
+	std::tm tm {};
+	localtime_r(&now, &tm);
+	time = static_cast<u16>((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+	date = static_cast<u16>(((std::max(tm.tm_year, 80) - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
 
 
 /*
- * save_npz - save arrays to an npz file
+ * zlib_read_central_directory - read the list of files of an archive
  */
 inline result
-to_zip_archive(std::filesystem::path filepath, std::vector<savez_arg> args, bool compress, bool overwrite=false, u32 compression_level=0)
+zlib_read_central_directory(backend_state *state, u64 file_size)
 {
-	namespace fs = std::filesystem;
-
-	// detect if there are any name clashes
-	std::unordered_set<std::string> _set;
-	for (auto &arg: args) {
-		if (_set.contains(arg.name))
-			return result::error_duplicate_array_name;
-		_set.insert(arg.name);
+	// the end of central directory record is at least 22 bytes, followed by
+	// a comment of up to 64k
+	constexpr u64 eocd_size = 22;
+	if (file_size < eocd_size)
+		return result::error_read;
+
+	const u64 tail_size = std::min<u64>(file_size, eocd_size + zlib_max16);
+	u8_vector tail(tail_size);
+	if (!zlib_pread(state->fd, tail.data(), tail_size, file_size - tail_size))
+		return result::error_read;
+
+	// search backwards for the signature
+	i64 pos = static_cast<i64>(tail_size - eocd_size);
+	for (; pos >= 0; --pos)
+		if (zlib_get<u32>(tail.data() + pos) == zlib_eocd_signature)
+			break;
+	if (pos < 0)
+		return result::error_read;
+
+	const u8 *eocd = tail.data() + pos;
+	u64 n_entries = zlib_get<u16>(eocd + 10);
+	u64 cd_size   = zlib_get<u32>(eocd + 12);
+	u64 cd_offset = zlib_get<u32>(eocd + 16);
+
+	// zip64 archives have an additional end of central directory record,
+	// which is pointed to by a locator right before the (regular) record
+	const u64 eocd_offset = file_size - tail_size + static_cast<u64>(pos);
+	if ((n_entries == zlib_max16 || cd_size == zlib_max32 || cd_offset == zlib_max32) && eocd_offset >= 20) {
+		u8 locator[20];
+		if (!zlib_pread(state->fd, locator, sizeof(locator), eocd_offset - 20))
+			return result::error_read;
+		if (zlib_get<u32>(locator) == zlib_zip64_locator_signature) {
+			u8 record[56];
+			if (!zlib_pread(state->fd, record, sizeof(record), zlib_get<u64>(locator + 8)))
+				return result::error_read;
+			if (zlib_get<u32>(record) != zlib_zip64_eocd_signature)
+				return result::error_read;
+			n_entries = zlib_get<u64>(record + 32);
+			cd_size   = zlib_get<u64>(record + 40);
+			cd_offset = zlib_get<u64>(record + 48);
+		}
 	}
+	if (cd_offset > file_size || cd_size > file_size - cd_offset)
+		return result::error_read;
+
+	u8_vector cd(cd_size);
+	if (!zlib_pread(state->fd, cd.data(), cd_size, cd_offset))
+		return result::error_read;
+
+	state->entries.clear();
+	state->index.clear();
+	u64 p = 0;
+	for (u64 i = 0; i < n_entries; i++) {
+		if (p + 46 > cd.size() || zlib_get<u32>(cd.data() + p) != zlib_central_header_signature)
+			return result::error_read;
+
+		const u8 *h = cd.data() + p;
+		zlib_entry e;
+		e.version_made_by      = zlib_get<u16>(h + 4);
+		e.flags                = zlib_get<u16>(h + 8);
+		e.method               = zlib_get<u16>(h + 10);
+		e.mod_time             = zlib_get<u16>(h + 12);
+		e.mod_date             = zlib_get<u16>(h + 14);
+		e.crc32                = zlib_get<u32>(h + 16);
+		e.compressed_size      = zlib_get<u32>(h + 20);
+		e.size                 = zlib_get<u32>(h + 24);
+		u16 name_length        = zlib_get<u16>(h + 28);
+		u16 extra_length       = zlib_get<u16>(h + 30);
+		u16 comment_length     = zlib_get<u16>(h + 32);
+		e.external_attributes  = zlib_get<u32>(h + 38);
+		e.local_header_offset  = zlib_get<u32>(h + 42);
+
+		if (p + 46 + name_length + extra_length + comment_length > cd.size())
+			return result::error_read;
+		e.name.assign(reinterpret_cast<const char*>(h + 46), name_length);
+
+		// the zip64 extra field contains those values which did not fit
+		const u8 *extra = h + 46 + name_length;
+		for (u64 q = 0; q + 4 <= extra_length; ) {
+			u16 id   = zlib_get<u16>(extra + q);
+			u16 size = zlib_get<u16>(extra + q + 2);
+			if (q + 4 + size > extra_length)
+				break;
+			if (id == zlib_zip64_extra_id) {
+				const u8 *f = extra + q + 4, *end = f + size;
+				if (e.size == zlib_max32 && f + 8 <= end)                { e.size = zlib_get<u64>(f); f += 8; }
+				if (e.compressed_size == zlib_max32 && f + 8 <= end)     { e.compressed_size = zlib_get<u64>(f); f += 8; }
+				if (e.local_header_offset == zlib_max32 && f + 8 <= end) { e.local_header_offset = zlib_get<u64>(f); }
+			}
+			else if (id == zlib_block_index_extra_id)
+				e.block_index.assign(extra + q + 4, extra + q + 4 + size);
+			q += 4 + size;
+		}
 
-	// test if the file exists
-	if (fs::exists(filepath) && !overwrite)
-		return result::error_file_exists;
+		state->index[e.name] = state->entries.size();
+		state->entries.push_back(std::move(e));
+		p += 46 + name_length + extra_length + comment_length;
+	}
 
-	zip::backend_state *zip_state        = nullptr;
-	zip::backend_interface zip_interface = zip::get_backend_interface();
+	state->write_offset = file_size;
+	return result::ok;
+}
 
-	zip_interface.make(&zip_state);
-	if (zip_interface.open(zip_state, filepath, zip::filemode::write) != zip::result::ok) {
-		zip_interface.release(&zip_state);
-		return result::error_file_open_failed;
-	}
 
-	// write all arrays. append .npy to each argument name
-	for (auto &arg: args) {
-		u8_vector buffer;
-		to_npy_buffer(arg.array, buffer);
-		std::string name = arg.name + ".npy";
-		if (zip_interface.write(zip_state, name, std::move(buffer), compress, compression_level) != zip::result::ok) {
-			zip_interface.release(&zip_state);
-			return result::error_file_write_failed;
+/*
+ * zlib_write_central_directory - write the central directory and its end
+ *
+ * The central directory is written at the current write offset, and the file
+ * is truncated after it.
+ */
+inline result
+zlib_write_central_directory(backend_state *state)
+{
+	u8_vector cd;
+	for (auto &e: state->entries) {
+		const bool big_size   = e.size >= zlib_max32 || e.compressed_size >= zlib_max32;
+		const bool big_offset = e.local_header_offset >= zlib_max32;
+
+		u8_vector extra;
+		if (big_size || big_offset) {
+			zlib_put<u16>(extra, zlib_zip64_extra_id);
+			zlib_put<u16>(extra, static_cast<u16>((big_size ? 16 : 0) + (big_offset ? 8 : 0)));
+			if (big_size) {
+				zlib_put<u64>(extra, e.size);
+				zlib_put<u64>(extra, e.compressed_size);
+			}
+			if (big_offset)
+				zlib_put<u64>(extra, e.local_header_offset);
 		}
+		if (!e.block_index.empty()) {
+			zlib_put<u16>(extra, zlib_block_index_extra_id);
+			zlib_put<u16>(extra, static_cast<u16>(e.block_index.size()));
+			extra.insert(extra.end(), e.block_index.begin(), e.block_index.end());
+		}
+
+		const u16 version = (big_size || big_offset) ? 45 : 20;
+		zlib_put<u32>(cd, zlib_central_header_signature);
+		zlib_put<u16>(cd, e.version_made_by ? e.version_made_by : static_cast<u16>((3 << 8) | version));
+		zlib_put<u16>(cd, version);
+		zlib_put<u16>(cd, e.flags);
+		zlib_put<u16>(cd, e.method);
+		zlib_put<u16>(cd, e.mod_time);
+		zlib_put<u16>(cd, e.mod_date);
+		zlib_put<u32>(cd, e.crc32);
+		zlib_put<u32>(cd, big_size ? zlib_max32 : static_cast<u32>(e.compressed_size));
+		zlib_put<u32>(cd, big_size ? zlib_max32 : static_cast<u32>(e.size));
+		zlib_put<u16>(cd, static_cast<u16>(e.name.size()));
+		zlib_put<u16>(cd, static_cast<u16>(extra.size()));
+		zlib_put<u16>(cd, 0);  // comment length
+		zlib_put<u16>(cd, 0);  // disk number
+		zlib_put<u16>(cd, 0);  // internal attributes
+		zlib_put<u32>(cd, e.external_attributes);
+		zlib_put<u32>(cd, big_offset ? zlib_max32 : static_cast<u32>(e.local_header_offset));
+		cd.insert(cd.end(), e.name.begin(), e.name.end());
+		cd.insert(cd.end(), extra.begin(), extra.end());
 	}
 
-	if (zip_interface.close(zip_state) != zip::result::ok) {
-		zip_interface.release(&zip_state);
-		return result::error_file_close;
+	const u64 cd_offset = state->write_offset;
+	const u64 cd_size   = cd.size();
+	const u64 n_entries = state->entries.size();
+	if (n_entries >= zlib_max16 || cd_size >= zlib_max32 || cd_offset >= zlib_max32) {
+		const u64 record_offset = cd_offset + cd_size;
+		zlib_put<u32>(cd, zlib_zip64_eocd_signature);
+		zlib_put<u64>(cd, 44);  // size of the remaining record
+		zlib_put<u16>(cd, (3 << 8) | 45);
+		zlib_put<u16>(cd, 45);
+		zlib_put<u32>(cd, 0);
+		zlib_put<u32>(cd, 0);
+		zlib_put<u64>(cd, n_entries);
+		zlib_put<u64>(cd, n_entries);
+		zlib_put<u64>(cd, cd_size);
+		zlib_put<u64>(cd, cd_offset);
+
+		zlib_put<u32>(cd, zlib_zip64_locator_signature);
+		zlib_put<u32>(cd, 0);
+		zlib_put<u64>(cd, record_offset);
+		zlib_put<u32>(cd, 1);
 	}
 
-	zip_interface.release(&zip_state);
+	zlib_put<u32>(cd, zlib_eocd_signature);
+	zlib_put<u16>(cd, 0);
+	zlib_put<u16>(cd, 0);
+	zlib_put<u16>(cd, static_cast<u16>(std::min<u64>(n_entries, zlib_max16)));
+	zlib_put<u16>(cd, static_cast<u16>(std::min<u64>(n_entries, zlib_max16)));
+	zlib_put<u32>(cd, static_cast<u32>(std::min<u64>(cd_size, zlib_max32)));
+	zlib_put<u32>(cd, static_cast<u32>(std::min<u64>(cd_offset, zlib_max32)));
+	zlib_put<u16>(cd, 0);  // comment length
+
+	if (!zlib_pwrite(state->fd, cd.data(), cd.size(), cd_offset))
+		return result::error_write;
+	if (::ftruncate(state->fd, static_cast<off_t>(cd_offset + cd.size())) != 0)
+		return result::error_write;
 	return result::ok;
 }
 
 
 /*
- * savez - save name/array pairs to an uncompressed npz file
+ * zlib_local_header - make the local file header of an entry
+ *
+ * Sizes are always known upfront, so no data descriptor is required.
  */
-inline result
-savez(std::filesystem::path filepath, std::vector<savez_arg> args, bool overwrite=false)
+inline void
+zlib_local_header(const zlib_entry &e, u8_vector &header)
 {
-	return to_zip_archive(filepath, std::forward<decltype(args)>(args), false, overwrite);
+	const bool big = e.size >= zlib_max32 || e.compressed_size >= zlib_max32;
+	zlib_put<u32>(header, zlib_local_header_signature);
+	zlib_put<u16>(header, big ? 45 : 20);
+	zlib_put<u16>(header, e.flags);
+	zlib_put<u16>(header, e.method);
+	zlib_put<u16>(header, e.mod_time);
+	zlib_put<u16>(header, e.mod_date);
+	zlib_put<u32>(header, e.crc32);
+	zlib_put<u32>(header, big ? zlib_max32 : static_cast<u32>(e.compressed_size));
+	zlib_put<u32>(header, big ? zlib_max32 : static_cast<u32>(e.size));
+	zlib_put<u16>(header, static_cast<u16>(e.name.size()));
+	zlib_put<u16>(header, big ? 20 : 0);
+	header.insert(header.end(), e.name.begin(), e.name.end());
+	if (big) {
+		zlib_put<u16>(header, zlib_zip64_extra_id);
+		zlib_put<u16>(header, 16);
+		zlib_put<u64>(header, e.size);
+		zlib_put<u64>(header, e.compressed_size);
+	}
 }
 
 
 /*
- * savez_compressed - save to compressed npz file
+ * zlib_copy_range - copy bytes from one file to another
+ */
+inline bool
+zlib_copy_range(int src_fd, u64 src_offset, int dst_fd, u64 dst_offset, u64 size)
+{
+#if defined(__linux__)
+	// let the kernel copy the data (or share it on file systems which support
+	// reflinks). fall back to reading and writing if this is not supported
+	while (size > 0) {
+		loff_t src_off = static_cast<loff_t>(src_offset);
+		loff_t dst_off = static_cast<loff_t>(dst_offset);
+		ssize_t n = ::copy_file_range(src_fd, &src_off, dst_fd, &dst_off, size, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		src_offset += static_cast<u64>(n);
+		dst_offset += static_cast<u64>(n);
+		size       -= static_cast<u64>(n);
+	}
+#endif
+
+	u8_vector buffer(std::min<u64>(size, 4 << 20));
+	while (size > 0) {
+		u64 n = std::min<u64>(size, buffer.size());
+		if (!zlib_pread(src_fd, buffer.data(), n, src_offset) || !zlib_pwrite(dst_fd, buffer.data(), n, dst_offset))
+			return false;
+		src_offset += n;
+		dst_offset += n;
+		size       -= n;
+	}
+	return true;
+}
+
+
+/*
+ * zlib_data_offset - get the offset of the data of an entry
  */
 inline result
-savez_compressed(std::filesystem::path filepath, std::vector<savez_arg> args, bool overwrite=false, u32 compression_level = 0)
+zlib_data_offset(backend_state *state, const zlib_entry &e, u64 &offset)
 {
-	return to_zip_archive(filepath, std::forward<decltype(args)>(args), true, overwrite, compression_level);
+	u8 header[30];
+	if (!zlib_pread(state->fd, header, sizeof(header), e.local_header_offset))
+		return result::error_read;
+	if (zlib_get<u32>(header) != zlib_local_header_signature)
+		return result::error_read;
+	offset = e.local_header_offset + sizeof(header) + zlib_get<u16>(header + 26) + zlib_get<u16>(header + 28);
+	return result::ok;
 }
 
 
 /*
- * savez - save unamed arrays to an uncompressed npz file
- *
- * Note that the arrays will receive a name of the format arr_i, where i is the
- * position in the args vector
+ * zlib_close - close an archive, writing the central directory if necessary
  */
 inline result
-savez(std::filesystem::path filepath, std::vector<std::reference_wrapper<ndarray>> args, bool overwrite=false)
+zlib_close(backend_state *state)
 {
-	std::vector<savez_arg> _args;
-	size_t i = 0;
-	for (auto &arg: args)
-		_args.push_back({std::string("arr_") + std::to_string(i++), arg});
-	return to_zip_archive(filepath, std::move(_args), false, overwrite);
+	if (!state)
+		return result::error_invalid_argument;
+	if (state->fd < 0)
+		return result::ok;
+
+	result res = result::ok;
+	if (state->mode != filemode::read && (state->modified || state->mode == filemode::write))
+		res = zlib_write_central_directory(state);
+
+	if (::close(state->fd) != 0 && res == result::ok)
+		res = result::error_file_close;
+	if (!state->temporary_path.empty()) {
+		if (res == result::ok && ::rename(state->temporary_path.c_str(), state->target_path.c_str()) != 0)
+			res = result::error_file_close;
+		if (res != result::ok)
+			::unlink(state->temporary_path.c_str());
+		state->temporary_path.clear();
+		state->target_path.clear();
+	}
+	state->fd = -1;
+	state->entries.clear();
+	state->index.clear();
+	state->modified = false;
+	return res;
 }
 
 
 /*
- * savez_compressed - save unamed arrays to a compressed npz file
- *
- * Note that the arrays will receive a name of the format arr_i, where i is the
- * position in the args vector
+ * zlib_get_file_list - get the list of files contained in an archive
  */
 inline result
-savez_compressed(std::filesystem::path filepath, std::vector<std::reference_wrapper<ndarray>> args, bool overwrite=false, u32 compression_level=0)
+zlib_get_file_list(backend_state *state, std::vector<std::string> &list)
 {
-	std::vector<savez_arg> _args;
-	size_t i = 0;
-	for (auto &arg: args)
-		_args.push_back({std::string("arr_") + std::to_string(i++), arg});
-	return to_zip_archive(filepath, std::move(_args), true, overwrite, compression_level);
+	if (!state)
+		return result::error_invalid_state;
+	if (state->fd < 0)
+		return result::error_archive_not_open;
+
+	for (auto &e: state->entries)
+		list.push_back(e.name);
+	return result::ok;
 }
 
 
+/*
+ * zlib_make - make a (zlib) backend state
+ */
+inline result
+zlib_make(backend_state **state)
+{
+	if (state == nullptr)
+		return result::error_invalid_argument;
+
+	result res = result::ok;
+	if (*state != nullptr)
+		res = result::warning_backend_ptr_not_null;
 
+	*state = new backend_state{};
+	return res;
+}
 
 
-}} // ncr::numpy
+/*
+ * zlib_attach - set up the state of an archive for an opened file descriptor
+ */
+inline result
+zlib_attach(backend_state *state, int fd, filemode mode, u64 size)
+{
+	state->fd = fd;
+	state->mode = mode;
+	state->modified = false;
+	state->entries.clear();
+	state->index.clear();
+	state->write_offset = 0;
+	state->original_size = 0;
+
+	if (mode == filemode::write)
+		return result::ok;
 
+	// appending to an empty (or newly created) file
+	if (mode == filemode::append && size == 0)
+		return result::ok;
 
-#endif /* _9750a253a01642ea81d4721d4c92ad7c_ */
+	state->original_size = size;
+	result res = zlib_read_central_directory(state, state->original_size);
+	if (res != result::ok) {
+		// do not let close write a central directory into a foreign file
+		state->mode = filemode::read;
+		zlib_close(state);
+	}
+	return res;
+}
 
 
 /*
- * the zip implementation can be actively turned off by setting the compiler
- * flag NCR_NUMPY_DISABLE_ZIP_LIBZIP. This allows to develop custom other zip
- * backends and disbale the libzip implementation that ships with ncr_numpy.
- */
-#ifndef NCR_NUMPY_DISABLE_ZIP_LIBZIP
-/*
- * zip_libzip.hpp - ncr zip backend based on libzip
- *
+ * zlib_open - open an archive
  */
+inline result
+zlib_open(backend_state *state, const std::filesystem::path filepath, filemode mode)
+{
+	if (!state)
+		return result::error_invalid_argument;
 
-#ifndef _ff3beaed1e3b48528794e7d803a82757_
-#define _ff3beaed1e3b48528794e7d803a82757_
-
-// TODO: get rid of iostream
-
+	int fd;
+	if (mode == filemode::write) {
+		// see backend_state::temporary_path. A replaced archive keeps its
+		// permissions
+		std::string tmp = filepath.native() + ".write-XXXXXX";
+		if ((fd = numpy::open_temporary_file(tmp)) < 0)
+			return (errno == ENOENT) ? result::error_file_not_found : result::error_invalid_filepath;
+		struct stat st;
+		if (::stat(filepath.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+			::fchmod(fd, st.st_mode & 07777);
+
+		result res = zlib_attach(state, fd, mode, 0);
+		state->temporary_path = std::move(tmp);
+		state->target_path    = filepath.native();
+		return res;
+	}
 
+	const int flags = (mode == filemode::read) ? O_RDONLY : O_RDWR | O_CREAT;
+	if ((fd = ::open(filepath.c_str(), flags | O_CLOEXEC, 0666)) < 0)
+		return (errno == ENOENT) ? result::error_file_not_found : result::error_invalid_filepath;
 
-namespace ncr { namespace zip {
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return result::error_read;
+	}
+	return zlib_attach(state, fd, mode, static_cast<u64>(st.st_size));
+}
 
 
 /*
- * backend_state - libzip state
+ * zlib_open_fd - open an archive for reading from a file descriptor
  */
-struct backend_state
+inline result
+zlib_open_fd(backend_state *state, int fd, u64 size)
 {
-	// zip archive
-	zip_t *zip {nullptr};
+	if (!state)
+		return result::error_invalid_argument;
 
-	// store all write buffers within the backend to make sure that the buffers
-	// live long enough. zip_file_add does not directly read from the buffer,
-	// and therefore a buffer might be invalid once writing actually happens
-	std::vector<u8_vector> write_buffers;
-};
+	// the state gets its own descriptor, which it closes in zlib_close
+	int dup_fd;
+	if ((dup_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0)
+		return result::error_invalid_argument;
+	return zlib_attach(state, dup_fd, filemode::read, size);
+}
 
 
 /*
- * libzip_close - close a libzip backend sate
+ * zlib_read_range - read and decompress a range of a file of an archive
+ *
+ * Files with a (valid) block index are inflated in parallel, and only the
+ * blocks which overlap the range are read. Other files are inflated serially
+ * up to the end of the range.
  */
 inline result
-libzip_close(backend_state *state)
+zlib_read_range(backend_state *state, const std::string filename, u64 offset, u8 *dest, u64 size)
 {
 	if (!state)
+		return result::error_invalid_state;
+	if (state->fd < 0)
+		return result::error_archive_not_open;
+
+	auto it = state->index.find(filename);
+	if (it == state->index.end())
+		return result::error_file_not_found;
+	const zlib_entry &e = state->entries[it->second];
+	if (offset > e.size || size > e.size - offset)
 		return result::error_invalid_argument;
-	if (state->zip != nullptr) {
-		zip_close(state->zip);
-		state->zip = nullptr;
+
+	result res;
+	u64 data_offset;
+	if ((res = zlib_data_offset(state, e, data_offset)) != result::ok)
+		return res;
+
+	const bool verify = offset + size == e.size;
+	u32 crc = 0;
+	if (e.method == zlib_method_store) {
+		if (e.compressed_size != e.size)
+			return result::error_read;
+		if (!zlib_pread(state->fd, dest, size, data_offset + offset))
+			return result::error_read;
+		if (verify) {
+			// the crc also covers what is before the range
+			u8_vector skipped(std::min<u64>(offset, 1 << 20));
+			for (u64 pos = 0; pos < offset; ) {
+				const u64 n = std::min<u64>(skipped.size(), offset - pos);
+				if (!zlib_pread(state->fd, skipped.data(), n, data_offset + pos))
+					return result::error_read;
+				crc = crc32_compute(skipped.data(), n, crc);
+				pos += n;
+			}
+			crc = crc32_concat(crc, crc32_parallel(dest, size, state->n_threads), size);
+		}
+	}
+	else if (e.method == zlib_method_deflate) {
+		if ((e.block_index.empty() || zlib_inflate_blocks(state, e, data_offset, offset, dest, size, verify, crc) != result::ok) &&
+		    (res = zlib_inflate_serial(state, e, data_offset, offset, dest, size, verify, crc)) != result::ok)
+			return res;
 	}
+	else
+		return result::error_read;
+
+	if (verify && crc != e.crc32)
+		return result::error_read;
 	return result::ok;
 }
 
 
 /*
- * libzip_get_file_list - get the list of files contained in an archive
+ * zlib_read - read and decompress a file of an archive into a buffer
  */
 inline result
-libzip_get_file_list(backend_state *state, std::vector<std::string> &list)
+zlib_read(backend_state *state, const std::string filename, u8_vector &buffer)
 {
 	if (!state)
 		return result::error_invalid_state;
-	if (!state->zip)
+	if (state->fd < 0)
 		return result::error_archive_not_open;
 
-	zip_int64_t num_entries = zip_get_num_entries(state->zip, 0);
-	for (zip_int64_t i = 0; i < num_entries; i++) {
-		const char *fname = zip_get_name(state->zip, i, 0);
-		if (fname == nullptr) {
-			zip_error_t *error = zip_get_error(state->zip);
-			// translate the error code
-			switch (error->zip_err) {
-				case ZIP_ER_MEMORY:  return result::error_memory;
-				case ZIP_ER_DELETED: return result::error_file_deleted;
-				case ZIP_ER_INVAL:   return result::error_invalid_file_index;
-				default:             return result::internal_error;
-			}
-		}
-		list.push_back(fname);
-	}
-	return result::ok;
+	auto it = state->index.find(filename);
+	if (it == state->index.end())
+		return result::error_file_not_found;
+
+	buffer.resize(state->entries[it->second].size);
+	return zlib_read_range(state, filename, 0, buffer.data(), buffer.size());
 }
 
 
 /*
- * libzip_make - make a (libzip) backend state
+ * zlib_release - release the zlib backend state
+ *
+ * If the archive was not closed, all changes are discarded. Archives opened
+ * for writing remove their temporary file, appended archives are truncated to
+ * their original size. If this fails, the state is released anyway and
+ * error_write is returned.
  */
 inline result
-libzip_make(backend_state **state)
+zlib_release(backend_state **bptr)
 {
-	if (state == nullptr)
+	if (bptr == nullptr || *bptr == nullptr)
 		return result::error_invalid_argument;
 
 	result res = result::ok;
-	if (*state != nullptr)
-		res = result::warning_backend_ptr_not_null;
-
-	*state = new backend_state{};
+	if ((*bptr)->fd >= 0) {
+		if (!(*bptr)->temporary_path.empty()) {
+			if (::unlink((*bptr)->temporary_path.c_str()) != 0)
+				res = result::error_write;
+		}
+		else if ((*bptr)->mode != filemode::read && (*bptr)->modified) {
+			if (::ftruncate((*bptr)->fd, static_cast<off_t>((*bptr)->original_size)) != 0)
+				res = result::error_write;
+		}
+		::close((*bptr)->fd);
+	}
+	delete *bptr;
+	*bptr = nullptr;
 	return res;
 }
 
 
 /*
- * libzip_open - open a file from an archive
+ * zlib_write - write a buffer to an archive that was opened for writing or appending
+ *
+ * The file is written directly, i.e. the buffer is not retained.
  */
 inline result
-libzip_open(backend_state *state, const std::filesystem::path filepath, filemode mode)
+zlib_write(backend_state *state, const std::string name, u8_vector &&buffer, bool compress, u32 compression_level = 0)
 {
 	if (!state)
+		return result::error_invalid_state;
+	if (state->fd < 0)
+		return result::error_archive_not_open;
+	if (state->mode == filemode::read || state->index.contains(name))
 		return result::error_invalid_argument;
 
-	// TODO: currently, when opening for writing, the file will be truncated if
-	//       it already exists. maybe a better approach would be to check the
-	//       file. However, this is done already on the callsite (see savez and
-	//       savez_compressed's overwrite argument). determine if this should be
-	//       kept this way or not
-	int flags = (mode == filemode::read) ? ZIP_RDONLY : (ZIP_CREATE | ZIP_TRUNCATE);
-
-	int err = 0;
-	if ((state->zip = zip_open(filepath.c_str(), flags, &err)) == nullptr) {
-		zip_error_t error;
-		zip_error_init_with_code(&error, err);
-
-		// TODO: set a local error string that is part of the zip interface
-		std::cerr << "cannot open zip archive " << filepath << ": " << zip_error_strerror(&error) << "\n";
-		return result::error_invalid_filepath;
+	zlib_entry e;
+	e.name                = name;
+	e.size                = buffer.size();
+	e.flags               = zlib_flag_utf8;
+	e.external_attributes = 0100644u << 16;
+	e.local_header_offset = state->write_offset;
+	zlib_dos_datetime(e.mod_time, e.mod_date);
+
+	// 0 means default compression, see backend_interface::write
+	u8_vector compressed;
+	const u8_vector *data = &buffer;
+	e.method = zlib_method_store;
+	if (compress) {
+		int level = compression_level == 0 ? Z_DEFAULT_COMPRESSION : static_cast<int>(std::min(compression_level, 9u));
+		// large files are deflated in parallel as independent blocks, which
+		// also computes the crc
+		result res = buffer.size() > zlib_min_block_size
+			? zlib_deflate_blocks(buffer.data(), buffer.size(), level, compressed, e.block_index, e.crc32, state->n_threads)
+			: zlib_deflate(buffer.data(), buffer.size(), level, compressed);
+		if (res != result::ok)
+			return result::error_compression_failed;
+		data = &compressed;
+		e.method = zlib_method_deflate;
 	}
+	if (e.block_index.empty())
+		e.crc32 = crc32_parallel(buffer.data(), buffer.size());
+	e.compressed_size = data->size();
+
+	u8_vector header;
+	zlib_local_header(e, header);
+	if (!zlib_pwrite(state->fd, header.data(), header.size(), state->write_offset) ||
+	    !zlib_pwrite(state->fd, data->data(), data->size(), state->write_offset + header.size()))
+		return result::error_write;
 
+	state->write_offset += header.size() + data->size();
+	state->index[e.name] = state->entries.size();
+	state->entries.push_back(std::move(e));
+	state->modified = true;
 	return result::ok;
 }
 
 
 /*
- * libzip_read - unzip a given filename (of an archive) into an u8 buffer
+ * zlib_stat - get size and crc of a file within an archive
  */
 inline result
-libzip_read(backend_state *bptr, const std::string filename, u8_vector &buffer)
+zlib_stat(backend_state *state, const std::string filename, file_stat &st)
 {
-	if (!bptr)
+	if (!state)
 		return result::error_invalid_state;
-	if (!bptr->zip)
+	if (state->fd < 0)
 		return result::error_archive_not_open;
 
-	// get the file index
-	zip_int64_t fid;
-	if ((fid = zip_name_locate(bptr->zip, filename.c_str(), 0)) < 0) {
-		zip_error_t *error = zip_get_error(bptr->zip);
-		// translate the error code
-		switch (error->zip_err) {
-			case ZIP_ER_MEMORY:  return result::error_memory;
-			case ZIP_ER_INVAL:   return result::error_invalid_file_index;
-			case ZIP_ER_NOENT:   return result::error_file_not_found;
-			default:             return result::internal_error;
-		}
-	}
-
-	// open the file pointer
-	zip_file_t *fp = zip_fopen_index(bptr->zip, fid, 0);
-	if (fp == nullptr) {
-		zip_error_t *error = zip_get_error(bptr->zip);
-		switch (error->zip_err) {
-			case ZIP_ER_MEMORY: return result::error_memory;
-			case ZIP_ER_READ:   return result::error_read;
-			case ZIP_ER_WRITE:  return result::error_write;
-			// TODO: translate more errors
-			default:            return result::internal_error;
+	auto it = state->index.find(filename);
+	if (it == state->index.end())
+		return result::error_file_not_found;
+	const zlib_entry &e = state->entries[it->second];
+
+	st.size            = e.size;
+	st.compressed_size = e.compressed_size;
+	st.crc32           = e.crc32;
+	st.compressed      = e.method != zlib_method_store;
+
+	// each block of a block index is a sync point
+	st.sync_points.clear();
+	const u8_vector &index = e.block_index;
+	if (e.method == zlib_method_deflate && index.size() >= 8 && (index.size() - 8) % 4 == 0) {
+		const u64 block_size = zlib_get<u64>(index.data());
+		const size_t n_blocks = (index.size() - 8) / 4;
+		u64 offset = 0;
+		for (size_t i = 0; i < n_blocks; i++) {
+			st.sync_points.emplace_back(i * block_size, offset);
+			offset += zlib_get<u32>(index.data() + 8 + 4 * i);
 		}
+		if (block_size == 0 || offset != e.compressed_size || n_blocks != (e.size + block_size - 1) / block_size)
+			st.sync_points.clear();
 	}
+	return result::ok;
+}
 
-	// get stats to know how many bytes to read
-	zip_stat_t stat;
-	if (zip_stat_index(bptr->zip, fid, 0, &stat) < 0) {
-		zip_error_t *error = zip_get_error(bptr->zip);
-		// translate the error code
-		switch (error->zip_err) {
-			case ZIP_ER_INVAL:   return result::error_invalid_file_index;
-			default:             return result::internal_error;
-		}
-	}
 
-	// finally, read the file into the buffer
-	buffer.resize(stat.size);
-	zip_int64_t nread = zip_fread(fp, buffer.data(), stat.size);
-	if (nread < 0) {
-		// TODO: better error reporting
-		return result::internal_error;
-	}
-	else if (nread == 0) {
-		return result::error_end_of_file;
-	}
+/*
+ * zlib_read_raw - read a range of the stored data of a file
+ */
+inline result
+zlib_read_raw(backend_state *state, const std::string filename, u64 offset, u8 *dest, u64 size)
+{
+	if (!state)
+		return result::error_invalid_state;
+	if (state->fd < 0)
+		return result::error_archive_not_open;
 
-	int err_code;
-	if ((err_code = zip_fclose(fp)) != 0) {
-		return result::error_file_close;
-	}
+	auto it = state->index.find(filename);
+	if (it == state->index.end())
+		return result::error_file_not_found;
+	const zlib_entry &e = state->entries[it->second];
+	if (offset > e.compressed_size || size > e.compressed_size - offset)
+		return result::error_invalid_argument;
 
+	result res;
+	u64 data_offset;
+	if ((res = zlib_data_offset(state, e, data_offset)) != result::ok)
+		return res;
+	if (!zlib_pread(state->fd, dest, size, data_offset + offset))
+		return result::error_read;
 	return result::ok;
 }
 
 
 /*
- * libzip_release - release the libzip backend state
+ * zlib_remove - remove a file from an archive
+ *
+ * The file is removed from the central directory only, i.e. its data remains
+ * in the archive as unreferenced bytes.
  */
 inline result
-libzip_release(backend_state **bptr)
+zlib_remove(backend_state *state, const std::string filename)
 {
-	if (bptr == nullptr || *bptr == nullptr)
+	if (!state)
+		return result::error_invalid_state;
+	if (state->fd < 0)
+		return result::error_archive_not_open;
+	if (state->mode == filemode::read)
 		return result::error_invalid_argument;
-	(*bptr)->write_buffers.clear();
-	delete *bptr;
-	bptr = nullptr;
+
+	auto it = state->index.find(filename);
+	if (it == state->index.end())
+		return result::error_file_not_found;
+
+	state->entries.erase(state->entries.begin() + it->second);
+	state->index.clear();
+	for (size_t i = 0; i < state->entries.size(); i++)
+		state->index[state->entries[i].name] = i;
+	state->modified = true;
 	return result::ok;
 }
 
 
 /*
- * libzip_write - write a buffer to a previously open zip archive
+ * zlib_copy - copy a file from one archive to another
+ *
+ * The (compressed) data is copied verbatim, together with its crc and sizes.
  */
 inline result
-libzip_write(backend_state *bptr, const std::string name, u8_vector &&buffer, bool compress, u32 compression_level = 0)
+zlib_copy(backend_state *dst, backend_state *src, const std::string src_filename, const std::string dst_filename)
 {
-	if (!bptr)
+	if (!dst || !src)
 		return result::error_invalid_state;
-	if (!bptr->zip)
+	if (dst->fd < 0 || src->fd < 0)
 		return result::error_archive_not_open;
+	if (dst->mode == filemode::read || dst->index.contains(dst_filename))
+		return result::error_invalid_argument;
 
-	// move the buffer into the local list of write buffers. this will retain
-	// the livetime of the buffer as long as required (cleared only during
-	// release and after zip_close was called, or on error)
-	bptr->write_buffers.push_back(std::move(buffer));
-	void *data_ptr = bptr->write_buffers.back().data();
-	zip_uint64_t size = bptr->write_buffers.back().size();
+	auto it = src->index.find(src_filename);
+	if (it == src->index.end())
+		return result::error_file_not_found;
 
-	// create a source from the buffer
-	zip_source_t *source = zip_source_buffer(bptr->zip, data_ptr, size, 0);
-	if (!source) {
-		return result::error_write;
-	}
+	result res;
+	u64 offset;
+	if ((res = zlib_data_offset(src, src->entries[it->second], offset)) != result::ok)
+		return res;
 
-	zip_int64_t fid;
-	if ((fid = zip_file_add(bptr->zip, name.c_str(), source, ZIP_FL_ENC_UTF_8)) < 0) {
-		zip_source_free(source);
+	zlib_entry e = src->entries[it->second];
+	e.name                = dst_filename;
+	e.local_header_offset = dst->write_offset;
+	e.version_made_by     = 0;
+	// sizes are written to the local header, not to a data descriptor
+	e.flags              &= static_cast<u16>(~(1u << 3));
+
+	u8_vector header;
+	zlib_local_header(e, header);
+	if (!zlib_pwrite(dst->fd, header.data(), header.size(), dst->write_offset) ||
+	    !zlib_copy_range(src->fd, offset, dst->fd, dst->write_offset + header.size(), e.compressed_size))
 		return result::error_write;
-	}
-
-	if (compress) {
-		// Note: ZIP_CM_DEFLATE accepts compression levels 1 to 9, with 0
-		// indicating "default". the values origin from zlib. python's zlib
-		// backend until python 3.7 used zlib's "default" value, meaning that
-		// for instance numpy arrays were compressed most likely with the
-		// default value
-		if (zip_set_file_compression(bptr->zip, fid, ZIP_CM_DEFLATE, compression_level) < 0) {
-			return result::error_compression_failed;
-		}
-	}
 
+	dst->write_offset += header.size() + e.compressed_size;
+	dst->index[e.name] = dst->entries.size();
+	dst->entries.push_back(std::move(e));
+	dst->modified = true;
 	return result::ok;
 }
 
 
 /*
- * get_backend_interface - get the (libzip) backend interface
+ * zlib_duplicate - write a file with the same content as another file of the archive
+ */
+inline result
+zlib_duplicate(backend_state *state, const std::string filename, const std::string new_filename)
+{
+	return zlib_copy(state, state, filename, new_filename);
+}
+
+
+/*
+ * get_backend_interface - get the (zlib) backend interface
  */
 inline backend_interface&
 get_backend_interface()
 {
 	static backend_interface interface = {
-		libzip_make,
-		libzip_release,
-		libzip_open,
-		libzip_close,
-		libzip_get_file_list,
-		libzip_read,
-		libzip_write
+		zlib_make,
+		zlib_release,
+		zlib_open,
+		zlib_close,
+		zlib_get_file_list,
+		zlib_read,
+		zlib_write,
+		zlib_stat,
+		zlib_remove,
+		zlib_copy,
+		zlib_duplicate,
+		zlib_read_raw,
+		zlib_open_fd,
+		zlib_read_range
 	};
 	return interface;
 }
@@ -5665,6 +16653,6 @@ get_backend_interface()
 
 }} // ncr::zip
 
-#endif /* _ff3beaed1e3b48528794e7d803a82757_ */
+#endif /* _5c2e8b1f7a9d4603b4e1d7f0a6c38e52_ */
 
 #endif
@@ -0,0 +1,115 @@
+/*
+ * fd_counter.cpp - count the calls to open and fstat of a process
+ *
+ * SPDX-License-Identifier: MIT
+ * See LICENSE file for more details
+ */
+#include "fd_counter.hpp"
+
+#include <atomic>
+#include <cstdarg>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+namespace fd_counter {
+
+std::atomic<int>
+	n_open  {0},
+	n_fstat {0};
+
+
+void
+reset()
+{
+	n_open  = 0;
+	n_fstat = 0;
+}
+
+
+counts
+get()
+{
+	return counts{n_open.load(), n_fstat.load()};
+}
+
+
+/*
+ * next - the function of the C library that an interposed function replaces
+ */
+template <typename F>
+F
+next(const char *name)
+{
+	return reinterpret_cast<F>(::dlsym(RTLD_NEXT, name));
+}
+
+} // fd_counter::
+
+
+// the mode is only passed along if the flags require it, in which case it is
+// the third argument
+#define FD_COUNTER_OPEN(name)                                                  \
+	extern "C" int                                                             \
+	name(const char *path, int flags, ...)                                     \
+	{                                                                          \
+		mode_t mode = 0;                                                       \
+		if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) {           \
+			va_list args;                                                      \
+			va_start(args, flags);                                             \
+			mode = static_cast<mode_t>(va_arg(args, int));                     \
+			va_end(args);                                                      \
+		}                                                                      \
+		fd_counter::n_open++;                                                  \
+		using open_fn = int (*)(const char *, int, ...);                       \
+		static open_fn fn = fd_counter::next<open_fn>(#name);                  \
+		return fn(path, flags, mode);                                          \
+	}
+
+FD_COUNTER_OPEN(open)
+FD_COUNTER_OPEN(open64)
+
+#undef FD_COUNTER_OPEN
+
+
+// fortified builds call these instead of open if the flags are not known at
+// compile time
+extern "C" int
+__open_2(const char *path, int flags)
+{
+	fd_counter::n_open++;
+	using open_fn = int (*)(const char *, int);
+	static open_fn fn = fd_counter::next<open_fn>("__open_2");
+	return fn(path, flags);
+}
+
+
+extern "C" int
+__open64_2(const char *path, int flags)
+{
+	fd_counter::n_open++;
+	using open_fn = int (*)(const char *, int);
+	static open_fn fn = fd_counter::next<open_fn>("__open64_2");
+	return fn(path, flags);
+}
+
+
+extern "C" int
+fstat(int fd, struct stat *st) noexcept
+{
+	fd_counter::n_fstat++;
+	using fstat_fn = int (*)(int, struct stat *);
+	static fstat_fn fn = fd_counter::next<fstat_fn>("fstat");
+	return fn(fd, st);
+}
+
+
+extern "C" int
+fstat64(int fd, struct stat64 *st) noexcept
+{
+	fd_counter::n_fstat++;
+	using fstat_fn = int (*)(int, struct stat64 *);
+	static fstat_fn fn = fd_counter::next<fstat_fn>("fstat64");
+	return fn(fd, st);
+}
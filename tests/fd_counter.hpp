@@ -0,0 +1,32 @@
+/*
+ * fd_counter.hpp - count the calls to open and fstat of a process
+ *
+ * SPDX-License-Identifier: MIT
+ * See LICENSE file for more details
+ *
+ * fd_counter.cpp defines open and fstat, including their 64 bit and fortified
+ * variants. When linked into an executable, these take precedence over the
+ * functions of the C library, count each call, and forward it to the C
+ * library.
+ */
+#ifndef _3afa623f41d146bf8032d436372095bc_
+#define _3afa623f41d146bf8032d436372095bc_
+
+namespace fd_counter {
+
+struct counts
+{
+	int
+		open                        {0},
+		fstat                       {0};
+};
+
+// reset all counts to zero
+void reset();
+
+// get the counts since the last reset
+counts get();
+
+} // fd_counter::
+
+#endif /* _3afa623f41d146bf8032d436372095bc_ */
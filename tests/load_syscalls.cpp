@@ -0,0 +1,75 @@
+/*
+ * load_syscalls.cpp - check that load and load_fd open and stat files once
+ *
+ * SPDX-License-Identifier: MIT
+ * See LICENSE file for more details
+ *
+ * load opens a file exactly once and stats it exactly once, independent of
+ * whether it is an npy or an npz file. load_fd only stats the file. This
+ * requires a zip backend which can read archives from a file descriptor, i.e.
+ * the test is built with the zlib backend.
+ */
+#include "ncr_numpy.hpp"
+#include "fd_counter.hpp"
+
+#include <cstdio>
+
+
+using namespace ncr;
+
+
+/*
+ * expect - compare the counts since the last reset to the expected counts
+ */
+static bool
+expect(const char *what, int n_open, int n_fstat)
+{
+	auto counts = fd_counter::get();
+	const bool ok = counts.open == n_open && counts.fstat == n_fstat;
+	std::printf("%-10s %-12s open %d (expected %d), fstat %d (expected %d)\n",
+		ok ? "ok" : "FAILED", what, counts.open, n_open, counts.fstat, n_fstat);
+	return ok;
+}
+
+
+int
+main()
+{
+	auto dir = std::filesystem::temp_directory_path() / ("ncr_numpy_load_syscalls_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(dir);
+	auto npy_path = dir / "array.npy";
+	auto npz_path = dir / "arrays.npz";
+
+	u8_vector data(4096 * sizeof(f64));
+	for (size_t i = 0; i < 4096; i++) {
+		f64 value = static_cast<f64>(i);
+		std::memcpy(data.data() + i * sizeof(f64), &value, sizeof(value));
+	}
+	numpy::ndarray array(numpy::dtype_float64(), u64_vector{64, 64}, std::move(data));
+	if (numpy::save(npy_path, array, true) != numpy::result::ok ||
+	    numpy::savez_compressed(npz_path, {{"a", array}, {"b", array}}, true) != numpy::result::ok) {
+		std::printf("FAILED to write the test files to %s\n", dir.c_str());
+		return 1;
+	}
+
+	bool ok = true;
+
+	fd_counter::reset();
+	auto npy = numpy::load(npy_path);
+	ok &= std::holds_alternative<numpy::ndarray>(npy) && expect("load npy", 1, 1);
+
+	fd_counter::reset();
+	auto npz = numpy::load(npz_path);
+	ok &= std::holds_alternative<numpy::npzfile>(npz) && expect("load npz", 1, 1);
+
+	for (auto &path: {npy_path, npz_path}) {
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		fd_counter::reset();
+		auto v = numpy::load_fd(fd);
+		ok &= !std::holds_alternative<numpy::result>(v) && expect(path == npy_path ? "load_fd npy" : "load_fd npz", 0, 1);
+		::close(fd);
+	}
+
+	std::filesystem::remove_all(dir);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/*
+ * malformed_headers.cpp - check that crafted headers are rejected
+ *
+ * SPDX-License-Identifier: MIT
+ * See LICENSE file for more details
+ *
+ * The shape of an npy header is not bounded by the size of the file, and
+ * the size of its array data can overflow 64 bits. Each loader needs to
+ * reject such a header instead of allocating or reading according to the
+ * wrapped size. Similarly, tar headers declare sizes which must not be
+ * trusted before the data arrived.
+ */
+#include "ncr_numpy.hpp"
+
+#include <cstdio>
+
+
+using namespace ncr;
+
+
+/*
+ * expect - compare a result to the expected result
+ */
+static bool
+expect(const std::string &what, numpy::result res, numpy::result expected)
+{
+	const bool ok = res == expected;
+	std::printf("%-10s %-32s %s\n", ok ? "ok" : "FAILED", what.c_str(), numpy::to_string(res).c_str());
+	return ok;
+}
+
+
+/*
+ * expect - print and return the outcome of a check
+ */
+static bool
+expect(const std::string &what, bool ok)
+{
+	std::printf("%-10s %-32s\n", ok ? "ok" : "FAILED", what.c_str());
+	return ok;
+}
+
+
+/*
+ * write_file - write a buffer to a file
+ */
+static void
+write_file(const std::filesystem::path &path, const u8_vector &data)
+{
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+
+/*
+ * crafted_npy - make an npy file of f32 with a shape whose size overflows,
+ * followed by a few bytes of data
+ */
+static u8_vector
+crafted_npy(const u64_vector &shape)
+{
+	u8_vector file;
+	numpy::to_npy_header(numpy::dtype_float32(), shape, storage_order::row_major, file);
+	file.resize(file.size() + 16);
+	return file;
+}
+
+
+/*
+ * tar_block - make a tar header block with a given size, optionally stored in
+ * base-256
+ */
+static std::array<u8, numpy::tar_block_size>
+tar_block(const char *name, char type, u64 size, bool base256)
+{
+	std::array<u8, numpy::tar_block_size> block {};
+	std::memcpy(block.data(), name, std::strlen(name));
+	std::memcpy(block.data() + 100, "0000644", 8);
+	if (base256) {
+		block[124] = 0x80;
+		for (size_t i = 0; i < 8; i++)
+			block[135 - i] = static_cast<u8>(size >> (8 * i));
+	}
+	else
+		std::snprintf(reinterpret_cast<char*>(block.data()) + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+	block[156] = static_cast<u8>(type);
+	std::memcpy(block.data() + 257, "ustar", 6);
+	std::memcpy(block.data() + 263, "00", 2);
+
+	std::memset(block.data() + 148, ' ', 8);
+	u64 sum = 0;
+	for (u8 b: block)
+		sum += b;
+	std::snprintf(reinterpret_cast<char*>(block.data()) + 148, 8, "%06llo", static_cast<unsigned long long>(sum));
+	return block;
+}
+
+
+/*
+ * stream_tar - read a tar archive with read_tar_stream
+ */
+static numpy::result
+stream_tar(const std::filesystem::path &path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return numpy::result::error_file_open_failed;
+	numpy::result res = numpy::read_tar_stream(fd, [](const std::string &, numpy::ndarray &&) { return true; });
+	::close(fd);
+	return res;
+}
+
+
+int
+main()
+{
+	auto dir = std::filesystem::temp_directory_path() / ("ncr_numpy_malformed_headers_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(dir);
+	auto npy_path = dir / "array.npy";
+	auto npz_path = dir / "arrays.npz";
+	auto tar_path = dir / "arrays.tar";
+
+	bool ok = true;
+	const numpy::result mismatch = numpy::result::error_data_size_mismatch;
+
+	// the number of items overflows, or their size in bytes
+	for (const u64_vector &shape: {u64_vector{u64(1) << 62, 4}, u64_vector{u64(1) << 62}}) {
+		const std::string suffix = shape.size() == 2 ? " (items)" : " (bytes)";
+		const u8_vector file = crafted_npy(shape);
+		write_file(npy_path, file);
+
+		numpy::mmap_ndarray mapped;
+		ok &= expect("from_npy_mmap" + suffix, numpy::from_npy_mmap(npy_path, mapped), mismatch);
+
+		numpy::ndarray array;
+		ok &= expect("from_npy" + suffix, numpy::from_npy(npy_path, array), mismatch);
+
+		numpy::npyfile npy;
+		auto source = numpy::span_reader(file);
+		ok &= expect("from_source" + suffix, numpy::from_source(source, array, numpy::array_schema{}, &npy), mismatch);
+
+		numpy::typed_ndarray<f32, 1> typed1;
+		numpy::typed_ndarray<f32, 2> typed2;
+		ok &= expect("typed from_npy" + suffix, shape.size() == 1 ? numpy::from_npy(npy_path, typed1) : numpy::from_npy(npy_path, typed2), mismatch);
+
+		int fd = ::open(npy_path.c_str(), O_RDONLY | O_CLOEXEC);
+		ok &= expect("take_fd" + suffix, numpy::take_fd(fd, {0}, array), mismatch);
+		::close(fd);
+
+		// npz members are written with the zip backend directly, as savez
+		// only writes valid arrays
+		zip::backend_interface zip_backend = zip::get_backend_interface();
+		zip::backend_state *zip_state = nullptr;
+		zip_backend.make(&zip_state);
+		zip_backend.open(zip_state, npz_path, zip::filemode::write);
+		zip_backend.write(zip_state, "a.npy", u8_vector(file), false, 0);
+		zip_backend.close(zip_state);
+		zip_backend.release(&zip_state);
+
+		numpy::npz_reader reader;
+		numpy::dtype dt;
+		u64_vector header_shape;
+		storage_order order;
+		ok &= expect("npz_reader open" + suffix, reader.open(npz_path), numpy::result::ok);
+		ok &= expect("npz_reader header" + suffix, reader.header("a", dt, header_shape, order), mismatch);
+	}
+
+	// a pax record whose length is shorter than its own prefix
+	{
+		const std::string record = "2 path=xxx\n";
+		u8_vector tar;
+		auto header = tar_block("pax", 'x', record.size(), false);
+		tar.insert(tar.end(), header.begin(), header.end());
+		tar.insert(tar.end(), record.begin(), record.end());
+		tar.resize(4 * numpy::tar_block_size);
+		write_file(tar_path, tar);
+
+		numpy::tar_reader reader;
+		numpy::tar_member member;
+		ok &= expect("tar_reader pax", reader.open(tar_path), numpy::result::ok);
+		// the invalid record is ignored, and the archive has no members
+		ok &= expect("tar_reader pax next", !reader.next(member) && reader.last_result() == numpy::result::ok);
+		ok &= expect("read_tar_stream pax", stream_tar(tar_path), numpy::result::ok);
+	}
+
+	// member sizes which overflow when rounded to blocks, or which are far
+	// larger than the archive
+	for (u64 size: {~u64(0) - 5, u64(1) << 62}) {
+		const bool overflows = size > (u64(1) << 62);
+		u8_vector tar;
+		auto header = tar_block("a.npy", '0', size, true);
+		tar.insert(tar.end(), header.begin(), header.end());
+		tar.resize(3 * numpy::tar_block_size);
+		write_file(tar_path, tar);
+
+		const std::string suffix = overflows ? " (overflow)" : " (large)";
+		ok &= expect("read_tar_stream" + suffix, stream_tar(tar_path), overflows ? numpy::result::error_tar_header_invalid : numpy::result::error_file_truncated);
+
+		numpy::tar_reader reader;
+		numpy::tar_member member;
+		reader.open(tar_path);
+		ok &= expect("tar_reader" + suffix, !reader.next(member) && reader.last_result() == numpy::result::error_file_truncated);
+	}
+
+	// extended headers are read into memory, and thus limited in size
+	{
+		u8_vector tar;
+		auto header = tar_block("pax", 'x', numpy::tar_max_extended_header_size + 1, false);
+		tar.insert(tar.end(), header.begin(), header.end());
+		tar.resize(3 * numpy::tar_block_size);
+		write_file(tar_path, tar);
+		ok &= expect("read_tar_stream pax size", stream_tar(tar_path), numpy::result::error_tar_header_invalid);
+	}
+
+	std::filesystem::remove_all(dir);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+/*
+ * typed_dtypes.cpp - check that typed_ndarrays of all supported types load
+ *
+ * SPDX-License-Identifier: MIT
+ * See LICENSE file for more details
+ *
+ * Loading into a typed_ndarray instantiates the byte swap of the element type,
+ * which has to compile for 1-byte and complex types as well. Each type is
+ * written with save, or with a hand-made header in the opposite byte order,
+ * and read back into a typed_ndarray.
+ */
+#include "ncr_numpy.hpp"
+
+#include <cstdio>
+
+
+using namespace ncr;
+
+static_assert(numpy::HasDtype<u8> && numpy::HasDtype<i8> && numpy::HasDtype<c64> && numpy::HasDtype<c128>);
+static_assert(!numpy::HasDtype<bool>);
+
+
+/*
+ * expect - print and return the outcome of a check
+ */
+static bool
+expect(const char *what, bool ok)
+{
+	std::printf("%-10s %s\n", ok ? "ok" : "FAILED", what);
+	return ok;
+}
+
+
+/*
+ * round_trip - save values as a native npy file and read them back
+ */
+template <typename T>
+static bool
+round_trip(const std::filesystem::path &path, const std::vector<T> &values)
+{
+	const u8 *bytes = reinterpret_cast<const u8*>(values.data());
+	numpy::ndarray array(numpy::dtype_selector<T>::get(), u64_vector{values.size()}, u8_vector(bytes, bytes + values.size() * sizeof(T)));
+	if (numpy::save(path, array, true) != numpy::result::ok)
+		return false;
+
+	numpy::typed_ndarray<T, 1> typed;
+	return numpy::from_npy(path, typed) == numpy::result::ok &&
+	       std::equal(values.begin(), values.end(), typed.data().begin(), typed.data().end());
+}
+
+
+/*
+ * swapped - write values in the opposite byte order and read them back
+ */
+template <typename T>
+static bool
+swapped(const std::filesystem::path &path, const std::vector<T> &values)
+{
+	numpy::dtype dt = numpy::dtype_selector<T>::get();
+	dt.endianness = (std::endian::native == std::endian::little) ? byte_order::big : byte_order::little;
+	u8_vector file;
+	numpy::to_npy_header(dt, u64_vector{values.size()}, storage_order::row_major, file);
+	for (const T &v: values) {
+		T s = numpy::bswap_value(v);
+		const u8 *p = reinterpret_cast<const u8*>(&s);
+		file.insert(file.end(), p, p + sizeof(T));
+	}
+	std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+
+	numpy::typed_ndarray<T, 1> typed;
+	return numpy::from_npy(path, typed) == numpy::result::ok &&
+	       std::equal(values.begin(), values.end(), typed.data().begin(), typed.data().end());
+}
+
+
+int
+main()
+{
+	auto dir = std::filesystem::temp_directory_path() / ("ncr_numpy_typed_dtypes_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(dir);
+	auto path = dir / "array.npy";
+
+	bool ok = true;
+	ok &= expect("u8",          round_trip<u8>(path, {0, 1, 127, 128, 255}));
+	ok &= expect("i8",          round_trip<i8>(path, {-128, -1, 0, 1, 127}));
+	ok &= expect("i32",         round_trip<i32>(path, {-70000, 0, 70000}));
+	ok &= expect("c64",         round_trip<c64>(path, {{1.0f, -2.0f}, {0.5f, 3.0f}}));
+	ok &= expect("c128",        round_trip<c128>(path, {{1.0, -2.0}, {0.25, 4.0}}));
+	ok &= expect("swapped u16", swapped<u16>(path, {1, 0x1234, 0xfffe}));
+	ok &= expect("swapped f64", swapped<f64>(path, {1.5, -2.25}));
+	ok &= expect("swapped c64", swapped<c64>(path, {{1.0f, -2.0f}, {0.5f, 3.0f}}));
+
+	// 1-byte arrays carry no byte order
+	u8_vector header;
+	numpy::to_npy_header(numpy::dtype_uint8(), u64_vector{0}, storage_order::row_major, header);
+	ok &= expect("u8 header", std::string(header.begin(), header.end()).find("'|u1'") != std::string::npos);
+
+	// types must match exactly, i.e. a u8 is not an i8
+	numpy::typed_ndarray<i8, 1> i;
+	round_trip<u8>(path, {1, 2});
+	ok &= expect("u8 into i8", numpy::from_npy(path, i) == (numpy::result::error_schema_mismatch | numpy::result::error_schema_dtype_mismatch));
+
+	std::filesystem::remove_all(dir);
+	return ok ? 0 : 1;
+}
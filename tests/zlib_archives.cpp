@@ -0,0 +1,152 @@
+/*
+ * zlib_archives.cpp - round trips of npz files through the zlib zip backend
+ *
+ * SPDX-License-Identifier: MIT
+ * See LICENSE file for more details
+ *
+ * Arrays are saved, appended, replaced, and merged, and read back with
+ * from_npz. Arrays larger than zlib_min_block_size are deflated in blocks,
+ * which are read in parallel and let npz_reader::slice start inflating close
+ * to the requested rows.
+ */
+#include "ncr_numpy.hpp"
+
+#include <cstdio>
+
+
+using namespace ncr;
+
+
+/*
+ * expect - print and return the outcome of a check
+ */
+static bool
+expect(const char *what, bool ok)
+{
+	std::printf("%-10s %s\n", ok ? "ok" : "FAILED", what);
+	return ok;
+}
+
+
+/*
+ * make_array - make a rows x cols array of f32 with values seed + index
+ */
+static numpy::ndarray
+make_array(u64 rows, u64 cols, f32 seed)
+{
+	u8_vector data(rows * cols * sizeof(f32));
+	for (u64 i = 0; i < rows * cols; i++) {
+		f32 value = seed + static_cast<f32>(i % 100000);
+		std::memcpy(data.data() + i * sizeof(f32), &value, sizeof(value));
+	}
+	return numpy::ndarray(numpy::dtype_float32(), u64_vector{rows, cols}, std::move(data));
+}
+
+
+/*
+ * same - test if two arrays have the same type, shape, and data
+ */
+static bool
+same(const numpy::ndarray &a, const numpy::ndarray &b)
+{
+	return numpy::is_same_dtype(a.dtype(), b.dtype()) && a.shape() == b.shape() &&
+	       std::equal(a.data().begin(), a.data().end(), b.data().begin(), b.data().end());
+}
+
+
+/*
+ * contains - test if an npz file contains exactly the given arrays
+ */
+static bool
+contains(const std::filesystem::path &path, const std::vector<std::pair<std::string, const numpy::ndarray*>> &arrays)
+{
+	numpy::npzfile npz;
+	if (numpy::from_npz(path, npz) != numpy::result::ok || npz.names.size() != arrays.size())
+		return false;
+	for (auto &[name, array]: arrays)
+		if (!npz.arrays.contains(name) || !same(npz[name], *array))
+			return false;
+	return true;
+}
+
+
+int
+main()
+{
+	auto dir = std::filesystem::temp_directory_path() / ("ncr_numpy_zlib_archives_" + std::to_string(::getpid()));
+	std::filesystem::create_directories(dir);
+	auto path   = dir / "arrays.npz";
+	auto other  = dir / "other.npz";
+	auto merged = dir / "merged.npz";
+
+	auto a = make_array(64, 32, 0.0f);
+	auto b = make_array(16, 8, 1.0f);
+	auto c = make_array(8, 8, 2.0f);
+	// larger than zlib_min_block_size, and thus deflated in blocks
+	auto big = make_array(3 * zip::zlib_min_block_size / (256 * sizeof(f32)) + 7, 256, 3.0f);
+
+	bool ok = true;
+
+	// save
+	ok &= expect("savez",            numpy::savez(path, {{"a", a}, {"b", b}}, true) == numpy::result::ok);
+	ok &= expect("savez read",       contains(path, {{"a", &a}, {"b", &b}}));
+	ok &= expect("compressed",       numpy::savez_compressed(path, {{"a", a}, {"b", b}}, true) == numpy::result::ok);
+	ok &= expect("compressed read",  contains(path, {{"a", &a}, {"b", &b}}));
+	ok &= expect("no overwrite",     numpy::savez(path, {{"c", c}}) != numpy::result::ok);
+	ok &= expect("archive intact",   contains(path, {{"a", &a}, {"b", &b}}));
+
+	// append and replace
+	ok &= expect("append",           numpy::savez_compressed_append(path, {{"c", c}}) == numpy::result::ok);
+	ok &= expect("append read",      contains(path, {{"a", &a}, {"b", &b}, {"c", &c}}));
+	ok &= expect("append conflict",  numpy::savez_append(path, {{"a", c}}) == numpy::result::error_duplicate_array_name);
+	ok &= expect("conflict intact",  contains(path, {{"a", &a}, {"b", &b}, {"c", &c}}));
+	ok &= expect("replace",          numpy::savez_append(path, {{"a", c}}, numpy::name_conflict::replace) == numpy::result::ok);
+	ok &= expect("replace read",     contains(path, {{"a", &c}, {"b", &b}, {"c", &c}}));
+	ok &= expect("skip",             numpy::savez_append(path, {{"b", a}}, numpy::name_conflict::skip) == numpy::result::ok);
+	ok &= expect("skip read",        contains(path, {{"a", &c}, {"b", &b}, {"c", &c}}));
+
+	// merge
+	ok &= expect("other",            numpy::savez_compressed(other, {{"b", a}, {"d", b}}, true) == numpy::result::ok);
+	ok &= expect("merge conflict",   numpy::merge_npz(merged, {path, other}) == numpy::result::error_duplicate_array_name);
+	ok &= expect("merge",            numpy::merge_npz(merged, {path, other}, numpy::name_conflict::replace) == numpy::result::ok);
+	ok &= expect("merge read",       contains(merged, {{"a", &c}, {"b", &a}, {"c", &c}, {"d", &b}}));
+
+	// block-indexed members
+	ok &= expect("blocks",           numpy::savez_compressed(path, {{"big", big}, {"b", b}}, true) == numpy::result::ok);
+	ok &= expect("blocks read",      contains(path, {{"big", &big}, {"b", &b}}));
+	{
+		zip::backend_interface zip_backend = zip::get_backend_interface();
+		zip::backend_state *zip_state = nullptr;
+		zip::file_stat st;
+		zip_backend.make(&zip_state);
+		const bool indexed = zip_backend.open(zip_state, path, zip::filemode::read) == zip::result::ok &&
+			zip_backend.stat(zip_state, "big.npy", st) == zip::result::ok &&
+			st.sync_points.size() > 1;
+		zip_backend.close(zip_state);
+		zip_backend.release(&zip_state);
+		ok &= expect("blocks index", indexed);
+	}
+	ok &= expect("blocks append",    numpy::savez_compressed_append(path, {{"c", c}}) == numpy::result::ok);
+	ok &= expect("blocks merge",     numpy::merge_npz(merged, {path}, numpy::name_conflict::error, true) == numpy::result::ok);
+	ok &= expect("blocks merged",    contains(merged, {{"big", &big}, {"b", &b}, {"c", &c}}));
+
+	// slices
+	numpy::npz_reader reader;
+	ok &= expect("reader open",      reader.open(merged) == numpy::result::ok);
+	const u64 row_bytes = big.shape()[1] * sizeof(f32);
+	for (u64 first: {u64(0), big.shape()[0] / 2, big.shape()[0] - 5}) {
+		numpy::ndarray rows;
+		const bool sliced = reader.slice("big", first, 5, rows) == numpy::result::ok &&
+			rows.shape() == u64_vector{5, big.shape()[1]} &&
+			std::equal(rows.data().begin(), rows.data().end(), big.data().begin() + first * row_bytes);
+		ok &= expect("slice big", sliced);
+	}
+	numpy::ndarray rows;
+	ok &= expect("slice small",      reader.slice("b", 3, 2, rows) == numpy::result::ok &&
+		std::equal(rows.data().begin(), rows.data().end(), b.data().begin() + 3 * 8 * sizeof(f32)));
+	ok &= expect("slice range",      reader.slice("b", 15, 2, rows) == numpy::result::error_invalid_item_offset);
+	ok &= expect("slice missing",    reader.slice("x", 0, 1, rows) == numpy::result::error_array_not_found);
+
+	std::filesystem::remove_all(dir);
+	return ok ? 0 : 1;
+}